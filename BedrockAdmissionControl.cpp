@@ -0,0 +1,110 @@
+#include "BedrockAdmissionControl.h"
+
+BedrockAdmissionControl::BedrockAdmissionControl(const SData& args, BedrockCommandQueue& commandQueue)
+  : _commandQueue(commandQueue), _targetUS(max(args.calc64("-admissionTargetMS"), (int64_t)0) * 1000),
+    _intervalUS(args.isSet("-admissionIntervalMS") ? max(args.calc64("-admissionIntervalMS"), (int64_t)1) * 1000
+                                                   : 100'000),
+    _maxQueued(max(args.calc64("-admissionMaxQueued"), (int64_t)0)),
+    _shedBelow(args.isSet("-admissionShedBelow") ? args.calc("-admissionShedBelow") : BedrockCommand::PRIORITY_NORMAL),
+    _nextUpdate(0)
+{
+    for (int priority : {BedrockCommand::PRIORITY_MIN, BedrockCommand::PRIORITY_LOW, BedrockCommand::PRIORITY_NORMAL,
+                         BedrockCommand::PRIORITY_HIGH, BedrockCommand::PRIORITY_MAX}) {
+        Level& level = _levels[priority];
+        level.shedding = false;
+        level.standingWaitUS = 0;
+        level.queuedAtOrAbove = 0;
+        level.rejected = 0;
+    }
+}
+
+bool BedrockAdmissionControl::admit(int priority, uint64_t& retryAfter) {
+    if (priority >= _shedBelow || (!_targetUS && !_maxQueued)) {
+        return true;
+    }
+    uint64_t now = STimeNow();
+    if (now >= _nextUpdate) {
+        _update(now);
+    }
+
+    // Anything below the lowest named priority is counted with it.
+    auto levelIt = _levels.upper_bound(priority);
+    Level& level = levelIt == _levels.begin() ? levelIt->second : prev(levelIt)->second;
+
+    if (level.shedding) {
+        // Waiting out the standing queue is a reasonable guess at when we'll have room.
+        retryAfter = max(level.standingWaitUS.load() / STIME_US_PER_S, (uint64_t)1);
+        level.rejected++;
+        return false;
+    }
+
+    // The total is cheap to check, and if it's under the limit, so is the number of commands ahead of this one.
+    if (_maxQueued && _commandQueue.size() >= _maxQueued) {
+        size_t ahead = 0;
+        for (const auto& entry : _commandQueue.sizeByPriority()) {
+            if (entry.first >= priority) {
+                ahead += entry.second;
+            }
+        }
+        if (ahead >= _maxQueued) {
+            retryAfter = 1;
+            level.rejected++;
+            return false;
+        }
+    }
+    return true;
+}
+
+STable BedrockAdmissionControl::getState() {
+    STable state;
+    for (const auto& entry : _levels) {
+        state[to_string(entry.first)] = SComposeJSONObject({
+            {"shedding", entry.second.shedding ? "true" : "false"},
+            {"standingWaitMS", to_string(entry.second.standingWaitUS / 1000)},
+            {"queuedAtOrAbove", to_string(entry.second.queuedAtOrAbove.load())},
+            {"rejected", to_string(entry.second.rejected.load())},
+        });
+    }
+    return state;
+}
+
+void BedrockAdmissionControl::_update(uint64_t now) {
+    unique_lock<mutex> lock(_updateMutex, try_to_lock);
+    if (!lock.owns_lock() || now < _nextUpdate) {
+        return;
+    }
+    _nextUpdate = now + _intervalUS;
+
+    map<int, uint64_t> minimumWaits = _commandQueue.takeMinimumWaits();
+    map<int, size_t> sizes = _commandQueue.sizeByPriority();
+
+    // Go from the highest priority down, so we can keep a running total of everything queued at or above each.
+    size_t queuedAtOrAbove = 0;
+    auto sizeIt = sizes.rbegin();
+    for (auto levelIt = _levels.rbegin(); levelIt != _levels.rend(); levelIt++) {
+        Level& level = levelIt->second;
+        size_t queuedAtLevel = 0;
+        bool lowest = next(levelIt) == _levels.rend();
+        for (; sizeIt != sizes.rend() && (lowest || sizeIt->first >= levelIt->first); sizeIt++) {
+            queuedAtLevel += sizeIt->second;
+        }
+        queuedAtOrAbove += queuedAtLevel;
+        level.queuedAtOrAbove = queuedAtOrAbove;
+
+        uint64_t minimumWait = minimumWaits[levelIt->first];
+        if (minimumWait != numeric_limits<uint64_t>::max()) {
+            level.standingWaitUS = minimumWait;
+        } else if (!queuedAtLevel) {
+            // Nothing got through because nothing was waiting.
+            level.standingWaitUS = 0;
+        }
+        // Otherwise, nothing at this priority got through in a whole interval, and we leave things as they were.
+
+        bool shedding = _targetUS && level.standingWaitUS > _targetUS && levelIt->first < _shedBelow;
+        if (shedding != level.shedding) {
+            SINFO((shedding ? "Started" : "Stopped") << " rejecting new commands at priority " << levelIt->first
+                  << ", shortest queue wait in the last interval was " << level.standingWaitUS / 1000 << "ms.");
+            level.shedding = shedding;
+        }
+    }
+}
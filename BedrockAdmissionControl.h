@@ -0,0 +1,64 @@
+#pragma once
+#include <libstuff/libstuff.h>
+#include "BedrockCommandQueue.h"
+
+// Decides whether BedrockServer should queue new commands from clients. When the workers fall behind, low priority
+// commands are turned away up front with a `503` and a `Retry-After` header, rather than waiting in the queue for
+// minutes and then timing out, so that higher priority commands keep their latency.
+//
+// Only commands with a priority below `-admissionShedBelow` (default PRIORITY_NORMAL) are ever rejected, and only for
+// one of two reasons, each of which is off unless configured:
+//
+// Queue wait (`-admissionTargetMS`): Like CoDel, we look at the *shortest* time any command at each priority waited
+// in the queue over an interval (`-admissionIntervalMS`, default 100). A burst fills the queue, but it drains, so some
+// commands get through quickly. If even the quickest waited longer than the target, there's a standing queue, and we
+// reject commands at that priority until an interval in which one doesn't.
+//
+// Queue depth (`-admissionMaxQueued`): A command is rejected if there are already this many commands queued at its
+// priority or higher, i.e., ahead of it.
+//
+// Queue waits are measured at the named priorities (see BedrockCommand::Priority), with any other priority counted
+// with the highest named one below it, and are brought up to date once per interval by whichever thread next calls
+// `admit`. Queue depth is checked as each command arrives.
+class BedrockAdmissionControl {
+  public:
+    BedrockAdmissionControl(const SData& args, BedrockCommandQueue& commandQueue);
+
+    // Returns true if a new command with priority `priority` should be queued. Otherwise, sets `retryAfter` to the
+    // number of seconds the client should wait before trying again. Thread-safe.
+    bool admit(int priority, uint64_t& retryAfter);
+
+    // Returns the state of each named priority as a JSON object, keyed by the priority, for `Status`.
+    STable getState();
+
+  private:
+    struct Level {
+        // Whether we're rejecting commands at this priority because of their wait time.
+        atomic<bool> shedding;
+
+        // The shortest time a command at this priority waited in the queue in the last interval in which any did.
+        atomic<uint64_t> standingWaitUS;
+
+        // The number of commands queued at this priority or higher at the end of the last interval, for `Status`.
+        atomic<size_t> queuedAtOrAbove;
+
+        // The number of commands we've rejected at this priority.
+        atomic<uint64_t> rejected;
+    };
+
+    // Measures the queue and decides which priorities to shed for the next interval, unless another thread is already
+    // doing so.
+    void _update(uint64_t now);
+
+    BedrockCommandQueue& _commandQueue;
+    const uint64_t _targetUS;
+    const uint64_t _intervalUS;
+    const size_t _maxQueued;
+    const int _shedBelow;
+
+    // Each named priority. The map itself never changes after construction.
+    map<int, Level> _levels;
+
+    atomic<uint64_t> _nextUpdate;
+    mutex _updateMutex;
+};
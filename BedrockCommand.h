@@ -107,10 +107,24 @@ class BedrockCommand : public SQLiteCommand {
     // A list of timing sets, with an info type, start, and end.
     list<tuple<TIMING_INFO, uint64_t, uint64_t>> timingInfo;
 
+    // Set by BedrockCommandQueue each time this command is queued: when it's scheduled to run (which can be later than
+    // requested, if its client is rate limited), and when queuing fairly, its place among other clients' commands.
+    uint64_t queueScheduled = 0;
+    uint64_t queueTag = 0;
+
     // This defaults to false, but a specific plugin can set it to 'true' to force this command to be passed
     // to the sync thread for processing, thus guaranteeing that process() will not result in a conflict.
     virtual bool onlyProcessOnSyncThread() { return false; }
 
+    // A plugin can return true here for commands that are finished in `peek` without side effects, such as reads. If
+    // identical copies of such a command (same method line, headers, and content) are run against the same commit,
+    // only one of them is peeked, and the rest get its response. See BedrockCommandCoalescer.
+    virtual bool shouldCoalesce() { return false; }
+
+    // Set if this command waited for an identical command's response, but didn't get one because that command wasn't
+    // finished in `peek`, so it runs on its own.
+    bool skipCoalescing = false;
+
     // This is a set of name/value pairs that must be present and matching for two commands to compare as "equivalent"
     // for the sake of determining whether they're likely to cause a crash.
     // i.e., if this command has set this to {userID, reportList}, and the server crashes while processing this
@@ -141,7 +155,7 @@ class BedrockCommand : public SQLiteCommand {
     CrashMap crashIdentifyingValues;
 
     // Return the timestamp by which this command must finish executing.
-    uint64_t timeout() const { return _timeout; }
+    uint64_t timeout() const override { return _timeout; }
 
     // Return the number of commands in existence.
     static size_t getCommandCount() { return _commandCount.load(); }
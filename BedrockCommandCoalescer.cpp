@@ -0,0 +1,75 @@
+#include "BedrockCommandCoalescer.h"
+
+const set<string, STableComp> BedrockCommandCoalescer::IGNORED_HEADERS = {
+    "_source",
+    "commandExecuteTime",
+    "Connection",
+    "orderedResponse",
+    "priority",
+    "requestID",
+};
+
+BedrockCommandCoalescer::BedrockCommandCoalescer(const SData& args) : _waiting(0), _shared(0), _requeued(0)
+{
+    list<string> verbs;
+    SParseList(args["-coalesceCommands"], verbs);
+    _verbs.insert(verbs.begin(), verbs.end());
+}
+
+string BedrockCommandCoalescer::key(BedrockCommand& command, uint64_t commitCount) {
+    // Only commands that haven't started running yet, from clients waiting for their responses, can share them.
+    if (command.skipCoalescing || command.complete || command.peekCount || command.processCount ||
+        command.httpsRequests.size() || command.initiatingPeerID || command.initiatingClientID <= 0) {
+        return "";
+    }
+    if (!command.shouldCoalesce() && !_verbs.count(command.request.getVerb())) {
+        return "";
+    }
+    SData request = command.request;
+    for (const string& header : IGNORED_HEADERS) {
+        request.nameValueMap.erase(header);
+    }
+    return to_string(commitCount) + ":" + request.serialize();
+}
+
+bool BedrockCommandCoalescer::wait(const string& key, unique_ptr<BedrockCommand>& command) {
+    lock_guard<mutex> lock(_mutex);
+    auto it = _running.find(key);
+    if (it == _running.end()) {
+        _running.emplace(key, list<unique_ptr<BedrockCommand>>());
+        return false;
+    }
+    SINFO("Waiting for the response to an identical '" << command->request.methodLine << "' that's already running.");
+    it->second.push_back(move(command));
+    _waiting++;
+    return true;
+}
+
+list<unique_ptr<BedrockCommand>> BedrockCommandCoalescer::finish(const string& key, bool shared) {
+    list<unique_ptr<BedrockCommand>> waiting;
+    {
+        lock_guard<mutex> lock(_mutex);
+        auto it = _running.find(key);
+        if (it == _running.end()) {
+            SWARN("Finishing a coalesced command that isn't running.");
+            return waiting;
+        }
+        waiting = move(it->second);
+        _running.erase(it);
+        _waiting -= waiting.size();
+    }
+    (shared ? _shared : _requeued) += waiting.size();
+    return waiting;
+}
+
+STable BedrockCommandCoalescer::getState() {
+    STable state;
+    {
+        lock_guard<mutex> lock(_mutex);
+        state["running"] = to_string(_running.size());
+        state["waiting"] = to_string(_waiting);
+    }
+    state["shared"] = to_string(_shared.load());
+    state["requeued"] = to_string(_requeued.load());
+    return state;
+}
@@ -0,0 +1,51 @@
+#pragma once
+#include <libstuff/libstuff.h>
+#include "BedrockCommand.h"
+
+// Lets identical read commands that are in flight at the same time share a single `peek`. When a worker is about to
+// peek a command, and a copy of it is already being peeked against the same commit, the worker hands the command to
+// us instead, and once the first copy has finished, it's answered with the same response.
+//
+// Commands opt in by overriding `BedrockCommand::shouldCoalesce`, which lets a plugin opt in all or some of its
+// commands, or by having their verb in `-coalesceCommands`, a comma-separated list. Copies are identical if they have
+// the same method line, content, and headers, apart from those that only say how to deliver the response (like
+// `requestID`), and were received by this node at the same commit count, so no copy ever gets a response older than
+// the data it could have read itself. If the first copy isn't finished in `peek` (because it turns out to need to
+// write, for instance), nothing is shared, and the copies waiting on it run on their own.
+class BedrockCommandCoalescer {
+  public:
+    BedrockCommandCoalescer(const SData& args);
+
+    // Returns the key identical copies of `command` share at `commitCount`, or an empty string if it can't be
+    // coalesced with other commands.
+    string key(BedrockCommand& command, uint64_t commitCount);
+
+    // If an identical command is already running under `key`, takes `command` to wait for its response and returns
+    // true. Otherwise, records that `command` is running under `key` and returns false, in which case the caller
+    // needs to call `finish` for it, whatever happens to it. Thread-safe.
+    bool wait(const string& key, unique_ptr<BedrockCommand>& command);
+
+    // Returns the commands waiting for the one running under `key` and forgets them. If `shared`, they're being
+    // answered with its response, otherwise they're going to run on their own. Thread-safe.
+    list<unique_ptr<BedrockCommand>> finish(const string& key, bool shared);
+
+    // Returns counts of coalesced commands, for `Status`.
+    STable getState();
+
+  private:
+    // Request headers that don't change the response, so they're left out of the key.
+    static const set<string, STableComp> IGNORED_HEADERS;
+
+    // The verbs from `-coalesceCommands`.
+    set<string, STableComp> _verbs;
+
+    // The commands waiting for each command that's running, by key.
+    map<string, list<unique_ptr<BedrockCommand>>> _running;
+    size_t _waiting;
+    mutex _mutex;
+
+    // The number of commands that have been answered with another's response, and that waited for one but had to run
+    // on their own after all.
+    atomic<uint64_t> _shared;
+    atomic<uint64_t> _requeued;
+};
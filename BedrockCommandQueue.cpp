@@ -8,65 +8,209 @@ void BedrockCommandQueue::stopTiming(unique_ptr<BedrockCommand>& command) {
     command->stopTiming(BedrockCommand::QUEUE_WORKER);
 }
 
-BedrockCommandQueue::BedrockCommandQueue() :
-  SScheduledPriorityQueue<unique_ptr<BedrockCommand>>(function<void(unique_ptr<BedrockCommand>&)>(startTiming), function<void(unique_ptr<BedrockCommand>&)>(stopTiming))
-{ }
+BedrockCommandQueue::BedrockCommandQueue(const SData& args, bool perClient) :
+  SShardedScheduledPriorityQueue<unique_ptr<BedrockCommand>>(0, function<void(unique_ptr<BedrockCommand>&)>(startTiming),
+      [this](unique_ptr<BedrockCommand>& command) {
+          stopTiming(command);
+          _recordWait(*command);
+          _recordClientDequeue(*command);
+      }, _order(args)),
+  _fair(perClient && args["-queueOrder"] == "fair"),
+  _clientKey(args.isSet("-fairQueueKey") ? args["-fairQueueKey"] : "_source"),
+  _rateIntervalUS(perClient && args.calc64("-clientRateLimit") > 0 ?
+                  STIME_US_PER_S / args.calc64("-clientRateLimit") : 0),
+  _rateBurstUS(_rateIntervalUS * (max(args.calc64("-clientRateBurst"), (int64_t)1) - 1)),
+  _virtualTime(0)
+{
+    for (const string& entry : SParseList(args["-fairQueueWeights"])) {
+        // Client names can be IPv6 addresses, so the weight is after the last colon.
+        size_t colon = entry.rfind(':');
+        if (colon == string::npos || SToInt64(entry.substr(colon + 1)) <= 0) {
+            SWARN("Ignoring invalid -fairQueueWeights entry '" << entry << "'.");
+            continue;
+        }
+        _clientWeights[entry.substr(0, colon)] = SToInt64(entry.substr(colon + 1));
+    }
+
+    for (int priority : {BedrockCommand::PRIORITY_MIN, BedrockCommand::PRIORITY_LOW, BedrockCommand::PRIORITY_NORMAL,
+                         BedrockCommand::PRIORITY_HIGH, BedrockCommand::PRIORITY_MAX}) {
+        WaitStats& stats = _waitStats[priority];
+        for (auto& bucket : stats.histogram) {
+            bucket = 0;
+        }
+        stats.minimumUS = numeric_limits<uint64_t>::max();
+    }
+}
 
 list<string> BedrockCommandQueue::getRequestMethodLines() {
     list<string> returnVal;
-    SAUTOLOCK(_queueMutex);
-    for (auto& queue : _queue) {
-        for (auto& entry : queue.second) {
-            returnVal.push_back(entry.second.item->request.methodLine);
+    forEach([&returnVal](const unique_ptr<BedrockCommand>& command) {
+        returnVal.push_back(command->request.methodLine);
+    });
+    return returnVal;
+}
+
+STable BedrockCommandQueue::getWaitHistograms() {
+    STable histograms;
+    for (const auto& entry : _waitStats) {
+        STable histogram;
+        for (size_t i = 0; i < WAIT_BUCKETS_MS.size(); i++) {
+            histogram[to_string(WAIT_BUCKETS_MS[i])] = to_string(entry.second.histogram[i].load());
         }
+        histogram["inf"] = to_string(entry.second.histogram.back().load());
+        histograms[to_string(entry.first)] = SComposeJSONObject(histogram);
     }
-    return returnVal;
+    return histograms;
 }
 
-void BedrockCommandQueue::abandonFutureCommands(int msInFuture) {
-    // We're going to delete every command scehduled after this timestamp.
-    uint64_t timeLimit = STimeNow() + msInFuture * 1000;
+map<int, uint64_t> BedrockCommandQueue::takeMinimumWaits() {
+    map<int, uint64_t> minimums;
+    for (auto& entry : _waitStats) {
+        minimums[entry.first] = entry.second.minimumUS.exchange(numeric_limits<uint64_t>::max());
+    }
+    return minimums;
+}
 
-    // Lock around changes to the queue.
-    unique_lock<mutex> queueLock(_queueMutex);
-
-    // We're going to look at each queue by priority. It's possible we'll end up removing *everything* from multiple
-    // queues. In that case, we need to remove the queues themselves, so we keep a list of queues to delete when we're
-    // done operating on each of them (so that we don't delete them while iterating over them).
-    list<typename decltype(_queue)::iterator> toDelete;
-    for (typename decltype(_queue)::iterator queueMapIt = _queue.begin(); queueMapIt != _queue.end(); ++queueMapIt) {
-        // Starting from the first item, skip any items that have a valid scheduled time.
-        auto commandMapIt = queueMapIt->second.begin();
-        while (commandMapIt != queueMapIt->second.end() && commandMapIt->first < timeLimit) {
-            commandMapIt++;
-        }
+STable BedrockCommandQueue::getClientStats() {
+    STable stats;
+    if (!_fair && !_rateIntervalUS) {
+        return stats;
+    }
 
-        // Whatever's left in the queue is scheduled in the future and can be erased.
-        size_t numberToErase = distance(commandMapIt, queueMapIt->second.end());
-        if (numberToErase) {
-            queueMapIt->second.erase(commandMapIt, queueMapIt->second.end());
+    // Count what's queued for each client first, so nobody's waiting on us while we do it.
+    map<string, size_t> queued;
+    forEach([&](const unique_ptr<BedrockCommand>& command) {
+        queued[_clientName(*command)]++;
+    });
+    for (auto& shard : _clientShards) {
+        lock_guard<mutex> lock(shard.m);
+        for (const auto& entry : shard.clients) {
+            stats[entry.first] = SComposeJSONObject({
+                {"queued", to_string(queued[entry.first])},
+                {"dequeued", to_string(entry.second.dequeued)},
+                {"delayed", to_string(entry.second.delayed)},
+            });
         }
+    }
+    return stats;
+}
 
-        // If the whole queue is empty, save it for deletion.
-        if (queueMapIt->second.empty()) {
-            toDelete.push_back(queueMapIt);
+list<unique_ptr<BedrockCommand>> BedrockCommandQueue::abandonFutureCommands(int msInFuture) {
+    // We're going to delete every command scehduled after this timestamp. A client waiting on a command that we
+    // scheduled later than it asked for is still owed a response, though.
+    uint64_t timeLimit = STimeNow() + msInFuture * 1000;
+    list<unique_ptr<BedrockCommand>> rateLimited;
+    size_t numberErased = eraseScheduledAfter(timeLimit, [&](unique_ptr<BedrockCommand>& command) {
+        if (command->clientSequence && command->queueScheduled > command->request.calcU64("commandExecuteTime")) {
+            rateLimited.push_back(move(command));
         }
+    });
 
-        // If we deleted any commands, log that.
-        if (numberToErase) {
-            SINFO("Erased " << numberToErase << " commands scheduled more than " << msInFuture << "ms in the future.");
-        }
+    // If we deleted any commands, log that.
+    if (numberErased) {
+        SINFO("Erased " << numberErased << " commands scheduled more than " << msInFuture << "ms in the future, "
+              << rateLimited.size() << " of them delayed by the rate limit.");
     }
+    return rateLimited;
+}
 
-    // Delete any empty queues.
-    for (auto& it : toDelete) {
-        _queue.erase(it);
-    }
+bool BedrockCommandQueue::removeEscalated(const string& commandID) {
+    return eraseIf([&](unique_ptr<BedrockCommand>& command) {
+        return command->initiatingPeerID && SIEquals(command->id, commandID);
+    });
 }
 
 void BedrockCommandQueue::push(unique_ptr<BedrockCommand>&& command) {
     BedrockCommand::Priority priority = command->priority;
-    uint64_t executionTime = command->request.calcU64("commandExecuteTime");
     uint64_t timeout = command->timeout();
-    SScheduledPriorityQueue<unique_ptr<BedrockCommand>>::push(move(command), priority, executionTime, timeout);
+    _tagCommand(*command, command->request.calcU64("commandExecuteTime"));
+    uint64_t scheduled = command->queueScheduled;
+    uint64_t rank = _fair ? command->queueTag : timeout;
+    SShardedScheduledPriorityQueue<unique_ptr<BedrockCommand>>::push(move(command), priority, scheduled, timeout, rank);
+}
+
+BedrockCommandQueue::Order BedrockCommandQueue::_order(const SData& args) {
+    if (args["-queueOrder"] == "deadline" || args["-queueOrder"] == "fair") {
+        return Order::RANKED;
+    }
+    return Order::SCHEDULED;
+}
+
+string BedrockCommandQueue::_clientName(const BedrockCommand& command) const {
+    // Commands from localhost don't have a `_source`.
+    auto it = command.request.nameValueMap.find(_clientKey);
+    return it == command.request.nameValueMap.end() || it->second.empty() ? "local" : it->second;
+}
+
+void BedrockCommandQueue::_tagCommand(BedrockCommand& command, uint64_t scheduled) {
+    command.queueScheduled = scheduled;
+    if (!_fair && !_rateIntervalUS) {
+        return;
+    }
+
+    string name = _clientName(command);
+    auto weightIt = _clientWeights.find(name);
+    uint64_t weight = weightIt == _clientWeights.end() ? 1 : weightIt->second;
+    uint64_t now = STimeNow();
+    ClientShard& shard = _clientShard(name);
+    lock_guard<mutex> lock(shard.m);
+
+    // Forget about clients we haven't heard from in a while, so the map doesn't grow forever.
+    if (shard.clients.size() > CLIENTS_BEFORE_PRUNING && !SContains(shard.clients, name)) {
+        for (auto it = shard.clients.begin(); it != shard.clients.end();) {
+            it = it->second.lastQueued + CLIENT_IDLE_US < now ? shard.clients.erase(it) : next(it);
+        }
+    }
+    Client& client = shard.clients[name];
+    client.lastQueued = now;
+
+    // A client that's been idle starts from the current virtual time, so it can't save up credit.
+    client.lastTag = max(client.lastTag, _virtualTime.load()) + FAIR_QUEUE_COST / weight;
+    command.queueTag = client.lastTag;
+
+    // Only new commands count against the rate limit, not ones coming back to the queue to be retried.
+    if (_rateIntervalUS && !command.peekCount && !command.processCount) {
+        uint64_t arrival = max(client.nextArrival, now);
+        if (arrival > now + _rateBurstUS) {
+            command.queueScheduled = max(scheduled, arrival - _rateBurstUS);
+            client.delayed++;
+        }
+        client.nextArrival = arrival + _rateIntervalUS;
+    }
+}
+
+void BedrockCommandQueue::_recordWait(const BedrockCommand& command) {
+    // `stopTiming` has just recorded when the command entered and left the queue. Time before it was scheduled to run
+    // isn't waiting.
+    const auto& timing = command.timingInfo.back();
+    uint64_t eligible = max(std::get<1>(timing), command.queueScheduled);
+    uint64_t waitUS = std::get<2>(timing) - min(std::get<2>(timing), eligible);
+
+    auto statsIt = _waitStats.upper_bound(command.priority);
+    if (statsIt == _waitStats.begin()) {
+        // Below the lowest named priority.
+        return;
+    }
+    WaitStats& stats = prev(statsIt)->second;
+    auto bucket = lower_bound(WAIT_BUCKETS_MS.begin(), WAIT_BUCKETS_MS.end(), waitUS / 1000);
+    stats.histogram[bucket - WAIT_BUCKETS_MS.begin()]++;
+    uint64_t minimum = stats.minimumUS;
+    while (waitUS < minimum && !stats.minimumUS.compare_exchange_weak(minimum, waitUS)) {}
+}
+
+void BedrockCommandQueue::_recordClientDequeue(const BedrockCommand& command) {
+    // Virtual time moves on to the tag of the latest command to be served.
+    if (_fair) {
+        uint64_t virtualTime = _virtualTime;
+        while (command.queueTag > virtualTime && !_virtualTime.compare_exchange_weak(virtualTime, command.queueTag)) {}
+    }
+    if (_fair || _rateIntervalUS) {
+        string name = _clientName(command);
+        ClientShard& shard = _clientShard(name);
+        lock_guard<mutex> lock(shard.m);
+        auto it = shard.clients.find(name);
+        if (it != shard.clients.end()) {
+            it->second.dequeued++;
+        }
+    }
 }
@@ -1,11 +1,30 @@
 #pragma once
 #include <libstuff/libstuff.h>
-#include <libstuff/SScheduledPriorityQueue.h>
+#include <libstuff/SShardedScheduledPriorityQueue.h>
 #include "BedrockCommand.h"
 
-class BedrockCommandQueue : public SScheduledPriorityQueue<unique_ptr<BedrockCommand>> {
+// The queue of commands waiting for a worker. How commands of the same priority are ordered once they're due is set by
+// `-queueOrder`:
+//
+// scheduled (the default): In the order they were scheduled, which for most commands is the order they arrived.
+//
+// deadline: In order of their timeouts, so that under load we run the ones whose clients will give up soonest.
+//
+// fair: Weighted fair queuing across clients, so that one client sending a flood of commands can't starve the others
+// at the same priority. Clients are told apart by the `-fairQueueKey` request header (by default `_source`, the peer's
+// IP), and each is given a share of the workers in proportion to its weight from `-fairQueueWeights` (a list of
+// `client:weight` pairs, default weight 1). Each command is tagged with a virtual finish time: its client's previous
+// tag, or the tag of the last command to leave the queue if that's later, plus 1/weight. Commands run in tag order,
+// so a client with a backlog gets its share, and one that's been idle is served next.
+//
+// Separately, `-clientRateLimit` caps how many new commands per second each client can have run (with bursts of up to
+// `-clientRateBurst`, default 1). Commands over the limit stay queued, scheduled for when the client has capacity
+// again.
+class BedrockCommandQueue : public SShardedScheduledPriorityQueue<unique_ptr<BedrockCommand>> {
   public:
-    BedrockCommandQueue();
+    // If not `perClient`, neither fair queuing nor the rate limit apply, and with `-queueOrder fair`, commands are in
+    // deadline order instead.
+    BedrockCommandQueue(const SData& args = SData(), bool perClient = true);
 
     // Functions to start and stop timing on the commands when they're inserted/removed from the queue.
     static void startTiming(unique_ptr<BedrockCommand>& command);
@@ -15,9 +34,101 @@ class BedrockCommandQueue : public SScheduledPriorityQueue<unique_ptr<BedrockCom
     // reporting, and is called by BedrockServer when we receive a `Status` command.
     list<string> getRequestMethodLines();
 
-    // Discards all commands scheduled more than msInFuture milliseconds after right now.
-    void abandonFutureCommands(int msInFuture);
+    // Returns a histogram for each priority of how long commands waited in this queue after they were scheduled to
+    // run, keyed by the priority, each keyed by the upper bound of each bucket in ms. Thread-safe.
+    STable getWaitHistograms();
+
+    // Returns, for each named priority, the shortest time in microseconds that a command at that priority waited in
+    // this queue (measured as for `getWaitHistograms`) since the last call, or the largest possible value if none were
+    // dequeued. If even the luckiest command waited a long time, there's a standing queue at that priority.
+    // Thread-safe, but only one caller at a time will see each command.
+    map<int, uint64_t> takeMinimumWaits();
+
+    // When queuing fairly or rate limiting, returns the state of each client we've seen recently as a JSON object,
+    // keyed by the client: how many commands it has queued, how many have left the queue, and how many were delayed by
+    // the rate limit. Thread-safe.
+    STable getClientStats();
+
+    // Discards all commands scheduled more than msInFuture milliseconds after right now, except those that are only
+    // that late because their client was rate limited, which are returned instead, so their clients can be told.
+    list<unique_ptr<BedrockCommand>> abandonFutureCommands(int msInFuture);
+
+    // Discards the queued command escalated to us with the given ID, without responding to it. Returns whether there
+    // was one.
+    bool removeEscalated(const string& commandID);
 
     // Add an item to the queue. The queue takes ownership of the item and the caller's copy is invalidated.
     void push(unique_ptr<BedrockCommand>&& command);
+
+  private:
+    // Upper bounds (in ms) of the buckets in the wait histograms. The last bucket counts everything slower.
+    static constexpr array<uint64_t, 12> WAIT_BUCKETS_MS = {1, 2, 5, 10, 20, 50, 100, 200, 500, 1000, 2000, 5000};
+
+    // The amount a client's fair queuing tag advances per command at weight 1.
+    static constexpr uint64_t FAIR_QUEUE_COST = 1'000'000;
+
+    // We forget clients that haven't queued anything for this long, once there are enough of them to be worth it.
+    static constexpr uint64_t CLIENT_IDLE_US = 600 * STIME_US_PER_S;
+    static constexpr size_t CLIENTS_BEFORE_PRUNING = 1000;
+
+    struct WaitStats {
+        array<atomic<uint64_t>, WAIT_BUCKETS_MS.size() + 1> histogram;
+        atomic<uint64_t> minimumUS;
+    };
+
+    struct Client {
+        // The tag given to this client's last command.
+        uint64_t lastTag = 0;
+
+        // The rate limit's theoretical arrival time (as in GCRA) of this client's next command.
+        uint64_t nextArrival = 0;
+
+        uint64_t lastQueued = 0;
+        uint64_t dequeued = 0;
+        uint64_t delayed = 0;
+    };
+
+    // Clients are split across shards by name, so that workers finishing commands from different clients don't
+    // contend.
+    static constexpr size_t CLIENT_SHARDS = 16;
+    struct ClientShard {
+        map<string, Client> clients;
+        mutex m;
+    };
+
+    // Picks the underlying queue's order for `-queueOrder`.
+    static Order _order(const SData& args);
+
+    // Returns the name of the client that sent `command`.
+    string _clientName(const BedrockCommand& command) const;
+
+    ClientShard& _clientShard(const string& name) { return _clientShards[hash<string>()(name) % CLIENT_SHARDS]; }
+
+    // Sets `command.queueTag` and `command.queueScheduled` for a command about to be queued, which is scheduled at
+    // `scheduled`, applying the client's rate limit if it's new.
+    void _tagCommand(BedrockCommand& command, uint64_t scheduled);
+
+    // Adds the time `command` just spent waiting in the queue to the stats for its priority.
+    void _recordWait(const BedrockCommand& command);
+
+    // Updates the virtual time and client stats when `command` leaves the queue.
+    void _recordClientDequeue(const BedrockCommand& command);
+
+    // Stats for each of the named priorities. Commands with other priorities are counted with the highest named
+    // priority below them. The map itself never changes after construction, so only the stats need to be atomic.
+    map<int, WaitStats> _waitStats;
+
+    const bool _fair;
+    const string _clientKey;
+    map<string, uint64_t> _clientWeights;
+
+    // The rate limit's minimum interval between commands from one client, and how far ahead of that schedule a client
+    // can get. 0 if there's no rate limit.
+    const uint64_t _rateIntervalUS;
+    const uint64_t _rateBurstUS;
+
+    // The tag of the last command to leave the queue, when queuing fairly.
+    atomic<uint64_t> _virtualTime;
+
+    array<ClientShard, CLIENT_SHARDS> _clientShards;
 };
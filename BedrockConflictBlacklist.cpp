@@ -0,0 +1,98 @@
+#include "BedrockConflictBlacklist.h"
+
+BedrockConflictBlacklist::BedrockConflictBlacklist(const SData& args)
+  : _conflictPercent(args.isSet("-autoBlacklistConflictPercent")
+                     ? min(max(args.calc64("-autoBlacklistConflictPercent"), (int64_t)0), (int64_t)100) : 50),
+    _minCommits(args.isSet("-autoBlacklistMinCommits") ? max(args.calc64("-autoBlacklistMinCommits"), (int64_t)1) : 20),
+    _windowUS((args.isSet("-autoBlacklistSeconds") ? max(args.calc64("-autoBlacklistSeconds"), (int64_t)1) : 60)
+              * STIME_US_PER_S)
+{ }
+
+void BedrockConflictBlacklist::recordCommit(const string& methodLine, bool conflicted) {
+    uint64_t now = STimeNow();
+    unique_lock<decltype(_mutex)> lock(_mutex);
+    if (_entries.size() > ENTRIES_BEFORE_PRUNING) {
+        _prune(now);
+    }
+    Entry& entry = _entries[methodLine];
+    entry.commits++;
+    if (conflicted) {
+        entry.conflicts++;
+    }
+
+    // These are commands that were already past the check when we went on the list, so they were measured along with
+    // the ones that put us there.
+    if (entry.blacklistedUntil > now) {
+        return;
+    }
+
+    if (!entry.sampleCommits || now - entry.sampleStart > _windowUS) {
+        entry.sampleStart = now;
+        entry.sampleCommits = 0;
+        entry.sampleConflicts = 0;
+    }
+    entry.sampleCommits++;
+    if (conflicted) {
+        entry.sampleConflicts++;
+    }
+    if (entry.sampleCommits < _minCommits) {
+        return;
+    }
+
+    if (_conflictPercent && entry.sampleConflicts * 100 >= _conflictPercent * entry.sampleCommits) {
+        uint64_t duration = _windowUS << min(entry.strikes, MAX_DOUBLINGS);
+        SINFO("Sending '" << methodLine << "' to the sync thread for " << duration / STIME_US_PER_S << "s after "
+              << entry.sampleConflicts << " conflicts in " << entry.sampleCommits << " worker commits.");
+        entry.blacklistedUntil = now + duration;
+        entry.strikes++;
+        entry.timesBlacklisted++;
+    } else {
+        entry.strikes = 0;
+    }
+    entry.sampleCommits = 0;
+    entry.sampleConflicts = 0;
+}
+
+bool BedrockConflictBlacklist::contains(const string& methodLine) {
+    shared_lock<decltype(_mutex)> lock(_mutex);
+    auto it = _entries.find(methodLine);
+    return it != _entries.end() && it->second.blacklistedUntil > STimeNow();
+}
+
+list<string> BedrockConflictBlacklist::getBlacklist() {
+    uint64_t now = STimeNow();
+    list<string> blacklist;
+    shared_lock<decltype(_mutex)> lock(_mutex);
+    for (const auto& entry : _entries) {
+        if (entry.second.blacklistedUntil > now) {
+            blacklist.push_back(entry.first);
+        }
+    }
+    return blacklist;
+}
+
+STable BedrockConflictBlacklist::getState() {
+    uint64_t now = STimeNow();
+    STable state;
+    shared_lock<decltype(_mutex)> lock(_mutex);
+    for (const auto& entry : _entries) {
+        uint64_t remaining = entry.second.blacklistedUntil > now ? entry.second.blacklistedUntil - now : 0;
+        state[entry.first] = SComposeJSONObject({
+            {"commits", to_string(entry.second.commits)},
+            {"conflicts", to_string(entry.second.conflicts)},
+            {"timesBlacklisted", to_string(entry.second.timesBlacklisted)},
+            {"blacklistedSeconds", to_string((remaining + STIME_US_PER_S - 1) / STIME_US_PER_S)},
+        });
+    }
+    return state;
+}
+
+void BedrockConflictBlacklist::_prune(uint64_t now) {
+    for (auto it = _entries.begin(); it != _entries.end();) {
+        if (it->second.blacklistedUntil <= now && now - it->second.sampleStart > _windowUS) {
+            it = _entries.erase(it);
+        } else {
+            it++;
+        }
+    }
+}
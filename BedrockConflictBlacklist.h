@@ -0,0 +1,68 @@
+#pragma once
+#include <libstuff/libstuff.h>
+
+// Keeps commands that keep conflicting from being committed by worker threads. With multi-write enabled, workers commit
+// write commands in parallel, retrying on conflict up to `_maxConflictRetries` times before handing them to the
+// blocking commit thread. A command that conflicts most of the time wastes all of that work (and holds up everything
+// else on the blocking thread), so we count how often each command conflicts, by method line, like
+// `-blacklistedParallelCommands`. Once a command has conflicted on at least `-autoBlacklistConflictPercent` (default
+// 50, 0 to disable) of `-autoBlacklistMinCommits` (default 20) commit attempts, it's sent straight to the sync thread.
+//
+// Whatever a command was conflicting with may stop, so it doesn't stay on the list forever. After
+// `-autoBlacklistSeconds` (default 60), it's allowed back on the workers to be measured again, and if it goes straight
+// back on the list, it stays there twice as long as the time before, up to `MAX_DOUBLINGS` times. Attempts older than
+// `-autoBlacklistSeconds` are forgotten, so occasional conflicts spread out over hours don't add up to a blacklisting.
+class BedrockConflictBlacklist {
+  public:
+    BedrockConflictBlacklist(const SData& args);
+
+    // Records whether a worker's attempt to commit a command with `methodLine` conflicted. Thread-safe.
+    void recordCommit(const string& methodLine, bool conflicted);
+
+    // Returns true if commands with `methodLine` should go to the sync thread rather than being committed by workers.
+    // Thread-safe.
+    bool contains(const string& methodLine);
+
+    // Returns the method lines currently on the list.
+    list<string> getBlacklist();
+
+    // Returns the commit and conflict counts for each method line we're tracking, as JSON objects keyed by method
+    // line, for `Status`.
+    STable getState();
+
+  private:
+    static constexpr int MAX_DOUBLINGS = 5;
+
+    // When we're tracking more method lines than this, we forget the ones that haven't been committed recently.
+    static constexpr size_t ENTRIES_BEFORE_PRUNING = 1000;
+
+    struct Entry {
+        // The attempts we're currently measuring: when the first was, how many there have been, and how many
+        // conflicted.
+        uint64_t sampleStart = 0;
+        uint64_t sampleCommits = 0;
+        uint64_t sampleConflicts = 0;
+
+        // If this is in the future, we're on the list until then.
+        uint64_t blacklistedUntil = 0;
+
+        // The number of times in a row we've gone on the list without a clean sample in between.
+        int strikes = 0;
+
+        // Totals, for `Status`.
+        uint64_t commits = 0;
+        uint64_t conflicts = 0;
+        uint64_t timesBlacklisted = 0;
+    };
+
+    // Forgets entries that aren't on the list and haven't started measuring attempts in the last `_windowUS`. Call with
+    // `_mutex` locked exclusively.
+    void _prune(uint64_t now);
+
+    const uint64_t _conflictPercent;
+    const uint64_t _minCommits;
+    const uint64_t _windowUS;
+
+    map<string, Entry> _entries;
+    shared_timed_mutex _mutex;
+};
@@ -0,0 +1,105 @@
+#include "BedrockFutureCommitQueue.h"
+
+BedrockFutureCommitQueue::BedrockFutureCommitQueue(BedrockCommandQueue& commandQueue)
+  : _commandQueue(commandQueue), _lastExpiredSlot(STimeNow() / WHEEL_SLOT_US), _commitCount(0), _nextID(1)
+{ }
+
+void BedrockFutureCommitQueue::push(unique_ptr<BedrockCommand>&& command, uint64_t commitCount) {
+    lock_guard<mutex> lock(_mutex);
+
+    // The commit may have arrived between the caller checking and calling us.
+    if (commitCount <= _commitCount) {
+        SINFO("Command (" << command->request.methodLine << ") waiting on commit " << commitCount
+              << " already has it, returning to queue.");
+        _commandQueue.push(move(command));
+        return;
+    }
+
+    uint64_t id = _nextID++;
+    uint64_t timeout = command->timeout();
+    SINFO("Command (" << command->request.methodLine << ") depends on future commit (" << commitCount
+          << "), currently at: " << _commitCount << ", storing for later. Queue size: " << _commands.size() + 1);
+
+    // Anything that's already timed out goes in the next slot `expire` looks at.
+    _wheel[max(timeout / WHEEL_SLOT_US, _lastExpiredSlot + 1) % WHEEL_SLOTS].push_back(id);
+    _commitToIDs.emplace(commitCount, id);
+    _commands.emplace(id, WaitingCommand{move(command), commitCount});
+    if (_commands.size() > 100) {
+        SHMMM("Future commit commands size == " << _commands.size());
+    }
+}
+
+void BedrockFutureCommitQueue::committed(uint64_t commitCount) {
+    lock_guard<mutex> lock(_mutex);
+    _commitCount = max(_commitCount, commitCount);
+    auto end = _commitToIDs.upper_bound(_commitCount);
+    for (auto it = _commitToIDs.begin(); it != end; it++) {
+        auto commandIt = _commands.find(it->second);
+        SINFO("Returning command (" << commandIt->second.command->request.methodLine << ") waiting on commit "
+              << it->first << " to queue, now have commit " << _commitCount);
+        _return(commandIt);
+    }
+    _commitToIDs.erase(_commitToIDs.begin(), end);
+}
+
+void BedrockFutureCommitQueue::expire() {
+    lock_guard<mutex> lock(_mutex);
+    uint64_t now = STimeNow();
+    uint64_t currentSlot = now / WHEEL_SLOT_US;
+
+    // If it's been more than a whole revolution since we last ran, each slot only needs to be visited once.
+    uint64_t firstSlot = max(_lastExpiredSlot + 1, currentSlot >= WHEEL_SLOTS ? currentSlot - WHEEL_SLOTS + 1 : 0);
+    for (uint64_t slot = firstSlot; slot <= currentSlot; slot++) {
+        list<uint64_t>& ids = _wheel[slot % WHEEL_SLOTS];
+        for (auto idIt = ids.begin(); idIt != ids.end();) {
+            auto commandIt = _commands.find(*idIt);
+            if (commandIt == _commands.end()) {
+                // Already returned when its commit arrived.
+                idIt = ids.erase(idIt);
+                continue;
+            }
+            uint64_t timeout = commandIt->second.command->timeout();
+            if (timeout > now) {
+                // Due in a later revolution.
+                idIt++;
+                continue;
+            }
+            SINFO("Returning command (" << commandIt->second.command->request.methodLine << ") waiting on commit "
+                  << commandIt->second.commitCount << " to queue, timed out at: " << now << ", timeout was: "
+                  << timeout << ".");
+
+            // Goes back to the main queue, where it will hit it's timeout in a worker thread.
+            auto range = _commitToIDs.equal_range(commandIt->second.commitCount);
+            for (auto it = range.first; it != range.second; it++) {
+                if (it->second == *idIt) {
+                    _commitToIDs.erase(it);
+                    break;
+                }
+            }
+            _return(commandIt);
+            idIt = ids.erase(idIt);
+        }
+    }
+    _lastExpiredSlot = max(_lastExpiredSlot, currentSlot);
+}
+
+void BedrockFutureCommitQueue::returnAll() {
+    lock_guard<mutex> lock(_mutex);
+    while (!_commands.empty()) {
+        _return(_commands.begin());
+    }
+    _commitToIDs.clear();
+    for (auto& slot : _wheel) {
+        slot.clear();
+    }
+}
+
+size_t BedrockFutureCommitQueue::size() {
+    lock_guard<mutex> lock(_mutex);
+    return _commands.size();
+}
+
+void BedrockFutureCommitQueue::_return(map<uint64_t, WaitingCommand>::iterator it) {
+    _commandQueue.push(move(it->second.command));
+    _commands.erase(it);
+}
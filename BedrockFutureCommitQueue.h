@@ -0,0 +1,65 @@
+#pragma once
+#include <libstuff/libstuff.h>
+#include <sqlitecluster/SQLite.h>
+#include "BedrockCommandQueue.h"
+
+// Holds commands that depend on a commit count newer than the local DB has (for instance, a follow-up to a command
+// that was escalated to leader, sent to a follower that's behind). It listens for commits on the DB, and moves each
+// command back to the command queue as soon as the commit it needs is applied, rather than waiting for someone to
+// check. Commands that time out first are moved back to the command queue by `expire`, where they'll be failed with a
+// timeout by a worker.
+class BedrockFutureCommitQueue : public SQLite::CommitListener {
+  public:
+    BedrockFutureCommitQueue(BedrockCommandQueue& commandQueue);
+
+    // Hold `command` until commit `commitCount` has been applied. If it already has been, the command goes straight
+    // back to the command queue.
+    void push(unique_ptr<BedrockCommand>&& command, uint64_t commitCount);
+
+    // Implement SQLite::CommitListener. Returns every command waiting on a commit up to `commitCount` to the command
+    // queue.
+    void committed(uint64_t commitCount) override;
+
+    // Returns any commands that have timed out to the command queue.
+    void expire();
+
+    // Returns every command to the command queue, regardless of commit count or timeout.
+    void returnAll();
+
+    // Returns the number of commands waiting.
+    size_t size();
+
+  private:
+    // Timeouts are tracked in a timer wheel of `WHEEL_SLOTS` slots, each covering `WHEEL_SLOT_US` microseconds. Each
+    // slot lists the IDs of the commands that time out during that slot of the wheel's current revolution, or of any
+    // later revolution. `expire` visits each slot that's passed since it last ran, and returns the commands in it that
+    // have actually timed out. Commands that have already been returned because their commit arrived are skipped.
+    static constexpr size_t WHEEL_SLOTS = 256;
+    static constexpr uint64_t WHEEL_SLOT_US = 100'000;
+
+    struct WaitingCommand {
+        unique_ptr<BedrockCommand> command;
+        uint64_t commitCount;
+    };
+
+    // Return a command to the command queue and forget about it. Call with `_mutex` locked.
+    void _return(map<uint64_t, WaitingCommand>::iterator it);
+
+    BedrockCommandQueue& _commandQueue;
+
+    // Every waiting command, by an ID assigned when it was pushed.
+    map<uint64_t, WaitingCommand> _commands;
+
+    // The IDs of the commands waiting on each commit count.
+    multimap<uint64_t, uint64_t> _commitToIDs;
+
+    // The timer wheel, and the slot (in absolute units of WHEEL_SLOT_US) that `expire` has handled up to.
+    array<list<uint64_t>, WHEEL_SLOTS> _wheel;
+    uint64_t _lastExpiredSlot;
+
+    // The highest commit count we've been notified about, and the next command ID to use.
+    uint64_t _commitCount;
+    uint64_t _nextID;
+
+    mutex _mutex;
+};
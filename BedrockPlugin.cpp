@@ -65,6 +65,15 @@ const string& BedrockPlugin::getName() const {
     SERROR("No name defined by this plugin, aborting.");
 }
 
+const set<string, STableComp>& BedrockPlugin::getSupportedVerbs() const {
+    static const set<string, STableComp> none;
+    return none;
+}
+
+bool BedrockPlugin::handlesUnregisteredVerbs() const {
+    return getSupportedVerbs().empty();
+}
+
 bool BedrockPlugin::preventAttach() {
     return false;
 }
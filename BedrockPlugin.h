@@ -35,6 +35,15 @@ class BedrockPlugin {
     // Return a command, or a null pointer if this plugin can't handle this request.
     virtual unique_ptr<BedrockCommand> getCommand(SQLiteCommand&& baseCommand) = 0;
 
+    // Returns the request verbs this plugin handles, matched case-insensitively. BedrockServer indexes these when it
+    // loads its plugins, and sends a request with one of them straight to this plugin's `getCommand`.
+    virtual const set<string, STableComp>& getSupportedVerbs() const;
+
+    // Returns true if `getCommand` should be offered requests whose verb isn't registered by any plugin, for plugins
+    // that recognize requests some other way (by a prefix of the method line, for instance). These are asked in turn,
+    // so it's slower than registering verbs. By default, this is any plugin that doesn't register verbs.
+    virtual bool handlesUnregisteredVerbs() const;
+
     // Called at some point during initiation to allow the plugin to verify/change the database schema.
     virtual void upgradeDatabase(SQLite& db);
 
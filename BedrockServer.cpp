@@ -72,7 +72,14 @@ void BedrockServer::acceptCommand(unique_ptr<SQLiteCommand>&& command, bool isNe
 }
 
 void BedrockServer::cancelCommand(const string& commandID) {
-    // TODO: Unimplemented (but never called, anyway)
+    // The follower that escalated this has already answered its client, so if we haven't started it yet, we just drop
+    // it. If we have, it's too late, and it finishes as usual.
+    if (_commandQueue.removeEscalated(commandID) || _blockingCommandQueue.removeEscalated(commandID) ||
+        _standDownQueue.removeEscalated(commandID)) {
+        SINFO("Cancelled escalated command '" << commandID << "' before running it.");
+    } else {
+        SINFO("Not cancelling escalated command '" << commandID << "', it's not queued.");
+    }
 }
 
 bool BedrockServer::canStandDown() {
@@ -86,18 +93,14 @@ bool BedrockServer::canStandDown() {
         size_t blockingQueueSize = _blockingCommandQueue.size();
         size_t syncNodeQueueSize = _syncNodeQueuedCommands.size();
         size_t completedCommandsSize = _completedCommands.size();
+        size_t futureCommitCommandsSize = _futureCommitCommands.size();
 
-        // These two aren't all nicely packaged so we need to lock them ourselves.
+        // This one isn't all nicely packaged so we need to lock it ourselves.
         size_t outstandingHTTPSCommandsSize = 0;
         {
             lock_guard<decltype(_httpsCommandMutex)> lock(_httpsCommandMutex);
             outstandingHTTPSCommandsSize = _outstandingHTTPSCommands.size();
         }
-        size_t futureCommitCommandsSize = 0;
-        {
-            lock_guard<decltype(_futureCommitCommandMutex)> lock(_futureCommitCommandMutex);
-            futureCommitCommandsSize = _futureCommitCommands.size();
-        }
 
         SINFO("Can't stand down with " << count << " commands remaining. Queue sizes are: "
               << "mainQueueSize: " << mainQueueSize << ", "
@@ -186,6 +189,11 @@ void BedrockServer::sync(const SData& args,
     SQLitePool dbPool(fdLimit, args["-db"], args.calc("-cacheSize"), args.calc("-maxJournalSize"), workerThreads, args["-synchronous"], mmapSizeGB, args.test("-pageLogging"));
     SQLite& db = dbPool.getBase();
 
+    // Commands waiting for a future commit are woken up by the commits themselves. We may already have commits that
+    // arrived while we were detached, so start from our current count.
+    db.addCommitListener(server._futureCommitCommands);
+    server._futureCommitCommands.committed(db.getCommitCount());
+
     // Initialize the command processor.
     BedrockCore core(db, server);
 
@@ -197,6 +205,12 @@ void BedrockServer::sync(const SData& args,
                                                             args["-peerList"], args.calc("-priority"), firstTimeout,
                                                             server._version, args.test("-parallelReplication")));
 
+    // Optionally move peer socket I/O off of this thread, so that replication traffic isn't held up by whatever this
+    // thread is doing.
+    if (args.test("-syncNetworkThread")) {
+        server._syncNode->startNetworkThread();
+    }
+
     // This should be empty anyway, but let's make sure.
     if (server._completedCommands.size()) {
         SWARN("_completedCommands not empty at startup of sync thread.");
@@ -223,6 +237,10 @@ void BedrockServer::sync(const SData& args,
     unique_ptr<BedrockCommand> command(nullptr);
     bool committingCommand = false;
 
+    // Commands whose pipelined QUORUM commits haven't been approved by a majority of followers yet, keyed by commit ID.
+    // We don't respond to these until they have.
+    map<uint64_t, unique_ptr<BedrockCommand>> commandsAwaitingQuorum;
+
     // Timer for S_poll performance logging. Created outside the loop because it's cumulative.
     AutoTimer pollTimer("sync thread poll");
     AutoTimer postPollTimer("sync thread PostPoll");
@@ -234,73 +252,15 @@ void BedrockServer::sync(const SData& args,
             SAUTOPREFIX(command->request);
         }
 
-        // If there were commands waiting on our commit count to come up-to-date, we'll move them back to the main
-        // command queue here. There's no place in particular that's best to do this, so we do it at the top of this
-        // main loop, as that prevents it from ever getting skipped in the event that we `continue` early from a loop
-        // iteration.
+        // Commands waiting on our commit count to come up-to-date are moved back to the main command queue as soon as
+        // that commit is applied, but any that have timed out waiting are moved back here. There's no place in
+        // particular that's best to do this, so we do it at the top of this main loop, as that prevents it from ever
+        // getting skipped in the event that we `continue` early from a loop iteration.
         // We also move all commands back to the main queue here if we're shutting down, just to make sure they don't
         // end up lost in the ether.
-        {
-            SAUTOLOCK(server._futureCommitCommandMutex);
-
-            // First, see if anything has timed out, and move that back to the main queue.
-            if (server._futureCommitCommandTimeouts.size()) {
-                uint64_t now = STimeNow();
-                auto it =  server._futureCommitCommandTimeouts.begin();
-                while (it != server._futureCommitCommandTimeouts.end() && it->first < now) {
-                    // Find commands depending on this commit.
-                    auto itPair =  server._futureCommitCommands.equal_range(it->second);
-                    for (auto cmdIt = itPair.first; cmdIt != itPair.second; cmdIt++) {
-                        // Check for one with this timeout.
-                        if (cmdIt->second->timeout() == it->first) {
-                            // This command has the right commit count *and* timeout, return it.
-                            SINFO("Returning command (" << cmdIt->second->request.methodLine << ") waiting on commit " << cmdIt->first
-                                  << " to queue, timed out at: " << now << ", timeout was: " << it->first << ".");
-
-                            // Goes back to the main queue, where it will hit it's timeout in a worker thread.
-                            server._commandQueue.push(move(cmdIt->second));
-
-                            // And delete it, it's gone.
-                             server._futureCommitCommands.erase(cmdIt);
-
-                            // Done.
-                            break;
-                        }
-                    }
-                    it++;
-                }
-
-                // And remove everything we just iterated through.
-                if (it != server._futureCommitCommandTimeouts.begin()) {
-                    server._futureCommitCommandTimeouts.erase(server._futureCommitCommandTimeouts.begin(), it);
-                }
-            }
-
-            // Anything that hasn't timed out might be ready to return because the commit count is up-to-date.
-            if (!server._futureCommitCommands.empty()) {
-                uint64_t commitCount = db.getCommitCount();
-                auto it = server._futureCommitCommands.begin();
-                while (it != server._futureCommitCommands.end() && (it->first <= commitCount || server._shutdownState.load() != RUNNING)) {
-                    // Save the timeout since we'll be moving the command, thus making this inaccessible.
-                    uint64_t commandTimeout = it->second->timeout();
-                    SINFO("Returning command (" << it->second->request.methodLine << ") waiting on commit " << it->first
-                          << " to queue, now have commit " << commitCount);
-                    server._commandQueue.push(move(it->second));
-
-                    // Remove it from the timed out list as well.
-                    auto itPair = server._futureCommitCommandTimeouts.equal_range(commandTimeout);
-                    for (auto timeoutIt = itPair.first; timeoutIt != itPair.second; timeoutIt++) {
-                        if (timeoutIt->second == it->first) {
-                             server._futureCommitCommandTimeouts.erase(timeoutIt);
-                            break;
-                        }
-                    }
-                    it++;
-                }
-                if (it != server._futureCommitCommands.begin()) {
-                    server._futureCommitCommands.erase(server._futureCommitCommands.begin(), it);
-                }
-            }
+        server._futureCommitCommands.expire();
+        if (server._shutdownState.load() != RUNNING) {
+            server._futureCommitCommands.returnAll();
         }
 
         // If we're in a state where we can initialize shutdown, then go ahead and do so.
@@ -362,6 +322,29 @@ void BedrockServer::sync(const SData& args,
         replicationState.store(nodeState);
         leaderVersion.store(server._syncNode->getLeaderVersion());
 
+        // Respond to any pipelined QUORUM commands that have now been approved. If we've stopped leading, the ones that
+        // haven't been never will be. They're committed here, but no majority confirmed them, so they could be lost
+        // when the cluster fails over, and we can't tell the caller they succeeded.
+        if (!commandsAwaitingQuorum.empty()) {
+            bool leading = nodeState == SQLiteNode::LEADING || nodeState == SQLiteNode::STANDINGDOWN;
+            uint64_t approvedCommit = leading ? server._syncNode->getQuorumApprovedCommit() : 0;
+            auto it = commandsAwaitingQuorum.begin();
+            while (it != commandsAwaitingQuorum.end() && (!leading || it->first <= approvedCommit)) {
+                unique_ptr<BedrockCommand>& awaitingCommand = it->second;
+                if (it->first > approvedCommit) {
+                    SWARN("Stopped leading before commit " << it->first << " for command "
+                          << awaitingCommand->request.methodLine << " was approved by quorum.");
+                    awaitingCommand->response.methodLine = "555 Commit not confirmed by quorum";
+                }
+                if (awaitingCommand->initiatingPeerID) {
+                    server._finishPeerCommand(awaitingCommand);
+                } else {
+                    server._reply(awaitingCommand);
+                }
+                it = commandsAwaitingQuorum.erase(it);
+            }
+        }
+
         // If anything was in the stand down queue, move it back to the main queue.
         if (nodeState != SQLiteNode::STANDINGDOWN) {
             while (server._standDownQueue.size()) {
@@ -373,7 +356,7 @@ void BedrockServer::sync(const SData& args,
             // they could be re-escalated to leader in the future, but there's not currently a way to decide if we've
             // run through all of the commands that might need peer responses before standing down aside from seeing if
             // the entire queue is empty.
-            server._commandQueue.abandonFutureCommands(5000);
+            server._abandonFutureCommands();
         }
 
         // If we were LEADING, but we've transitioned, then something's gone wrong (perhaps we got disconnected
@@ -476,7 +459,15 @@ void BedrockServer::sync(const SData& args,
             }
 
             if (server._syncNode->commitSucceeded()) {
-                if (command) {
+                uint64_t pipelinedCommitID = server._syncNode->getPipelinedCommitID();
+                if (command && pipelinedCommitID) {
+                    // Committed, but we can't respond until a majority of followers have approved it.
+                    SINFO("[performance] Sync thread committed command " << command->request.methodLine
+                          << " as #" << pipelinedCommitID << ", awaiting quorum approval.");
+                    command->response["commitCount"] = to_string(pipelinedCommitID);
+                    command->complete = true;
+                    commandsAwaitingQuorum[pipelinedCommitID] = move(command);
+                } else if (command) {
                     SINFO("[performance] Sync thread finished committing command " << command->request.methodLine);
 
                     // Otherwise, save the commit count, mark this command as complete, and reply.
@@ -528,8 +519,9 @@ void BedrockServer::sync(const SData& args,
                 // when _completedCommands.pop() throws for running out of commands, we fall out of the loop.
             }
 
-            // We don't start processing a new command until we've completed any existing ones.
-            if (committingCommand) {
+            // We don't start processing a new command until we've completed any existing ones, or, if we're
+            // pipelining QUORUM commits, until there's room for another.
+            if (committingCommand || commandsAwaitingQuorum.size() >= SQLiteNode::quorumPipelineDepth) {
                 continue;
             }
 
@@ -710,6 +702,9 @@ void BedrockServer::sync(const SData& args,
         workerThread.join();
     }
 
+    // Nothing else is going to commit to this DB, and it's about to go away.
+    db.removeCommitListener(server._futureCommitCommands);
+
     // If there's anything left in the command queue here, we'll discard it, because we have no way of processing it.
     if (server._commandQueue.size()) {
         SWARN("Sync thread shut down with " << server._commandQueue.size() << " queued commands. Commands were: "
@@ -902,23 +897,46 @@ void BedrockServer::worker(SQLitePool& dbPool,
             }
 
             // If this command is dependent on a commitCount newer than what we have (maybe it's a follow-up to a
-            // command that was escalated to leader), we'll set it aside for later processing. When the sync node
-            // finishes its update loop, it will re-queue any of these commands that are no longer blocked on our
-            // updated commit count.
+            // command that was escalated to leader), we'll set it aside for later processing. It will be re-queued as
+            // soon as the commit it's waiting for is applied.
             uint64_t commitCount = db.getCommitCount();
             uint64_t commandCommitCount = command->request.calcU64("commitCount");
-            if (commandCommitCount > commitCount) {
-                SAUTOLOCK(server._futureCommitCommandMutex);
-                auto newQueueSize = server._futureCommitCommands.size() + 1;
-                SINFO("Command (" << command->request.methodLine << ") depends on future commit (" << commandCommitCount
-                      << "), Currently at: " << commitCount << ", storing for later. Queue size: " << newQueueSize);
-                server._futureCommitCommandTimeouts.insert(make_pair(command->timeout(), commandCommitCount));
-                server._futureCommitCommands.insert(make_pair(commandCommitCount, move(command)));
 
-                // Don't count this as `in progress`, it's just sitting there.
-                if (newQueueSize > 100) {
-                    SHMMM("server._futureCommitCommands.size() == " << newQueueSize);
+            // If the client has said how stale a read it will accept, and we're following, check that our data is
+            // recent enough. If it's not, but leader's told us about commits we haven't applied yet, we'll wait for
+            // those like any other future commit, as they'll bring us up to date as of when leader told us about them.
+            // Otherwise (or if we've already spent as long as the client's willing to wait for fresh data), we'll
+            // escalate to leader.
+            if (state == SQLiteNode::FOLLOWING && command->request.isSet("maxStalenessMS")) {
+                auto syncNodeCopy = atomic_load(&server._syncNode);
+                uint64_t maxStalenessMS = command->request.calcU64("maxStalenessMS");
+                uint64_t staleness = syncNodeCopy ? syncNodeCopy->getReadStalenessMS() : UINT64_MAX;
+                if (staleness > maxStalenessMS) {
+                    uint64_t leaderCommitCount = syncNodeCopy ? syncNodeCopy->getLeaderCommitCount() : 0;
+                    uint64_t waitedMS = (STimeNow() - command->request.calcU64("commandExecuteTime")) / 1000;
+                    if (leaderCommitCount > commitCount && waitedMS < maxStalenessMS) {
+                        SINFO("Command (" << command->request.methodLine << ") allows " << maxStalenessMS
+                              << "ms staleness but we're " << staleness << "ms behind, waiting for commit "
+                              << leaderCommitCount << ".");
+                        commandCommitCount = max(commandCommitCount, leaderCommitCount);
+                    } else {
+                        SINFO("Command (" << command->request.methodLine << ") allows " << maxStalenessMS
+                              << "ms staleness but we're " << staleness << "ms behind, escalating.");
+                        syncNodeQueuedCommands.push(move(command));
+                        continue;
+                    }
                 }
+            }
+
+            if (commandCommitCount > commitCount) {
+                // Don't count this as `in progress`, it's just sitting there.
+                server._futureCommitCommands.push(move(command), commandCommitCount);
+                continue;
+            }
+
+            // If an identical read is already being peeked, this can wait to share its response rather than running.
+            string coalesceKey = server._commandCoalescer.key(*command, commitCount);
+            if (!coalesceKey.empty() && server._commandCoalescer.wait(coalesceKey, command)) {
                 continue;
             }
 
@@ -936,6 +954,9 @@ void BedrockServer::worker(SQLitePool& dbPool,
                     (_blacklistedParallelCommands.find(command->request.methodLine) == _blacklistedParallelCommands.end());
             }
 
+            // Or if it's been conflicting with other commands so often lately that it's not worth trying.
+            canWriteParallel = canWriteParallel && !server._conflictBlacklist.contains(command->request.methodLine);
+
             // More checks for parallel writing.
             canWriteParallel = canWriteParallel && (state == SQLiteNode::LEADING);
             canWriteParallel = canWriteParallel && (command->writeConsistency == SQLiteNode::ASYNC);
@@ -974,6 +995,22 @@ void BedrockServer::worker(SQLitePool& dbPool,
                     continue;
                 }
 
+                // Anything waiting for this command's response gets a copy of it if `peek` finished it (before we add
+                // our own timing info to it). Otherwise, it's not a pure read after all, so they run on their own.
+                if (!coalesceKey.empty()) {
+                    for (auto& waiting : server._commandCoalescer.finish(coalesceKey, command->complete)) {
+                        if (command->complete) {
+                            waiting->response = command->response;
+                            waiting->complete = true;
+                            server._reply(waiting);
+                        } else {
+                            waiting->skipCoalescing = true;
+                            commandQueue.push(move(waiting));
+                        }
+                    }
+                    coalesceKey.clear();
+                }
+
                 if (!calledPeek || peekResult == BedrockCore::RESULT::SHOULD_PROCESS) {
                     // We've just unsuccessfully peeked a command, which means we're in a state where we might want to
                     // write it. We'll flag that here, to keep the node from falling out of LEADING/STANDINGDOWN
@@ -1065,6 +1102,7 @@ void BedrockServer::worker(SQLitePool& dbPool,
                             } else {
                                 BedrockCore::AutoTimer(command, BedrockCommand::COMMIT_WORKER);
                                 commitSuccess = core.commit(SQLiteNode::stateName(server._replicationState));
+                                server._conflictBlacklist.recordCommit(command->request.methodLine, !commitSuccess);
                             }
                         }
                         if (commitSuccess) {
@@ -1232,15 +1270,24 @@ void BedrockServer::_resetServer() {
     }
 }
 
-BedrockServer::BedrockServer(SQLiteNode::State state, const SData& args_) : SQLiteServer(""), args(args_), _replicationState(SQLiteNode::LEADING)
+BedrockServer::BedrockServer(SQLiteNode::State state, const SData& args_)
+  : SQLiteServer(""), args(args_), _admissionControl(args, _commandQueue), _replicationState(SQLiteNode::LEADING),
+    _futureCommitCommands(_commandQueue), _conflictBlacklist(args), _commandCoalescer(args)
 {}
 
 BedrockServer::BedrockServer(const SData& args_)
-  : SQLiteServer(""), shutdownWhileDetached(false), args(args_), _requestCount(0), _replicationState(SQLiteNode::SEARCHING),
+  : SQLiteServer(""), shutdownWhileDetached(false), args(args_),
+    _commandQueue(args), _blockingCommandQueue(args, false),
+    _requestCount(0),
+    _clientPipelineDepth(args.isSet("-clientPipelineDepth") ? max(args.calc("-clientPipelineDepth"), 1) : 1),
+    _admissionControl(args, _commandQueue),
+    _replicationState(SQLiteNode::SEARCHING),
     _upgradeInProgress(false), _suppressCommandPort(false), _suppressCommandPortManualOverride(false),
-    _syncThreadComplete(false), _syncNode(nullptr), _shutdownState(RUNNING),
+    _syncThreadComplete(false), _syncNode(nullptr), _lastChance(0), _clientIOPortsOpen(false),
+    _clientIOThreadsShouldExit(false), _futureCommitCommands(_commandQueue), _shutdownState(RUNNING),
     _multiWriteEnabled(args.test("-enableMultiWrite")), _shouldBackup(false), _detach(args.isSet("-bootstrap")),
-    _controlPort(nullptr), _commandPort(nullptr), _maxConflictRetries(3), _lastQuorumCommandTime(STimeNow()),
+    _controlPort(nullptr), _commandPort(nullptr), _maxConflictRetries(3), _conflictBlacklist(args),
+    _commandCoalescer(args), _lastQuorumCommandTime(STimeNow()),
     _pluginsDetached(false)
 {
     _version = VERSION;
@@ -1269,6 +1316,21 @@ BedrockServer::BedrockServer(const SData& args_)
     sort(versions.begin(), versions.end());
     _version = SComposeList(versions, ":");
 
+    // Index the verbs each plugin handles. If two plugins claim the same verb, the first by name gets it, which is
+    // the one that would have been asked first without the index.
+    for (auto& p : plugins) {
+        for (const string& verb : p.second->getSupportedVerbs()) {
+            auto result = _pluginsByVerb.emplace(SToLower(verb), p.second);
+            if (!result.second && result.first->second != p.second) {
+                SWARN("Plugins '" << result.first->second->getName() << "' and '" << p.first << "' both handle verb '"
+                      << verb << "', using '" << result.first->second->getName() << "'.");
+            }
+        }
+        if (p.second->handlesUnregisteredVerbs()) {
+            _unindexedPlugins.push_back(p.second);
+        }
+    }
+
     list<string> pluginString;
     for (auto& p : plugins) {
         pluginString.emplace_back(p.first);
@@ -1317,6 +1379,13 @@ BedrockServer::BedrockServer(const SData& args_)
     SINFO("Opening control port on '" << args["-controlPort"] << "'");
     _controlPort = openPort(args["-controlPort"]);
 
+    // Start any client I/O threads. They'll open their command ports once we're ready to process commands.
+    int ioThreads = args.isSet("-ioThreads") ? max(args.calc("-ioThreads"), 0) : 0;
+    for (int i = 0; i < ioThreads; i++) {
+        _clientIOThreads.emplace_back();
+        _clientIOThreads.back().handle = thread(&BedrockServer::_clientIOLoop, this, ref(_clientIOThreads.back()), i);
+    }
+
     // If we're bootstraping this node we need to go into detached mode here.
     // The syncWrapper will handle this for us.
     if (_detach) {
@@ -1326,6 +1395,18 @@ BedrockServer::BedrockServer(const SData& args_)
     // Set the quorum checkpoint, or default if not specified.
     _quorumCheckpointSeconds = args.isSet("-quorumCheckpointSeconds") ? args.calc("-quorumCheckpointSeconds") : 60;
 
+    // Nodes this many commits behind the cluster bootstrap from a snapshot rather than replaying the journal. Disabled
+    // unless set.
+    SQLiteNode::snapshotThreshold = args.isSet("-snapshotThreshold") ? args.calcU64("-snapshotThreshold") : 0;
+    SQLiteNode::snapshotMaxBytesPerSecond = args.isSet("-snapshotMaxBytesPerSecond") ?
+                                            args.calcU64("-snapshotMaxBytesPerSecond") : 0;
+
+    // How many QUORUM commits the sync thread can have awaiting approval at once. 1 disables pipelining.
+    SQLiteNode::quorumPipelineDepth = args.isSet("-quorumPipelineDepth") ? max(args.calc("-quorumPipelineDepth"), 1) : 1;
+
+    // How much data can be waiting to be sent to a single peer before we give up on it. 0 (the default) is unlimited.
+    SQLiteNode::peerSendBufferLimit = args.calcU64("-peerSendBufferLimitMB") * 1024 * 1024;
+
     // Start the sync thread, which will start the worker threads.
     SINFO("Launching sync thread '" << _syncThreadName << "'");
     _syncThread = thread(syncWrapper,
@@ -1344,10 +1425,19 @@ BedrockServer::~BedrockServer() {
     }
     SINFO("Threads closed.");
 
+    // Stop the client I/O threads, which close their own sockets on the way out.
+    _clientIOThreadsShouldExit = true;
+    for (auto& ioThread : _clientIOThreads) {
+        ioThread.owner.wake();
+        ioThread.handle.join();
+    }
+    _clientIOThreads.clear();
+
     // Close any sockets that are still open. We wait until the sync thread has completed to do this, as until it's
     // finished, it may keep writing to these sockets.
-    if (_socketIDMap.size()) {
-        SWARN("Still have " << _socketIDMap.size() << " entries in _socketIDMap.");
+    size_t registeredSockets = _socketRegistry.size();
+    if (registeredSockets) {
+        SWARN("Still have " << registeredSockets << " entries in _socketRegistry.");
     }
 
     if (socketList.size()) {
@@ -1418,26 +1508,44 @@ bool BedrockServer::shutdownComplete() {
 }
 
 void BedrockServer::prePoll(fd_map& fdm) {
-    SAUTOLOCK(_socketIDMutex);
+    _socketOwner.prePoll(fdm);
     STCPServer::prePoll(fdm);
 }
 
 void BedrockServer::postPoll(fd_map& fdm, uint64_t& nextActivity) {
-    // Let the base class do its thing. We lock around this because we allow worker threads to modify the sockets (by
-    // writing to them, but this can truncate send buffers).
+    // Queue any responses workers have finished for our sockets, and then let the base class do its thing, which
+    // sends them. Workers don't touch client sockets, so nothing else is using them while we do this.
+    _socketOwner.postPoll(fdm);
+    _socketRegistry.send(_socketOwner, *this);
+    list<Socket*> activeSockets = STCPServer::postPoll(fdm);
+
+    // Run any control commands the client I/O threads have read. Their responses go back to the I/O threads' sockets
+    // through the socket registry, like a worker's.
+    list<unique_ptr<BedrockCommand>> controlCommands;
     {
-        SAUTOLOCK(_socketIDMutex);
-        STCPServer::postPoll(fdm);
+        lock_guard<mutex> lock(_clientIOControlCommandsMutex);
+        controlCommands = move(_clientIOControlCommands);
+        _clientIOControlCommands.clear();
+    }
+    for (auto& command : controlCommands) {
+        SAUTOPREFIX(command->request);
+        _handleIfStatusOrControlCommand(command);
     }
 
     // Open the port the first time we enter a command-processing state
     SQLiteNode::State state = _replicationState.load();
     if (!_suppressCommandPort && (state == SQLiteNode::LEADING || state == SQLiteNode::FOLLOWING) &&
         _shutdownState.load() == RUNNING) {
-        // Open the port
-        if (!_commandPort) {
-            SINFO("Ready to process commands, opening command port on '" << args["-serverHost"] << "'");
-            _commandPort = openPort(args["-serverHost"]);
+        // Open the port, or have the client I/O threads open theirs.
+        if (_clientIOThreads.empty()) {
+            if (!_commandPort) {
+                SINFO("Ready to process commands, opening command port on '" << args["-serverHost"] << "'");
+                _commandPort = openPort(args["-serverHost"]);
+            }
+        } else if (!_clientIOPortsOpen) {
+            SINFO("Ready to process commands, opening command port on '" << args["-serverHost"] << "' in "
+                  << _clientIOThreads.size() << " client I/O threads");
+            _setClientIOPortsOpen(true);
         }
         if (!_controlPort) {
             SINFO("Opening control port on '" << args["-controlPort"] << "'");
@@ -1502,49 +1610,96 @@ void BedrockServer::postPoll(fd_map& fdm, uint64_t& nextActivity) {
     // Process any new activity from incoming sockets. In order to not modify the socket list while we're iterating
     // over it, we'll keep a list of sockets that need closing.
     list<STCPManager::Socket*> socketsToClose;
+    const list<Socket*>& sockets = _closingIdleSockets() ? socketList : activeSockets;
+    for (auto s : sockets) {
+        _handleClientSocket(_socketOwner, s, socketsToClose, deserializationAttempts, deserializedRequests);
+    }
+
+    // Log the timing of this loop.
+    uint64_t readElapsedMS = (STimeNow() - acceptEndTime) / 1000;
+    SINFO("[performance] Read from " << sockets.size() << " sockets, attempted to deserialize " << deserializationAttempts
+          << " commands, " << deserializedRequests << " were complete and deserialized in " << readElapsedMS << "ms.");
+
+    // Now we can close any sockets that we need to.
+    for (auto s: socketsToClose) {
+        closeSocket(s);
+    }
 
-    // This is a timestamp, after which we'll start giving up on any sockets that don't seem to be giving us any data.
-    // The case for this is that once we start shutting down, we'll close any sockets when we respond to a command on
-    // them, and we'll stop accepting any new sockets, but if existing sockets just sit around giving us nothing, we
-    // need to figure out some way to handle them. We'll wait 5 seconds and then start killing them.
-    static uint64_t lastChance = 0;
-    for (auto s : socketList) {
-        switch (s->state.load()) {
-            case STCPManager::Socket::CLOSED:
-            {
-                // TODO: Cancel any outstanding commands initiated by this socket. This isn't critical, and is an
-                // optimization. Otherwise, they'll continue to get processed to completion, and will just never be
-                // able to have their responses returned.
-                SAUTOLOCK(_socketIDMutex);
-                _socketIDMap.erase(s->id);
-                socketsToClose.push_back(s);
+    // If any plugin timers are firing, let the plugins know.
+    for (auto plugin : plugins) {
+        for (SStopwatch* timer : plugin.second->timers) {
+            if (timer->ding()) {
+                plugin.second->timerFired(timer);
             }
-            break;
-            case STCPManager::Socket::CONNECTED:
-            {
-                {
-                    SAUTOLOCK(_socketIDMutex);
-                    if (s->recvBuffer.empty()) {
-                        // If nothing's been received, break early.
-                        if (_shutdownState.load() != RUNNING && lastChance && lastChance < STimeNow() && _socketIDMap.find(s->id) == _socketIDMap.end()) {
-                            // If we're shutting down and past our lastChance timeout, we start killing these.
-                            SINFO("Closing socket " << s->id << " with no data and no pending command: shutting down.");
-                            socketsToClose.push_back(s);
-                        }
-                        break;
-                    } else {
-                        // Otherwise, we'll see if there's any activity on this socket. Currently, we don't handle clients
-                        // pipelining requests well. We process commands in no particular order, so we can't dequeue two
-                        // requests off the same socket at one time, or we don't guarantee their return order, thus we just
-                        // wait and will try again later.
-                        auto socketIt = _socketIDMap.find(s->id);
-                        if (socketIt != _socketIDMap.end()) {
-                            break;
-                        }
+        }
+    }
+
+    // If we've been told to start shutting down, we'll set the lastChance timer.
+    if (_shutdownState.load() == START_SHUTDOWN) {
+        if (!_lastChance) {
+            _lastChance = STimeNow() + 5 * 1'000'000; // 5 seconds from now.
+        }
+        // If we've run out of sockets or hit our timeout, we'll increment _shutdownState.
+        if ((socketList.empty() && _clientIOThreadsIdle()) || _gracefulShutdownTimeout.ringing()) {
+            _lastChance = 0;
+
+            // We empty the socket list here, we will no longer allow new requests to come in, as the sync node can
+            // shutdown any time after here, and we'll have no way to handle new requests.
+            if (socketList.size()) {
+                SINFO("Killing " << socketList.size() << " remaining sockets at graceful shutdown timeout.");
+                while(socketList.size()) {
+                    auto s = socketList.front();
+                    _socketRegistry.remove(s->id);
+                    closeSocket(s);
+                }
+            }
+            _shutdownState.store(CLIENTS_RESPONDED);
+        }
+    }
+}
+
+bool BedrockServer::_closingIdleSockets() {
+    return _shutdownState.load() != RUNNING && _lastChance && _lastChance < STimeNow();
+}
+
+void BedrockServer::_handleClientSocket(BedrockSocketRegistry::Owner& owner, Socket* s,
+                                        list<Socket*>& socketsToClose, int& deserializationAttempts,
+                                        int& deserializedRequests) {
+    switch (s->state.load()) {
+        case STCPManager::Socket::CLOSED:
+        {
+            // TODO: Cancel any outstanding commands initiated by this socket. This isn't critical, and is an
+            // optimization. Otherwise, they'll continue to get processed to completion, and will just never be
+            // able to have their responses returned.
+            _socketRegistry.remove(s->id);
+            socketsToClose.push_back(s);
+        }
+        break;
+        case STCPManager::Socket::CONNECTED:
+        {
+            // If the client is pipelining requests, we keep reading them until we run out or reach the limit.
+            bool readAnother = true;
+            while (readAnother) {
+                readAnother = false;
+                bool pipelining = false;
+                if (s->recvBuffer.empty()) {
+                    // If nothing's been received, break early.
+                    if (_closingIdleSockets() && !_socketRegistry.contains(s->id)) {
+                        // If we're shutting down and past our lastChance timeout, we start killing these.
+                        SINFO("Closing socket " << s->id << " with no data and no pending command: shutting down.");
+                        socketsToClose.push_back(s);
                     }
+                    break;
+                } else if (!_socketRegistry.canAdd(s->id, s->data ? 1 : _clientPipelineDepth, pipelining)) {
+                    // Otherwise, we'll see if there's any activity on this socket. We process commands in no
+                    // particular order, so unless the client is pipelining requests (and can tell the responses
+                    // apart), we can't dequeue two requests off the same socket at one time, or we don't guarantee
+                    // their return order, thus we just wait and will try again later. Plugins handle their own
+                    // sockets, so those never pipeline.
+                    break;
                 }
 
-                // If there's a request, we'll dequeue it (but only the first one).
+                // If there's a request, we'll dequeue it.
                 SData request;
 
                 // If the socket is owned by a plugin, we let the plugin populate our request.
@@ -1559,8 +1714,14 @@ void BedrockServer::postPoll(fd_map& fdm, uint64_t& nextActivity) {
                 } else {
                     // Otherwise, handle any default request.
                     int requestSize = request.deserialize(s->recvBuffer);
-                    s->recvBuffer.consumeFront(requestSize);
                     deserializationAttempts++;
+
+                    // A request without a `requestID` can't be matched up with its response if it's not the only one
+                    // in flight, so it waits for the ones ahead of it.
+                    if (requestSize && pipelining && !request.isSet("requestID")) {
+                        break;
+                    }
+                    s->recvBuffer.consumeFront(requestSize);
                 }
 
                 // If we have a populated request, from either a plugin or our default handling, we'll queue up the
@@ -1568,6 +1729,7 @@ void BedrockServer::postPoll(fd_map& fdm, uint64_t& nextActivity) {
                 if (!request.empty()) {
                     SAUTOPREFIX(request);
                     deserializedRequests++;
+                    uint64_t sequence = 0;
                     // Either shut down the socket or store it so we can eventually sync out the response.
                     if (SIEquals(request["Connection"], "forget") ||
                         (uint64_t)request.calc64("commandExecuteTime") > STimeNow()) {
@@ -1587,8 +1749,10 @@ void BedrockServer::postPoll(fd_map& fdm, uint64_t& nextActivity) {
                         }
                     } else {
                         SINFO("Waiting for '" << request.methodLine << "' to complete.");
-                        SAUTOLOCK(_socketIDMutex);
-                        _socketIDMap[s->id] = s;
+                        bool pipelined = !s->data && _clientPipelineDepth > 1 && request.isSet("requestID");
+                        bool close = SIEquals(request["Connection"], "close");
+                        sequence = _socketRegistry.add(s, owner, pipelined, close);
+                        readAnother = pipelined && !close;
                     }
 
                     // Get the source ip of the command.
@@ -1617,17 +1781,34 @@ void BedrockServer::postPoll(fd_map& fdm, uint64_t& nextActivity) {
                     // And we and keep track of the client that initiated this command, so we can respond later, except
                     // if we received connection:forget in which case we don't respond later
                     command->initiatingClientID = SIEquals(command->request["Connection"], "forget") ? -1 : s->id;
+                    command->clientSequence = sequence;
+                    command->orderedResponse = command->request.test("orderedResponse");
 
-                    // If it's a status or control command, we handle it specially there. If not, we'll queue it for
+                    // If it's a status or control command, we handle it specially there, except that control
+                    // commands read by client I/O threads are handed to the main thread. If not, we'll queue it for
                     // later processing.
-                    if (!_handleIfStatusOrControlCommand(command)) {
+                    if (&owner != &_socketOwner && _isControlCommand(command)) {
+                        SINFO("Passing control command '" << command->request.methodLine << "' to the main thread.");
+                        lock_guard<mutex> lock(_clientIOControlCommandsMutex);
+                        _clientIOControlCommands.push_back(move(command));
+                        _socketOwner.wake();
+                    } else if (!_handleIfStatusOrControlCommand(command)) {
                         auto _syncNodeCopy = atomic_load(&_syncNode);
                         if (_syncNodeCopy && _syncNodeCopy->getState() == SQLiteNode::STANDINGDOWN) {
                             _standDownQueue.push(move(command));
                         } else {
+                            uint64_t retryAfter = 0;
                             if (_version != _leaderVersion.load()) {
                                 SINFO("Immediately escalating " << command->request.methodLine << " to leader due to version mismatch.");
                                 _syncNodeQueuedCommands.push(move(command));
+                            } else if (command->clientSequence &&
+                                       !_admissionControl.admit(command->priority, retryAfter)) {
+                                // Only commands whose client is waiting for an answer can be turned away.
+                                SINFO("Rejecting new '" << command->request.methodLine << "' command from local "
+                                      << "client, with " << _commandQueue.size() << " commands already queued.");
+                                command->response.methodLine = "503 Service Unavailable";
+                                command->response["Retry-After"] = to_string(retryAfter);
+                                _reply(command);
                             } else {
                                 SINFO("Queued new '" << command->request.methodLine << "' command from local client, with "
                                       << _commandQueue.size() << " commands already queued.");
@@ -1636,70 +1817,26 @@ void BedrockServer::postPoll(fd_map& fdm, uint64_t& nextActivity) {
                         }
                     }
                 } else {
-                    SAUTOLOCK(_socketIDMutex);
                     // If we weren't able to deserialize a complete request, and we're shutting down, give up.
-                    if (_shutdownState.load() != RUNNING && lastChance && lastChance < STimeNow() && _socketIDMap.find(s->id) == _socketIDMap.end()) {
+                    if (_closingIdleSockets() && !_socketRegistry.contains(s->id)) {
                         SINFO("Closing socket " << s->id << " with incomplete data and no pending command: shutting down.");
                         socketsToClose.push_back(s);
                     }
                 }
             }
-            break;
-            case STCPManager::Socket::SHUTTINGDOWN:
-            {
-                // We do nothing in this state, we just wait until the next iteration of poll and let the CLOSED
-                // case run. This block just prevents default warning from firing.
-            }
-            break;
-            default:
-            {
-                SWARN("Socket in unhandled state: " << s->state);
-            }
-            break;
-        }
-    }
-
-    // Log the timing of this loop.
-    uint64_t readElapsedMS = (STimeNow() - acceptEndTime) / 1000;
-    SINFO("[performance] Read from " << socketList.size() << " sockets, attempted to deserialize " << deserializationAttempts
-          << " commands, " << deserializedRequests << " were complete and deserialized in " << readElapsedMS << "ms.");
-
-    // Now we can close any sockets that we need to.
-    for (auto s: socketsToClose) {
-        closeSocket(s);
-    }
-
-    // If any plugin timers are firing, let the plugins know.
-    for (auto plugin : plugins) {
-        for (SStopwatch* timer : plugin.second->timers) {
-            if (timer->ding()) {
-                plugin.second->timerFired(timer);
-            }
         }
-    }
-
-    // If we've been told to start shutting down, we'll set the lastChance timer.
-    if (_shutdownState.load() == START_SHUTDOWN) {
-        if (!lastChance) {
-            lastChance = STimeNow() + 5 * 1'000'000; // 5 seconds from now.
+        break;
+        case STCPManager::Socket::SHUTTINGDOWN:
+        {
+            // We do nothing in this state, we just wait until the next iteration of poll and let the CLOSED
+            // case run. This block just prevents default warning from firing.
         }
-        // If we've run out of sockets or hit our timeout, we'll increment _shutdownState.
-        if (socketList.empty() || _gracefulShutdownTimeout.ringing()) {
-            lastChance = 0;
-
-            // We empty the socket list here, we will no longer allow new requests to come in, as the sync node can
-            // shutdown any time after here, and we'll have no way to handle new requests.
-            if (socketList.size()) {
-                SAUTOLOCK(_socketIDMutex);
-                SINFO("Killing " << socketList.size() << " remaining sockets at graceful shutdown timeout.");
-                while(socketList.size()) {
-                    auto s = socketList.front();
-                    _socketIDMap.erase(s->id);
-                    closeSocket(s);
-                }
-            }
-            _shutdownState.store(CLIENTS_RESPONDED);
+        break;
+        default:
+        {
+            SWARN("Socket in unhandled state: " << s->state);
         }
+        break;
     }
 }
 
@@ -1708,13 +1845,23 @@ unique_ptr<BedrockCommand> BedrockServer::getCommandFromPlugins(SData&& request)
 }
 
 unique_ptr<BedrockCommand> BedrockServer::getCommandFromPlugins(unique_ptr<SQLiteCommand>&& baseCommand) {
-    for (auto pair : plugins) {
-
+    // Most requests have a verb that a plugin has registered, so we can go straight to that plugin.
+    auto verbIt = _pluginsByVerb.find(SToLower(baseCommand->request.getVerb()));
+    if (verbIt != _pluginsByVerb.end()) {
         // This is a bit weird to avoid changing this signature in all the plugins. It would be more straightforward if
         // the plugins just accepted a `unique_ptr<SQLiteCommand>&&`, but this still works.
-        auto command = pair.second->getCommand(move(*baseCommand));
+        auto command = verbIt->second->getCommand(move(*baseCommand));
         if (command) {
-            SDEBUG("Plugin " << pair.first << " handling command " << command->request.methodLine);
+            SDEBUG("Plugin " << verbIt->second->getName() << " handling command " << command->request.methodLine);
+            return command;
+        }
+    }
+
+    // Otherwise, ask each plugin that handles requests by something other than their verb.
+    for (auto plugin : _unindexedPlugins) {
+        auto command = plugin->getCommand(move(*baseCommand));
+        if (command) {
+            SDEBUG("Plugin " << plugin->getName() << " handling command " << command->request.methodLine);
             return command;
         }
     }
@@ -1723,9 +1870,15 @@ unique_ptr<BedrockCommand> BedrockServer::getCommandFromPlugins(unique_ptr<SQLit
     return make_unique<BedrockCommand>(move(*baseCommand), nullptr);
 }
 
-void BedrockServer::_reply(unique_ptr<BedrockCommand>& command) {
-    SAUTOLOCK(_socketIDMutex);
+void BedrockServer::_abandonFutureCommands() {
+    for (auto& command : _commandQueue.abandonFutureCommands(5000)) {
+        command->response.methodLine = "503 Service Unavailable";
+        command->response["Retry-After"] = "1";
+        _reply(command);
+    }
+}
 
+void BedrockServer::_reply(unique_ptr<BedrockCommand>& command) {
     // Finalize timing info even for commands we won't respond to (this makes this data available in logs).
     command->finalizeTimingInfo();
 
@@ -1734,42 +1887,40 @@ void BedrockServer::_reply(unique_ptr<BedrockCommand>& command) {
         return;
     }
 
-    // Do we have a socket for this command?
-    auto socketIt = _socketIDMap.find(command->initiatingClientID);
-    if (socketIt != _socketIDMap.end()) {
-        command->response["nodeName"] = args["-nodeName"];
+    command->response["nodeName"] = args["-nodeName"];
 
-        // If we're shutting down, tell the caller to close the connection.
-        if (_shutdownState.load() != RUNNING) {
-            command->response["Connection"] = "close";
-        }
+    // If we're shutting down, tell the caller to close the connection.
+    if (_shutdownState.load() != RUNNING) {
+        command->response["Connection"] = "close";
+    }
 
-        // Is a plugin handling this command? If so, it gets to send the response.
-        const string& pluginName = command->request["plugin"];
+    // If `Connection: close` was set, shut down the socket once everything on it has been answered, in case the caller
+    // ignores us.
+    bool close = SIEquals(command->request["Connection"], "close") || _shutdownState.load() != RUNNING;
 
-        if (!pluginName.empty()) {
+    // Is a plugin handling this command? If so, it gets to send the response. Otherwise we queue the standard response
+    // for the thread that owns the socket to send. Either way, this fails if there's no socket waiting for it.
+    bool replied;
+    const string& pluginName = command->request["plugin"];
+    if (!pluginName.empty()) {
+        replied = _socketRegistry.replyWithSocket(command->initiatingClientID, command->clientSequence, close,
+                                                  [&](Socket* socket) {
             // Let the plugin handle it
             SINFO("Plugin '" << pluginName << "' handling response '" << command->response.methodLine
                   << "' to request '" << command->request.methodLine << "'");
             auto it = plugins.find(pluginName);
             if (it != plugins.end()) {
-                it->second->onPortRequestComplete(*command, socketIt->second);
+                it->second->onPortRequestComplete(*command, socket);
             } else {
                 SERROR("Couldn't find plugin '" << pluginName << ".");
             }
-        } else {
-            // Otherwise we send the standard response.
-            socketIt->second->send(command->response.serialize());
-        }
-
-        // If `Connection: close` was set, shut down the socket, in case the caller ignores us.
-        if (SIEquals(command->request["Connection"], "close") || _shutdownState.load() != RUNNING) {
-            shutdownSocket(socketIt->second, SHUT_RDWR);
-        }
-
-        // We only keep track of sockets with pending commands.
-        _socketIDMap.erase(socketIt);
+        });
     } else {
+        replied = _socketRegistry.reply(command->initiatingClientID, command->clientSequence, command->response,
+                                        command->request["requestID"], command->orderedResponse, close);
+    }
+
+    if (!replied) {
         if (!SIEquals(command->request["Connection"], "forget")) {
             SINFO("No socket to reply for: '" << command->request.methodLine << "' #" << command->initiatingClientID);
         }
@@ -1800,6 +1951,7 @@ void BedrockServer::suppressCommandPort(const string& reason, bool suppress, boo
             _portPluginMap.clear();
             _commandPort = nullptr;
         }
+        _setClientIOPortsOpen(false);
     } else {
         // Clearing past suppression, but don't reopen (It's always safe to close, but not always safe to open).
         SHMMM("Clearing command port suppression");
@@ -1911,8 +2063,12 @@ void BedrockServer::_status(unique_ptr<BedrockCommand>& command) {
             // Both of these need to be in the correct state for multi-write to be enabled.
             content["multiWriteEnabled"] = _multiWriteEnabled ? "true" : "false";
             content["multiWriteManualBlacklist"] = SComposeJSONArray(_blacklistedParallelCommands);
+            content["multiWriteAutoBlacklist"] = SComposeJSONArray(_conflictBlacklist.getBlacklist());
+            content["multiWriteConflicts"] = SComposeJSONObject(_conflictBlacklist.getState());
         }
 
+        content["coalescedCommands"] = SComposeJSONObject(_commandCoalescer.getState());
+
         // Coalesce all of the peer data into one value to return or return
         // an error message if we timed out getting the peerList data.
         list<string> peerList;
@@ -1929,6 +2085,9 @@ void BedrockServer::_status(unique_ptr<BedrockCommand>& command) {
         });
         content["peerList"]                    = SComposeJSONArray(peerList);
         content["queuedCommandList"]           = SComposeJSONArray(_commandQueue.getRequestMethodLines());
+        content["queueWaitMS"]                 = SComposeJSONObject(_commandQueue.getWaitHistograms());
+        content["admissionControl"]            = SComposeJSONObject(_admissionControl.getState());
+        content["queueClients"]                = SComposeJSONObject(_commandQueue.getClientStats());
         content["syncThreadQueuedCommandList"] = SComposeJSONArray(syncNodeQueuedMethods);
 
         auto _syncNodeCopy = atomic_load(&_syncNode);
@@ -1940,6 +2099,17 @@ void BedrockServer::_status(unique_ptr<BedrockCommand>& command) {
 
             // Get any escalated commands that are waiting to be processed.
             content["escalatedCommandList"] = SComposeJSONArray(_syncNodeCopy->getEscalatedCommandRequestMethodLines());
+            content["escalationLatencyMS"] = SComposeJSONObject(_syncNodeCopy->getEscalationLatencyHistogram());
+
+            // Conflicts between transactions replicated in parallel.
+            list<string> replicationBatches;
+            for (const STable& batch : _syncNodeCopy->getReplicationBatchStats()) {
+                replicationBatches.push_back(SComposeJSONObject(batch));
+            }
+            content["replicationBatches"] = SComposeJSONArray(replicationBatches);
+
+            // Progress of synchronization (if we're doing, or have done, any).
+            content["synchronization"] = SComposeJSONObject(_syncNodeCopy->getSynchronizationInfo());
             _syncNodeCopy = nullptr;
         } else {
             content["syncNodeAvailable"] = "false";
@@ -1989,7 +2159,8 @@ bool BedrockServer::_isControlCommand(const unique_ptr<BedrockCommand>& command)
         SIEquals(command->request.methodLine, "Attach")                 ||
         SIEquals(command->request.methodLine, "SetConflictParams")      ||
         SIEquals(command->request.methodLine, "SetCheckpointIntervals") ||
-        SIEquals(command->request.methodLine, "EnableSQLTracing")
+        SIEquals(command->request.methodLine, "EnableSQLTracing")       ||
+        SIEquals(command->request.methodLine, "GetPeerTelemetry")
         ) {
         return true;
     }
@@ -2053,6 +2224,22 @@ void BedrockServer::_control(unique_ptr<BedrockCommand>& command) {
             SQLite::enableTrace.store(command->request.test("enable"));
             response["newValue"] = SQLite::enableTrace ? "true" : "false";
         }
+    } else if (SIEquals(command->request.methodLine, "GetPeerTelemetry")) {
+        // Returns the telemetry history of every peer, or just the one named by `peer`, keyed by peer name.
+        STable content;
+        auto syncNodeCopy = atomic_load(&_syncNode);
+        if (syncNodeCopy) {
+            for (SQLiteNode::Peer* peer : syncNodeCopy->peerList) {
+                if (!command->request.isSet("peer") || command->request["peer"] == peer->name) {
+                    content[peer->name] = peer->getTelemetryJSON();
+                }
+            }
+        }
+        if (command->request.isSet("peer") && content.empty()) {
+            response.methodLine = "404 No such peer";
+        } else {
+            response.content = SComposeJSONObject(content);
+        }
     }
 }
 
@@ -2122,7 +2309,7 @@ void BedrockServer::_beginShutdown(const string& reason, bool detach) {
         _gracefulShutdownTimeout.start();
 
         // Delete any commands scheduled in the future.
-        _commandQueue.abandonFutureCommands(5000);
+        _abandonFutureCommands();
 
         // Accept any new connections before closing, this avoids leaving clients who had connected to in a weird
         // state.
@@ -2138,6 +2325,7 @@ void BedrockServer::_beginShutdown(const string& reason, bool detach) {
         }
         _portPluginMap.clear();
         _commandPort = nullptr;
+        _setClientIOPortsOpen(false);
         _shutdownState.store(START_SHUTDOWN);
         SINFO("START_SHUTDOWN. Ports shutdown, will perform final socket read. Commands queued: " << _commandQueue.size()
               << ", blocking commands queued: " << _blockingCommandQueue.size());
@@ -2219,6 +2407,91 @@ void BedrockServer::_acceptSockets() {
     }
 }
 
+BedrockServer::ClientIOThread::ClientIOThread() : server(""), portOpen(false), socketCount(0) { }
+
+void BedrockServer::_setClientIOPortsOpen(bool open) {
+    _clientIOPortsOpen = open;
+    for (auto& ioThread : _clientIOThreads) {
+        ioThread.owner.wake();
+    }
+}
+
+bool BedrockServer::_clientIOThreadsIdle() {
+    for (auto& ioThread : _clientIOThreads) {
+        if (ioThread.portOpen || ioThread.socketCount) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void BedrockServer::_clientIOLoop(ClientIOThread& ioThread, int threadID) {
+    SInitialize("io" + to_string(threadID));
+    STCPServer& server = ioThread.server;
+
+    // Closes every client socket we have. Each is removed from `_socketRegistry` first, so workers can't reply on it.
+    auto closeAllSockets = [&]() {
+        while (server.socketList.size()) {
+            auto s = server.socketList.front();
+            _socketRegistry.remove(s->id);
+            server.closeSocket(s);
+        }
+    };
+
+    uint64_t nextActivity = STimeNow();
+    while (!_clientIOThreadsShouldExit) {
+        // Open or close our port to match the main thread. Like `_beginShutdown`, we accept anything pending before
+        // closing, so clients that have already connected aren't left in a weird state.
+        if (_clientIOPortsOpen && server.portList.empty()) {
+            SINFO("Opening command port on '" << args["-serverHost"] << "'");
+            server.openPort(args["-serverHost"], true);
+        } else if (!_clientIOPortsOpen && !server.portList.empty()) {
+            while (server.acceptSocket()) {}
+            server.closePorts();
+        }
+
+        fd_map fdm;
+        ioThread.owner.prePoll(fdm);
+        server.prePoll(fdm);
+        const uint64_t now = STimeNow();
+        S_poll(fdm, max(nextActivity, now) - now);
+        nextActivity = STimeNow() + STIME_US_PER_S;
+
+        // As in `postPoll`, queue any finished responses before the server sends what it can.
+        ioThread.owner.postPoll(fdm);
+        _socketRegistry.send(ioThread.owner, server);
+        list<Socket*> activeSockets = server.postPoll(fdm);
+        while (server.acceptSocket()) {}
+
+        int deserializationAttempts = 0;
+        int deserializedRequests = 0;
+        list<Socket*> socketsToClose;
+        for (auto s : _closingIdleSockets() ? server.socketList : activeSockets) {
+            _handleClientSocket(ioThread.owner, s, socketsToClose, deserializationAttempts, deserializedRequests);
+        }
+        for (auto s : socketsToClose) {
+            server.closeSocket(s);
+        }
+
+        // Once the main thread has given up on the remaining clients, so do we.
+        if (_shutdownState.load() >= CLIENTS_RESPONDED && server.socketList.size()) {
+            SINFO("Killing " << server.socketList.size() << " remaining sockets after clients responded.");
+            closeAllSockets();
+        }
+
+        // The socket count has to be up to date by the time the main thread can see our port is closed.
+        ioThread.socketCount = server.socketList.size();
+        ioThread.portOpen = !server.portList.empty();
+    }
+
+    closeAllSockets();
+    if (!server.portList.empty()) {
+        server.closePorts();
+    }
+    ioThread.socketCount = 0;
+    ioThread.portOpen = false;
+}
+
 void BedrockServer::waitForHTTPS(unique_ptr<BedrockCommand>&& command) {
     SAUTOPREFIX(command->request);
     lock_guard<mutex> lock(_httpsCommandMutex);
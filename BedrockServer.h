@@ -3,7 +3,12 @@
 #include <sqlitecluster/SQLiteNode.h>
 #include <sqlitecluster/SQLiteServer.h>
 #include "BedrockPlugin.h"
+#include "BedrockAdmissionControl.h"
+#include "BedrockCommandCoalescer.h"
 #include "BedrockCommandQueue.h"
+#include "BedrockConflictBlacklist.h"
+#include "BedrockFutureCommitQueue.h"
+#include "BedrockSocketRegistry.h"
 #include "BedrockTimeoutCommandQueue.h"
 
 class BedrockServer : public SQLiteServer {
@@ -109,11 +114,11 @@ class BedrockServer : public SQLiteServer {
     // we should eventually do about it:
     //
     // A follower begins shutdown, and sets a 60 second timeout. It has escalated commands to leader. It wants to wait for
-    // the responses to these commands before it finishes shutting down, but *there is no timeout on escalated
-    // commands*. Normally, we won't try to shut down the sync node until we've responded to all connected clients.
-    // Because there will always be connected clients waiting for these responses to escalated commands, we'll wait the
-    // full 60 seconds, and then we'll just die with no responses. Effectively, the sever `kill -9`'s itself here,
-    // leaving clients hanging with no cleanup.
+    // the responses to these commands before it finishes shutting down, but *escalated commands only time out with the
+    // command itself, which defaults to much longer than that*. Normally, we won't try to shut down the sync node until
+    // we've responded to all connected clients. Because there will always be connected clients waiting for these
+    // responses to escalated commands, we'll wait the full 60 seconds, and then we'll just die with no responses.
+    // Effectively, the sever `kill -9`'s itself here, leaving clients hanging with no cleanup.
     //
     // On leader, this state could be catastrophic, though leader doesn't need to worry about a lack of timeouts on
     // escalations, so let's look at a different case - a command running a custom query that takes longer than our 60
@@ -127,12 +132,13 @@ class BedrockServer : public SQLiteServer {
     // reason, but if we're going to enforce a timeout, then we need to.
     //
     // The only way to make this timeout safe is to make sure no individual command can live longer than our shutdown
-    // timeout, which would require time-stamping commands pre-escalation and giving up on them if we failed to receive
-    // a response in time, as well as making sure that commands always return in less time than that (they currently,
-    // usually will, as long as the default command timeout is less than one minute, but they can still block in system
-    // calls like sleep(), and the timeout is configurable). Certainly, no "normal" command (i.e., a programmatically
-    // generated command, as opposed to something like a CustomQuery command) should have a timeout longer than the
-    // shutdown timeout, or it can cause a non-graceful shutdown.
+    // timeout. Escalations now give up at the command's own timeout (and leader is told how long it has left), but
+    // that doesn't help while the command timeout is longer than the shutdown timeout. It also requires making sure
+    // that commands always return in less time than that (they currently, usually will, as long as the default command
+    // timeout is less than one minute, but they can still block in system calls like sleep(), and the timeout is
+    // configurable). Certainly, no "normal" command (i.e., a programmatically generated command, as opposed to
+    // something like a CustomQuery command) should have a timeout longer than the shutdown timeout, or it can cause a
+    // non-graceful shutdown.
     //
     // Of course, if nothing can take longer than the shutdown timeout, then we should never hit that timeout, and all
     // our failures should be limited to individual commands rather than the entire server shutting down.
@@ -247,29 +253,31 @@ class BedrockServer : public SQLiteServer {
     // The name of the sync thread.
     static constexpr auto _syncThreadName = "sync";
 
-    // Commands that aren't currently being processed are kept here.
+    // Commands that aren't currently being processed are kept here. See BedrockCommandQueue for how `-queueOrder` and
+    // `-clientRateLimit` affect the order they're run in.
     BedrockCommandQueue _commandQueue;
 
-    // These are commands that will be processed in a blacking fashion.
+    // These are commands that will be processed in a blacking fashion. They've already been through `_commandQueue`,
+    // so the per-client limits don't apply again.
     BedrockCommandQueue _blockingCommandQueue;
 
     // Each time we read a new request from a client, we give it a unique ID.
-    uint64_t _requestCount;
-
-    // Each time we read a command off a socket, we put the socket in this map, so that we can respond to it when the
-    // command completes. We remove the socket from the map when we reply to the command, even if the socket is still
-    // open. It will be re-inserted in this set when another command is read from it.
-    map <uint64_t, Socket*> _socketIDMap;
-
-    // The above _socketIDMap is modified by multiple threads, so we lock this mutex around operations that access it.
-    // We don't need to lock around access to the base class's `socketList` because we carefully control access to it
-    // to the main thread.
-    // The only functions that access `socketList` are prePoll, postPoll, openSocket, and closeSocket, in STCPManager,
-    // and acceptSocket in STCPServer.
-    // prePoll and postPoll are only ever called by the main thread.
-    // openSocket is never called by bedrockServer (it is called in SHTTPSManager and STCPNode).
-    // closeSocket and acceptSocket are only called inside postPoll.
-    recursive_mutex _socketIDMutex;
+    atomic<uint64_t> _requestCount;
+
+    // Each time we read a command off a socket, we record the socket here, so that we can respond to it when the
+    // command completes. Sockets are removed when the last command in flight on them has been answered, even if the
+    // socket is still open. They'll be re-added when another command is read from them.
+    BedrockSocketRegistry _socketRegistry;
+
+    // The main thread's registration as the owner of the client sockets it handles.
+    BedrockSocketRegistry::Owner _socketOwner;
+
+    // The most commands a client connection can have in flight at once when it's pipelining requests. Set with
+    // `-clientPipelineDepth`. 1 disables pipelining.
+    size_t _clientPipelineDepth;
+
+    // Decides whether to queue new commands from clients, or reject them because the queue's backed up.
+    BedrockAdmissionControl _admissionControl;
 
     // This is the replication state of the sync node. It's updated after every SQLiteNode::update() iteration. A
     // reference to this object is passed to the sync thread to allow this update.
@@ -294,6 +302,13 @@ class BedrockServer : public SQLiteServer {
     // This is a map of open listening ports to the plugin objects that created them.
     map<Port*, BedrockPlugin*> _portPluginMap;
 
+    // Our plugins indexed by each request verb they support (lowercased), so that `getCommandFromPlugins` can find the
+    // plugin for most requests with a single lookup.
+    unordered_map<string, BedrockPlugin*> _pluginsByVerb;
+
+    // The plugins that are offered requests whose verb isn't in `_pluginsByVerb`, in the order they're asked.
+    list<BedrockPlugin*> _unindexedPlugins;
+
     // The server version. This may be fake if the arguments contain a `versionOverride` value.
     string _version;
 
@@ -340,6 +355,10 @@ class BedrockServer : public SQLiteServer {
     // then this is an error, as the command should have been sent back to a peer.
     void _reply(unique_ptr<BedrockCommand>& command);
 
+    // Discards every command scheduled more than 5 seconds in the future, answering those whose clients are only
+    // waiting because of the rate limit with a 503, so they can retry elsewhere.
+    void _abandonFutureCommands();
+
     // The following are constants used as methodlines by status command requests.
     static constexpr auto STATUS_IS_FOLLOWER       = "GET /status/isFollower HTTP/1.1";
     static constexpr auto STATUS_HANDLING_COMMANDS = "GET /status/handlingCommands HTTP/1.1";
@@ -366,18 +385,72 @@ class BedrockServer : public SQLiteServer {
     // those ports.
     void _acceptSockets();
 
+    // Handles whatever's happened on a client socket since the last `poll()`: reads any complete request and queues a
+    // command for it, or adds the socket to `socketsToClose` if it's finished. Called by whichever thread owns the
+    // socket, which is the main thread, or one of the client I/O threads below, identified by `owner`.
+    void _handleClientSocket(BedrockSocketRegistry::Owner& owner, Socket* s, list<Socket*>& socketsToClose,
+                             int& deserializationAttempts, int& deserializedRequests);
+
+    // This is a timestamp, after which we'll start giving up on any sockets that don't seem to be giving us any data.
+    // The case for this is that once we start shutting down, we'll close any sockets when we respond to a command on
+    // them, and we'll stop accepting any new sockets, but if existing sockets just sit around giving us nothing, we
+    // need to figure out some way to handle them. We'll wait 5 seconds and then start killing them.
+    atomic<uint64_t> _lastChance;
+
+    // Returns true once we're past `_lastChance`. Sockets nothing's happening on aren't normally looked at, but from
+    // then on, every client socket needs checking, so the idle ones can be closed.
+    bool _closingIdleSockets();
+
+    // If `-ioThreads` is set, connections to the command port are handled by this many threads rather than the main
+    // thread. Each has its own listening socket for the command port, opened with SO_REUSEPORT so the kernel spreads
+    // new connections across them, and its own set of sockets, for which it reads and parses requests, queues their
+    // commands, and finishes sending responses. The control port and plugin ports are still handled by the main thread.
+    struct ClientIOThread {
+        ClientIOThread();
+
+        // The listening port and client sockets for this thread.
+        STCPServer server;
+        thread handle;
+
+        // Responses for this thread's sockets are queued for it here, which also wakes it from `poll()`.
+        BedrockSocketRegistry::Owner owner;
+
+        // Updated by the thread every time around its loop, so the main thread can tell when it's done with clients
+        // while shutting down.
+        atomic<bool> portOpen;
+        atomic<size_t> socketCount;
+    };
+    list<ClientIOThread> _clientIOThreads;
+
+    // Set by the main thread when the command port should be open, for the client I/O threads to follow.
+    atomic<bool> _clientIOPortsOpen;
+
+    // Set when the client I/O threads should exit.
+    atomic<bool> _clientIOThreadsShouldExit;
+
+    // The main function for each client I/O thread.
+    void _clientIOLoop(ClientIOThread& ioThread, int threadID);
+
+    // Opens or closes the client I/O threads' command ports, waking them to do so.
+    void _setClientIOPortsOpen(bool open);
+
+    // Returns true if none of the client I/O threads have an open port or any client sockets.
+    bool _clientIOThreadsIdle();
+
+    // Control commands can change the ports and sockets that belong to the main thread, so when a client I/O thread
+    // reads one, it queues it here for the main thread to run (and reply to) in `postPoll`, and wakes it. Status
+    // commands only read state, and are answered by the I/O thread itself.
+    list<unique_ptr<BedrockCommand>> _clientIOControlCommands;
+    mutex _clientIOControlCommandsMutex;
+
     // This stars the server shutting down.
     void _beginShutdown(const string& reason, bool detach = false);
 
-    // This is a map of commit counts in the future to commands that depend on them. We can receive a command that
-    // depends on a future commit if we're a follower that's behind leader, and a client makes two requests, one to a node
-    // more current than ourselves, and a following request to us. We'll move these commands to this special map until
-    // we catch up, and then move them back to the regular command queue.
-    multimap<uint64_t, unique_ptr<BedrockCommand>> _futureCommitCommands;
-
-    // Map of command timeouts to the indexes into _futureCommitCommands where those commands live.
-    multimap<uint64_t, uint64_t> _futureCommitCommandTimeouts;
-    recursive_mutex _futureCommitCommandMutex;
+    // Commands that depend on commits in the future. We can receive a command that depends on a future commit if we're
+    // a follower that's behind leader, and a client makes two requests, one to a node more current than ourselves, and
+    // a following request to us. We'll park these commands here until we catch up, at which point they're moved back
+    // to the regular command queue as soon as the commit they need is applied.
+    BedrockFutureCommitQueue _futureCommitCommands;
 
     // A set of command names that will always be run with QUORUM consistency level.
     // Specified by the `-synchronousCommands` command-line switch.
@@ -407,6 +480,13 @@ class BedrockServer : public SQLiteServer {
     // The maximum number of conflicts we'll accept before forwarding a command to the sync thread.
     atomic<int> _maxConflictRetries;
 
+    // Commands that have been conflicting so often on worker threads that we send them to the sync thread instead, for
+    // a while. This is kept up to date automatically, on top of the manual `_blacklistedParallelCommands`.
+    BedrockConflictBlacklist _conflictBlacklist;
+
+    // Identical read commands waiting for one copy of them to be peeked, so they can share its response.
+    BedrockCommandCoalescer _commandCoalescer;
+
     // This is a map of HTTPS requests to the commands that contain them. We use this to quickly look up commands when
     // their HTTPS requests finish and move them back to the main queue.
     map<SHTTPSManager::Transaction*, BedrockCommand*> _outstandingHTTPSRequests;
@@ -0,0 +1,218 @@
+#include "BedrockSocketRegistry.h"
+
+BedrockSocketRegistry::Owner::Owner() {
+    SASSERT(0 == pipe(_wakeFD));
+    int flags = fcntl(_wakeFD[0], F_GETFL, 0);
+    fcntl(_wakeFD[0], F_SETFL, flags | O_NONBLOCK);
+}
+
+BedrockSocketRegistry::Owner::~Owner() {
+    close(_wakeFD[0]);
+    close(_wakeFD[1]);
+}
+
+void BedrockSocketRegistry::Owner::prePoll(fd_map& fdm) {
+    SFDset(fdm, _wakeFD[0], SREADEVTS);
+}
+
+void BedrockSocketRegistry::Owner::postPoll(fd_map& fdm) {
+    if (SFDAnySet(fdm, _wakeFD[0], SREADEVTS)) {
+        char readbuffer[64];
+        while (read(_wakeFD[0], readbuffer, sizeof(readbuffer)) > 0) {}
+    }
+}
+
+void BedrockSocketRegistry::Owner::wake() {
+    // **NOTE: 1 byte so write is atomic.
+    SASSERT(write(_wakeFD[1], "A", 1));
+}
+
+void BedrockSocketRegistry::Owner::_ready(uint64_t id) {
+    bool wasEmpty;
+    {
+        lock_guard<mutex> lock(_readyMutex);
+        wasEmpty = _readySockets.empty();
+        _readySockets.insert(id);
+    }
+
+    // If there were already sockets waiting, we've already been woken for them, and they'll be handled together.
+    if (wasEmpty) {
+        wake();
+    }
+}
+
+uint64_t BedrockSocketRegistry::add(STCPManager::Socket* socket, Owner& owner, bool pipelined, bool close) {
+    Shard& shard = _shard(socket->id);
+    lock_guard<mutex> lock(shard.m);
+    Connection& connection = shard.connections[socket->id];
+    connection.socket = socket;
+    connection.owner = &owner;
+    uint64_t sequence = ++connection.lastSequence;
+    connection.inFlight[sequence] = pipelined;
+    if (!pipelined) {
+        connection.unpipelined++;
+    }
+    if (close) {
+        connection.closeWhenDone = true;
+    }
+    return sequence;
+}
+
+bool BedrockSocketRegistry::canAdd(uint64_t id, size_t depth, bool& pipelining) {
+    Shard& shard = _shard(id);
+    lock_guard<mutex> lock(shard.m);
+    auto it = shard.connections.find(id);
+    if (it != shard.connections.end() && it->second.closeWhenDone) {
+        // We're done with this socket once everything already read from it is answered.
+        pipelining = false;
+        return false;
+    }
+    if (it == shard.connections.end() || it->second.inFlight.empty()) {
+        pipelining = false;
+        return true;
+    }
+    pipelining = true;
+    return !it->second.unpipelined && it->second.inFlight.size() < depth;
+}
+
+bool BedrockSocketRegistry::contains(uint64_t id) {
+    Shard& shard = _shard(id);
+    lock_guard<mutex> lock(shard.m);
+    return shard.connections.find(id) != shard.connections.end();
+}
+
+void BedrockSocketRegistry::remove(uint64_t id) {
+    Shard& shard = _shard(id);
+    lock_guard<mutex> lock(shard.m);
+    shard.connections.erase(id);
+}
+
+bool BedrockSocketRegistry::reply(uint64_t id, uint64_t sequence, SData& response, const string& requestID,
+                                  bool ordered, bool close) {
+    Owner* owner;
+    {
+        Shard& shard = _shard(id);
+        lock_guard<mutex> lock(shard.m);
+        auto it = shard.connections.find(id);
+        if (it == shard.connections.end() || !SContains(it->second.inFlight, sequence)) {
+            return false;
+        }
+        Connection& connection = it->second;
+
+        // Pipelined responses say which request they answer, as they can arrive in any order.
+        if (connection.inFlight[sequence]) {
+            response["requestID"] = requestID;
+        }
+
+        if (ordered && connection.inFlight.begin()->first != sequence) {
+            // There are earlier requests on this socket that haven't been answered, so this has to wait for them.
+            SINFO("Holding response to request " << sequence << " on socket " << id << " for earlier requests.");
+            connection.heldResponses[sequence] = response.serialize();
+        } else {
+            connection.responses.push_back(response.serialize());
+            _finish(connection, sequence);
+        }
+        if (close) {
+            connection.closeWhenDone = true;
+        }
+        owner = connection.owner;
+    }
+    owner->_ready(id);
+    return true;
+}
+
+bool BedrockSocketRegistry::replyWithSocket(uint64_t id, uint64_t sequence, bool close,
+                                            const function<void(STCPManager::Socket*)>& respond) {
+    Owner* owner;
+    {
+        // The owner can't close the socket without locking the shard to remove it first, so it stays open while we
+        // hold the lock.
+        Shard& shard = _shard(id);
+        lock_guard<mutex> lock(shard.m);
+        auto it = shard.connections.find(id);
+        if (it == shard.connections.end() || !SContains(it->second.inFlight, sequence)) {
+            return false;
+        }
+        Connection& connection = it->second;
+        respond(connection.socket);
+        _finish(connection, sequence);
+        if (close) {
+            connection.closeWhenDone = true;
+        }
+        owner = connection.owner;
+    }
+    owner->_ready(id);
+    return true;
+}
+
+void BedrockSocketRegistry::send(Owner& owner, STCPManager& manager) {
+    set<uint64_t> readySockets;
+    {
+        lock_guard<mutex> lock(owner._readyMutex);
+        readySockets.swap(owner._readySockets);
+    }
+
+    for (uint64_t id : readySockets) {
+        STCPManager::Socket* socket;
+        list<string> responses;
+        bool shutdown = false;
+        {
+            Shard& shard = _shard(id);
+            lock_guard<mutex> lock(shard.m);
+            auto it = shard.connections.find(id);
+            if (it == shard.connections.end()) {
+                // Closed since its response was queued.
+                continue;
+            }
+            Connection& connection = it->second;
+            socket = connection.socket;
+            responses.swap(connection.responses);
+
+            // We only keep track of sockets with pending commands.
+            if (connection.inFlight.empty()) {
+                shutdown = connection.closeWhenDone;
+                shard.connections.erase(it);
+            }
+        }
+
+        // Only our thread closes this socket, so we don't need the lock to use it.
+        for (const string& response : responses) {
+            socket->send(response);
+        }
+        if (shutdown) {
+            manager.shutdownSocket(socket, SHUT_RDWR);
+        }
+    }
+}
+
+size_t BedrockSocketRegistry::size() {
+    size_t total = 0;
+    for (Shard& shard : _shards) {
+        lock_guard<mutex> lock(shard.m);
+        total += shard.connections.size();
+    }
+    return total;
+}
+
+void BedrockSocketRegistry::_finish(Connection& connection, uint64_t sequence) {
+    while (true) {
+        auto it = connection.inFlight.find(sequence);
+        if (!it->second) {
+            connection.unpipelined--;
+        }
+        connection.inFlight.erase(it);
+
+        // If the earliest request still in flight has a held response, it's not waiting on anything any more, so it's
+        // finished too.
+        if (connection.inFlight.empty()) {
+            return;
+        }
+        auto heldIt = connection.heldResponses.find(connection.inFlight.begin()->first);
+        if (heldIt == connection.heldResponses.end()) {
+            return;
+        }
+        connection.responses.push_back(move(heldIt->second));
+        sequence = heldIt->first;
+        connection.heldResponses.erase(heldIt);
+    }
+}
@@ -0,0 +1,122 @@
+#pragma once
+#include <libstuff/libstuff.h>
+#include <libstuff/STCPManager.h>
+
+// Keeps track of the client sockets that are waiting on responses, so that worker threads can answer them. Sockets
+// are split across `SHARDS` shards by ID, each with its own lock, so workers answering different clients don't contend
+// with each other or with the threads reading new requests.
+//
+// Workers never write to client sockets themselves. Each socket belongs to an `Owner` (the main thread, or a client
+// I/O thread), which is the only thread that reads from, writes to, or closes it. A worker's response is queued on the
+// socket's entry here, and its owner is woken to send it.
+//
+// Normally a socket has one request in flight at a time, but a client can pipeline requests by giving each a
+// `requestID` header, in which case BedrockServer reads several of them from the socket and runs them concurrently.
+// Their responses are sent back as they complete (each with the `requestID` it answers), unless a request sets
+// `orderedResponse: true`, in which case its response waits until every earlier request on the socket has been
+// answered.
+class BedrockSocketRegistry {
+  public:
+    // A thread that owns client sockets. It should call `prePoll` and `postPoll` around each `poll()`, and then
+    // `BedrockSocketRegistry::send` to send whatever responses have been queued for it.
+    class Owner {
+      public:
+        Owner();
+        ~Owner();
+
+        // Add our wakeup pipe to `fdm`, and empty it after `poll()`.
+        void prePoll(fd_map& fdm);
+        void postPoll(fd_map& fdm);
+
+        // Wakes the owning thread from `poll()`.
+        void wake();
+
+      private:
+        friend class BedrockSocketRegistry;
+
+        // Notes that socket `id` has responses to send, waking us if we weren't already going to be.
+        void _ready(uint64_t id);
+
+        int _wakeFD[2];
+
+        // The IDs of our sockets with responses waiting to be sent.
+        set<uint64_t> _readySockets;
+        mutex _readyMutex;
+    };
+
+    // Records that a request has been read from `socket`, which belongs to `owner`, and returns the sequence number
+    // that identifies its response. `pipelined` requests don't stop more being read from the socket. If `close`, the
+    // client has asked us to close the connection, so nothing more is read from it, and it's shut down once every
+    // request on it has been answered.
+    uint64_t add(STCPManager::Socket* socket, Owner& owner, bool pipelined, bool close);
+
+    // Returns whether another request can be read from socket `id`, which is true if it has nothing in flight, or if
+    // everything in flight is pipelined and there are fewer than `depth` requests, unless the client has asked us to
+    // close it. Sets `pipelining` if there's anything in flight, in which case the next request has to be pipelined,
+    // too.
+    bool canAdd(uint64_t id, size_t depth, bool& pipelining);
+
+    // Returns true if socket `id` has requests in flight or responses waiting to be sent.
+    bool contains(uint64_t id);
+
+    // Forgets socket `id`, because it's being closed. Any responses that haven't been sent are dropped. Only call this
+    // from the socket's owner, and before closing it.
+    void remove(uint64_t id);
+
+    // Queues `response` to request `sequence` on socket `id`. If the request was pipelined, the response is given its
+    // `requestID`. If `ordered`, it's held until every earlier request on the socket has been answered. If `close`,
+    // the socket is shut down once everything on it has been answered. Returns false if the socket isn't waiting for
+    // this response, because it's been closed, or because the request was never expected to get one.
+    bool reply(uint64_t id, uint64_t sequence, SData& response, const string& requestID, bool ordered, bool close);
+
+    // Like `reply`, but for sockets owned by plugins, which send their own responses: calls `respond` with the socket,
+    // which is guaranteed to stay open until it returns.
+    bool replyWithSocket(uint64_t id, uint64_t sequence, bool close,
+                         const function<void(STCPManager::Socket*)>& respond);
+
+    // Sends every response that's been queued for sockets belonging to `owner`, and shuts down those that were waiting
+    // to close. `manager` is the one the sockets belong to. Call from the owner's thread.
+    void send(Owner& owner, STCPManager& manager);
+
+    // Returns the number of sockets with requests in flight or responses waiting.
+    size_t size();
+
+  private:
+    static constexpr size_t SHARDS = 64;
+
+    struct Connection {
+        STCPManager::Socket* socket = nullptr;
+        Owner* owner = nullptr;
+
+        // The sequence number of the last request read from this socket.
+        uint64_t lastSequence = 0;
+
+        // The sequence number of each request we haven't got a response for, and whether it was pipelined.
+        map<uint64_t, bool> inFlight;
+
+        // The number of requests in `inFlight` that weren't pipelined. While there are any, we don't read more.
+        size_t unpipelined = 0;
+
+        // Serialized responses to `orderedResponse` requests, waiting on responses to earlier requests.
+        map<uint64_t, string> heldResponses;
+
+        // Serialized responses ready for the owner to send.
+        list<string> responses;
+
+        // Set if we should shut down the socket once every request has been answered.
+        bool closeWhenDone = false;
+    };
+
+    struct Shard {
+        map<uint64_t, Connection> connections;
+        mutex m;
+    };
+
+    Shard& _shard(uint64_t id) { return _shards[id % SHARDS]; }
+
+    // Marks request `sequence` on `connection` as answered, and moves any held responses that were only waiting on it
+    // to `responses`. Call with the shard locked.
+    void _finish(Connection& connection, uint64_t sequence);
+
+    array<Shard, SHARDS> _shards;
+};
@@ -59,3 +59,16 @@ unique_ptr<BedrockCommand> BedrockTimeoutCommandQueue::pop() {
     _queue.pop_front();
     return item;
 }
+
+bool BedrockTimeoutCommandQueue::removeEscalated(const string& commandID) {
+    lock_guard<decltype(_queueMutex)> lock(_queueMutex);
+    for (auto it = _timeoutMap.begin(); it != _timeoutMap.end(); it++) {
+        unique_ptr<BedrockCommand>& command = *(it->second);
+        if (command->initiatingPeerID && SIEquals(command->id, commandID)) {
+            _queue.erase(it->second);
+            _timeoutMap.erase(it);
+            return true;
+        }
+    }
+    return false;
+}
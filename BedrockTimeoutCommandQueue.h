@@ -8,6 +8,10 @@ class BedrockTimeoutCommandQueue : public SSynchronizedQueue<unique_ptr<BedrockC
     void push(unique_ptr<BedrockCommand>&& rhs);
     unique_ptr<BedrockCommand> pop();
 
+    // Discards the queued command escalated to us with the given ID, without responding to it. Returns whether there
+    // was one.
+    bool removeEscalated(const string& commandID);
+
   private:
     // Map of timeouts to commands in the queue. Because the queue is a std::list, we can store iterators into it and
     // they stay valid as we manipulate the list, avoiding walking the list to re-locate them.
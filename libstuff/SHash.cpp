@@ -0,0 +1,203 @@
+#include <libstuff/libstuff.h>
+#include "SHash.h"
+
+#if defined(__x86_64__)
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+atomic<bool> SHash::hardwareEnabled(true);
+
+#if defined(__x86_64__)
+
+// Everything compiled for the SHA extensions needs these, and nothing else in bedrock is built for a CPU that's
+// guaranteed to have them, so they're enabled per function.
+#define SHASH_TARGET __attribute__((target("sha,sse4.1,ssse3")))
+
+namespace {
+
+const uint32_t SHA256_K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+// Hashes `length` bytes of `data` with `processBlocks`, which only handles whole 64 byte blocks. SHA-1 and SHA-256 pad
+// the message the same way: a single 1 bit, then zeroes up to 8 bytes short of a whole block, then the length of the
+// message in bits as a big-endian 64 bit integer.
+template <typename F>
+void hashPadded(const unsigned char* data, size_t length, F processBlocks) {
+    size_t wholeBlockBytes = length - length % 64;
+    processBlocks(data, wholeBlockBytes);
+
+    unsigned char tail[128] = {0};
+    size_t remaining = length - wholeBlockBytes;
+    memcpy(tail, data + wholeBlockBytes, remaining);
+    tail[remaining] = 0x80;
+    size_t tailLength = remaining < 56 ? 64 : 128;
+    uint64_t bits = (uint64_t)length * 8;
+    for (int i = 0; i < 8; i++) {
+        tail[tailLength - 1 - i] = (unsigned char)(bits >> (8 * i));
+    }
+    processBlocks(tail, tailLength);
+}
+
+// Writes `count` state words to `digest` as big-endian.
+void writeDigest(const uint32_t* state, size_t count, unsigned char* digest) {
+    for (size_t i = 0; i < count; i++) {
+        digest[4 * i]     = (unsigned char)(state[i] >> 24);
+        digest[4 * i + 1] = (unsigned char)(state[i] >> 16);
+        digest[4 * i + 2] = (unsigned char)(state[i] >> 8);
+        digest[4 * i + 3] = (unsigned char)(state[i]);
+    }
+}
+
+// `_mm_sha1rnds4_epu32` needs its round function as an immediate.
+SHASH_TARGET inline __m128i sha1Rounds(__m128i abcd, __m128i e, int function) {
+    switch (function) {
+        case 0:
+            return _mm_sha1rnds4_epu32(abcd, e, 0);
+        case 1:
+            return _mm_sha1rnds4_epu32(abcd, e, 1);
+        case 2:
+            return _mm_sha1rnds4_epu32(abcd, e, 2);
+        default:
+            return _mm_sha1rnds4_epu32(abcd, e, 3);
+    }
+}
+
+// Runs the SHA-1 compression function over each 64 byte block in `data`. Each iteration of the inner loop is four
+// rounds. `w` holds the last four groups of four message schedule words, each of which is completed a group ahead of
+// when it's used.
+SHASH_TARGET void sha1Blocks(uint32_t state[5], const unsigned char* data, size_t length) {
+    const __m128i byteSwap = _mm_set_epi64x(0x0001020304050607ULL, 0x08090a0b0c0d0e0fULL);
+    __m128i abcd = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)state), 0x1B);
+    __m128i e0 = _mm_set_epi32(state[4], 0, 0, 0);
+    __m128i e1 = _mm_setzero_si128();
+
+    for (; length >= 64; data += 64, length -= 64) {
+        __m128i abcdSave = abcd;
+        __m128i eSave = e0;
+        __m128i w[4];
+        #pragma GCC unroll 20
+        for (int i = 0; i < 20; i++) {
+            if (i < 4) {
+                w[i] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + 16 * i)), byteSwap);
+            }
+
+            // The two `e` registers alternate between holding the input to these rounds and saving `abcd` for the
+            // next.
+            __m128i& e = (i % 2) ? e1 : e0;
+            __m128i& nextE = (i % 2) ? e0 : e1;
+            e = i ? _mm_sha1nexte_epu32(e, w[i % 4]) : _mm_add_epi32(e, w[0]);
+            nextE = abcd;
+            abcd = sha1Rounds(abcd, e, i / 5);
+
+            if (i >= 1 && i <= 16) {
+                w[(i + 3) % 4] = _mm_sha1msg1_epu32(w[(i + 3) % 4], w[i % 4]);
+            }
+            if (i >= 2 && i <= 17) {
+                w[(i + 2) % 4] = _mm_xor_si128(w[(i + 2) % 4], w[i % 4]);
+            }
+            if (i >= 3 && i <= 18) {
+                w[(i + 1) % 4] = _mm_sha1msg2_epu32(w[(i + 1) % 4], w[i % 4]);
+            }
+        }
+        e0 = _mm_sha1nexte_epu32(e0, eSave);
+        abcd = _mm_add_epi32(abcd, abcdSave);
+    }
+
+    _mm_storeu_si128((__m128i*)state, _mm_shuffle_epi32(abcd, 0x1B));
+    state[4] = _mm_extract_epi32(e0, 3);
+}
+
+// Runs the SHA-256 compression function over each 64 byte block in `data`. The SHA extensions keep the state as ABEF
+// and CDGH rather than ABCD and EFGH, so it's rearranged on the way in and out. Each iteration of the inner loop is
+// four rounds, and `w` holds the last four groups of four message schedule words.
+SHASH_TARGET void sha256Blocks(uint32_t state[8], const unsigned char* data, size_t length) {
+    const __m128i byteSwap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+    __m128i tmp = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)&state[0]), 0xB1);
+    __m128i state1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)&state[4]), 0x1B);
+    __m128i state0 = _mm_alignr_epi8(tmp, state1, 8);
+    state1 = _mm_blend_epi16(state1, tmp, 0xF0);
+
+    for (; length >= 64; data += 64, length -= 64) {
+        __m128i abefSave = state0;
+        __m128i cdghSave = state1;
+        __m128i w[4];
+        #pragma GCC unroll 16
+        for (int i = 0; i < 16; i++) {
+            __m128i& current = w[i % 4];
+            if (i < 4) {
+                current = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + 16 * i)), byteSwap);
+            } else {
+                __m128i partial = _mm_add_epi32(_mm_sha256msg1_epu32(current, w[(i + 1) % 4]),
+                                                _mm_alignr_epi8(w[(i + 3) % 4], w[(i + 2) % 4], 4));
+                current = _mm_sha256msg2_epu32(partial, w[(i + 3) % 4]);
+            }
+            __m128i message = _mm_add_epi32(current, _mm_loadu_si128((const __m128i*)&SHA256_K[4 * i]));
+            state1 = _mm_sha256rnds2_epu32(state1, state0, message);
+            state0 = _mm_sha256rnds2_epu32(state0, state1, _mm_shuffle_epi32(message, 0x0E));
+        }
+        state0 = _mm_add_epi32(state0, abefSave);
+        state1 = _mm_add_epi32(state1, cdghSave);
+    }
+
+    tmp = _mm_shuffle_epi32(state0, 0x1B);
+    state1 = _mm_shuffle_epi32(state1, 0xB1);
+    _mm_storeu_si128((__m128i*)&state[0], _mm_blend_epi16(tmp, state1, 0xF0));
+    _mm_storeu_si128((__m128i*)&state[4], _mm_alignr_epi8(state1, tmp, 8));
+}
+
+}
+
+bool SHash::hardwareSupported() {
+    static const bool supported = []() {
+        unsigned int eax, ebx, ecx, edx;
+        if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx) || !(ecx & bit_SSSE3) || !(ecx & bit_SSE4_1)) {
+            return false;
+        }
+        if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) {
+            return false;
+        }
+        return (ebx & bit_SHA) != 0;
+    }();
+    return supported;
+}
+
+void SHash::sha1(const unsigned char* data, size_t length, unsigned char digest[20]) {
+    uint32_t state[5] = {0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0};
+    hashPadded(data, length, [&state](const unsigned char* blocks, size_t blocksLength) {
+        sha1Blocks(state, blocks, blocksLength);
+    });
+    writeDigest(state, 5, digest);
+}
+
+void SHash::sha256(const unsigned char* data, size_t length, unsigned char digest[32]) {
+    uint32_t state[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+    hashPadded(data, length, [&state](const unsigned char* blocks, size_t blocksLength) {
+        sha256Blocks(state, blocks, blocksLength);
+    });
+    writeDigest(state, 8, digest);
+}
+
+#else
+
+bool SHash::hardwareSupported() {
+    return false;
+}
+
+void SHash::sha1(const unsigned char* data, size_t length, unsigned char digest[20]) {
+    SERROR("SHA extensions aren't available on this architecture.");
+}
+
+void SHash::sha256(const unsigned char* data, size_t length, unsigned char digest[32]) {
+    SERROR("SHA extensions aren't available on this architecture.");
+}
+
+#endif
@@ -0,0 +1,17 @@
+#pragma once
+
+// SHA-1 and SHA-256 implemented with the x86 SHA extensions. `SHashSHA1` and `SHashSHA256` use these in place of
+// mbedtls on CPUs that support them, which is considerably faster on the large buffers we hash for each commit.
+class SHash {
+  public:
+    // Returns true if this CPU supports the SHA extensions. Detected the first time it's called.
+    static bool hardwareSupported();
+
+    // If false, `SHashSHA1` and `SHashSHA256` use mbedtls even if the CPU supports the SHA extensions. This exists so
+    // the two can be compared.
+    static atomic<bool> hardwareEnabled;
+
+    // Compute digests with the SHA extensions. Only call these if `hardwareSupported` returns true.
+    static void sha1(const unsigned char* data, size_t length, unsigned char digest[20]);
+    static void sha256(const unsigned char* data, size_t length, unsigned char digest[32]);
+};
@@ -21,6 +21,12 @@
 // If two items have the same priority, the one with the older scheduled timestamp is returned.
 //
 // Items scheduled in the future are never returned (unless they've timed out).
+//
+// Optionally, the queue can be ranked instead, in which case items with the same priority that are scheduled before now
+// are returned in order of a rank given to `push` (lowest first), rather than their scheduled times. By default, the
+// rank is the item's timeout, so the earliest deadline comes first. Everything above still applies: items that have
+// already timed out come out before anything else, so the caller can discard them without doing any work, and items
+// scheduled in the future are never returned early.
 template<typename T>
 class SScheduledPriorityQueue {
   public:
@@ -38,10 +44,17 @@ class SScheduledPriorityQueue {
         }
     };
 
-    // By default, the start and end functions are No-ops.
+    // How items of the same priority are ordered once they're scheduled before now.
+    enum class Order {
+        SCHEDULED,
+        RANKED
+    };
+
+    // By default, the start and end functions are No-ops, and items are in scheduled order.
     SScheduledPriorityQueue(function<void(T& item)> startFunction = [](T& item){},
-                            function<void(T& item)> endFunction = [](T& item){})
-      : _startFunction(startFunction), _endFunction(endFunction) {};
+                            function<void(T& item)> endFunction = [](T& item){},
+                            Order order = Order::SCHEDULED)
+      : _startFunction(startFunction), _endFunction(endFunction), _order(order) {};
 
     // Remove all items from the queue.
     void clear();
@@ -52,6 +65,9 @@ class SScheduledPriorityQueue {
     // Returns the size of the queue.
     size_t size();
 
+    // Returns the number of items queued at each priority.
+    map<Priority, size_t> sizeByPriority();
+
     // Get an item from the queue. Optionally, a timeout can be specified.
     // If timeout is non-zero, a timeout_error exception will be thrown after waitUS microseconds, if no work was
     // available.
@@ -60,20 +76,68 @@ class SScheduledPriorityQueue {
     // Add an item to the queue. The queue takes ownership of the item and the caller's copy is invalidated.
     void push(T&& item, Priority priority, Scheduled scheduled, Timeout timeout);
 
+    // Like `push`, but with the rank the item is ordered by once it's due, if the queue is ranked.
+    void push(T&& item, Priority priority, Scheduled scheduled, Timeout timeout, uint64_t rank);
+
+    // Calls `f` with each queued item, in no particular order.
+    void forEach(function<void(const T&)> f);
+
+    // Removes every item scheduled at or after `limit`, without calling the end function on them. If `erased` is
+    // given, it's called with each item first, and can take it. Returns the number of items removed.
+    size_t eraseScheduledAfter(Scheduled limit, const function<void(T& item)>& erased = nullptr);
+
+    // Removes every item for which `predicate` returns true, without calling the end function on them. `predicate` can
+    // take the items it returns true for. Returns the number of items removed.
+    size_t eraseIf(const function<bool(T& item)>& predicate);
+
   protected:
 
     // Associate the item with it's timeout so that when we dequeue an item to return, we can also remove it's entry
-    // in our set of timeouts.
+    // in our set of timeouts. The scheduled time and rank are kept too, so that an item can be matched with its timeout
+    // entry wherever it's filed.
     struct ItemTimeoutPair {
-        ItemTimeoutPair(T&& _item, Timeout _timeout) : item(move(_item)), timeout(_timeout) {}
+        ItemTimeoutPair(T&& _item, Scheduled _scheduled, Timeout _timeout, uint64_t _rank)
+          : item(move(_item)), scheduled(_scheduled), timeout(_timeout), rank(_rank) {}
         T item;
+        Scheduled scheduled;
         Timeout timeout;
+        uint64_t rank;
     };
 
+    // What we need to find an item from its timeout.
+    struct TimeoutEntry {
+        Priority priority;
+        Scheduled scheduled;
+        uint64_t rank;
+    };
+
+    // The unlocked implementations of `push`, `clear`, `size`, `sizeByPriority`, `forEach`, `eraseScheduledAfter`, and
+    // `eraseIf`. Call with `_queueMutex` locked.
+    void _push(T&& item, Priority priority, Scheduled scheduled, Timeout timeout, uint64_t rank);
+    void _clear();
+    size_t _size();
+    void _sizeByPriority(map<Priority, size_t>& sizes);
+    void _forEach(const function<void(const T&)>& f);
+    size_t _eraseScheduledAfter(Scheduled limit, const function<void(T& item)>& erased);
+    size_t _eraseIf(const function<bool(T& item)>& predicate);
+
     // Removes an item from the queue and returns it, if a suitable item is available (see the comment at the top of
     // this file for what counts as a suitable item). Throws `out_of_range` otherwise.
     T _dequeue();
 
+    // In a ranked queue, moves every item in `_queue` scheduled at or before `now` into `_due`. Call with `_queueMutex`
+    // locked.
+    void _promote(uint64_t now);
+
+    // Removes the entry in `_lookupByTimeout` for the item with the given timeout, priority, and scheduled time. Call
+    // with `_queueMutex` locked.
+    void _eraseTimeout(Timeout timeout, Priority priority, Scheduled scheduled);
+
+    // Returns the earliest time at which an item will be suitable to return, which is the earliest of the scheduled
+    // time of the first item at each priority, and the earliest timeout. If that's not after now, there's an item
+    // available now. Returns the largest possible value if the queue is empty. Call with `_queueMutex` locked.
+    uint64_t _nextEligible();
+
     // Synchronization primitives for managing access to the queue.
     mutex _queueMutex;
     condition_variable _queueCondition;
@@ -81,50 +145,181 @@ class SScheduledPriorityQueue {
     // The main queue is a map of priorities to the items queued at that priority, sorted by their scheduled time.
     map<Priority, multimap<Scheduled, ItemTimeoutPair>> _queue;
 
+    // In a ranked queue, items are moved out of `_queue` once they're scheduled before now, into this map of
+    // priorities to the items due at that priority, sorted by their rank. It's always empty in scheduled order.
+    map<Priority, multimap<uint64_t, ItemTimeoutPair>> _due;
+
     // A map of timeouts back into the respective priority queue to find the item with the given timeout.
-    multimap<Timeout, pair<Priority, Scheduled>> _lookupByTimeout;
+    multimap<Timeout, TimeoutEntry> _lookupByTimeout;
 
     // Functions to call on each item when inserting or removing from the queue.
     function<void(T&)> _startFunction;
     function<void(T&)> _endFunction;
+
+    const Order _order;
 };
 
 template<typename T>
 void SScheduledPriorityQueue<T>::clear()  {
     lock_guard<decltype(_queueMutex)> lock(_queueMutex);
-    _queue.clear();
+    _clear();
 }
 
 template<typename T>
 bool SScheduledPriorityQueue<T>::empty()  {
     lock_guard<decltype(_queueMutex)> lock(_queueMutex);
-    return _queue.empty();
+    return _queue.empty() && _due.empty();
 }
 
 template<typename T>
 size_t SScheduledPriorityQueue<T>::size()  {
     lock_guard<decltype(_queueMutex)> lock(_queueMutex);
+    return _size();
+}
+
+template<typename T>
+map<typename SScheduledPriorityQueue<T>::Priority, size_t> SScheduledPriorityQueue<T>::sizeByPriority() {
+    lock_guard<decltype(_queueMutex)> lock(_queueMutex);
+    map<Priority, size_t> sizes;
+    _sizeByPriority(sizes);
+    return sizes;
+}
+
+template<typename T>
+void SScheduledPriorityQueue<T>::forEach(function<void(const T&)> f) {
+    lock_guard<decltype(_queueMutex)> lock(_queueMutex);
+    _forEach(f);
+}
+
+template<typename T>
+size_t SScheduledPriorityQueue<T>::eraseScheduledAfter(Scheduled limit, const function<void(T& item)>& erased) {
+    lock_guard<decltype(_queueMutex)> lock(_queueMutex);
+    return _eraseScheduledAfter(limit, erased);
+}
+
+template<typename T>
+size_t SScheduledPriorityQueue<T>::eraseIf(const function<bool(T& item)>& predicate) {
+    lock_guard<decltype(_queueMutex)> lock(_queueMutex);
+    return _eraseIf(predicate);
+}
+
+template<typename T>
+void SScheduledPriorityQueue<T>::_clear()  {
+    _queue.clear();
+    _due.clear();
+    _lookupByTimeout.clear();
+}
+
+template<typename T>
+size_t SScheduledPriorityQueue<T>::_size()  {
     size_t size = 0;
     for (const auto& queue : _queue) {
         size += queue.second.size();
     }
+    for (const auto& queue : _due) {
+        size += queue.second.size();
+    }
     return size;
 }
 
+template<typename T>
+void SScheduledPriorityQueue<T>::_sizeByPriority(map<Priority, size_t>& sizes) {
+    for (const auto& queue : _queue) {
+        sizes[queue.first] += queue.second.size();
+    }
+    for (const auto& queue : _due) {
+        sizes[queue.first] += queue.second.size();
+    }
+}
+
+template<typename T>
+void SScheduledPriorityQueue<T>::_forEach(const function<void(const T&)>& f) {
+    for (const auto& queue : _queue) {
+        for (const auto& entry : queue.second) {
+            f(entry.second.item);
+        }
+    }
+    for (const auto& queue : _due) {
+        for (const auto& entry : queue.second) {
+            f(entry.second.item);
+        }
+    }
+}
+
+template<typename T>
+size_t SScheduledPriorityQueue<T>::_eraseScheduledAfter(Scheduled limit, const function<void(T& item)>& erased) {
+    size_t count = 0;
+
+    // The items in `_queue` are in scheduled order, so we can erase everything from the first one at or after the
+    // limit to the end, and any priority left empty.
+    for (auto queueIt = _queue.begin(); queueIt != _queue.end();) {
+        auto& queue = queueIt->second;
+        for (auto it = queue.lower_bound(limit); it != queue.end(); it = queue.erase(it)) {
+            if (erased) {
+                erased(it->second.item);
+            }
+            _eraseTimeout(it->second.timeout, queueIt->first, it->first);
+            count++;
+        }
+        queueIt = queue.empty() ? _queue.erase(queueIt) : next(queueIt);
+    }
+
+    // Items in `_due` were scheduled before they were promoted, but the limit could be earlier than that.
+    for (auto queueIt = _due.begin(); queueIt != _due.end();) {
+        auto& queue = queueIt->second;
+        for (auto it = queue.begin(); it != queue.end();) {
+            if (it->second.scheduled >= limit) {
+                if (erased) {
+                    erased(it->second.item);
+                }
+                _eraseTimeout(it->second.timeout, queueIt->first, it->second.scheduled);
+                it = queue.erase(it);
+                count++;
+            } else {
+                it++;
+            }
+        }
+        queueIt = queue.empty() ? _due.erase(queueIt) : next(queueIt);
+    }
+    return count;
+}
+
+template<typename T>
+size_t SScheduledPriorityQueue<T>::_eraseIf(const function<bool(T& item)>& predicate) {
+    size_t count = 0;
+    for (auto queueIt = _queue.begin(); queueIt != _queue.end();) {
+        auto& queue = queueIt->second;
+        for (auto it = queue.begin(); it != queue.end();) {
+            if (predicate(it->second.item)) {
+                _eraseTimeout(it->second.timeout, queueIt->first, it->first);
+                it = queue.erase(it);
+                count++;
+            } else {
+                it++;
+            }
+        }
+        queueIt = queue.empty() ? _queue.erase(queueIt) : next(queueIt);
+    }
+    for (auto queueIt = _due.begin(); queueIt != _due.end();) {
+        auto& queue = queueIt->second;
+        for (auto it = queue.begin(); it != queue.end();) {
+            if (predicate(it->second.item)) {
+                _eraseTimeout(it->second.timeout, queueIt->first, it->second.scheduled);
+                it = queue.erase(it);
+                count++;
+            } else {
+                it++;
+            }
+        }
+        queueIt = queue.empty() ? _due.erase(queueIt) : next(queueIt);
+    }
+    return count;
+}
+
 template<typename T>
 T SScheduledPriorityQueue<T>::get(uint64_t waitUS) {
     unique_lock<mutex> queueLock(_queueMutex);
 
-    // NOTE:
-    // Possible future improvement: Say there's work in the queue, but it's not ready yet (i.e., it's scheduled in the
-    // future). Someone calls `get(1000000)`, and nothing gets added to the queue during that second (which would wake
-    // someone up to process whatever is next, which isn't necessarily the same thing that was added). BUT, some work
-    // in the queue comes due during that wait (i.e., it's timestamp is no longer in the future). Currently, we won't
-    // wake up here, we'll wait out our full second and force the caller to retry. This is fine for the current
-    // (03-2017) use case, where we interrupt every second and only really use scheduling at 1-second granularity.
-    //
-    // What we could do, is truncate the timeout to not be farther in the future than the next timestamp in the list.
-
     // If there's already work in the queue, just return some.
     try {
         return _dequeue();
@@ -136,8 +331,16 @@ T SScheduledPriorityQueue<T>::get(uint64_t waitUS) {
     if (waitUS) {
         auto timeout = chrono::steady_clock::now() + chrono::microseconds(waitUS);
         while (true) {
-            // Wait until we hit our timeout, or someone gives us some work.
-            _queueCondition.wait_until(queueLock, timeout);
+            // Wait until we hit our timeout, someone gives us some work, or something in the queue becomes available
+            // (because it's scheduled for now, or it times out). In that last case, every waiting thread wakes up, and
+            // only one gets the item. See SShardedScheduledPriorityQueue for a queue that wakes only one.
+            uint64_t nextEligible = _nextEligible();
+            uint64_t untilEligible = nextEligible - min(nextEligible, STimeNow());
+            auto wakeTime = timeout;
+            if (untilEligible < waitUS) {
+                wakeTime = min(timeout, chrono::steady_clock::now() + chrono::microseconds(untilEligible));
+            }
+            _queueCondition.wait_until(queueLock, wakeTime);
             
             // If we got any work, return it.
             try {
@@ -152,9 +355,15 @@ T SScheduledPriorityQueue<T>::get(uint64_t waitUS) {
             }
         }
     } else {
-        // Wait indefinitely.
+        // Wait indefinitely, unless something in the queue will become available.
         while (true) {
-            _queueCondition.wait(queueLock);
+            uint64_t nextEligible = _nextEligible();
+            if (nextEligible != numeric_limits<uint64_t>::max()) {
+                uint64_t untilEligible = nextEligible - min(nextEligible, STimeNow());
+                _queueCondition.wait_for(queueLock, chrono::microseconds(min(untilEligible, (uint64_t)3600 * STIME_US_PER_S)));
+            } else {
+                _queueCondition.wait(queueLock);
+            }
             try {
                 return _dequeue();
             } catch (const out_of_range& e) {
@@ -166,14 +375,30 @@ T SScheduledPriorityQueue<T>::get(uint64_t waitUS) {
 
 template<typename T>
 void SScheduledPriorityQueue<T>::push(T&& item, Priority priority, Scheduled scheduled, Timeout timeout) {
+    push(move(item), priority, scheduled, timeout, timeout);
+}
+
+template<typename T>
+void SScheduledPriorityQueue<T>::push(T&& item, Priority priority, Scheduled scheduled, Timeout timeout, uint64_t rank) {
     lock_guard<decltype(_queueMutex)> lock(_queueMutex);
-    auto& queue = _queue[priority];
-    _startFunction(item);
-    _lookupByTimeout.insert(make_pair(timeout, make_pair(priority, scheduled)));
-    queue.emplace(scheduled, ItemTimeoutPair(move(item), timeout));
+    _push(move(item), priority, scheduled, timeout, rank);
     _queueCondition.notify_one();
 }
 
+template<typename T>
+void SScheduledPriorityQueue<T>::_push(T&& item, Priority priority, Scheduled scheduled, Timeout timeout,
+                                       uint64_t rank) {
+    _startFunction(item);
+    _lookupByTimeout.insert(make_pair(timeout, TimeoutEntry{priority, scheduled, rank}));
+
+    // In a ranked queue, anything that's already due can skip `_queue`.
+    if (_order == Order::RANKED && scheduled <= STimeNow()) {
+        _due[priority].emplace(rank, ItemTimeoutPair(move(item), scheduled, timeout, rank));
+    } else {
+        _queue[priority].emplace(scheduled, ItemTimeoutPair(move(item), scheduled, timeout, rank));
+    }
+}
+
 template<typename T>
 T SScheduledPriorityQueue<T>::_dequeue() {
     // NOTE: We don't grab a mutex here on purpose - we use a non-recursive mutex to work with condition_variable, so
@@ -183,6 +408,11 @@ T SScheduledPriorityQueue<T>::_dequeue() {
     // We need to know what time it is, so that we can compare to scheduled times.
     uint64_t now = STimeNow();
 
+    // In a ranked queue, anything that's become due since we last looked needs to be filed by its rank.
+    if (_order == Order::RANKED) {
+        _promote(now);
+    }
+
     // If anything has timed out, pull that out of the queue, and return that first.
     if (_lookupByTimeout.size()) {
 
@@ -191,8 +421,9 @@ T SScheduledPriorityQueue<T>::_dequeue() {
 
         // Convenience names for legibility.
         const Timeout& itemTimeout = timeoutIt->first;
-        const Priority& itemPriority = timeoutIt->second.first;
-        const Scheduled& itemScheduled = timeoutIt->second.second;
+        const Priority& itemPriority = timeoutIt->second.priority;
+        const Scheduled& itemScheduled = timeoutIt->second.scheduled;
+        const uint64_t& itemRank = timeoutIt->second.rank;
 
         // Has this timed out? If so, this is the item we'll return (regardless of which priority it had).
         if (itemTimeout <= now) {
@@ -234,14 +465,49 @@ T SScheduledPriorityQueue<T>::_dequeue() {
                 }
             }
 
+            // In a ranked queue, it may be due already, in which case it's filed by its rank instead.
+            auto dueQueueIt = _due.find(itemPriority);
+            if (dueQueueIt != _due.end()) {
+                auto matchingItemIterators = dueQueueIt->second.equal_range(itemRank);
+                for (auto it = matchingItemIterators.first; it != matchingItemIterators.second; it++) {
+                    if (it->second.scheduled == itemScheduled && it->second.timeout == itemTimeout) {
+                        T item = move(it->second.item);
+                        dueQueueIt->second.erase(it);
+                        if (dueQueueIt->second.empty()) {
+                            _due.erase(dueQueueIt);
+                        }
+                        _lookupByTimeout.erase(timeoutIt);
+                        _endFunction(item);
+                        return item;
+                    }
+                }
+            }
+
             // This isn't supposed to be possible.
             SWARN("Timeout (" << itemTimeout << ") before now, but couldn't find a item for it?");
             _lookupByTimeout.erase(timeoutIt);
         }
     }
 
-    // Ok, if we got here nothing has timed out, so we'll just look at each queue, in priority order, to see if any
-    // items are ready to return.
+    // Ok, if we got here nothing has timed out. In a ranked queue, everything that's ready has been promoted, so we
+    // return the item with the lowest rank at the highest priority that has any.
+    if (_order == Order::RANKED) {
+        if (_due.empty()) {
+            throw out_of_range("No item found.");
+        }
+        auto queueIt = prev(_due.end());
+        auto itemIt = queueIt->second.begin();
+        T item = move(itemIt->second.item);
+        _eraseTimeout(itemIt->second.timeout, queueIt->first, itemIt->second.scheduled);
+        queueIt->second.erase(itemIt);
+        if (queueIt->second.empty()) {
+            _due.erase(queueIt);
+        }
+        _endFunction(item);
+        return item;
+    }
+
+    // Otherwise, we'll just look at each queue, in priority order, to see if any items are ready to return.
     for (auto queueIt = _queue.rbegin(); queueIt != _queue.rend(); ++queueIt) {
 
         // Record the priority of the queue we're currently looking at.
@@ -272,21 +538,7 @@ T SScheduledPriorityQueue<T>::_dequeue() {
             }
 
             // Remove from the timeout map, as well.
-            auto matchingTimeoutIterators = _lookupByTimeout.equal_range(thisItemTimeout);
-            for (auto it = matchingTimeoutIterators.first; it != matchingTimeoutIterators.second; it++) {
-
-                // Convenience names for legibility.
-                auto& timeoutPair = it->second;
-                Priority& thisTimeoutPriority = timeoutPair.first;
-                Scheduled& thisTimeoutScheduled = timeoutPair.second;
-
-                // If this timeout entry has the same queue that we're in, and the same scheduled time, we can remove
-                // it.
-                if (thisTimeoutPriority == queuePriority && thisTimeoutScheduled == thisItemScheduled) {
-                    _lookupByTimeout.erase(it);
-                    break;
-                }
-            }
+            _eraseTimeout(thisItemTimeout, queuePriority, thisItemScheduled);
 
             // Call the end function and return!
             _endFunction(item);
@@ -298,3 +550,42 @@ T SScheduledPriorityQueue<T>::_dequeue() {
     throw out_of_range("No item found.");
 }
 
+template<typename T>
+void SScheduledPriorityQueue<T>::_promote(uint64_t now) {
+    for (auto queueIt = _queue.begin(); queueIt != _queue.end();) {
+        auto& queue = queueIt->second;
+        auto dueEnd = queue.upper_bound(now);
+        if (dueEnd != queue.begin()) {
+            auto& due = _due[queueIt->first];
+            for (auto it = queue.begin(); it != dueEnd; it++) {
+                due.emplace(it->second.rank, move(it->second));
+            }
+            queue.erase(queue.begin(), dueEnd);
+        }
+        queueIt = queue.empty() ? _queue.erase(queueIt) : next(queueIt);
+    }
+}
+
+template<typename T>
+void SScheduledPriorityQueue<T>::_eraseTimeout(Timeout timeout, Priority priority, Scheduled scheduled) {
+    auto matchingTimeoutIterators = _lookupByTimeout.equal_range(timeout);
+    for (auto it = matchingTimeoutIterators.first; it != matchingTimeoutIterators.second; it++) {
+        // If this timeout entry has the same priority and the same scheduled time, we can remove it.
+        if (it->second.priority == priority && it->second.scheduled == scheduled) {
+            _lookupByTimeout.erase(it);
+            return;
+        }
+    }
+}
+
+template<typename T>
+uint64_t SScheduledPriorityQueue<T>::_nextEligible() {
+    uint64_t next = _lookupByTimeout.empty() ? numeric_limits<uint64_t>::max() : _lookupByTimeout.begin()->first;
+    for (const auto& queue : _queue) {
+        next = min(next, queue.second.begin()->first);
+    }
+    for (const auto& queue : _due) {
+        next = min(next, queue.second.begin()->second.scheduled);
+    }
+    return next;
+}
@@ -0,0 +1,530 @@
+#pragma once
+#include <libstuff/libstuff.h>
+#include <libstuff/SScheduledPriorityQueue.h>
+
+// A scheduled priority queue (see SScheduledPriorityQueue for what that means) split into shards, each with its own
+// lock, so that the threads pushing and getting items don't all contend on a single mutex.
+//
+// Each thread that calls `get` is given a home shard. Items it pushes go to its home shard, and items pushed by any
+// other thread are spread across the shards in turn. `get` takes from whichever shard has the best item, preferring
+// its home shard among equals, so a thread mostly works from its own shard and steals from the others when they have
+// better (or any) work. Each shard publishes its size, the priority of its best item that's ready now (and that item's
+// scheduled time or rank), and its earliest timeout in atomics, so choosing a shard doesn't take any locks.
+//
+// When nothing's available, one of the threads waiting in `get` is the timekeeper, which sleeps until the next item in
+// the queue becomes available (because its scheduled time arrives, or it times out), and the others sleep until
+// they're given work. So an item scheduled in the future, or one that times out, wakes exactly one thread, on time.
+//
+// Items come out in the same order as SScheduledPriorityQueue, except that while items are being pushed and removed
+// concurrently, the order is approximate: two threads calling `get` at once may each take the best item from a
+// different shard, and `size` may be briefly out of date.
+template<typename T>
+class SShardedScheduledPriorityQueue {
+  public:
+    typedef typename SScheduledPriorityQueue<T>::Priority Priority;
+    typedef typename SScheduledPriorityQueue<T>::Timeout Timeout;
+    typedef typename SScheduledPriorityQueue<T>::Scheduled Scheduled;
+    typedef typename SScheduledPriorityQueue<T>::timeout_error timeout_error;
+    typedef typename SScheduledPriorityQueue<T>::Order Order;
+
+    // By default, there's a shard per CPU, the start and end functions are No-ops, and items are in scheduled order.
+    SShardedScheduledPriorityQueue(size_t shardCount = 0,
+                                   function<void(T& item)> startFunction = [](T& item){},
+                                   function<void(T& item)> endFunction = [](T& item){},
+                                   Order order = Order::SCHEDULED);
+
+    // Remove all items from the queue.
+    void clear();
+
+    // Returns true if there are no queued items.
+    bool empty();
+
+    // Returns the size of the queue.
+    size_t size();
+
+    // Returns the number of items queued at each priority, locking one shard at a time.
+    map<Priority, size_t> sizeByPriority();
+
+    // Get an item from the queue. Optionally, a timeout can be specified.
+    // If timeout is non-zero, a timeout_error exception will be thrown after waitUS microseconds, if no work was
+    // available.
+    T get(uint64_t waitUS = 0);
+
+    // Add an item to the queue. The queue takes ownership of the item and the caller's copy is invalidated.
+    void push(T&& item, Priority priority, Scheduled scheduled, Timeout timeout);
+
+    // Like `push`, but with the rank the item is ordered by once it's due, if the queue is ranked.
+    void push(T&& item, Priority priority, Scheduled scheduled, Timeout timeout, uint64_t rank);
+
+    // Calls `f` with each queued item, in no particular order, locking one shard at a time.
+    void forEach(function<void(const T&)> f);
+
+    // Removes every item scheduled at or after `limit`, without calling the end function on them. If `erased` is
+    // given, it's called with each item first, and can take it. Returns the number of items removed.
+    size_t eraseScheduledAfter(Scheduled limit, const function<void(T& item)>& erased = nullptr);
+
+    // Removes every item for which `predicate` returns true, without calling the end function on them. `predicate` can
+    // take the items it returns true for. Returns the number of items removed.
+    size_t eraseIf(const function<bool(T& item)>& predicate);
+
+  protected:
+    // A single shard is an ordinary scheduled priority queue that also publishes a summary of what it holds.
+    class Shard : public SScheduledPriorityQueue<T> {
+      public:
+        Shard(function<void(T& item)> startFunction, function<void(T& item)> endFunction, Order order);
+
+        // Like the base class's `push`, `clear`, `eraseScheduledAfter`, and `eraseIf`, but these keep our summary up to
+        // date, and `push` doesn't wake anyone, as nobody waits on a single shard.
+        void push(T&& item, Priority priority, Scheduled scheduled, Timeout timeout, uint64_t rank);
+        void clear();
+        size_t eraseScheduledAfter(Scheduled limit, const function<void(T& item)>& erased);
+        size_t eraseIf(const function<bool(T& item)>& predicate);
+
+        // Adds the number of items queued at each priority to `sizes`.
+        void addSizeByPriority(map<Priority, size_t>& sizes);
+
+        // Removes and returns the next item, if one is ready. Throws `out_of_range` otherwise. Never waits.
+        T dequeue();
+
+        // Brings the summary below up to date, once `refreshAt` has passed.
+        void refresh();
+
+        // A summary of this shard that can be read without locking it. If `ready`, the shard has an item that's ready
+        // to return, and the best of them is at `topPriority`, where `topKey` is what it's ordered by: its scheduled
+        // time, or in a ranked queue, its rank. Items scheduled in the future don't count, however high their
+        // priority, so a shard whose best item isn't due yet doesn't hide the next best one. `refreshAt` is when the
+        // first of those becomes due, which may change the best item, so the summary needs updating.
+        atomic<size_t> count;
+        atomic<bool> ready;
+        atomic<Priority> topPriority;
+        atomic<uint64_t> topKey;
+        atomic<uint64_t> refreshAt;
+        atomic<Timeout> earliestTimeout;
+        atomic<uint64_t> nextEligible;
+
+      private:
+        // Updates the summary above. Call with `_queueMutex` locked.
+        void _updateSummary();
+    };
+
+    // Removes an item from whichever shard has the best one, if any item is available. Throws `out_of_range`
+    // otherwise.
+    T _dequeue();
+
+    // Returns the earliest time at which any shard will have an item available (see
+    // `SScheduledPriorityQueue::_nextEligible`), or the largest possible value if every shard is empty.
+    uint64_t _nextEligible();
+
+    // Returns the index of the calling thread's home shard, assigning it one if it doesn't have one yet.
+    size_t _homeShard();
+
+    vector<unique_ptr<Shard>> _shards;
+
+    // Used to spread items pushed by threads without a home shard.
+    atomic<uint64_t> _nextPushShard;
+
+    // Threads waiting in `get` wait on `_waitCondition`, except the timekeeper, which waits on `_timerCondition` until
+    // `_timerDeadline`. `_waiters` counts them all, and lets `push` skip locking `_waitMutex` when nobody's waiting.
+    // The rest of these are protected by `_waitMutex`.
+    mutex _waitMutex;
+    condition_variable _waitCondition;
+    condition_variable _timerCondition;
+    atomic<size_t> _waiters;
+    bool _timekeeperWaiting;
+    uint64_t _timerDeadline;
+
+    // Each thread that gets items from a queue is given an index, which picks its home shard in every queue of this
+    // type. It's -1 for threads that have never called `get`.
+    static thread_local int64_t _threadIndex;
+    static atomic<int64_t> _nextThreadIndex;
+};
+
+template<typename T>
+thread_local int64_t SShardedScheduledPriorityQueue<T>::_threadIndex = -1;
+
+template<typename T>
+atomic<int64_t> SShardedScheduledPriorityQueue<T>::_nextThreadIndex(0);
+
+template<typename T>
+SShardedScheduledPriorityQueue<T>::Shard::Shard(function<void(T& item)> startFunction,
+                                                function<void(T& item)> endFunction, Order order)
+  : SScheduledPriorityQueue<T>(startFunction, endFunction, order), count(0), ready(false),
+    topPriority(numeric_limits<Priority>::min()), topKey(0), refreshAt(numeric_limits<uint64_t>::max()),
+    earliestTimeout(numeric_limits<Timeout>::max()), nextEligible(numeric_limits<uint64_t>::max())
+{ }
+
+template<typename T>
+void SShardedScheduledPriorityQueue<T>::Shard::push(T&& item, Priority priority, Scheduled scheduled, Timeout timeout,
+                                                    uint64_t rank) {
+    lock_guard<decltype(this->_queueMutex)> lock(this->_queueMutex);
+    this->_push(move(item), priority, scheduled, timeout, rank);
+    count++;
+    _updateSummary();
+}
+
+template<typename T>
+void SShardedScheduledPriorityQueue<T>::Shard::clear() {
+    lock_guard<decltype(this->_queueMutex)> lock(this->_queueMutex);
+    this->_clear();
+    count = 0;
+    _updateSummary();
+}
+
+template<typename T>
+size_t SShardedScheduledPriorityQueue<T>::Shard::eraseScheduledAfter(Scheduled limit,
+                                                                   const function<void(T& item)>& erased) {
+    lock_guard<decltype(this->_queueMutex)> lock(this->_queueMutex);
+    size_t removed = this->_eraseScheduledAfter(limit, erased);
+    count -= removed;
+    _updateSummary();
+    return removed;
+}
+
+template<typename T>
+size_t SShardedScheduledPriorityQueue<T>::Shard::eraseIf(const function<bool(T& item)>& predicate) {
+    lock_guard<decltype(this->_queueMutex)> lock(this->_queueMutex);
+    size_t removed = this->_eraseIf(predicate);
+    count -= removed;
+    _updateSummary();
+    return removed;
+}
+
+template<typename T>
+T SShardedScheduledPriorityQueue<T>::Shard::dequeue() {
+    lock_guard<decltype(this->_queueMutex)> lock(this->_queueMutex);
+    try {
+        T item = this->_dequeue();
+        count--;
+        _updateSummary();
+        return item;
+    } catch (const out_of_range& e) {
+        // `_dequeue` may have discarded a stale timeout on the way.
+        _updateSummary();
+        throw;
+    }
+}
+
+template<typename T>
+void SShardedScheduledPriorityQueue<T>::Shard::refresh() {
+    lock_guard<decltype(this->_queueMutex)> lock(this->_queueMutex);
+    _updateSummary();
+}
+
+template<typename T>
+void SShardedScheduledPriorityQueue<T>::Shard::addSizeByPriority(map<Priority, size_t>& sizes) {
+    lock_guard<decltype(this->_queueMutex)> lock(this->_queueMutex);
+    this->_sizeByPriority(sizes);
+}
+
+template<typename T>
+void SShardedScheduledPriorityQueue<T>::Shard::_updateSummary() {
+    // In a ranked queue, everything that's ready is moved to `_due`, and the best of it is the first item at its
+    // highest priority.
+    const uint64_t now = STimeNow();
+    auto& queue = this->_queue;
+    auto& due = this->_due;
+    bool found = false;
+    Priority priority = numeric_limits<Priority>::min();
+    uint64_t key = 0;
+    if (this->_order == Order::RANKED) {
+        this->_promote(now);
+        if (!due.empty()) {
+            found = true;
+            priority = due.rbegin()->first;
+            key = due.rbegin()->second.begin()->first;
+        }
+    }
+
+    // Otherwise, it's the first item at the highest priority whose first item is scheduled before now. Anything at a
+    // higher priority (or in a ranked queue, the same one) that isn't due yet will change that when it is.
+    uint64_t refresh = numeric_limits<uint64_t>::max();
+    for (auto it = queue.rbegin(); it != queue.rend() && (!found || it->first >= priority); ++it) {
+        Scheduled scheduled = it->second.begin()->first;
+        if (scheduled <= now) {
+            found = true;
+            priority = it->first;
+            key = scheduled;
+            break;
+        }
+        refresh = min(refresh, scheduled);
+    }
+    ready = found;
+    topPriority = priority;
+    topKey = key;
+    refreshAt = refresh;
+    earliestTimeout = this->_lookupByTimeout.empty() ? numeric_limits<Timeout>::max() : this->_lookupByTimeout.begin()->first;
+    nextEligible = this->_nextEligible();
+}
+
+template<typename T>
+SShardedScheduledPriorityQueue<T>::SShardedScheduledPriorityQueue(size_t shardCount,
+                                                                  function<void(T& item)> startFunction,
+                                                                  function<void(T& item)> endFunction,
+                                                                  Order order)
+  : _nextPushShard(0), _waiters(0), _timekeeperWaiting(false), _timerDeadline(numeric_limits<uint64_t>::max())
+{
+    if (!shardCount) {
+        shardCount = max(1u, thread::hardware_concurrency());
+    }
+    for (size_t i = 0; i < shardCount; i++) {
+        _shards.emplace_back(make_unique<Shard>(startFunction, endFunction, order));
+    }
+}
+
+template<typename T>
+void SShardedScheduledPriorityQueue<T>::clear() {
+    for (auto& shard : _shards) {
+        shard->clear();
+    }
+}
+
+template<typename T>
+bool SShardedScheduledPriorityQueue<T>::empty() {
+    for (auto& shard : _shards) {
+        if (shard->count) {
+            return false;
+        }
+    }
+    return true;
+}
+
+template<typename T>
+size_t SShardedScheduledPriorityQueue<T>::size() {
+    size_t size = 0;
+    for (auto& shard : _shards) {
+        size += shard->count;
+    }
+    return size;
+}
+
+template<typename T>
+map<typename SShardedScheduledPriorityQueue<T>::Priority, size_t> SShardedScheduledPriorityQueue<T>::sizeByPriority() {
+    map<Priority, size_t> sizes;
+    for (auto& shard : _shards) {
+        if (shard->count) {
+            shard->addSizeByPriority(sizes);
+        }
+    }
+    return sizes;
+}
+
+template<typename T>
+void SShardedScheduledPriorityQueue<T>::forEach(function<void(const T&)> f) {
+    for (auto& shard : _shards) {
+        shard->forEach(f);
+    }
+}
+
+template<typename T>
+size_t SShardedScheduledPriorityQueue<T>::eraseScheduledAfter(Scheduled limit, const function<void(T& item)>& erased) {
+    size_t removed = 0;
+    for (auto& shard : _shards) {
+        removed += shard->eraseScheduledAfter(limit, erased);
+    }
+    return removed;
+}
+
+template<typename T>
+size_t SShardedScheduledPriorityQueue<T>::eraseIf(const function<bool(T& item)>& predicate) {
+    size_t removed = 0;
+    for (auto& shard : _shards) {
+        removed += shard->eraseIf(predicate);
+    }
+    return removed;
+}
+
+template<typename T>
+T SShardedScheduledPriorityQueue<T>::get(uint64_t waitUS) {
+    // If there's already work in the queue, just return some, without touching `_waitMutex`.
+    _homeShard();
+    try {
+        return _dequeue();
+    } catch (const out_of_range& e) {
+        // Nothing available.
+    }
+
+    // Otherwise, we'll wait for some. We register as a waiter before checking again, and `push` checks for waiters
+    // after adding its item, so that either we'll see the item, or `push` will see us and wake us.
+    auto timeout = chrono::steady_clock::now() + chrono::microseconds(waitUS);
+    unique_lock<mutex> waitLock(_waitMutex);
+    _waiters++;
+    bool timekeeper = false;
+
+    // When we stop waiting, if we were the timekeeper, we wake another waiter to take over.
+    auto stopWaiting = [&]() {
+        _waiters--;
+        if (timekeeper) {
+            _timekeeperWaiting = false;
+            _timerDeadline = numeric_limits<uint64_t>::max();
+            _waitCondition.notify_one();
+        }
+    };
+
+    while (true) {
+        try {
+            T item = _dequeue();
+            stopWaiting();
+            return item;
+        } catch (const out_of_range& e) {
+            // Still nothing available.
+        }
+
+        // Did we go past our timeout? If so, we give up.
+        if (waitUS && chrono::steady_clock::now() > timeout) {
+            stopWaiting();
+            throw timeout_error();
+        }
+
+        // If nobody's the timekeeper, we are.
+        if (!_timekeeperWaiting) {
+            _timekeeperWaiting = true;
+            timekeeper = true;
+        }
+
+        if (timekeeper) {
+            // Wait until the next item becomes available, if that's before our timeout.
+            _timerDeadline = _nextEligible();
+            if (_timerDeadline != numeric_limits<uint64_t>::max()) {
+                uint64_t untilEligible = min(_timerDeadline - min(_timerDeadline, STimeNow()), (uint64_t)3600 * STIME_US_PER_S);
+                auto wakeTime = chrono::steady_clock::now() + chrono::microseconds(untilEligible);
+                _timerCondition.wait_until(waitLock, waitUS ? min(timeout, wakeTime) : wakeTime);
+            } else if (waitUS) {
+                _timerCondition.wait_until(waitLock, timeout);
+            } else {
+                _timerCondition.wait(waitLock);
+            }
+        } else if (waitUS) {
+            // Wait until we hit our timeout, or someone gives us some work.
+            _waitCondition.wait_until(waitLock, timeout);
+        } else {
+            // Wait indefinitely.
+            _waitCondition.wait(waitLock);
+        }
+    }
+}
+
+template<typename T>
+void SShardedScheduledPriorityQueue<T>::push(T&& item, Priority priority, Scheduled scheduled, Timeout timeout) {
+    push(move(item), priority, scheduled, timeout, timeout);
+}
+
+template<typename T>
+void SShardedScheduledPriorityQueue<T>::push(T&& item, Priority priority, Scheduled scheduled, Timeout timeout,
+                                             uint64_t rank) {
+    size_t index = _threadIndex >= 0 ? _threadIndex % _shards.size() : _nextPushShard++ % _shards.size();
+    _shards[index]->push(move(item), priority, scheduled, timeout, rank);
+    if (_waiters) {
+        lock_guard<mutex> lock(_waitMutex);
+        uint64_t eligible = min(scheduled, timeout);
+        if (!_timekeeperWaiting || (eligible <= STimeNow() && _waiters > 1)) {
+            // Either this is available now, and there's someone other than the timekeeper to take it, or there's no
+            // timekeeper, in which case whoever we wake will become one.
+            _waitCondition.notify_one();
+        } else if (eligible < _timerDeadline) {
+            // The timekeeper needs to wake up earlier than it planned, either to take this itself or to wait for it.
+            _timerCondition.notify_one();
+        }
+    }
+}
+
+template<typename T>
+T SShardedScheduledPriorityQueue<T>::_dequeue() {
+    const size_t home = _homeShard();
+    const uint64_t now = STimeNow();
+
+    // Look at the summary of each shard with anything in it, starting from our home shard, updating it first if
+    // anything in the shard has become due since it was written. If anything has timed out, it comes first, so we note
+    // the shard with the oldest timeout. Otherwise, we want the shard whose best ready item has the highest priority,
+    // and then the lowest key (see `Shard::topKey`) at that priority, preferring the first we see among equals.
+    struct Candidate {
+        Priority priority;
+        uint64_t key;
+        size_t index;
+        bool operator<(const Candidate& other) const {
+            return priority > other.priority || (priority == other.priority && key < other.key);
+        }
+    };
+    Candidate best = {0, 0, _shards.size()};
+    Shard* timedOut = nullptr;
+    Timeout oldestTimeout = now;
+    for (size_t i = 0; i < _shards.size(); i++) {
+        size_t index = (home + i) % _shards.size();
+        Shard& shard = *_shards[index];
+        if (!shard.count) {
+            continue;
+        }
+        if (shard.refreshAt <= now) {
+            shard.refresh();
+        }
+        Timeout shardTimeout = shard.earliestTimeout;
+        if (shardTimeout <= oldestTimeout) {
+            timedOut = &shard;
+            oldestTimeout = shardTimeout;
+        }
+        if (!shard.ready) {
+            continue;
+        }
+        Candidate candidate = {shard.topPriority, shard.topKey, index};
+        if (best.index == _shards.size() || candidate < best) {
+            best = candidate;
+        }
+    }
+    if (best.index == _shards.size() && !timedOut) {
+        throw out_of_range("No item found.");
+    }
+    if (timedOut) {
+        try {
+            return timedOut->dequeue();
+        } catch (const out_of_range& e) {
+            // Someone else got it first.
+        }
+    }
+
+    // Usually, the best shard still has its item for us.
+    if (best.index != _shards.size()) {
+        try {
+            return _shards[best.index]->dequeue();
+        } catch (const out_of_range& e) {
+            // Someone else got it first.
+        }
+    }
+
+    // If not, we try the others with anything ready in the same order, until one of them has it.
+    vector<Candidate> candidates;
+    for (size_t i = 0; i < _shards.size(); i++) {
+        size_t index = (home + i) % _shards.size();
+        if (index != best.index && _shards[index]->count && _shards[index]->ready) {
+            candidates.push_back({_shards[index]->topPriority, _shards[index]->topKey, index});
+        }
+    }
+    stable_sort(candidates.begin(), candidates.end());
+    for (const auto& candidate : candidates) {
+        try {
+            return _shards[candidate.index]->dequeue();
+        } catch (const out_of_range& e) {
+            // Nothing ready in this shard.
+        }
+    }
+
+    // No item suitable to return.
+    throw out_of_range("No item found.");
+}
+
+template<typename T>
+uint64_t SShardedScheduledPriorityQueue<T>::_nextEligible() {
+    uint64_t next = numeric_limits<uint64_t>::max();
+    for (auto& shard : _shards) {
+        if (shard->count) {
+            next = min(next, shard->nextEligible.load());
+        }
+    }
+    return next;
+}
+
+template<typename T>
+size_t SShardedScheduledPriorityQueue<T>::_homeShard() {
+    if (_threadIndex < 0) {
+        _threadIndex = _nextThreadIndex++;
+    }
+    return _threadIndex % _shards.size();
+}
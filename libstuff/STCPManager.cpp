@@ -1,12 +1,33 @@
 #include "libstuff.h"
+#include <sys/epoll.h>
 
 atomic<uint64_t> STCPManager::Socket::socketCount(1);
+atomic<STCPManager::PollBackend> STCPManager::pollBackend(STCPManager::POLL);
+
+STCPManager::STCPManager() : _epollFD(-1) {
+    if (pollBackend.load() == EPOLL) {
+        _epollFD = epoll_create1(EPOLL_CLOEXEC);
+        if (_epollFD < 0) {
+            SWARN("Couldn't create epoll instance (" << strerror(errno) << "), using poll.");
+        }
+    }
+}
 
 STCPManager::~STCPManager() {
     SASSERTWARN(socketList.empty());
+    if (_epollFD >= 0) {
+        ::close(_epollFD);
+    }
 }
 
 void STCPManager::prePoll(fd_map& fdm) {
+    // With epoll, every socket was registered when we got it, and never needs updating, so poll just needs to tell us
+    // when any of them are ready.
+    if (_epollFD >= 0) {
+        SFDset(fdm, _epollFD, SREADEVTS);
+        return;
+    }
+
     // Add all the sockets
     for (Socket* socket : socketList) {
         // Make sure it's not closed
@@ -17,7 +38,7 @@ void STCPManager::prePoll(fd_map& fdm) {
                       << socket->s << "), we're probably about to corrupt stack memory. FD_SETSIZE=" << FD_SETSIZE);
             }
             // Add this socket. First, we always want to read, and we always want to learn of exceptions.
-            SFDset(fdm, socket->s, SREADEVTS);
+            short events = SREADEVTS;
 
             // However, we only want to write in some states. No matter what, we want to send if we're not yet
             // connected. And if we're not using SSL, then we want to send only when we have something buffered for
@@ -26,11 +47,11 @@ void STCPManager::prePoll(fd_map& fdm) {
             // to decide if it wants to send.
             if (socket->state.load() == Socket::CONNECTING) {
                 // We haven't yet connected -- send regardless of SSL
-                SFDset(fdm, socket->s, SWRITEEVTS);
+                events |= SWRITEEVTS;
             } else if (!socket->ssl) {
                 // No SSL, just send if we have anything buffered
                 if (!socket->sendBufferEmpty()) {
-                    SFDset(fdm, socket->s, SWRITEEVTS);
+                    events |= SWRITEEVTS;
                 }
             } else {
                 // Have we completed the handshake?
@@ -39,7 +60,7 @@ void STCPManager::prePoll(fd_map& fdm) {
                 if (sslState->ssl.state == MBEDTLS_SSL_HANDSHAKE_OVER) {
                     // Handshake done -- send if we have anything buffered
                     if (!socket->sendBufferEmpty()) {
-                        SFDset(fdm, socket->s, SWRITEEVTS);
+                        events |= SWRITEEVTS;
                     }
                 } else {
                     // Handshake isn't done -- send if SSL wants to
@@ -61,141 +82,244 @@ void STCPManager::prePoll(fd_map& fdm) {
                         break;
                     }
                     if (write) {
-                        SFDset(fdm, socket->s, SWRITEEVTS);
+                        events |= SWRITEEVTS;
                     }
                 }
             }
+            SFDset(fdm, socket->s, events);
         }
     }
 }
 
-void STCPManager::postPoll(fd_map& fdm) {
-    // Walk across the sockets
-    for (Socket* socket : socketList) {
-        // Update this socket
-        switch (socket->state.load()) {
-        case Socket::CONNECTING: {
-            // See if it connected or failed
-            if (!SFDAnySet(fdm, socket->s, SWRITEEVTS | POLLHUP | POLLERR)) {
-                // Keep waiting for asynchronous connect result
-                break;
-            }
+void STCPManager::_epollAdd(Socket* socket) {
+    if (_epollFD < 0) {
+        return;
+    }
 
-            // Mark any sockets that the other end disconnected as closed.
-            if (SFDAnySet(fdm, socket->s, POLLHUP)) {
-                socket->state.store(Socket::CLOSED);
-                ::shutdown(socket->s, SHUT_RDWR);
-            }
+    // Edge-triggered, epoll tells us once each time the socket becomes readable or writable, so we can always ask for
+    // both. It only becomes writable again after a send has filled the kernel's buffer, which is exactly when we have
+    // something left to send, so we never need to change what we asked for, and only hear about sockets we need to
+    // handle.
+    epoll_event event = {};
+    event.events = EPOLLIN | EPOLLPRI | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    event.data.fd = socket->s;
+    lock_guard<decltype(_epollMutex)> lock(_epollMutex);
+    int result = epoll_ctl(_epollFD, EPOLL_CTL_ADD, socket->s, &event);
+    if (result && errno == EEXIST) {
+        // The FD was closed and reused without us noticing, so it's still registered.
+        result = epoll_ctl(_epollFD, EPOLL_CTL_MOD, socket->s, &event);
+    }
+    if (result) {
+        SWARN("Couldn't register socket '" << socket->addr << "' with epoll: " << strerror(errno));
+        return;
+    }
+    _epollSockets[socket->s] = socket;
+}
 
-            // Tagged as writable; check SO_ERROR to see if the connect failed
-            int result = 0;
-            socklen_t size = sizeof(result);
-            SASSERTWARN(!getsockopt(socket->s, SOL_SOCKET, SO_ERROR, &result, &size));
-            if (result) {
-                // Asynchronous connect failed; close socket
-                SDEBUG("Connect to '" << socket->addr << "' failed with SO_ERROR #" << result << ", closing.");
-                socket->state.store(Socket::CLOSED);
-                socket->connectFailure = true;
-                break;
+list<STCPManager::Socket*> STCPManager::_epollCollect(fd_map& fdm) {
+    // Sockets that are shutting down are checked every time, whether or not epoll has anything for them.
+    list<Socket*> sockets;
+    set<int> fds;
+    lock_guard<decltype(_epollMutex)> lock(_epollMutex);
+    for (Socket* socket : _shuttingDownSockets) {
+        sockets.push_back(socket);
+        fds.insert(socket->s);
+    }
+
+    // If poll didn't say so, there's nothing else waiting.
+    if (!SFDAnySet(fdm, _epollFD, SREADEVTS)) {
+        return sockets;
+    }
+
+    // epoll's event flags have the same values as poll's, except that it reports the other end shutting down
+    // separately, which we handle like poll does: as the socket being readable (so `recv` will see it).
+    epoll_event events[EPOLL_MAX_EVENTS];
+    int count = 0;
+    do {
+        count = epoll_wait(_epollFD, events, EPOLL_MAX_EVENTS, 0);
+        for (int i = 0; i < count; i++) {
+            pollfd& fd = fdm[events[i].data.fd];
+            fd.fd = events[i].data.fd;
+            fd.revents |= events[i].events & (EPOLLIN | EPOLLPRI | EPOLLOUT | EPOLLERR | EPOLLHUP);
+            if (events[i].events & EPOLLRDHUP) {
+                fd.revents |= POLLIN;
+            }
+            auto it = _epollSockets.find(fd.fd);
+            if (it != _epollSockets.end() && fds.insert(fd.fd).second) {
+                sockets.push_back(it->second);
             }
+        }
+    } while (count == EPOLL_MAX_EVENTS);
+    if (count < 0 && errno != EINTR) {
+        SWARN("epoll_wait failed with response '" << strerror(errno) << "' (#" << errno << "), ignoring");
+    }
+    return sockets;
+}
 
-            // Asynchronous connect succeeded
-            SDEBUG("Connect to '" << socket->addr << "' succeeded.");
-            SASSERTWARN(SFDAnySet(fdm, socket->s, SWRITEEVTS));
-            socket->state.store(Socket::CONNECTED);
-            // **NOTE: Intentionally fall through to the connected state
+list<STCPManager::Socket*> STCPManager::postPoll(fd_map& fdm) {
+    if (_epollFD < 0) {
+        // Walk across the sockets
+        for (Socket* socket : socketList) {
+            _postPollSocket(socket, fdm);
         }
+        return socketList;
+    }
 
-        case Socket::CONNECTED: {
-            // Connected -- see if we're ready to send
-            bool aliveAfterRecv = true;
-            bool aliveAfterSend = true;
-            if (socket->ssl) {
-                // If the socket is ready to send or receive, do both: SSL has its own internal traffic, so even if we
-                // only want to receive, SSL might need to send (and vice versa)
-                //
-                // **NOTE: SSL can receive data for a while before giving any back, so if this gets called many times
-                //         in a row it might just be filling an internal buffer (and not due to some busy loop)
-                SDEBUG("sslState=" << SSSLGetState(socket->ssl) << ", canrecv=" << SFDAnySet(fdm, socket->s, SREADEVTS)
-                                   << ", recvsize=" << socket->recvBuffer.size()
-                                   << ", cansend=" << SFDAnySet(fdm, socket->s, SWRITEEVTS)
-                                   << ", sendsize=" << socket->sendBufferCopy().size());
-                if (SFDAnySet(fdm, socket->s, SREADEVTS | SWRITEEVTS)) {
-                    // Do both
-                    aliveAfterRecv = socket->recv();
-                    aliveAfterSend = socket->send();
-                }
-            } else {
-                // Only send/recv if the socket is ready
-                if (SFDAnySet(fdm, socket->s, SREADEVTS)) {
-                    aliveAfterRecv = socket->recv();
-                }
-                if (SFDAnySet(fdm, socket->s, SWRITEEVTS)) {
-                    aliveAfterSend = socket->send();
-                }
-            }
+    // Find out which sockets are ready, and only handle those. Because epoll is edge-triggered, it only tells us about
+    // each one once, so we need to handle everything it reports. Sockets read until they'd block, which does that.
+    list<Socket*> sockets = _epollCollect(fdm);
+    for (Socket* socket : sockets) {
+        _postPollSocket(socket, fdm);
+        if (socket->state.load() == Socket::CLOSED) {
+            lock_guard<decltype(_epollMutex)> lock(_epollMutex);
+            _shuttingDownSockets.erase(socket);
+        }
+    }
 
-            // If we died, update
-            if (!aliveAfterRecv || !aliveAfterSend) {
-                // How did we die?
-                SDEBUG("Connection to '" << socket->addr << "' died (recv=" << aliveAfterRecv << ", send="
-                       << aliveAfterSend << ")");
-                socket->state.store(Socket::CLOSED);
+    // epoll won't tell us about data we've already read, so the caller gets sockets it hasn't finished with again.
+    set<Socket*> handled(sockets.begin(), sockets.end());
+    for (auto it = _unconsumedSockets.begin(); it != _unconsumedSockets.end();) {
+        if ((*it)->recvBuffer.empty()) {
+            it = _unconsumedSockets.erase(it);
+        } else {
+            if (!handled.count(*it)) {
+                sockets.push_back(*it);
             }
+            it++;
+        }
+    }
+    for (Socket* socket : sockets) {
+        if (!socket->recvBuffer.empty()) {
+            _unconsumedSockets.insert(socket);
+        }
+    }
+    return sockets;
+}
+
+void STCPManager::_postPollSocket(Socket* socket, fd_map& fdm) {
+    // Update this socket
+    switch (socket->state.load()) {
+    case Socket::CONNECTING: {
+        // See if it connected or failed
+        if (!SFDAnySet(fdm, socket->s, SWRITEEVTS | POLLHUP | POLLERR)) {
+            // Keep waiting for asynchronous connect result
             break;
         }
 
-        case Socket::SHUTTINGDOWN:
-            // Is this a SSL socket?
-            if (socket->ssl) {
-                // Always send/recv (see Socket::CONNECTED, above)
-                // **FIXME: Add timeout.
-                bool aliveAfterRecv = socket->recv();
-                bool aliveAfterSend = socket->send();
-                if (!aliveAfterSend || (!aliveAfterRecv && socket->sendBufferEmpty())) {
-
-                    // Did we send everything?  (Technically this the send buffer could be empty and we still haven't
-                    // sent everything -- SSL buffers internally, so we should check that buffer.  But odds are it sent fine.)
-                    if (socket->sendBufferEmpty()) {
-                        SDEBUG("Graceful shutdown of SSL socket '" << socket->addr << "'");
-                    } else {
-                        SWARN("Dirty shutdown of SSL socket '" << socket->addr << "' (" << socket->sendBufferCopy().size()
-                                                               << " bytes remain)");
-                    }
-                    socket->state.store(Socket::CLOSED);
-                    ::shutdown(socket->s, SHUT_RDWR);
+        // Mark any sockets that the other end disconnected as closed.
+        if (SFDAnySet(fdm, socket->s, POLLHUP)) {
+            socket->state.store(Socket::CLOSED);
+            ::shutdown(socket->s, SHUT_RDWR);
+        }
+
+        // Tagged as writable; check SO_ERROR to see if the connect failed
+        int result = 0;
+        socklen_t size = sizeof(result);
+        SASSERTWARN(!getsockopt(socket->s, SOL_SOCKET, SO_ERROR, &result, &size));
+        if (result) {
+            // Asynchronous connect failed; close socket
+            SDEBUG("Connect to '" << socket->addr << "' failed with SO_ERROR #" << result << ", closing.");
+            socket->state.store(Socket::CLOSED);
+            socket->connectFailure = true;
+            break;
+        }
+
+        // Asynchronous connect succeeded
+        SDEBUG("Connect to '" << socket->addr << "' succeeded.");
+        SASSERTWARN(SFDAnySet(fdm, socket->s, SWRITEEVTS));
+        socket->state.store(Socket::CONNECTED);
+        // **NOTE: Intentionally fall through to the connected state
+    }
+
+    case Socket::CONNECTED: {
+        // Connected -- see if we're ready to send
+        bool aliveAfterRecv = true;
+        bool aliveAfterSend = true;
+        if (socket->ssl) {
+            // If the socket is ready to send or receive, do both: SSL has its own internal traffic, so even if we
+            // only want to receive, SSL might need to send (and vice versa)
+            //
+            // **NOTE: SSL can receive data for a while before giving any back, so if this gets called many times
+            //         in a row it might just be filling an internal buffer (and not due to some busy loop)
+            SDEBUG("sslState=" << SSSLGetState(socket->ssl) << ", canrecv=" << SFDAnySet(fdm, socket->s, SREADEVTS)
+                               << ", recvsize=" << socket->recvBuffer.size()
+                               << ", cansend=" << SFDAnySet(fdm, socket->s, SWRITEEVTS)
+                               << ", sendsize=" << socket->sendBufferCopy().size());
+            if (SFDAnySet(fdm, socket->s, SREADEVTS | SWRITEEVTS)) {
+                // Do both
+                aliveAfterRecv = socket->recv();
+                aliveAfterSend = socket->send();
+            }
+        } else {
+            // Only send/recv if the socket is ready
+            if (SFDAnySet(fdm, socket->s, SREADEVTS)) {
+                aliveAfterRecv = socket->recv();
+            }
+            if (SFDAnySet(fdm, socket->s, SWRITEEVTS)) {
+                aliveAfterSend = socket->send();
+            }
+        }
+
+        // If we died, update
+        if (!aliveAfterRecv || !aliveAfterSend) {
+            // How did we die?
+            SDEBUG("Connection to '" << socket->addr << "' died (recv=" << aliveAfterRecv << ", send="
+                   << aliveAfterSend << ")");
+            socket->state.store(Socket::CLOSED);
+        }
+        break;
+    }
+
+    case Socket::SHUTTINGDOWN:
+        // Is this a SSL socket?
+        if (socket->ssl) {
+            // Always send/recv (see Socket::CONNECTED, above)
+            // **FIXME: Add timeout.
+            bool aliveAfterRecv = socket->recv();
+            bool aliveAfterSend = socket->send();
+            if (!aliveAfterSend || (!aliveAfterRecv && socket->sendBufferEmpty())) {
+
+                // Did we send everything?  (Technically this the send buffer could be empty and we still haven't
+                // sent everything -- SSL buffers internally, so we should check that buffer.  But odds are it sent fine.)
+                if (socket->sendBufferEmpty()) {
+                    SDEBUG("Graceful shutdown of SSL socket '" << socket->addr << "'");
+                } else {
+                    SWARN("Dirty shutdown of SSL socket '" << socket->addr << "' (" << socket->sendBufferCopy().size()
+                                                           << " bytes remain)");
                 }
-            } else {
-                // Not SSL -- only send if we have something to send
-                if (!socket->sendBufferEmpty()) {
-                    // Still have something to send -- try to send it.
-                    if (!socket->send()) {
-                        // Done trying to send
-                        SHMMM("Unable to finish sending to '" << socket->addr << "' on shutdown, clearing.");
-                        ::shutdown(socket->s, SHUT_RDWR);
-                        socket->setSendBuffer("");
-                    }
+                socket->state.store(Socket::CLOSED);
+                ::shutdown(socket->s, SHUT_RDWR);
+            }
+        } else {
+            // Not SSL -- only send if we have something to send
+            if (!socket->sendBufferEmpty()) {
+                // Still have something to send -- try to send it.
+                if (!socket->send()) {
+                    // Done trying to send
+                    SHMMM("Unable to finish sending to '" << socket->addr << "' on shutdown, clearing.");
+                    ::shutdown(socket->s, SHUT_RDWR);
+                    socket->setSendBuffer("");
                 }
+            }
 
-                // Are we done sending?
-                // **FIXME: Add timeout
-                if (socket->sendBufferEmpty()) {
-                    // Wait for the other side to shut down
-                    if (!socket->recv()) {
-                        // Done shutting down
-                        SDEBUG("Graceful shutdown of socket '" << socket->addr << "'");
-                        socket->state.store(Socket::CLOSED);
-                        ::shutdown(socket->s, SHUT_RDWR);
-                    }
+            // Are we done sending?
+            // **FIXME: Add timeout
+            if (socket->sendBufferEmpty()) {
+                // Wait for the other side to shut down
+                if (!socket->recv()) {
+                    // Done shutting down
+                    SDEBUG("Graceful shutdown of socket '" << socket->addr << "'");
+                    socket->state.store(Socket::CLOSED);
+                    ::shutdown(socket->s, SHUT_RDWR);
                 }
             }
-            break;
-        case Socket::CLOSED:
-            // Ignore
-            break;
-        default:
-            SERROR("Unknown socket state");
         }
+        break;
+    case Socket::CLOSED:
+        // Ignore
+        break;
+    default:
+        SERROR("Unknown socket state");
     }
 }
 
@@ -205,6 +329,10 @@ void STCPManager::shutdownSocket(Socket* socket, int how) {
     SDEBUG("Shutting down socket '" << socket->addr << "' (" << how << ")");
     ::shutdown(socket->s, how);
     socket->state.store(Socket::SHUTTINGDOWN);
+    if (_epollFD >= 0) {
+        lock_guard<decltype(_epollMutex)> lock(_epollMutex);
+        _shuttingDownSockets.insert(socket);
+    }
 }
 
 void STCPManager::closeSocket(Socket* socket) {
@@ -212,6 +340,13 @@ void STCPManager::closeSocket(Socket* socket) {
     SASSERT(socket);
     SDEBUG("Closing socket '" << socket->addr << "'");
     socketList.remove(socket);
+    if (_epollFD >= 0) {
+        // Closing the FD removes it from epoll, we just need to forget about it.
+        lock_guard<decltype(_epollMutex)> lock(_epollMutex);
+        _epollSockets.erase(socket->s);
+        _shuttingDownSockets.erase(socket);
+    }
+    _unconsumedSockets.erase(socket);
 
     delete socket;
 }
@@ -251,6 +386,7 @@ STCPManager::Socket* STCPManager::openSocket(const string& host, SX509* x509, re
     } else {
         socketList.push_back(socket);
     }
+    _epollAdd(socket);
     return socket;
 }
 
@@ -304,6 +440,11 @@ bool STCPManager::Socket::sendBufferEmpty() {
     return sendBuffer.empty();
 }
 
+size_t STCPManager::Socket::sendBufferSize() {
+    lock_guard<decltype(sendRecvMutex)> lock(sendRecvMutex);
+    return sendBuffer.size();
+}
+
 string STCPManager::Socket::sendBufferCopy() {
     lock_guard<decltype(sendRecvMutex)> lock(sendRecvMutex);
     return string(sendBuffer.c_str(), sendBuffer.size());
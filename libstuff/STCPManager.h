@@ -27,6 +27,7 @@ struct STCPManager {
         string logString;
 
         bool sendBufferEmpty();
+        size_t sendBufferSize();
         string sendBufferCopy();
         void setSendBuffer(const string& buffer);
 
@@ -52,12 +53,25 @@ struct STCPManager {
         uint64_t recvBytes;
     };
 
+    // How a manager's sockets are watched. With `POLL`, `prePoll` adds every socket to the fd_map each time it's
+    // called, and `postPoll` checks every socket. With `EPOLL`, each socket is registered once, when it's opened or
+    // accepted, with an edge-triggered epoll instance owned by the manager. `prePoll` adds just the epoll instance to
+    // the fd_map, and `postPoll` only handles the sockets it says are ready (and any that are shutting down), and
+    // reports them in the fd_map as though `poll` had, so callers work the same either way. Each manager uses the
+    // backend selected when it's created.
+    enum PollBackend { POLL, EPOLL };
+    static atomic<PollBackend> pollBackend;
+
+    STCPManager();
+
     // Cleans up outstanding sockets
     virtual ~STCPManager();
 
-    // Updates all managed sockets
+    // Updates all managed sockets. `postPoll` returns the sockets the caller needs to look at: with `POLL`, all of
+    // them, and with `EPOLL`, the ones it handled, plus any whose `recvBuffer` the caller left data in last time (say,
+    // a request it wasn't ready to take yet), until the caller empties it.
     void prePoll(fd_map& fdm);
-    void postPoll(fd_map& fdm);
+    list<Socket*> postPoll(fd_map& fdm);
 
     // Opens outgoing socket
     Socket* openSocket(const string& host, SX509* x509 = nullptr, recursive_mutex* listMutexPtr = nullptr);
@@ -70,4 +84,32 @@ struct STCPManager {
 
     // Attributes
     list<Socket*> socketList;
+
+  protected:
+    // Registers a socket that's just been added to `socketList` with our epoll instance, if we're using one.
+    void _epollAdd(Socket* socket);
+
+  private:
+    // The most events we'll take from epoll per call.
+    static constexpr int EPOLL_MAX_EVENTS = 256;
+
+    // Takes every event epoll has for us and sets it in `fdm`, and returns the sockets `postPoll` needs to handle:
+    // those with events, and those that are shutting down.
+    list<Socket*> _epollCollect(fd_map& fdm);
+
+    // Handles whatever `fdm` says is ready for `socket`.
+    void _postPollSocket(Socket* socket, fd_map& fdm);
+
+    // Our epoll instance, or -1 if we're using `poll`.
+    int _epollFD;
+
+    // The sockets registered with epoll, by FD, and the sockets that are shutting down, which need handling each time
+    // until they're closed, whether or not epoll reports them. Protected by `_epollMutex`, as sockets are closed from
+    // threads other than the one polling them.
+    map<int, Socket*> _epollSockets;
+    set<Socket*> _shuttingDownSockets;
+    mutex _epollMutex;
+
+    // The sockets `postPoll` last returned with data in their `recvBuffer`. Only used by the polling thread.
+    set<Socket*> _unconsumedSockets;
 };
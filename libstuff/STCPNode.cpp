@@ -5,10 +5,13 @@
 
 STCPNode::STCPNode(const string& name_, const string& host, const vector<Peer*> _peerList, const uint64_t recvTimeout_)
     : STCPServer(host), name(name_), recvTimeout(recvTimeout_), peerList(_peerList), _deserializeTimer("STCPNode::deserialize"),
-      _sConsumeFrontTimer("STCPNode::SConsumeFront"), _sAppendTimer("STCPNode::append") {
+      _sConsumeFrontTimer("STCPNode::SConsumeFront"), _sAppendTimer("STCPNode::append"), _networkThreadRunning(false) {
 }
 
 STCPNode::~STCPNode() {
+    // The network thread uses all of the sockets, so it needs to be gone before we clean them up.
+    stopNetworkThread();
+
     // Clean up all the sockets and peers
     for (Socket* socket : acceptedSocketList) {
         closeSocket(socket);
@@ -90,17 +93,156 @@ uint64_t STCPNode::getIDByPeer(STCPNode::Peer* peer) {
 }
 
 void STCPNode::prePoll(fd_map& fdm) {
+    if (_networkThreadRunning) {
+        // The network thread owns the sockets, we just wait for it to hand us something. Anything we've queued for
+        // sending since our last poll didn't make it out immediately, so let the network thread know it has work.
+        _networkEvents.prePoll(fdm);
+        for (Peer* peer : peerList) {
+            lock_guard<decltype(peer->_stateMutex)> lock(peer->_stateMutex);
+            if (peer->socket && !peer->socket->sendBufferEmpty()) {
+                _wakeNetworkThread();
+                break;
+            }
+        }
+        return;
+    }
+
     // Let the base class do its thing
     return STCPServer::prePoll(fdm);
 }
 
 void STCPNode::postPoll(fd_map& fdm, uint64_t& nextActivity) {
+    // Handle anything the network thread has queued. This runs even if it's been stopped, so nothing it queued before
+    // stopping is lost.
+    if (_networkThreadRunning) {
+        _networkEvents.postPoll(fdm);
+    }
+    _processNetworkEvents(nextActivity);
+    if (_networkThreadRunning) {
+        return;
+    }
+
     // Process the sockets
     {
         AutoTimerTime appendTime(_sAppendTimer);
         STCPServer::postPoll(fdm);
     }
+    _processSockets(nextActivity, false);
+}
+
+void STCPNode::startNetworkThread() {
+    if (_networkThreadRunning) {
+        return;
+    }
+
+    // Open up a pipe for waking the thread and set non-blocking reads, as in SSynchronizedQueue.
+    SASSERT(0 == pipe(_networkWakeFD));
+    int flags = fcntl(_networkWakeFD[0], F_GETFL, 0);
+    fcntl(_networkWakeFD[0], F_SETFL, flags | O_NONBLOCK);
+
+    SINFO("Starting network thread.");
+    _networkThreadRunning = true;
+    _networkThread = thread(&STCPNode::_networkLoop, this);
+}
+
+void STCPNode::stopNetworkThread() {
+    if (!_networkThreadRunning) {
+        return;
+    }
+    SINFO("Stopping network thread.");
+    _networkThreadRunning = false;
+    _wakeNetworkThread();
+    _networkThread.join();
+    close(_networkWakeFD[0]);
+    close(_networkWakeFD[1]);
+    _networkWakeFD[0] = -1;
+    _networkWakeFD[1] = -1;
+
+    // Anything still in `_networkEvents` gets handled by the next postPoll.
+}
+
+void STCPNode::_wakeNetworkThread() {
+    // **NOTE: 1 byte so write is atomic.
+    SASSERT(write(_networkWakeFD[1], "A", 1));
+}
+
+void STCPNode::_networkLoop() {
+    SInitialize(name + "-network");
+    uint64_t nextActivity = STimeNow();
+    while (_networkThreadRunning) {
+        fd_map fdm;
+        SFDset(fdm, _networkWakeFD[0], SREADEVTS);
+        {
+            lock_guard<decltype(_socketListMutex)> lock(_socketListMutex);
+            STCPServer::prePoll(fdm);
+        }
+        const uint64_t now = STimeNow();
+        S_poll(fdm, max(nextActivity, now) - now);
+
+        // Same default timeout as the sync thread; `_processSockets` shortens it if a peer needs reconnecting sooner.
+        nextActivity = STimeNow() + STIME_US_PER_S;
+
+        // Empty the wakeup pipe.
+        if (SFDAnySet(fdm, _networkWakeFD[0], SREADEVTS)) {
+            char readbuffer[64];
+            while (read(_networkWakeFD[0], readbuffer, sizeof(readbuffer)) > 0) {}
+        }
+
+        lock_guard<decltype(_socketListMutex)> lock(_socketListMutex);
+        {
+            AutoTimerTime appendTime(_sAppendTimer);
+            STCPServer::postPoll(fdm);
+        }
+        _processSockets(nextActivity, true);
+    }
+}
+
+void STCPNode::_processNetworkEvents(uint64_t& nextActivity) {
+    while (!_networkEvents.empty()) {
+        NetworkEvent event = _networkEvents.pop();
+        Peer* peer = event.peer;
+        switch (event.type) {
+            case NetworkEvent::CONNECT:
+                _onConnect(peer);
+                break;
+
+            case NetworkEvent::MESSAGE:
+                try {
+                    _onMESSAGE(peer, event.message);
+                } catch (const SException& e) {
+                    PWARN("Error processing message '" << event.message.methodLine << "' (" << e.what()
+                                                       << "), reconnecting:" << event.message.serialize());
+                    lock_guard<decltype(_socketListMutex)> lock(_socketListMutex);
+                    if (peer->socket) {
+                        SData reconnect("RECONNECT");
+                        reconnect["Reason"] = e.what();
+                        peer->socket->send(reconnect.serialize());
+                        shutdownSocket(peer->socket);
+                    }
+                }
+                break;
 
+            case NetworkEvent::DISCONNECT: {
+                // The network thread won't touch this peer again until we've reset it, so clean it up the same way
+                // `_processSockets` does inline.
+                _onDisconnect(peer);
+                lock_guard<decltype(_socketListMutex)> lock(_socketListMutex);
+                uint64_t delay = SRandom::rand64() % (STIME_US_PER_S * 5);
+                if (peer->socket && peer->socket->connectFailure) {
+                    peer->failedConnections++;
+                }
+                peer->closeSocket(this);
+                peer->reset();
+                peer->nextReconnect = STimeNow() + delay;
+                nextActivity = min(nextActivity, peer->nextReconnect.load());
+                _disconnectingPeers.erase(peer);
+                break;
+            }
+        }
+    }
+}
+
+void STCPNode::_processSockets(uint64_t& nextActivity, bool queueEvents) {
     // Accept any new peers
     Socket* socket = nullptr;
     while ((socket = acceptSocket()))
@@ -132,10 +274,13 @@ void STCPNode::postPoll(fd_map& fdm, uint64_t& nextActivity) {
                         // **FIXME: Authenticate and match by public key
                         if (peer->name == message["Name"]) {
                             // Found it!  Are we already connected?
-                            if (!peer->socket) {
+                            if (!peer->socket && !_disconnectingPeers.count(peer)) {
                                 // Attach to this peer and LOGIN
                                 PINFO("Attaching incoming socket");
-                                peer->socket = socket;
+                                {
+                                    lock_guard<decltype(peer->_stateMutex)> lock(peer->_stateMutex);
+                                    peer->socket = socket;
+                                }
                                 peer->failedConnections = 0;
                                 acceptedSocketList.erase(socketIt);
                                 foundIt = true;
@@ -144,7 +289,11 @@ void STCPNode::postPoll(fd_map& fdm, uint64_t& nextActivity) {
                                 _sendPING(peer);
 
                                 // Let the child class do its connection logic
-                                _onConnect(peer);
+                                if (queueEvents) {
+                                    _networkEvents.push({NetworkEvent::CONNECT, peer, SData()});
+                                } else {
+                                    _onConnect(peer);
+                                }
                                 break;
                             } else
                                 STHROW("already connected");
@@ -207,6 +356,7 @@ void STCPNode::postPoll(fd_map& fdm, uint64_t& nextActivity) {
                             AutoTimerTime consumeTime(_sConsumeFrontTimer);
                             peer->socket->recvBuffer.consumeFront(messageSize);
                         }
+                        peer->messagesReceived++;
                         if (peer->socket->recvBuffer.size() > 10'000) {
                             // Make in known if this buffer ever gets big.
                             PINFO("Received '" << message.methodLine << "'(size: " << messageSize << ") with " 
@@ -231,6 +381,9 @@ void STCPNode::postPoll(fd_map& fdm, uint64_t& nextActivity) {
                             // peers.
                             peer->latency = max(STimeNow() - message.calc64("Timestamp"), (uint64_t)1);
                             SINFO("Received PONG from peer '" << peer->name << "' (" << peer->latency/1000 << "ms latency)");
+                        } else if (queueEvents) {
+                            // Hand it off to the thread calling postPoll.
+                            _networkEvents.push({NetworkEvent::MESSAGE, peer, message});
                         } else {
                             // Not a PING or PONG; pass to the child class
                             _onMESSAGE(peer, message);
@@ -253,6 +406,20 @@ void STCPNode::postPoll(fd_map& fdm, uint64_t& nextActivity) {
             }
 
             case Socket::CLOSED: {
+                if (queueEvents) {
+                    // The thread calling postPoll cleans up the socket once it's handled everything we've queued
+                    // for this peer.
+                    if (_disconnectingPeers.insert(peer).second) {
+                        if (peer->socket->connectFailure) {
+                            PINFO("Peer connection failed after " << (STimeNow() - peer->socket->openTime) / 1000 << "ms");
+                        } else {
+                            PHMMM("Lost peer connection after " << (STimeNow() - peer->socket->openTime) / 1000 << "ms");
+                        }
+                        _networkEvents.push({NetworkEvent::DISCONNECT, peer, SData()});
+                    }
+                    break;
+                }
+
                 // Done; clean up and try to reconnect
                 uint64_t delay = SRandom::rand64() % (STIME_US_PER_S * 5);
                 if (peer->socket->connectFailure) {
@@ -283,7 +450,11 @@ void STCPNode::postPoll(fd_map& fdm, uint64_t& nextActivity) {
                 // Try again
                 PINFO("Retrying the connection");
                 peer->reset();
-                peer->socket = openSocket(peer->host);
+                Socket* socket = openSocket(peer->host);
+                {
+                    lock_guard<decltype(peer->_stateMutex)> lock(peer->_stateMutex);
+                    peer->socket = socket;
+                }
                 if (peer->socket) {
                     // Try to log in now.  Send a PING immediately after so we
                     // can get a fast estimate of latency.
@@ -291,7 +462,11 @@ void STCPNode::postPoll(fd_map& fdm, uint64_t& nextActivity) {
                     login["Name"] = name;
                     peer->socket->send(login.serialize());
                     _sendPING(peer);
-                    _onConnect(peer);
+                    if (queueEvents) {
+                        _networkEvents.push({NetworkEvent::CONNECT, peer, SData()});
+                    } else {
+                        _onConnect(peer);
+                    }
                 } else {
                     // Failed to open -- try again later
                     SWARN("Failed to open socket '" << peer->host << "', trying again in 60s");
@@ -327,7 +502,19 @@ STCPNode::Peer::Peer(const string& name_, const string& host_, const STable& par
     subscribed(false),
     transactionResponse(Response::NONE),
     version(),
-    hash()
+    messagesSent(0),
+    messagesReceived(0),
+    approvalRTT(0),
+    sendBufferHighWater(0),
+    sendBufferOverflows(0),
+    hash(),
+    _telemetryNext(0),
+    _telemetryCount(0),
+    _telemetrySocketID(0),
+    _telemetryBytesSent(0),
+    _telemetryBytesReceived(0),
+    _telemetryMessages(0),
+    _caughtUpTime(STimeNow())
 { }
 
 bool STCPNode::Peer::connected() const {
@@ -353,11 +540,22 @@ void STCPNode::Peer::sendMessage(const SData& message) {
     lock_guard<decltype(_stateMutex)> lock(_stateMutex);
     if (socket) {
         socket->send(message.serialize());
+        messagesSent++;
+        updateSendBufferHighWater();
     } else {
         SWARN("Tried to send " << message.methodLine << " to peer, but not available.");
     }
 }
 
+size_t STCPNode::Peer::updateSendBufferHighWater() {
+    size_t size = socket->sendBufferSize();
+    uint64_t highWater = sendBufferHighWater.load();
+    while (size > highWater && !sendBufferHighWater.compare_exchange_weak(highWater, size)) {
+        // `highWater` is reloaded by the failed exchange, try again.
+    }
+    return size;
+}
+
 void STCPNode::Peer::closeSocket(STCPManager* manager) {
     lock_guard<decltype(_stateMutex)> lock(_stateMutex);
     if (socket) {
@@ -414,8 +612,25 @@ STable STCPNode::Peer::getData() const {
         {"standupResponse", responseName(standupResponse)},
         {"transactionResponse", responseName(transactionResponse)},
         {"subscribed", (subscribed ? "true" : "false")},
+        {"sendBufferHighWater", to_string(sendBufferHighWater)},
+        {"sendBufferOverflows", to_string(sendBufferOverflows)},
     });
 
+    // The most recent telemetry sample, if we have one. `getTelemetry` has the full history.
+    {
+        lock_guard<mutex> lock(_telemetryMutex);
+        if (_telemetryCount) {
+            const TelemetrySample& sample = _telemetry[(_telemetryNext + TELEMETRY_SAMPLES - 1) % TELEMETRY_SAMPLES];
+            result["commitLag"] = to_string(sample.commitLag);
+            result["applyLagMS"] = to_string(sample.applyLagMS);
+            result["bytesSentPerSecond"] = to_string(sample.bytesSentPerSecond);
+            result["bytesReceivedPerSecond"] = to_string(sample.bytesReceivedPerSecond);
+            result["messagesPerSecond"] = to_string(sample.messagesPerSecond);
+            result["sendBufferBytes"] = to_string(sample.sendBufferBytes);
+            result["approvalRTT"] = to_string(sample.approvalRTT);
+        }
+    }
+
     // And anything from the params (note: doesn't overwrite our standard stuff).
     for (auto& p : params) {
         result.emplace(p);
@@ -423,6 +638,95 @@ STable STCPNode::Peer::getData() const {
     return result;
 }
 
+void STCPNode::Peer::recordTelemetry(uint64_t localCommitCount) {
+    uint64_t now = STimeNow();
+    uint64_t peerCommitCount = commitCount.load();
+
+    // Get everything we need from the socket at once, as it can go away.
+    uint64_t socketID = 0;
+    uint64_t bytesSent = 0;
+    uint64_t bytesReceived = 0;
+    uint64_t sendBufferBytes = 0;
+    {
+        lock_guard<decltype(_stateMutex)> lock(_stateMutex);
+        if (socket) {
+            socketID = socket->id;
+            bytesSent = socket->getSentBytes();
+            bytesReceived = socket->getRecvBytes();
+            sendBufferBytes = socket->sendBufferSize();
+        }
+    }
+    uint64_t messages = messagesSent.load() + messagesReceived.load();
+
+    lock_guard<mutex> lock(_telemetryMutex);
+
+    // A new socket starts counting from 0.
+    if (socketID != _telemetrySocketID) {
+        _telemetrySocketID = socketID;
+        _telemetryBytesSent = 0;
+        _telemetryBytesReceived = 0;
+    }
+    if (peerCommitCount >= localCommitCount) {
+        _caughtUpTime = now;
+    }
+
+    // Rates are over the time since the last sample, or since we started if this is the first one.
+    uint64_t lastTimestamp = _telemetryCount ? _telemetry[(_telemetryNext + TELEMETRY_SAMPLES - 1) % TELEMETRY_SAMPLES].timestamp : 0;
+    uint64_t elapsed = lastTimestamp && now > lastTimestamp ? now - lastTimestamp : TELEMETRY_INTERVAL;
+    auto perSecond = [elapsed](uint64_t count) {
+        return count * STIME_US_PER_S / elapsed;
+    };
+
+    // The node resets each socket's counters every so often, so a counter that's gone down has been reset since the
+    // last sample, and everything it's counted since then is new.
+    auto since = [](uint64_t current, uint64_t last) {
+        return current >= last ? current - last : current;
+    };
+
+    TelemetrySample& sample = _telemetry[_telemetryNext];
+    sample.timestamp = now;
+    sample.commitLag = localCommitCount > peerCommitCount ? localCommitCount - peerCommitCount : 0;
+    sample.applyLagMS = (now - _caughtUpTime) / STIME_US_PER_MS;
+    sample.bytesSentPerSecond = perSecond(since(bytesSent, _telemetryBytesSent));
+    sample.bytesReceivedPerSecond = perSecond(since(bytesReceived, _telemetryBytesReceived));
+    sample.messagesPerSecond = perSecond(since(messages, _telemetryMessages));
+    sample.sendBufferBytes = sendBufferBytes;
+    sample.approvalRTT = approvalRTT.load();
+
+    _telemetryBytesSent = bytesSent;
+    _telemetryBytesReceived = bytesReceived;
+    _telemetryMessages = messages;
+    _telemetryNext = (_telemetryNext + 1) % TELEMETRY_SAMPLES;
+    _telemetryCount = min(_telemetryCount + 1, TELEMETRY_SAMPLES);
+}
+
+vector<STCPNode::Peer::TelemetrySample> STCPNode::Peer::getTelemetry() const {
+    lock_guard<mutex> lock(_telemetryMutex);
+    vector<TelemetrySample> samples;
+    samples.reserve(_telemetryCount);
+    for (size_t i = 0; i < _telemetryCount; i++) {
+        samples.push_back(_telemetry[(_telemetryNext + TELEMETRY_SAMPLES - _telemetryCount + i) % TELEMETRY_SAMPLES]);
+    }
+    return samples;
+}
+
+string STCPNode::Peer::getTelemetryJSON() const {
+    list<string> samples;
+    for (const TelemetrySample& sample : getTelemetry()) {
+        samples.push_back(SComposeJSONObject({
+            {"timestamp", to_string(sample.timestamp)},
+            {"commitLag", to_string(sample.commitLag)},
+            {"applyLagMS", to_string(sample.applyLagMS)},
+            {"bytesSentPerSecond", to_string(sample.bytesSentPerSecond)},
+            {"bytesReceivedPerSecond", to_string(sample.bytesReceivedPerSecond)},
+            {"messagesPerSecond", to_string(sample.messagesPerSecond)},
+            {"sendBufferBytes", to_string(sample.sendBufferBytes)},
+            {"approvalRTT", to_string(sample.approvalRTT)},
+        }));
+    }
+    return SComposeJSONArray(samples);
+}
+
 bool STCPNode::Peer::isPermafollower(const STable& params) {
     auto it = params.find("Permafollower");
     if (it != params.end() && it->second == "true") {
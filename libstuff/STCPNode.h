@@ -58,10 +58,17 @@ struct STCPNode : public STCPServer {
     static const string& stateName(State state);
     static State stateFromName(const string& name);
 
-    // Updates all peers
+    // Updates all peers. If the network thread is running, these only hand off events it has queued.
     void prePoll(fd_map& fdm);
     void postPoll(fd_map& fdm, uint64_t& nextActivity);
 
+    // Moves all peer socket I/O (sending, receiving, PING/PONG, and message framing) onto a dedicated thread, so that
+    // replication traffic keeps flowing while the thread calling pre/postPoll is busy. Connections, messages, and
+    // disconnections are still delivered to `_onConnect`, `_onMESSAGE`, and `_onDisconnect` on the thread calling
+    // postPoll, in the order they happened.
+    void startNetworkThread();
+    void stopNetworkThread();
+
     // Represents a single peer in the database cluster
     class Peer {
       public:
@@ -73,6 +80,23 @@ struct STCPNode : public STCPServer {
             DENY
         };
 
+        // A single point in this peer's replication telemetry. Rates are averaged over the time since the previous
+        // sample.
+        struct TelemetrySample {
+            uint64_t timestamp;
+            uint64_t commitLag;
+            uint64_t applyLagMS;
+            uint64_t bytesSentPerSecond;
+            uint64_t bytesReceivedPerSecond;
+            uint64_t messagesPerSecond;
+            uint64_t sendBufferBytes;
+            uint64_t approvalRTT;
+        };
+
+        // How many telemetry samples we keep for each peer, and how often the node takes them.
+        static constexpr size_t TELEMETRY_SAMPLES = 300;
+        static constexpr uint64_t TELEMETRY_INTERVAL = STIME_US_PER_S;
+
         // Const (and thus implicitly thread-safe) attributes of this Peer.
         const string name;
         const string host;
@@ -99,6 +123,17 @@ struct STCPNode : public STCPServer {
         atomic<Response> transactionResponse;
         atomic<string> version;
 
+        // Counters for telemetry. `approvalRTT` is the time in microseconds between the most recent transaction we
+        // sent this peer and its approval.
+        atomic<uint64_t> messagesSent;
+        atomic<uint64_t> messagesReceived;
+        atomic<uint64_t> approvalRTT;
+
+        // The most bytes we've seen waiting in this peer's send buffer, and the number of times it's gone over the
+        // node's limit, causing us to drop the connection.
+        atomic<uint64_t> sendBufferHighWater;
+        atomic<uint64_t> sendBufferOverflows;
+
         // Constructor.
         Peer(const string& name_, const string& host_, const STable& params_, uint64_t id_);
 
@@ -123,18 +158,38 @@ struct STCPNode : public STCPServer {
         // Send a message to this peer. Thread-safe.
         void sendMessage(const SData& message);
 
+        // Update `sendBufferHighWater` from the current size of the send buffer, which is returned. Call with
+        // `_stateMutex` locked, or from the thread that owns the socket.
+        size_t updateSendBufferHighWater();
+
         // Get a string name for a Response object.
         static string responseName(Response response);
 
+        // Takes a telemetry sample for this peer, given the commit count it should be caught up to, and adds it to
+        // the ring buffer of samples, overwriting the oldest if it's full. Should only be called by the node that owns
+        // this peer.
+        void recordTelemetry(uint64_t localCommitCount);
+
+        // Returns the stored telemetry samples, oldest first.
+        vector<TelemetrySample> getTelemetry() const;
+
+        // Returns a JSON array of the stored telemetry samples, oldest first.
+        string getTelemetryJSON() const;
+
       private:
         // The hash corresponding to commitCount.
         atomic<string> hash;
 
         // This allows direct access to the socket from the node object that should actually be managing peer
-        // connections, which should always be handled by a single thread, and thus safe. Ideally, this isn't required,
-        // but for the time being, the amount of refactoring required to fix that is too high.
+        // connections. Ideally, this isn't required, but for the time being, the amount of refactoring required to fix
+        // that is too high. The network thread (if it's running) opens and attaches sockets, and the thread calling
+        // postPoll closes them, so `socket` is only ever changed with `_stateMutex` locked (and, while the network
+        // thread is running, `STCPNode::_socketListMutex` as well). The network thread can use it with just the
+        // latter, but any other thread needs to lock `_stateMutex` to use it.
         friend class STCPNode;
         friend class SQLiteNode;
+        friend class STCPNodeTester;
+        friend class SQLiteNodeTester;
         Socket* socket = nullptr;
 
         // Mutex for locking around non-atomic member access (for set/getCommit, accessing socket, etc).
@@ -142,6 +197,24 @@ struct STCPNode : public STCPServer {
 
         // For initializing the permafollower value from the params list.
         static bool isPermafollower(const STable& params);
+
+        // Ring buffer of telemetry samples. `_telemetryCount` is the number of samples stored, and `_telemetryNext`
+        // the index the next one will be written to.
+        array<TelemetrySample, TELEMETRY_SAMPLES> _telemetry;
+        size_t _telemetryNext;
+        size_t _telemetryCount;
+
+        // What the counters were at the last sample, so we can compute rates. The socket's byte counters start over
+        // with each new socket, so we keep track of which one we last saw, and when they're reset.
+        uint64_t _telemetrySocketID;
+        uint64_t _telemetryBytesSent;
+        uint64_t _telemetryBytesReceived;
+        uint64_t _telemetryMessages;
+
+        // The last time this peer had every commit we did, for computing apply lag.
+        uint64_t _caughtUpTime;
+
+        mutable mutex _telemetryMutex;
     };
 
     // Begins listening for connections on a given port
@@ -171,15 +244,50 @@ struct STCPNode : public STCPServer {
     uint64_t getIDByPeer(Peer* peer);
 
   private:
+    // Something that happened on the network thread that needs to be handled by the thread calling postPoll.
+    struct NetworkEvent {
+        enum Type { CONNECT, MESSAGE, DISCONNECT };
+        Type type;
+        Peer* peer;
+        SData message;
+    };
+
     // Override dead function
     void postPoll(fd_map& ignore) { SERROR("Don't call."); }
 
     // Helper functions
     void _sendPING(Peer* peer);
 
+    // Accepts and logs in new peers, processes each peer's socket, and reconnects dead peers. If `queueEvents` is set,
+    // connections, messages, and disconnections are queued for the thread calling postPoll rather than handled inline.
+    void _processSockets(uint64_t& nextActivity, bool queueEvents);
+
+    // Handles everything queued by the network thread since the last call.
+    void _processNetworkEvents(uint64_t& nextActivity);
+
+    // Main loop of the network thread, and a way to interrupt its `poll`.
+    void _networkLoop();
+    void _wakeNetworkThread();
+
     AutoTimer _deserializeTimer;
     AutoTimer _sConsumeFrontTimer;
     AutoTimer _sAppendTimer;
+
+    // Network thread and its hand-off queue to the thread calling postPoll.
+    thread _networkThread;
+    atomic<bool> _networkThreadRunning;
+    SSynchronizedQueue<NetworkEvent> _networkEvents;
+
+    // Pipe written to wake the network thread up when there's new data to send.
+    int _networkWakeFD[2] = {-1, -1};
+
+    // Protects `socketList`, `acceptedSocketList`, and each peer's `socket` pointer while the network thread is
+    // running, as sockets are opened and accepted on the network thread but closed on the thread calling postPoll.
+    recursive_mutex _socketListMutex;
+
+    // Peers whose disconnection has been queued but not yet handled. We don't reconnect these until it is.
+    set<Peer*> _disconnectingPeers;
+
 };
 
 // serialization for Responses.
@@ -12,12 +12,12 @@ STCPServer::~STCPServer() {
     closePorts();
 }
 
-STCPServer::Port* STCPServer::openPort(const string& host) {
+STCPServer::Port* STCPServer::openPort(const string& host, bool reusePort) {
     // Open a port on the requested host
     SASSERT(SHostIsValid(host));
     Port port;
     port.host = host;
-    port.s = S_socket(host, true, true, false);
+    port.s = S_socket(host, true, true, false, reusePort);
     SASSERT(port.s >= 0);
     lock_guard <decltype(portListMutex)> lock(portListMutex);
     list<Port>::iterator portIt = portList.insert(portList.end(), port);
@@ -63,6 +63,7 @@ STCPManager::Socket* STCPServer::acceptSocket(Port*& portOut) {
             socket = new Socket(s, Socket::CONNECTED);
             socket->addr = addr;
             socketList.push_back(socket);
+            _epollAdd(socket);
 
             // Try to read immediately
             S_recvappend(socket->s, socket->recvBuffer);
@@ -86,8 +87,8 @@ void STCPServer::prePoll(fd_map& fdm) {
     }
 }
 
-void STCPServer::postPoll(fd_map& fdm) {
+list<STCPManager::Socket*> STCPServer::postPoll(fd_map& fdm) {
     // Process all the existing sockets.
     // FIXME: Detect port failure
-    STCPManager::postPoll(fdm);
+    return STCPManager::postPoll(fdm);
 }
@@ -16,8 +16,9 @@ struct STCPServer : public STCPManager {
     // Destructor
     virtual ~STCPServer();
 
-    // Begins listening on a new port
-    Port* openPort(const string& host);
+    // Begins listening on a new port. If `reusePort` is set, other sockets can listen on the same port, as long as
+    // they set it too, and new connections are balanced between them.
+    Port* openPort(const string& host, bool reusePort = false);
 
     // Closes all open ports, allowing for exceptions.
     void closePorts(list<Port*> except = {});
@@ -29,9 +30,9 @@ struct STCPServer : public STCPManager {
         return acceptSocket(ignore);
     }
 
-    // Updates all managed ports and sockets
+    // Updates all managed ports and sockets. `postPoll` returns the sockets to look at, as `STCPManager::postPoll`.
     void prePoll(fd_map& fdm);
-    void postPoll(fd_map& fdm);
+    list<Socket*> postPoll(fd_map& fdm);
 
     // Attributes
     list<Port> portList;
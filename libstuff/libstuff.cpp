@@ -1672,7 +1672,7 @@ string SGUnzip (const string& content) {
 /////////////////////////////////////////////////////////////////////////////
 
 // --------------------------------------------------------------------------
-int S_socket(const string& host, bool isTCP, bool isPort, bool isBlocking) {
+int S_socket(const string& host, bool isTCP, bool isPort, bool isBlocking, bool reusePort) {
     // Try to set up the socket
     int s = 0;
     try {
@@ -1741,6 +1741,11 @@ int S_socket(const string& host, bool isTCP, bool isPort, bool isBlocking) {
             if (setsockopt(s, SOL_SOCKET, SO_REUSEADDR, (char*)&enable, sizeof(enable)))
                 STHROW("couldn't set REUSEADDR");
 
+            // If requested, let other sockets bind the same port, and have the kernel balance connections across them.
+            int reusePortEnable = 1;
+            if (reusePort && setsockopt(s, SOL_SOCKET, SO_REUSEPORT, &reusePortEnable, sizeof(reusePortEnable)))
+                STHROW("couldn't set REUSEPORT");
+
             // Bind to the configured port
             sockaddr_in addr;
             memset(&addr, 0, sizeof(addr));
@@ -2339,14 +2344,22 @@ uint64_t SFileSize(const string& path) {
 string SHashSHA1(const string& buffer) {
     string result;
     result.resize(20);
-    mbedtls_sha1((unsigned char*)buffer.c_str(), buffer.size(), (unsigned char*)&result[0]);
+    if (SHash::hardwareEnabled.load() && SHash::hardwareSupported()) {
+        SHash::sha1((const unsigned char*)buffer.c_str(), buffer.size(), (unsigned char*)&result[0]);
+    } else {
+        mbedtls_sha1((unsigned char*)buffer.c_str(), buffer.size(), (unsigned char*)&result[0]);
+    }
     return result;
 }
 
 string SHashSHA256(const string& buffer) {
     string result;
     result.resize(32);
-    mbedtls_sha256((unsigned char*)buffer.c_str(), buffer.size(), (unsigned char*)&result[0], 0);
+    if (SHash::hardwareEnabled.load() && SHash::hardwareSupported()) {
+        SHash::sha256((const unsigned char*)buffer.c_str(), buffer.size(), (unsigned char*)&result[0]);
+    } else {
+        mbedtls_sha256((unsigned char*)buffer.c_str(), buffer.size(), (unsigned char*)&result[0], 0);
+    }
     return result;
 }
 
@@ -626,7 +626,7 @@ void SFDset(fd_map& fdm, int socket, short evts);
 bool SFDAnySet(fd_map& fdm, int socket, short evts);
 
 // Socket helpers
-int S_socket(const string& host, bool isTCP, bool isPort, bool isBlocking);
+int S_socket(const string& host, bool isTCP, bool isPort, bool isBlocking, bool reusePort = false);
 int S_accept(int port, sockaddr_in& fromAddr, bool isBlocking);
 ssize_t S_recvfrom(int s, char* recvBuffer, int recvBufferSize, sockaddr_in& fromAddr);
 bool S_recvappend(int s, SFastBuffer& recvBuffer);
@@ -660,7 +660,7 @@ uint64_t SFileSize(const string& path);
 // --------------------------------------------------------------------------
 // Crypto stuff
 // --------------------------------------------------------------------------
-// Various hashing functions
+// Various hashing functions. These use the CPU's SHA extensions if it has them (see SHash.h).
 string SHashSHA1(const string& buffer);
 string SHashSHA256(const string& buffer);
 
@@ -803,6 +803,7 @@ struct STestTimer {
 // Networking includes
 #include "SX509.h"
 #include "SSSLState.h"
+#include "SSynchronizedQueue.h"
 #include "STCPManager.h"
 #include "STCPServer.h"
 #include "STCPNode.h"
@@ -810,7 +811,7 @@ struct STestTimer {
 
 // Other libstuff headers.
 #include "SRandom.h"
+#include "SHash.h"
 #include "SPerformanceTimer.h"
-#include "SSynchronizedQueue.h"
 
 #endif	// LIBSTUFF_H
@@ -223,6 +223,15 @@ int main(int argc, char* argv[]) {
         cout << "-q                          Enables quiet logging" << endl;
         cout << "-clean                      Recreate a new database from scratch" << endl;
         cout << "-enableMultiWrite           Enable multi-write mode (default: true)" << endl;
+        cout << "-autoBlacklistConflictPercent <#> Send commands to the sync thread instead of committing them on workers "
+                "when this percentage of their worker commits conflict (default 50, 0 to disable)"
+             << endl;
+        cout << "-autoBlacklistMinCommits <#> Number of worker commits to measure before -autoBlacklistConflictPercent "
+                "applies (default 20)"
+             << endl;
+        cout << "-autoBlacklistSeconds <#>   How long a command stays off the workers before it's retried, doubling if "
+                "it keeps conflicting (default 60)"
+             << endl;
         cout << "-versionOverride <version>  Pretends to be a different version when talking to peers" << endl;
         cout << "-db             <filename>  Use a database with the given name (default 'bedrock.db')" << endl;
         cout
@@ -241,6 +250,52 @@ int main(int argc, char* argv[]) {
              << endl;
         cout << "-maxJournalSize <#commits>  Number of commits to retain in the historical journal (default 1000000)"
              << endl;
+        cout << "-snapshotThreshold <#commits> Download a snapshot of a peer's DB instead of synchronizing when this "
+                "far behind (default disabled)"
+             << endl;
+        cout << "-snapshotMaxBytesPerSecond <#> Limit the rate this node serves snapshots to peers (default unlimited)"
+             << endl;
+        cout << "-quorumPipelineDepth <#>    Number of QUORUM commits leader can have awaiting approval at once "
+                "(default 1, no pipelining)"
+             << endl;
+        cout << "-syncNetworkThread          Handle peer network I/O on its own thread rather than the sync thread"
+             << endl;
+        cout << "-peerSendBufferLimitMB <#>  Disconnect a peer with more than this much data waiting to be sent to it "
+                "(default 0, unlimited)"
+             << endl;
+        cout << "-clientPipelineDepth <#>    Number of commands a client connection can have in flight at once, if each "
+                "request has a requestID header (default 1, no pipelining)"
+             << endl;
+        cout << "-ioThreads <#>              Handle command port connections on this many threads rather than the main "
+                "thread (default 0)"
+             << endl;
+        cout << "-pollBackend <poll|epoll>   How sockets are watched for activity (default poll)" << endl;
+        cout << "-queueOrder <scheduled|deadline|fair> Run queued commands of the same priority in the order they were "
+                "scheduled, earliest timeout first, or fairly across clients (default scheduled)"
+             << endl;
+        cout << "-fairQueueKey <header>      Request header that identifies the client for -queueOrder fair and "
+                "-clientRateLimit (default _source, the client's IP)"
+             << endl;
+        cout << "-fairQueueWeights <list>    Comma-separated client:weight pairs giving clients a larger share with "
+                "-queueOrder fair (default weight 1)"
+             << endl;
+        cout << "-clientRateLimit <#>        Most new commands per second each client can have run (default unlimited)"
+             << endl;
+        cout << "-clientRateBurst <#>        Number of commands a client can run at once before -clientRateLimit applies "
+                "(default 1)"
+             << endl;
+        cout << "-admissionTargetMS <#>      Reject new commands below -admissionShedBelow priority with a 503 while "
+                "every command at their priority waits longer than this in the queue (default disabled)"
+             << endl;
+        cout << "-admissionMaxQueued <#>     Reject new commands below -admissionShedBelow priority with a 503 while "
+                "this many commands are queued ahead of them (default disabled)"
+             << endl;
+        cout << "-admissionShedBelow <#>     Priority below which new commands can be rejected (default 500)" << endl;
+        cout << "-admissionIntervalMS <#>    How often queue waits are measured for -admissionTargetMS (default 100)"
+             << endl;
+        cout << "-coalesceCommands <list>    Comma-separated list of read-only verbs for which identical commands running "
+                "at once share a single peek and its response (default none)"
+             << endl;
         cout << "-synchronous    <value>     Set the PRAGMA schema.synchronous "
                 "(defaults see https://sqlite.org/pragma.html#pragma_synchronous)"
              << endl;
@@ -332,6 +387,18 @@ int main(int argc, char* argv[]) {
     // Log stack traces if we have unhandled exceptions.
     set_terminate(STerminateHandler);
 
+    // Choose how sockets are watched before creating anything that manages them.
+    if (args["-pollBackend"] == "epoll") {
+        SINFO("Using epoll to watch sockets.");
+        STCPManager::pollBackend = STCPManager::EPOLL;
+    } else if (args.isSet("-pollBackend") && args["-pollBackend"] != "poll") {
+        SERROR("Unknown -pollBackend '" << args["-pollBackend"] << "'.");
+    }
+    if (args.isSet("-queueOrder") && args["-queueOrder"] != "scheduled" && args["-queueOrder"] != "deadline" &&
+        args["-queueOrder"] != "fair") {
+        SERROR("Unknown -queueOrder '" << args["-queueOrder"] << "'.");
+    }
+
     // Create our BedrockServer object so we can keep it for the life of the
     // program.
     SINFO("Starting bedrock server");
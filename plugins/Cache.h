@@ -12,6 +12,7 @@ class BedrockPlugin_Cache : public BedrockPlugin {
     virtual const string& getName() const;
     virtual void upgradeDatabase(SQLite& db);
     virtual unique_ptr<BedrockCommand> getCommand(SQLiteCommand&& baseCommand);
+    virtual const set<string, STableComp>& getSupportedVerbs() const { return supportedRequestVerbs; }
     static const string name;
 
     // Bedrock Cache LRU map
@@ -59,6 +60,9 @@ class BedrockCacheCommand : public BedrockCommand {
     virtual bool peek(SQLite& db);
     virtual void process(SQLite& db);
 
+    // Identical reads can share a response.
+    virtual bool shouldCoalesce() { return SIEquals(request.getVerb(), "ReadCache"); }
+
   private:
     BedrockPlugin_Cache& plugin() { return static_cast<BedrockPlugin_Cache&>(*_plugin); }
 };
@@ -9,6 +9,10 @@ const string& BedrockPlugin_DB::getName() const {
     return name;
 }
 
+const set<string, STableComp> BedrockPlugin_DB::supportedRequestVerbs = {
+    "Query",
+};
+
 BedrockPlugin_DB::BedrockPlugin_DB(BedrockServer& s) : BedrockPlugin(s)
 {
 }
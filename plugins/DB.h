@@ -8,6 +8,11 @@ class BedrockPlugin_DB : public BedrockPlugin {
     virtual const string& getName() const;
     virtual unique_ptr<BedrockCommand> getCommand(SQLiteCommand&& baseCommand);
     static const string name;
+
+    // We handle `Query` by verb, but also `Query: ...sql...`, which has to be matched by prefix.
+    virtual const set<string, STableComp>& getSupportedVerbs() const { return supportedRequestVerbs; }
+    virtual bool handlesUnregisteredVerbs() const { return true; }
+    static const set<string, STableComp> supportedRequestVerbs;
 };
 
 class BedrockDBCommand : public BedrockCommand {
@@ -6,6 +6,7 @@ class BedrockPlugin_Jobs : public BedrockPlugin {
   public:
     BedrockPlugin_Jobs(BedrockServer& s);
     virtual unique_ptr<BedrockCommand> getCommand(SQLiteCommand&& baseCommand);
+    virtual const set<string, STableComp>& getSupportedVerbs() const { return supportedRequestVerbs; }
     virtual const string& getName() const;
     virtual void upgradeDatabase(SQLite& db);
 
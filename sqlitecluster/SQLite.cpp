@@ -907,6 +907,98 @@ bool SQLite::getCommits(uint64_t fromIndex, uint64_t toIndex, SQResult& result)
     return !SQuery(_db, "getting commits", query, result);
 }
 
+bool SQLite::createSnapshot(const string& filename, uint64_t& commitCount, string& hash) {
+    SASSERT(!_insideTransaction);
+
+    // VACUUM INTO reads the whole DB in a single read transaction, so the copy is consistent. It can take a long time
+    // on a large DB, so we don't let a checkpoint interrupt it.
+    unlink(filename.c_str());
+    bool enableCheckpointInterrupt = _enableCheckpointInterrupt;
+    _enableCheckpointInterrupt = false;
+    int result = SQuery(_db, "creating snapshot", "VACUUM INTO " + SQ(filename) + ";", STIME_US_PER_M);
+    _enableCheckpointInterrupt = enableCheckpointInterrupt;
+    if (result) {
+        DBINFO("Couldn't create snapshot '" << filename << "', error: " << result);
+        return false;
+    }
+
+    // Open the copy and find its latest commit.
+    sqlite3* snapshot = nullptr;
+    if (sqlite3_open_v2(filename.c_str(), &snapshot, SQLITE_OPEN_READWRITE | SQLITE_OPEN_NOMUTEX, NULL)) {
+        sqlite3_close(snapshot);
+        return false;
+    }
+    vector<string> journalNames = initializeJournal(snapshot, -2);
+    string query = "SELECT MAX(maxIDs) FROM (" + _getJournalQuery(journalNames, {"SELECT MAX(id) as maxIDs FROM"}, true) + ")";
+    SQResult maxResult;
+    string lastQuery;
+    if (journalNames.empty() || SQuery(snapshot, "getting snapshot commit count", query, maxResult) || maxResult.empty() ||
+        !(commitCount = SToUInt64(maxResult[0][0])) || !getCommit(snapshot, journalNames, commitCount, lastQuery, hash)) {
+        sqlite3_close(snapshot);
+        return false;
+    }
+
+    // The receiving node doesn't need the history before the snapshot (it can't have commits that are in the snapshot
+    // without having the snapshot), and it will have its own set of journal tables, so we reduce the journal to a
+    // single row in `journal`. Then we vacuum again to actually release the space the old journal used.
+    bool success = !SQuery(snapshot, "trimming snapshot journal", "BEGIN TRANSACTION;");
+    for (const string& journalName : journalNames) {
+        if (journalName == "journal") {
+            success = success && !SQuery(snapshot, "trimming snapshot journal", "DELETE FROM journal;");
+        } else {
+            success = success && !SQuery(snapshot, "trimming snapshot journal", "DROP TABLE " + journalName + ";");
+        }
+    }
+    success = success && !SQuery(snapshot, "trimming snapshot journal",
+                                 "INSERT INTO journal VALUES (" + SQ(commitCount) + ", " + SQ(lastQuery) + ", " + SQ(hash) + ");");
+    success = success && !SQuery(snapshot, "trimming snapshot journal", "COMMIT;");
+    success = success && !SQuery(snapshot, "compacting snapshot", "VACUUM;", STIME_US_PER_M);
+    sqlite3_close(snapshot);
+    DBINFO((success ? "Created" : "Failed to create") << " snapshot '" << filename << "' at commit " << commitCount);
+    return success;
+}
+
+bool SQLite::restoreSnapshot(const string& filename, uint64_t commitCount, const string& hash) {
+    SASSERT(!_insideTransaction);
+    sqlite3* snapshot = nullptr;
+    if (sqlite3_open_v2(filename.c_str(), &snapshot, SQLITE_OPEN_READONLY | SQLITE_OPEN_NOMUTEX, NULL)) {
+        sqlite3_close(snapshot);
+        return false;
+    }
+
+    // Make sure this is the snapshot we expect.
+    string query, snapshotHash;
+    if (!SQVerifyTableExists(snapshot, "journal") || !getCommit(snapshot, {"journal"}, commitCount, query, snapshotHash) ||
+        snapshotHash != hash) {
+        DBINFO("Snapshot '" << filename << "' doesn't contain commit " << commitCount << " (" << hash << ").");
+        sqlite3_close(snapshot);
+        return false;
+    }
+
+    // Hold the commit lock so no other handle can commit while the contents change underneath it. The backup runs in
+    // a single transaction on our handle, so if it fails, nothing has changed.
+    lock_guard<decltype(_sharedData.commitLock)> lock(_sharedData.commitLock);
+    sqlite3_backup* backup = sqlite3_backup_init(_db, "main", snapshot, "main");
+    int result = backup ? sqlite3_backup_step(backup, -1) : sqlite3_errcode(_db);
+    if (backup) {
+        sqlite3_backup_finish(backup);
+    }
+    sqlite3_close(snapshot);
+    if (result != SQLITE_DONE) {
+        DBINFO("Couldn't restore snapshot '" << filename << "', error: " << result);
+        return false;
+    }
+
+    // The snapshot only has `journal`, put back the rest of the journal tables this node expects.
+    for (const string& journalName : _journalNames) {
+        SQVerifyTable(_db, journalName, "CREATE TABLE " + journalName + " ( id INTEGER PRIMARY KEY, query TEXT, hash TEXT )");
+    }
+    _sharedData.resetCommit(commitCount, hash);
+    _journalSize = 0;
+    DBINFO("Restored snapshot '" << filename << "' at commit " << commitCount);
+    return true;
+}
+
 int64_t SQLite::getLastInsertRowID() {
     // Make sure it *does* happen after an INSERT, but not with a IGNORE
     SASSERTWARN(SContains(_uncommittedQuery, "INSERT") || SContains(_uncommittedQuery, "REPLACE"));
@@ -1088,6 +1180,14 @@ void SQLite::removeCheckpointListener(SQLite::CheckpointRequiredListener& listen
     _sharedData.removeCheckpointListener(listener);
 }
 
+void SQLite::addCommitListener(SQLite::CommitListener& listener) {
+    _sharedData.addCommitListener(listener);
+}
+
+void SQLite::removeCommitListener(SQLite::CommitListener& listener) {
+    _sharedData.removeCommitListener(listener);
+}
+
 void SQLite::setCommitEnabled(bool enable) {
     _sharedData.setCommitEnabled(enable);
 }
@@ -1119,6 +1219,16 @@ void SQLite::SharedData::removeCheckpointListener(SQLite::CheckpointRequiredList
     _checkpointListeners.erase(&listener);
 }
 
+void SQLite::SharedData::addCommitListener(SQLite::CommitListener& listener) {
+    lock_guard<decltype(_internalStateMutex)> lock(_internalStateMutex);
+    _commitListeners.insert(&listener);
+}
+
+void SQLite::SharedData::removeCommitListener(SQLite::CommitListener& listener) {
+    lock_guard<decltype(_internalStateMutex)> lock(_internalStateMutex);
+    _commitListeners.erase(&listener);
+}
+
 void SQLite::SharedData::checkpointRequired(SQLite& db) {
     lock_guard<decltype(_internalStateMutex)> lock(_internalStateMutex);
     for (auto listener : _checkpointListeners) {
@@ -1138,6 +1248,20 @@ void SQLite::SharedData::incrementCommit(const string& commitHash) {
     commitCount++;
     commitTransactionInfo(commitCount);
     lastCommittedHash.store(commitHash);
+    for (auto listener : _commitListeners) {
+        listener->committed(commitCount);
+    }
+}
+
+void SQLite::SharedData::resetCommit(uint64_t count, const string& commitHash) {
+    lock_guard<decltype(_internalStateMutex)> lock(_internalStateMutex);
+    commitCount = count;
+    lastCommittedHash.store(commitHash);
+    _preparedTransactions.clear();
+    _committedTransactions.clear();
+    for (auto listener : _commitListeners) {
+        listener->committed(commitCount);
+    }
 }
 
 void SQLite::SharedData::prepareTransactionInfo(uint64_t commitID, const string& query, const string& hash, uint64_t dbCountAtTransactionStart) {
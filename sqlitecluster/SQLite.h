@@ -68,6 +68,14 @@ class SQLite {
         virtual void checkpointComplete(SQLite& db) = 0;
     };
 
+    // Anything that needs to know as soon as a commit is applied, by any handle to this DB, can implement this
+    // interface. `committed` is called with the new commit count while the commit lock is still held, so it must be
+    // quick, and must not try to access the DB.
+    class CommitListener {
+      public:
+        virtual void committed(uint64_t commitCount) = 0;
+    };
+
     // minJournalTables: Creates journal tables through the specified number. If `-1` is passed, only `journal` is
     //                   created. If some value larger than -1 is passed, then journals `journal0000 through
     //                   journalNNNN` are created (or left alone if such tables already exist). If -2 or less is
@@ -215,6 +223,17 @@ class SQLite {
     // Looks up a range of commits.
     bool getCommits(uint64_t fromIndex, uint64_t toIndex, SQResult& result);
 
+    // Writes a consistent copy of this database to `filename` (replacing it if it exists), for bootstrapping another
+    // node. The copy's journal is reduced to just its latest commit, which is returned in `commitCount` and `hash`.
+    // Must be called outside of a transaction. Returns false on failure.
+    bool createSnapshot(const string& filename, uint64_t& commitCount, string& hash);
+
+    // Replaces the entire contents of this database with a copy made by `createSnapshot`, and resets the commit count
+    // and hash shared by all handles to this database to match it. No other handle may be inside a transaction.
+    // Returns false, leaving the database unchanged, if the snapshot can't be read or its latest commit doesn't match
+    // `commitCount` and `hash`.
+    bool restoreSnapshot(const string& filename, uint64_t commitCount, const string& hash);
+
     // Start a timing operation, that will time out after the given number of microseconds.
     void startTiming(uint64_t timeLimitUS);
 
@@ -226,6 +245,10 @@ class SQLite {
     void addCheckpointListener(CheckpointRequiredListener& listener);
     void removeCheckpointListener(CheckpointRequiredListener& listener);
 
+    // Register and deregister listeners for commits. See `CommitListener` above.
+    void addCommitListener(CommitListener& listener);
+    void removeCommitListener(CommitListener& listener);
+
     // This atomically removes and returns committed transactions from our internal list. SQLiteNode can call this, and
     // it will return a map of transaction IDs to tuples of (query, hash, dbCountAtTransactionStart), so that those
     // transactions can be replicated out to peers.
@@ -279,6 +302,10 @@ class SQLite {
         void checkpointRequired(SQLite& db);
         void checkpointComplete(SQLite& db);
 
+        // Add and remove commit listeners in a thread-safe way.
+        void addCommitListener(CommitListener& listener);
+        void removeCommitListener(CommitListener& listener);
+
         // Enable or disable commits for the DB.
         void setCommitEnabled(bool enable);
 
@@ -286,6 +313,10 @@ class SQLite {
         // after completing a commit and before releasing the commit lock.
         void incrementCommit(const string& commitHash);
 
+        // Replace the shared state of the DB entirely, after its contents have been replaced by a snapshot. Discards any
+        // prepared or committed transactions that haven't been replicated.
+        void resetCommit(uint64_t count, const string& commitHash);
+
         // This removes and returns all committed transactions.
         map<uint64_t, tuple<string, string, uint64_t>> popCommittedTransactions();
 
@@ -344,6 +375,9 @@ class SQLite {
 
         // set of objects listening for checkpoints.
         set<SQLite::CheckpointRequiredListener*> _checkpointListeners;
+
+        // set of objects listening for commits.
+        set<SQLite::CommitListener*> _commitListeners;
         
         // This mutex is locked when we need to change the state of the _shareData object. It is shared between a
         // variety of operations (i.e., inserting checkpoint listeners, updating _committedTransactions, etc.
@@ -22,6 +22,8 @@ SData SQLiteCommand::preprocessRequest(SData&& request) {
 SQLiteCommand::SQLiteCommand(SData&& _request) : 
     initiatingPeerID(0),
     initiatingClientID(0),
+    clientSequence(0),
+    orderedResponse(false),
     request(preprocessRequest(move(_request))),
     writeConsistency(SQLiteNode::ASYNC),
     complete(false),
@@ -51,6 +53,8 @@ SQLiteCommand::SQLiteCommand(SData&& _request) :
 SQLiteCommand::SQLiteCommand() :
     initiatingPeerID(0),
     initiatingClientID(0),
+    clientSequence(0),
+    orderedResponse(false),
     writeConsistency(SQLiteNode::ASYNC),
     complete(false),
     escalationTimeUS(0),
@@ -23,6 +23,12 @@ class SQLiteCommand {
     // can't respond to.
     int64_t initiatingClientID;
 
+    // If this command came from a client connection, the order it was read from that connection in (starting from 1,
+    // 0 is unset), and whether the client asked for its response to wait until every earlier request on the
+    // connection has been answered. These are only meaningful when the client is pipelining requests.
+    uint64_t clientSequence;
+    bool orderedResponse;
+
     // Each command is given a unique id that can be serialized and passed back and forth across nodes. Its id must be
     // uniquely identifiable for cases where, for instance, two peers escalate commands to the leader, and leader will
     // need to  respond to them.
@@ -56,6 +62,10 @@ class SQLiteCommand {
     // Whether or not the command has been escalated.
     bool escalated;
 
+    // Return the timestamp by which this command must finish executing, or 0 if it has no deadline. Escalations pass
+    // the time remaining until this to leader.
+    virtual uint64_t timeout() const { return 0; }
+
     // Construct that takes a request object.
     SQLiteCommand(SData&& _request);
 
@@ -1,3 +1,5 @@
+#include <fstream>
+
 #include <libstuff/libstuff.h>
 #include "SQLiteNode.h"
 #include "SQLiteServer.h"
@@ -44,6 +46,13 @@
 //                   and not some old out-of-date message from the past.
 // Response:         Sent in STANDUP_RESPONSE, either "approve" or "deny".
 // NumCommits:       With a "SYNCHRONIZE_RESPONSE" message, indicates the number of commits returned.
+// FromCommit:       With a "SYNCHRONIZE" message, the first commit being requested. Echoed back in the corresponding
+//                   "SYNCHRONIZE_RESPONSE" so that pipelined responses can be applied in order.
+// ToCommit:         With a "SYNCHRONIZE" message, the last commit being requested. The response may contain fewer.
+// Offset:           With a "SNAPSHOT" or "SNAPSHOT_RESPONSE" message, the byte offset into the snapshot file.
+// TotalSize:        With a "SNAPSHOT_RESPONSE" message, the size of the whole snapshot file in bytes.
+// SnapshotCommitCount: With a "SNAPSHOT" or "SNAPSHOT_RESPONSE" message, the latest commit in the snapshot, which
+//                   identifies it. "SnapshotHash" is the hash of that commit.
 // leaderSendTime:   Timestamp in microseconds that leader sent a message, for performance analysis.
 // dbCountAtStart:   The highest committed transaction in the DB at the start of this transaction on leader, for
 //                   optimizing replication.
@@ -54,6 +63,20 @@
 // Initializations for static vars.
 const uint64_t SQLiteNode::SQL_NODE_DEFAULT_RECV_TIMEOUT = STIME_US_PER_M * 5;
 const uint64_t SQLiteNode::SQL_NODE_SYNCHRONIZING_RECV_TIMEOUT = STIME_US_PER_S * 30;
+const size_t SQLiteNode::SQL_NODE_SYNC_MAX_IN_FLIGHT = 4;
+const size_t SQLiteNode::SQL_NODE_SYNC_MAX_PEERS = 3;
+const size_t SQLiteNode::SQL_NODE_SYNC_CHUNK_TARGET_BYTES = 1024 * 1024;
+const size_t SQLiteNode::SQL_NODE_SYNC_CHUNK_MAX_BYTES = 8 * 1024 * 1024;
+const size_t SQLiteNode::SQL_NODE_SNAPSHOT_CHUNK_BYTES = 4 * 1024 * 1024;
+const uint64_t SQLiteNode::SQL_NODE_SNAPSHOT_MAX_AGE = STIME_US_PER_M * 10;
+const uint64_t SQLiteNode::SQL_NODE_HEARTBEAT_INTERVAL = STIME_US_PER_MS * 250;
+const uint64_t SQLiteNode::SQL_NODE_SERIAL_REPLICATION_COMMITS = 100;
+const uint64_t SQLiteNode::SQL_NODE_REPLICATION_BATCH_COMMITS = 1000;
+const size_t SQLiteNode::SQL_NODE_REPLICATION_BATCHES_KEPT = 10;
+atomic<uint64_t> SQLiteNode::snapshotThreshold(0);
+atomic<uint64_t> SQLiteNode::snapshotMaxBytesPerSecond(0);
+atomic<size_t> SQLiteNode::quorumPipelineDepth(1);
+atomic<uint64_t> SQLiteNode::peerSendBufferLimit(0);
 uint64_t SQLiteNode::_lastSentTransactionID = 0;
 
 const string SQLiteNode::consistencyLevelNames[] = {"ASYNC",
@@ -93,12 +116,34 @@ SQLiteNode::SQLiteNode(SQLiteServer& server, SQLitePool& dbPool, const string& n
     : STCPNode(name, host, initPeers(peerList), max(SQL_NODE_DEFAULT_RECV_TIMEOUT, SQL_NODE_SYNCHRONIZING_RECV_TIMEOUT)),
       _dbPool(dbPool),
       _db(_dbPool.getBase()),
+      _syncNextRequestCommit(0),
+      _snapshotInProgress(false),
+      _snapshotFile(_db.getFilename() + ".snapshot.download"),
+      _snapshotCommitCount(0),
+      _snapshotThreadShouldExit(false),
+      _servedSnapshotCommitCount(0),
+      _servedSnapshotCreated(0),
+      _nextSnapshotSendTime(0),
+      _syncChunkCommits(100),
+      _syncInFlightDepth(0),
+      _syncActivePeers(0),
+      _syncStartCommit(0),
+      _syncStartTime(0),
+      _syncTargetCommit(0),
+      _snapshotBytesReceived(0),
+      _snapshotTotalBytes(0),
       _commitState(CommitState::UNINITIALIZED),
+      _lastPipelinedCommitID(0),
+      _quorumApprovedCommit(0),
+      _lastHeartbeatTime(0),
+      _caughtUpTime(0),
+      _lastTelemetryTime(0),
       _server(server),
       _stateChangeCount(0),
       _lastNetStatTime(chrono::steady_clock::now()),
       _handledCommitCount(0),
       _replicationThreadsShouldExit(false),
+      _serialReplicationUntil(0),
       _replicationThreadCount(0),
       _useParallelReplication(useParallelReplication),
       _multiReplicationThreadSpawn("multi-replication"),
@@ -116,6 +161,10 @@ SQLiteNode::SQLiteNode(SQLiteServer& server, SQLitePool& dbPool, const string& n
     _stateTimeout = STimeNow() + firstTimeout;
     _version = version;
 
+    for (auto& bucket : _escalationLatencyHistogram) {
+        bucket = 0;
+    }
+
     SINFO("[NOTIFY] setting commit count to: " << _db.getCommitCount());
     _localCommitNotifier.notifyThrough(_db.getCommitCount());
 
@@ -132,6 +181,16 @@ SQLiteNode::~SQLiteNode() {
     SASSERTWARN(_escalatedCommandMap.empty());
     SASSERTWARN(!commitInProgress());
 
+    // Stop serving snapshots. This waits for the one in progress, if any, but not for any rate limit.
+    {
+        lock_guard<mutex> lock(_snapshotRequestMutex);
+        _snapshotThreadShouldExit = true;
+    }
+    _snapshotRequestCV.notify_all();
+    if (_snapshotThread.joinable()) {
+        _snapshotThread.join();
+    }
+
     // Don't notify these, they won't exist anymore.
     _dbPool.getBase().removeCheckpointListener(_localCommitNotifier);
     _dbPool.getBase().removeCheckpointListener(_leaderCommitNotifier);
@@ -163,6 +222,13 @@ void SQLiteNode::replicate(SQLiteNode& node, Peer* peer, SData command, size_t s
             // the DB was at when the transaction began on leader).
             bool quorum = !SStartsWith(command["ID"], "ASYNC");
             uint64_t waitForCount = SStartsWith(command["ID"], "ASYNC") ? command.calcU64("dbCountAtStart") : currentCount;
+
+            // If this ran concurrently with an earlier transaction on leader, and replicated transactions have been
+            // conflicting recently, don't start it until the previous commit is done, so it can't conflict with it.
+            bool serial = waitForCount < currentCount && newCount <= node._serialReplicationUntil.load();
+            if (serial) {
+                waitForCount = currentCount;
+            }
             SINFO("Thread for commit " << newCount << " waiting on DB count " << waitForCount << " (" << (quorum ? "QUORUM" : "ASYNC") << ")");
             while (true) {
                 SQLiteSequentialNotifier::RESULT result = node._localCommitNotifier.waitFor(waitForCount);
@@ -187,6 +253,7 @@ void SQLiteNode::replicate(SQLiteNode& node, Peer* peer, SData command, size_t s
             try {
                 int result = -1;
                 int commitAttemptCount = 1;
+                uint64_t retries = 0;
                 while (result != SQLITE_OK) {
                     if (commitAttemptCount > 1) {
                         SINFO("Commit attempt number " << commitAttemptCount << " for concurrent replication.");
@@ -237,6 +304,8 @@ void SQLiteNode::replicate(SQLiteNode& node, Peer* peer, SData command, size_t s
                     if (uniqueContraintsError) {
                         SINFO("Got unique constraints error in replication, restarting.");
                         db.rollback();
+                        retries++;
+                        node._recordReplicationConflict(newCount);
                         continue;
                     } else if (waitResult == SQLiteSequentialNotifier::RESULT::CANCELED) {
                         SINFO("Replication canceled mid-transaction, stopping.");
@@ -254,8 +323,13 @@ void SQLiteNode::replicate(SQLiteNode& node, Peer* peer, SData command, size_t s
                     result = node.handleCommitTransaction(db, peer, command.calcU64("NewCount"), command["NewHash"]);
                     if (result != SQLITE_OK) {
                         db.rollback();
+                        retries++;
+                        node._recordReplicationConflict(newCount);
                     }
                 }
+                if (result == SQLITE_OK) {
+                    node._recordReplicationStats(newCount, retries, serial);
+                }
 
                 // Notify that we've succeeded (it actually also notifies if we were canceled, but that's fine).
                 node._localCommitNotifier.notifyThrough(db.getCommitCount());
@@ -286,6 +360,7 @@ void SQLiteNode::startCommit(ConsistencyLevel consistency)
             _commitState == CommitState::FAILED);
     _commitState = CommitState::WAITING;
     _commitConsistency = consistency;
+    _lastPipelinedCommitID = 0;
     if (_commitConsistency != QUORUM) {
         SHMMM("Non-quorum transaction running in the sync thread.");
     }
@@ -299,8 +374,188 @@ void SQLiteNode::sendResponse(const SQLiteCommand& command)
     SData escalate("ESCALATE_RESPONSE");
     escalate["ID"] = command.id;
     escalate.content = command.response.serialize();
-    SINFO("Sending ESCALATE_RESPONSE to " << peer->name << " for " << command.id << ".");
-    _sendToPeer(peer, escalate);
+    SINFO("Queueing ESCALATE_RESPONSE to " << peer->name << " for " << command.id << ".");
+    _pendingEscalateResponses.push(make_pair(command.initiatingPeerID, move(escalate)));
+}
+
+void SQLiteNode::prePoll(fd_map& fdm) {
+    _expireEscalatedCommands();
+    _sendPendingEscalations();
+    _pendingEscalateResponses.prePoll(fdm);
+    STCPNode::prePoll(fdm);
+}
+
+void SQLiteNode::postPoll(fd_map& fdm, uint64_t& nextActivity) {
+    // Queueing a response wakes us up, so send it now, rather than waiting for the next prePoll.
+    _pendingEscalateResponses.postPoll(fdm);
+    _sendPendingEscalateResponses();
+    STCPNode::postPoll(fdm, nextActivity);
+    _recordPeerTelemetry();
+
+    // Make sure we're woken up in time to send the next HEARTBEAT.
+    if (_state == LEADING) {
+        nextActivity = min(nextActivity, _lastHeartbeatTime + SQL_NODE_HEARTBEAT_INTERVAL);
+    }
+}
+
+void SQLiteNode::_recordPeerTelemetry() {
+    uint64_t now = STimeNow();
+    if (now < _lastTelemetryTime + Peer::TELEMETRY_INTERVAL) {
+        return;
+    }
+    _lastTelemetryTime = now;
+    uint64_t commitCount = _db.getCommitCount();
+    for (auto peer : peerList) {
+        peer->recordTelemetry(commitCount);
+    }
+}
+
+void SQLiteNode::_sendHeartbeats() {
+    uint64_t now = STimeNow();
+    if (now < _lastHeartbeatTime + SQL_NODE_HEARTBEAT_INTERVAL) {
+        return;
+    }
+    _lastHeartbeatTime = now;
+    for (auto peer : _heartbeatPeers) {
+        if (peer->subscribed) {
+            _sendToPeer(peer, SData("HEARTBEAT"));
+        }
+    }
+}
+
+void SQLiteNode::_recordLeaderContact(uint64_t leaderCommitCount) {
+    _leaderContacts.emplace_back(leaderCommitCount, STimeNow());
+
+    // If we're falling far behind, forget the oldest contacts. This only makes our staleness estimate more
+    // conservative.
+    if (_leaderContacts.size() > 1000) {
+        _leaderContacts.pop_front();
+    }
+    _updateCaughtUpTime();
+}
+
+void SQLiteNode::_updateCaughtUpTime() {
+    uint64_t commitCount = _db.getCommitCount();
+    while (!_leaderContacts.empty() && _leaderContacts.front().first <= commitCount) {
+        _caughtUpTime = _leaderContacts.front().second;
+        _leaderContacts.pop_front();
+    }
+}
+
+uint64_t SQLiteNode::getReadStalenessMS() {
+    State state = _state;
+    if (state == LEADING || state == STANDINGDOWN) {
+        return 0;
+    }
+    lock_guard<mutex> lock(_stalenessMutex);
+    if (state != FOLLOWING || !_caughtUpTime) {
+        return UINT64_MAX;
+    }
+
+    // We may have committed more since the sync thread last checked. Round up, this is a bound.
+    _updateCaughtUpTime();
+    return (STimeNow() - _caughtUpTime + 999) / 1000;
+}
+
+uint64_t SQLiteNode::getLeaderCommitCount() {
+    Peer* leader = _leadPeer;
+    if (_state != FOLLOWING || !leader) {
+        return 0;
+    }
+    return leader->commitCount;
+}
+
+void SQLiteNode::_sendPendingEscalations() {
+    // Group everything by the peer it's going to, keeping the order they were queued in.
+    map<Peer*, list<SData>> escalations;
+    for (auto& p : _pendingEscalations) {
+        if (p.first != _leadPeer) {
+            // Leader changed since this was escalated. The command itself is still in `_escalatedCommandMap`, and is
+            // re-queued from there when we change state.
+            SINFO("Not sending ESCALATE for '" << p.second["ID"] << "', leader changed.");
+            continue;
+        }
+        escalations[p.first].push_back(move(p.second));
+    }
+    _pendingEscalations.clear();
+    for (auto& p : escalations) {
+        _sendBatchToPeer(p.first, "ESCALATE_BATCH", p.second);
+    }
+    _sendPendingEscalateResponses();
+}
+
+void SQLiteNode::_sendPendingEscalateResponses() {
+    map<Peer*, list<SData>> responses;
+    while (!_pendingEscalateResponses.empty()) {
+        pair<uint64_t, SData> response = _pendingEscalateResponses.pop();
+        Peer* peer = getPeerByID(response.first);
+        SASSERT(peer);
+        responses[peer].push_back(move(response.second));
+    }
+    for (auto& p : responses) {
+        _sendBatchToPeer(p.first, "ESCALATE_RESPONSE_BATCH", p.second);
+    }
+}
+
+void SQLiteNode::_requeueEscalatedCommands() {
+    auto lock = _escalatedCommandMap.scopedLock();
+    uint64_t now = STimeNow();
+    for (auto& cmd : _escalatedCommandMap) {
+        unique_ptr<SQLiteCommand>& command = cmd.second;
+        if (command->timeout() && command->timeout() < now) {
+            // No point escalating this again, the client's given up on it.
+            SINFO("Escalated command '" << command->request.methodLine << "' (" << command->id
+                  << ") timed out waiting for leader, not re-escalating.");
+            command->response.methodLine = "555 Timeout";
+            command->complete = true;
+        }
+        _server.acceptCommand(move(command), false);
+    }
+    _escalatedCommandMap.clear();
+}
+
+void SQLiteNode::_expireEscalatedCommands() {
+    auto lock = _escalatedCommandMap.scopedLock();
+    uint64_t now = STimeNow();
+    for (auto it = _escalatedCommandMap.begin(); it != _escalatedCommandMap.end();) {
+        unique_ptr<SQLiteCommand>& command = it->second;
+        if (!command->timeout() || command->timeout() >= now) {
+            it++;
+            continue;
+        }
+        SINFO("Escalated command '" << command->request.methodLine << "' (" << command->id << ") timed out after "
+              << (now - command->escalationTimeUS) / 1000 << "ms waiting for leader, cancelling.");
+
+        // Let leader know it can skip this, if it hasn't started it yet.
+        if (_leadPeer) {
+            SData cancel("ESCALATE_CANCEL");
+            cancel["ID"] = command->id;
+            cancel.content = command->request.serialize();
+            _sendToPeer(_leadPeer, cancel);
+        }
+        command->response.methodLine = "555 Timeout";
+        command->complete = true;
+        _server.acceptCommand(move(command), false);
+        it = _escalatedCommandMap.erase(it);
+    }
+}
+
+void SQLiteNode::_sendBatchToPeer(Peer* peer, const string& batchMethod, const list<SData>& messages) {
+    if (messages.size() == 1 || !_escalateBatchPeers.count(peer)) {
+        for (auto& message : messages) {
+            _sendToPeer(peer, message);
+        }
+        return;
+    }
+
+    // Each message is serialized back-to-back in the content, and deserialized one at a time by the receiver.
+    SData batch(batchMethod);
+    batch["Count"] = to_string(messages.size());
+    for (auto& message : messages) {
+        batch.content += message.serialize();
+    }
+    PINFO("Sending " << batchMethod << " of " << messages.size() << " messages.");
+    _sendToPeer(peer, batch);
 }
 
 void SQLiteNode::beginShutdown(uint64_t usToWait) {
@@ -328,6 +583,11 @@ bool SQLiteNode::_isNothingBlockingShutdown() {
         return false;
     }
 
+    // If we have responses to escalated commands we haven't sent yet, not done
+    if (!_pendingEscalateResponses.empty()) {
+        return false;
+    }
+
     return true;
 }
 
@@ -377,6 +637,7 @@ bool SQLiteNode::shutdownComplete() {
 
     // If we have unsent data, not done
     for (auto peer : peerList) {
+        lock_guard<decltype(peer->_stateMutex)> lock(peer->_stateMutex);
         if (peer->socket && !peer->socket->sendBufferEmpty()) {
             // Still sending data
             SINFO("Can't graceful shutdown yet because unsent data to peer '" << peer->name << "'");
@@ -466,6 +727,12 @@ void SQLiteNode::escalateCommand(unique_ptr<SQLiteCommand>&& command, bool forge
     escalate["ID"] = command->id;
     escalate.content = command->request.serialize();
 
+    // Tell leader how long it has to respond. This is relative, rather than the absolute timeout, so it doesn't depend
+    // on our clocks agreeing.
+    if (command->timeout()) {
+        escalate["TimeRemaining"] = to_string(((int64_t)command->timeout() - (int64_t)STimeNow()) / 1000);
+    }
+
     // Marking the command as escalated, even if we are going to forget it, because the command's destructor may need
     // this info.
     command->escalated = true;
@@ -478,8 +745,8 @@ void SQLiteNode::escalateCommand(unique_ptr<SQLiteCommand>&& command, bool forge
         _escalatedCommandMap.emplace(command->id, move(command));
     }
 
-    // And send to leader.
-    _sendToPeer(_leadPeer, escalate);
+    // And queue it to send to leader with anything else we escalate before we next poll.
+    _pendingEscalations.emplace_back(_leadPeer, move(escalate));
 }
 
 list<string> SQLiteNode::getEscalatedCommandRequestMethodLines() {
@@ -491,6 +758,84 @@ list<string> SQLiteNode::getEscalatedCommandRequestMethodLines() {
     return returnList;
 }
 
+STable SQLiteNode::getEscalationLatencyHistogram() {
+    STable histogram;
+    for (size_t i = 0; i < ESCALATION_LATENCY_BUCKETS_MS.size(); i++) {
+        histogram[to_string(ESCALATION_LATENCY_BUCKETS_MS[i])] = to_string(_escalationLatencyHistogram[i].load());
+    }
+    histogram["inf"] = to_string(_escalationLatencyHistogram.back().load());
+    return histogram;
+}
+
+list<STable> SQLiteNode::getReplicationBatchStats() {
+    lock_guard<mutex> lock(_replicationBatchStatsMutex);
+    list<STable> batches;
+    for (const auto& [firstCommit, batch] : _replicationBatchStats) {
+        batches.push_back({
+            {"firstCommit", to_string(batch.firstCommit)},
+            {"transactions", to_string(batch.transactions)},
+            {"conflicts", to_string(batch.conflicts)},
+            {"retries", to_string(batch.retries)},
+            {"serial", to_string(batch.serial)},
+        });
+    }
+    return batches;
+}
+
+void SQLiteNode::_recordReplicationConflict(uint64_t commitCount) {
+    uint64_t serialUntil = commitCount + SQL_NODE_SERIAL_REPLICATION_COMMITS;
+    uint64_t current = _serialReplicationUntil.load();
+    while (current < serialUntil && !_serialReplicationUntil.compare_exchange_weak(current, serialUntil)) {
+        // `current` is reloaded by the failed exchange, try again.
+    }
+    SINFO("Replicating commit " << commitCount << " conflicted, replicating concurrent transactions serially through "
+          << max(current, serialUntil) << ".");
+}
+
+void SQLiteNode::_recordReplicationStats(uint64_t commitCount, uint64_t retries, bool serial) {
+    lock_guard<mutex> lock(_replicationBatchStatsMutex);
+
+    // Replication threads can get here in any order, so a commit can belong to an earlier batch than the last one
+    // recorded. If it's for a batch we've already discarded, there's nowhere to record it.
+    uint64_t firstCommit = commitCount - commitCount % SQL_NODE_REPLICATION_BATCH_COMMITS;
+    auto it = _replicationBatchStats.find(firstCommit);
+    if (it == _replicationBatchStats.end()) {
+        if (_replicationBatchStats.size() >= SQL_NODE_REPLICATION_BATCHES_KEPT &&
+            firstCommit < _replicationBatchStats.begin()->first) {
+            return;
+        }
+        it = _replicationBatchStats.emplace(firstCommit, ReplicationBatchStats{firstCommit, 0, 0, 0, 0}).first;
+        if (_replicationBatchStats.size() > SQL_NODE_REPLICATION_BATCHES_KEPT) {
+            _replicationBatchStats.erase(_replicationBatchStats.begin());
+        }
+    }
+    ReplicationBatchStats& batch = it->second;
+    batch.transactions++;
+    batch.conflicts += retries ? 1 : 0;
+    batch.retries += retries;
+    batch.serial += serial ? 1 : 0;
+}
+
+STable SQLiteNode::getSynchronizationInfo() {
+    STable info;
+    uint64_t commitCount = _db.getCommitCount();
+    uint64_t startCommit = _syncStartCommit;
+    uint64_t targetCommit = _syncTargetCommit;
+    uint64_t startTime = _syncStartTime;
+    info["inFlightRequests"] = to_string(_syncInFlightDepth);
+    info["peers"] = to_string(_syncActivePeers);
+    info["chunkCommits"] = to_string(_syncChunkCommits);
+    info["commitsRemaining"] = to_string(targetCommit > commitCount ? targetCommit - commitCount : 0);
+
+    // There's no rate until we've synchronized at least once.
+    uint64_t elapsed = startTime ? STimeNow() - startTime : 0;
+    info["commitsPerSecond"] = to_string(elapsed && commitCount > startCommit ?
+                                         (commitCount - startCommit) * STIME_US_PER_S / elapsed : 0);
+    info["snapshotBytesReceived"] = to_string(_snapshotBytesReceived);
+    info["snapshotTotalBytes"] = to_string(_snapshotTotalBytes);
+    return info;
+}
+
 // --------------------------------------------------------------------------
 // State Machine
 // --------------------------------------------------------------------------
@@ -535,6 +880,7 @@ bool SQLiteNode::update() {
                         to_string(chrono::duration_cast<chrono::milliseconds>(elapsed).count()) +
                         " ms elapsed. ";
         for (auto& p : peerList) {
+            lock_guard<decltype(p->_stateMutex)> lock(p->_stateMutex);
             if (p->socket) {
                 logMsg += p->name + " sent " + to_string(p->socket->getSentBytes()) + " bytes, recv " + to_string(p->socket->getRecvBytes()) + " bytes. ";
                 p->socket->resetCounters();
@@ -639,13 +985,15 @@ bool SQLiteNode::update() {
         // It has a higher commit count than us, synchronize.
         SASSERT(freshestPeerCommitCount > _db.getCommitCount());
         SASSERTWARN(!_syncPeer);
-        _updateSyncPeer();
-        if (_syncPeer) {
-            _sendToPeer(_syncPeer, SData("SYNCHRONIZE"));
-        } else {
-            SWARN("Updated to NULL _syncPeer when about to send SYNCHRONIZE. Going to WAITING.");
-            _changeState(WAITING);
-            return true; // Re-update
+        if (!_startSnapshot(freshestPeerCommitCount)) {
+            _updateSyncPeer();
+            if (_syncPeer) {
+                _startSynchronization();
+            } else {
+                SWARN("Updated to NULL _syncPeer when about to send SYNCHRONIZE. Going to WAITING.");
+                _changeState(WAITING);
+                return true; // Re-update
+            }
         }
         _changeState(SYNCHRONIZING);
         return true; // Re-update
@@ -913,6 +1261,15 @@ bool SQLiteNode::update() {
         if (!commitInProgress()) {
             _sendOutstandingTransactions();
         }
+        if (_state == LEADING) {
+            _sendHeartbeats();
+        }
+
+        // A follower that denied a pipelined commit can only confirm it by resynchronizing, which we only find out
+        // about from the commit and hash it reports.
+        if (!_quorumPendingCommits.empty()) {
+            _updateQuorumApprovedCommit();
+        }
 
         // This means we've started a distributed transaction and need to decide if we should commit it, which can mean
         // waiting on peers to approve the transaction. We can do this even after we've begun standing down.
@@ -1099,9 +1456,18 @@ bool SQLiteNode::update() {
 
             // And send it to everyone who's subscribed.
             uint64_t beforeSend = STimeNow();
+            _transactionSendTimes[commitCount + 1] = beforeSend;
+            while (_transactionSendTimes.size() > 1000) {
+                _transactionSendTimes.erase(_transactionSendTimes.begin());
+            }
             _sendToAllPeers(transaction, true);
             SINFO("[performance] SQLite::_sendToAllPeers in SQLiteNode took " << ((STimeNow() - beforeSend)/1000) << "ms.");
 
+            // If we're pipelining QUORUM commits, we don't wait for anyone to approve this one before committing it.
+            if (_commitConsistency == QUORUM && quorumPipelineDepth > 1) {
+                _commitPipelined();
+            }
+
             // We return `true` here to immediately re-update and thus commit this transaction immediately if it was
             // asynchronous.
             return true;
@@ -1220,13 +1586,7 @@ bool SQLiteNode::update() {
             SHMMM("Leader stepping down, re-queueing commands.");
 
             // If there were escalated commands, give them back to the server to retry.
-            {
-                auto lock = _escalatedCommandMap.scopedLock();
-                for (auto& cmd : _escalatedCommandMap) {
-                    _server.acceptCommand(move(cmd.second), false);
-                }
-                _escalatedCommandMap.clear();
-            }
+            _requeueEscalatedCommands();
 
             // Are we in the middle of a commit? This should only happen if we received a `BEGIN_TRANSACTION` without a
             // corresponding `COMMIT` or `ROLLBACK`, this isn't supposed to happen.
@@ -1264,6 +1624,10 @@ void SQLiteNode::_onMESSAGE(Peer* peer, const SData& message) {
     }
 
     peer->setCommit(message.calcU64("CommitCount"), message["Hash"]);
+    if (_state == FOLLOWING && peer == _leadPeer) {
+        lock_guard<mutex> lock(_stalenessMutex);
+        _recordLeaderContact(message.calcU64("CommitCount"));
+    }
 
     // Classify and process the message
     if (SIEquals(message.methodLine, "LOGIN")) {
@@ -1297,6 +1661,16 @@ void SQLiteNode::_onMESSAGE(Peer* peer, const SData& message) {
         peer->loggedIn = true;
         peer->version = message["Version"];
         peer->state = stateFromName(message["State"]);
+        if (message.test("EscalateBatch")) {
+            _escalateBatchPeers.insert(peer);
+        } else {
+            _escalateBatchPeers.erase(peer);
+        }
+        if (message.test("Heartbeat")) {
+            _heartbeatPeers.insert(peer);
+        } else {
+            _heartbeatPeers.erase(peer);
+        }
 
         // Let the server know that a peer has logged in.
         _server.onNodeLogin(peer);
@@ -1501,11 +1875,15 @@ void SQLiteNode::_onMESSAGE(Peer* peer, const SData& message) {
         } else {
             SINFO("Got STANDUP_RESPONSE but not STANDINGUP. Probably a late message, ignoring.");
         }
-    } else if (SIEquals(message.methodLine, "SYNCHRONIZE")) {
+    } else if (SIEquals(message.methodLine, "SYNCHRONIZE") || SIEquals(message.methodLine, "SNAPSHOT")) {
         // If we're FOLLOWING, we'll let worker threads handle SYNCHRONIZATION messages. We don't on leader, because if
         // there's a backlog of commands, these can get stale, and by the time they reach the follower, it's already
         // behind, thus never catching up.
-        if (_state == FOLLOWING) {
+        // SNAPSHOT requests are only ever served while FOLLOWING, by `_snapshotThread`, creating and reading a snapshot
+        // is far too slow to do on the sync thread.
+        if (_state == FOLLOWING && SIEquals(message.methodLine, "SNAPSHOT")) {
+            _queueSnapshotRequest(peer, message);
+        } else if (_state == FOLLOWING) {
             // Attach all of the state required to populate a SYNCHRONIZE_RESPONSE to this message. All of this is
             // processed asynchronously, but that is fine, the final `SUBSCRIBE` message and its response will be
             // processed synchronously.
@@ -1525,29 +1903,54 @@ void SQLiteNode::_onMESSAGE(Peer* peer, const SData& message) {
             auto command = make_unique<SQLiteCommand>(move(request));
             command->initiatingPeerID = peer->id;
             _server.acceptCommand(move(command), true);
+        } else if (SIEquals(message.methodLine, "SNAPSHOT")) {
+            STHROW("not following");
         } else {
             // Otherwise we handle them immediately, as the server doesn't deliver commands to workers until we've
             // stood up.
             SData response("SYNCHRONIZE_RESPONSE");
-            _queueSynchronize(this, peer, _db, response, false);
+            _queueSynchronize(this, peer, _db, response, false, message.calcU64("FromCommit"), message.calcU64("ToCommit"));
             _sendToPeer(peer, response);
         }
     } else if (SIEquals(message.methodLine, "SYNCHRONIZE_RESPONSE")) {
         // SYNCHRONIZE_RESPONSE: Sent in response to a SYNCHRONIZE request. Contains a payload of zero or more COMMIT
         // messages, all of which are immediately committed to the local database.
         if (_state != SYNCHRONIZING) {
+            if (message.isSet("FromCommit")) {
+                // A pipelined request can be answered after we've already finished synchronizing, that's fine.
+                PINFO("Ignoring late pipelined SYNCHRONIZE_RESPONSE, not synchronizing.");
+                return;
+            }
             STHROW("not synchronizing");
         }
         if (!_syncPeer) {
             STHROW("too late, gave up on you");
         }
-        if (peer != _syncPeer) {
+        if (peer != _syncPeer && !message.isSet("FromCommit")) {
+            // We only send requests to peers other than `_syncPeer` after it's shown it supports pipelining, but this
+            // one doesn't, so it ignored the range we asked for. Ask someone else for it.
+            if (any_of(_syncRequestsInFlight.begin(), _syncRequestsInFlight.end(),
+                       [peer](const auto& request) { return request.second.second == peer; })) {
+                PINFO("Peer doesn't support pipelined SYNCHRONIZE, not synchronizing from it.");
+                _syncLegacyPeers.insert(peer);
+                _retrySynchronizeRanges(peer);
+                _sendSynchronizeRequests();
+                return;
+            }
             STHROW("sync peer mismatch");
         }
         PINFO("Beginning synchronization");
         try {
             // Received this synchronization response; are we done?
-            _recvSynchronize(peer, message);
+            if (message.isSet("FromCommit")) {
+                // This can be from any of the peers we're synchronizing from.
+                _recvSynchronizeChunk(peer, message);
+            } else {
+                // This peer doesn't support pipelining, it sent commits from wherever we were when we asked.
+                _syncPipelinedPeers.erase(peer);
+                _syncRequestsInFlight.clear();
+                _recvSynchronize(peer, message);
+            }
             uint64_t peerCommitCount = _syncPeer->commitCount;
             if (_db.getCommitCount() == peerCommitCount) {
                 // All done
@@ -1566,10 +1969,16 @@ void SQLiteNode::_onMESSAGE(Peer* peer, const SData& message) {
                 // Otherwise, more to go
                 SINFO("Synchronization underway, at commitCount #"
                       << _db.getCommitCount() << " (" << _db.getCommittedHash() << "), "
-                      << peerCommitCount - _db.getCommitCount() << " to go.");
-                _updateSyncPeer();
+                      << peerCommitCount - _db.getCommitCount() << " to go, "
+                      << _syncRequestsInFlight.size() << " requests in flight.");
+
+                // We only consider switching peers when nothing is outstanding, otherwise we'd throw away everything
+                // the current peer is already sending us.
+                if (_syncRequestsInFlight.empty() && _syncResponsesPending.empty()) {
+                    _updateSyncPeer();
+                }
                 if (_syncPeer) {
-                    _sendToPeer(_syncPeer, SData("SYNCHRONIZE"));
+                    _sendSynchronizeRequests();
                 } else {
                     SWARN("No usable _syncPeer but syncing not finished. Going to SEARCHING.");
                     _changeState(SEARCHING);
@@ -1586,6 +1995,40 @@ void SQLiteNode::_onMESSAGE(Peer* peer, const SData& message) {
             _changeState(SEARCHING);
             throw e;
         }
+    } else if (SIEquals(message.methodLine, "SNAPSHOT_RESPONSE")) {
+        // SNAPSHOT_RESPONSE: Sent in response to a SNAPSHOT request. Contains one chunk of a copy of the peer's DB. When
+        // we have the whole thing, we replace our DB with it and then synchronize normally from there.
+        if (_state != SYNCHRONIZING || !_snapshotInProgress) {
+            STHROW("not downloading a snapshot");
+        }
+        if (peer != _syncPeer) {
+            STHROW("sync peer mismatch");
+        }
+        try {
+            _recvSnapshot(peer, message);
+            if (!_snapshotInProgress) {
+                // The snapshot's been restored, synchronize anything committed since it was taken.
+                if (_syncPeer->commitCount > _db.getCommitCount()) {
+                    _startSynchronization();
+                } else {
+                    SINFO("Snapshot restored, at commitCount #" << _db.getCommitCount() << " (" << _db.getCommittedHash()
+                          << "), WAITING");
+                    _syncPeer = nullptr;
+                    _changeState(WAITING);
+                    return;
+                }
+            }
+
+            // Extend our timeout so long as we're still alive.
+            _stateTimeout = STimeNow() + SQL_NODE_SYNCHRONIZING_RECV_TIMEOUT + SRandom::rand64() % STIME_US_PER_S * 5;
+        } catch (const SException& e) {
+            SWARN("Snapshot failed '" << e.what() << "', reconnecting and re-SEARCHING.");
+            _snapshotInProgress = false;
+            _reconnectPeer(_syncPeer);
+            _syncPeer = nullptr;
+            _changeState(SEARCHING);
+            throw e;
+        }
     } else if (SIEquals(message.methodLine, "SUBSCRIBE")) {
         // SUBSCRIBE: Sent by a node in the WAITING state to the current leader to begin FOLLOWING. Respond
         // SUBSCRIPTION_APPROVED with any COMMITs that the subscribing peer lacks (for example, any commits that have
@@ -1681,7 +2124,38 @@ void SQLiteNode::_onMESSAGE(Peer* peer, const SData& message) {
             STHROW("not leading");
         }
         Peer::Response response = SIEquals(message.methodLine, "APPROVE_TRANSACTION") ? Peer::Response::APPROVE : Peer::Response::DENY;
+        if (response == Peer::Response::APPROVE) {
+            auto sendTimeIt = _transactionSendTimes.find(message.calcU64("NewCount"));
+            if (sendTimeIt != _transactionSendTimes.end()) {
+                peer->approvalRTT = STimeNow() - sendTimeIt->second;
+            }
+        }
         try {
+            // Approvals of pipelined commits arrive after we've committed them, and likely after we've sent later
+            // transactions. A follower approving one has every commit before it as well.
+            uint64_t commitID = SToUInt64(message["ID"]);
+            auto pendingIt = _quorumPendingCommits.find(commitID);
+            if (pendingIt != _quorumPendingCommits.end() && pendingIt->second == message["NewHash"]) {
+                if (peer->permaFollower) {
+                    STHROW("permafollowers shouldn't approve/deny");
+                }
+                if (response == Peer::Response::DENY) {
+                    // We've already committed this, so there's nothing to roll back, but the follower doesn't have
+                    // it, so it doesn't count towards a majority. It needs to resynchronize, and only counts once it
+                    // reports the same commit and hash that we have. If a majority doesn't have it by the time we stop
+                    // leading, its command fails.
+                    PWARN("Peer denied pipelined transaction #" << commitID << " (" << message["NewHash"]
+                          << "), reconnecting to resynchronize.");
+                    _reconnectPeer(peer);
+                } else {
+                    PINFO("Peer approved pipelined transaction #" << commitID << " (" << message["NewHash"] << ")");
+                    uint64_t& approvedCommit = _quorumApprovals[peer];
+                    approvedCommit = max(approvedCommit, commitID);
+                }
+                _updateQuorumApprovedCommit();
+                return;
+            }
+
             // We ignore late approvals of commits that have already been finalized. They could have been committed
             // already, in which case `_lastSentTransactionID` will have incremented, or they could have been rolled
             // back due to a conflict, which would cuase them to have the wrong hash (the hash of the previous attempt
@@ -1745,6 +2219,23 @@ void SQLiteNode::_onMESSAGE(Peer* peer, const SData& message) {
             SAUTOPREFIX(request);
             PINFO("Received ESCALATE command for '" << message["ID"] << "' (" << request.methodLine << ")");
 
+            // If the follower told us how long it's willing to wait, set the command's timeout to match, so we don't
+            // bother doing any work we can't respond to in time.
+            if (message.isSet("TimeRemaining")) {
+                int64_t timeRemaining = message.calc64("TimeRemaining");
+                if (timeRemaining <= 0) {
+                    PINFO("Escalated command '" << message["ID"] << "' already timed out, not processing.");
+                    SData response("555 Timeout");
+                    SData timedOut("ESCALATE_RESPONSE");
+                    timedOut["ID"] = message["ID"];
+                    timedOut.content = response.serialize();
+                    _sendToPeer(peer, timedOut);
+                    return;
+                }
+                int64_t elapsed = (int64_t)STimeNow() - request.calc64("commandExecuteTime");
+                request["timeout"] = to_string(timeRemaining + elapsed / 1000);
+            }
+
             // Create a new Command and send to the server.
             auto command = make_unique<SQLiteCommand>(move(request));
             command->initiatingPeerID = peer->id;
@@ -1806,6 +2297,9 @@ void SQLiteNode::_onMESSAGE(Peer* peer, const SData& message) {
                 command->escalationTimeUS = STimeNow() - command->escalationTimeUS;
                 SINFO("Total escalation time for command " << command->request.methodLine << " was "
                       << command->escalationTimeUS/1000 << "ms.");
+                auto bucket = lower_bound(ESCALATION_LATENCY_BUCKETS_MS.begin(), ESCALATION_LATENCY_BUCKETS_MS.end(),
+                                          command->escalationTimeUS / 1000);
+                _escalationLatencyHistogram[bucket - ESCALATION_LATENCY_BUCKETS_MS.begin()]++;
             }
             command->response = response;
             command->complete = true;
@@ -1814,6 +2308,28 @@ void SQLiteNode::_onMESSAGE(Peer* peer, const SData& message) {
         } else {
             SHMMM("Received ESCALATE_RESPONSE for unknown command ID '" << message["ID"] << "', ignoring. ");
         }
+    } else if (SIEquals(message.methodLine, "ESCALATE_BATCH") || SIEquals(message.methodLine, "ESCALATE_RESPONSE_BATCH")) {
+        // ESCALATE_BATCH/ESCALATE_RESPONSE_BATCH: Several ESCALATE or ESCALATE_RESPONSE messages sent together. Each
+        // is handled exactly as if it had been sent on its own.
+        const string expectedMethod = SIEquals(message.methodLine, "ESCALATE_BATCH") ? "ESCALATE" : "ESCALATE_RESPONSE";
+        PINFO("Received " << message.methodLine << " of " << message["Count"] << " messages.");
+        size_t offset = 0;
+        while (offset < message.content.size()) {
+            SData batched;
+            int size = batched.deserialize(message.content.c_str() + offset, message.content.size() - offset);
+            if (!size) {
+                STHROW("malformed batch");
+            }
+            offset += size;
+            if (!SIEquals(batched.methodLine, expectedMethod)) {
+                STHROW("unexpected " + batched.methodLine + " in batch");
+            }
+
+            // These describe the state of the peer as of sending the whole batch.
+            batched["CommitCount"] = message["CommitCount"];
+            batched["Hash"] = message["Hash"];
+            _onMESSAGE(peer, batched);
+        }
     } else if (SIEquals(message.methodLine, "ESCALATE_ABORTED")) {
         // ESCALATE_RESPONSE: Sent when the leader aborts processing an escalated command. Re-submit to the new leader.
         if (_state != FOLLOWING) {
@@ -1836,6 +2352,9 @@ void SQLiteNode::_onMESSAGE(Peer* peer, const SData& message) {
             _escalatedCommandMap.erase(commandIt);
         } else
             SWARN("Received ESCALATE_ABORTED for unescalated command " << message["ID"] << ", ignoring.");
+    } else if (SIEquals(message.methodLine, "HEARTBEAT")) {
+        // HEARTBEAT: Sent periodically by leader. There's nothing to do with it, it's just a recent CommitCount from
+        // leader, which is recorded above.
     } else if (SIEquals(message.methodLine, "CRASH_COMMAND") || SIEquals(message.methodLine, "BROADCAST_COMMAND")) {
         // Create a new Command and send to the server.
         SData messageCopy = message;
@@ -1856,6 +2375,8 @@ void SQLiteNode::_onConnect(Peer* peer) {
     login["State"] = stateName(_state);
     login["Version"] = _version;
     login["Permafollower"] = _originalPriority ? "false" : "true";
+    login["EscalateBatch"] = "true";
+    login["Heartbeat"] = "true";
     _sendToPeer(peer, login);
 }
 
@@ -1876,8 +2397,12 @@ void SQLiteNode::_onDisconnect(Peer* peer) {
     ///   is out of touch with reality: we processed a command and reality doesn't
     ///   know it.  Not cool!
     ///
-    if (peer->socket && peer->socket->sendBufferCopy().find("ESCALATE_RESPONSE") != string::npos)
-        PWARN("Initiating follower died before receiving response to escalation: " << peer->socket->sendBufferCopy());
+    {
+        lock_guard<decltype(peer->_stateMutex)> lock(peer->_stateMutex);
+        if (peer->socket && peer->socket->sendBufferCopy().find("ESCALATE_RESPONSE") != string::npos)
+            PWARN("Initiating follower died before receiving response to escalation: "
+                  << peer->socket->sendBufferCopy());
+    }
 
     /// - Verify we didn't just lose contact with our leader.  This should
     ///   only be possible if we're SUBSCRIBING or FOLLOWING.  If we did lose our
@@ -1904,13 +2429,7 @@ void SQLiteNode::_onDisconnect(Peer* peer) {
 
         // If there were escalated commands, give them back to the server to retry, unless it looks like they were in
         // progress when the leader died, in which case we say they completed with a 500 Error.
-        {
-            auto lock = _escalatedCommandMap.scopedLock();
-            for (auto& cmd : _escalatedCommandMap) {
-                _server.acceptCommand(move(cmd.second), false);
-            }
-            _escalatedCommandMap.clear();
-        }
+        _requeueEscalatedCommands();
         _changeState(SEARCHING);
     }
 
@@ -1918,12 +2437,36 @@ void SQLiteNode::_onDisconnect(Peer* peer) {
     ///   with.  This should only be possible if we're SYNCHRONIZING.  If we did
     ///   lose our sync peer, give up and go back to SEARCHING.
     ///
+    ///   If we were also synchronizing from other peers that support
+    ///   pipelining, carry on with one of those instead. Any ranges we'd
+    ///   requested from the lost peer are requested from someone else.
+    ///
     if (peer == _syncPeer) {
-        // Synchronization failed
-        PHMMM("Lost our synchronization peer, re-SEARCHING.");
-        SASSERTWARN(_state == SYNCHRONIZING);
-        _syncPeer = nullptr;
-        _changeState(SEARCHING);
+        Peer* newSyncPeer = nullptr;
+        if (!_snapshotInProgress) {
+            for (auto candidate : _syncPipelinedPeers) {
+                if (candidate != peer && candidate->connected() && candidate->loggedIn &&
+                    candidate->commitCount > _db.getCommitCount() &&
+                    (!newSyncPeer || candidate->commitCount > newSyncPeer->commitCount)) {
+                    newSyncPeer = candidate;
+                }
+            }
+        }
+        if (newSyncPeer) {
+            PHMMM("Lost our synchronization peer, continuing with '" << newSyncPeer->name << "'.");
+            _retrySynchronizeRanges(peer);
+            _syncPeer = newSyncPeer;
+            _sendSynchronizeRequests();
+        } else {
+            // Synchronization failed
+            PHMMM("Lost our synchronization peer, re-SEARCHING.");
+            SASSERTWARN(_state == SYNCHRONIZING);
+            _syncPeer = nullptr;
+            _changeState(SEARCHING);
+        }
+    } else if (_state == SYNCHRONIZING && _syncPeer && !_snapshotInProgress) {
+        _retrySynchronizeRanges(peer);
+        _sendSynchronizeRequests();
     }
 
     // If we're leader, but we've lost quorum, we can't commit anything, nor can worker threads. We need to drop out of
@@ -1965,16 +2508,44 @@ void SQLiteNode::_sendToPeer(Peer* peer, const SData& message) {
     SASSERT(peer);
     SASSERT(!message.empty());
 
+    // Piggyback on whatever we're sending to add the CommitCount/Hash
+    SData messageCopy = message;
+    messageCopy["CommitCount"] = to_string(_db.getCommitCount());
+    messageCopy["Hash"] = _db.getCommittedHash();
+
+    // The network thread can replace the peer's socket at any time, so hold its lock while we use it.
+    lock_guard<decltype(peer->_stateMutex)> lock(peer->_stateMutex);
+
     // If a peer is currently disconnected, we can't send it a message.
     if (!peer->socket) {
         PWARN("Can't send message to peer, no socket. Message '" << message.methodLine << "' will be discarded.");
         return;
     }
-    // Piggyback on whatever we're sending to add the CommitCount/Hash
-    SData messageCopy = message;
-    messageCopy["CommitCount"] = to_string(_db.getCommitCount());
-    messageCopy["Hash"] = _db.getCommittedHash();
+
+    // If we're already disconnecting, the socket won't take any more data, so don't bother serializing it.
+    if (peer->socket->state.load() == STCPManager::Socket::SHUTTINGDOWN) {
+        PDEBUG("Not sending '" << message.methodLine << "' to peer, disconnecting.");
+        return;
+    }
     peer->socket->send(messageCopy.serialize());
+    peer->messagesSent++;
+    _checkSendBuffer(peer);
+}
+
+void SQLiteNode::_checkSendBuffer(Peer* peer) {
+    lock_guard<decltype(peer->_stateMutex)> lock(peer->_stateMutex);
+    size_t bufferSize = peer->updateSendBufferHighWater();
+    uint64_t limit = peerSendBufferLimit.load();
+    if (limit && bufferSize > limit) {
+        PWARN("Peer has " << bufferSize << " bytes waiting in its send buffer, over the limit of " << limit
+              << ". Discarding them and disconnecting, it will need to resynchronize.");
+        peer->sendBufferOverflows++;
+
+        // Stop streaming transactions to it now, rather than waiting for the disconnect.
+        peer->subscribed = false;
+        peer->socket->setSendBuffer("");
+        _reconnectPeer(peer);
+    }
 }
 
 void SQLiteNode::_sendToAllPeers(const SData& message, bool subscribedOnly) {
@@ -1991,9 +2562,12 @@ void SQLiteNode::_sendToAllPeers(const SData& message, bool subscribedOnly) {
     // Loop across all connected peers and send the message
     for (auto peer : peerList) {
         // Send either to everybody, or just subscribed peers.
+        lock_guard<decltype(peer->_stateMutex)> lock(peer->_stateMutex);
         if (peer->socket && (!subscribedOnly || peer->subscribed)) {
             // Send it now, without waiting for the outer event loop
             peer->socket->send(serializedMessage);
+            peer->messagesSent++;
+            _checkSendBuffer(peer);
         }
     }
 }
@@ -2076,6 +2650,11 @@ void SQLiteNode::_changeState(SQLiteNode::State newState) {
                 _db.rollback();
             }
 
+            // Any pipelined commits that haven't been approved won't be now. The server is responsible for telling
+            // the callers waiting on them.
+            _quorumPendingCommits.clear();
+            _quorumApprovals.clear();
+
             // Turn off commits. This prevents late commits coming in right after we call `_sendOutstandingTransactions`
             // below, which otherwise could get committed on leader and not replicated to followers.
             _db.setCommitEnabled(false);
@@ -2085,6 +2664,28 @@ void SQLiteNode::_changeState(SQLiteNode::State newState) {
             _sendOutstandingTransactions();
         }
 
+        // Our data's freshness is only known relative to the leader we're following.
+        if (oldState == FOLLOWING) {
+            lock_guard<mutex> lock(_stalenessMutex);
+            _leaderContacts.clear();
+            _caughtUpTime = 0;
+        }
+
+        // Drop anything left over from synchronizing, late responses will be ignored.
+        if (oldState == SYNCHRONIZING) {
+            _syncRequestsInFlight.clear();
+            _syncResponsesPending.clear();
+            _syncRangesToRetry.clear();
+            _syncPipelinedPeers.clear();
+            _syncLegacyPeers.clear();
+            _syncInFlightDepth = 0;
+            _syncActivePeers = 0;
+            if (_snapshotInProgress) {
+                _snapshotInProgress = false;
+                unlink(_snapshotFile.c_str());
+            }
+        }
+
         // Clear some state if we can
         if (newState < SUBSCRIBING) {
             // We're no longer SUBSCRIBING or FOLLOWING, so we have no leader
@@ -2140,7 +2741,8 @@ void SQLiteNode::_changeState(SQLiteNode::State newState) {
     }
 }
 
-void SQLiteNode::_queueSynchronize(SQLiteNode* node, Peer* peer, SQLite& db, SData& response, bool sendAll) {
+void SQLiteNode::_queueSynchronize(SQLiteNode* node, Peer* peer, SQLite& db, SData& response, bool sendAll,
+                                   uint64_t fromCommit, uint64_t toCommit) {
     // We need this to check the state of the node, and we also need `name` to make the logging macros work in a static
     // function. However, if you pass a null pointer here, we can't set these, so we'll fail. We also can't log that,
     // so we are just going to rely on the signal handling for sigsegv to log that for you. Don't do that.
@@ -2177,33 +2779,49 @@ void SQLiteNode::_queueSynchronize(SQLiteNode* node, Peer* peer, SQLite& db, SDa
     // twice, where _lastSentTransactionID only changes in the sync thread. From followers serving SYNCHRONIZE
     // requests, they can always serve their entire DB, there's no point at which they risk double-sending data.
     uint64_t targetCommit = (_state == LEADING || _state == STANDINGDOWN) ? _lastSentTransactionID : db.getCommitCount();
-    if (peerCommitCount == targetCommit) {
+
+    // A pipelined request asks for a specific range, which may start beyond the peer's current commit count (because
+    // the peer is still applying earlier chunks). We echo back `FromCommit` so the peer can put responses in order.
+    uint64_t fromIndex = fromCommit ? fromCommit : peerCommitCount + 1;
+    if (fromCommit) {
+        response["FromCommit"] = to_string(fromCommit);
+    }
+    if (fromIndex > targetCommit) {
         // Already synchronized; nothing to send
         PINFO("Peer is already synchronized");
         response["NumCommits"] = "0";
     } else {
         // Figure out how much to send it
-        uint64_t fromIndex = peerCommitCount + 1;
         uint64_t toIndex = targetCommit;
-        if (!sendAll)
+        if (toCommit) {
+            toIndex = min(toIndex, toCommit);
+        } else if (!sendAll) {
             toIndex = min(toIndex, fromIndex + 100); // 100 transactions at a time
+        }
         if (!db.getCommits(fromIndex, toIndex, result))
             STHROW("error getting commits");
         if ((uint64_t)result.size() != toIndex - fromIndex + 1)
             STHROW("mismatched commit count");
 
-        // Wrap everything into one huge message
-        PINFO("Synchronizing commits from " << peerCommitCount + 1 << "-" << targetCommit);
-        response["NumCommits"] = SToStr(result.size());
+        // Wrap everything into one huge message. For pipelined requests, we stop early if the chunk gets too big, the
+        // peer will re-request whatever we didn't send.
+        size_t numCommits = 0;
         for (size_t c = 0; c < result.size(); ++c) {
+            if (fromCommit && numCommits && response.content.size() >= SQL_NODE_SYNC_CHUNK_MAX_BYTES) {
+                break;
+            }
+
             // Queue the result
             SASSERT(result[c].size() == 2);
             SData commit("COMMIT");
-            commit["CommitIndex"] = SToStr(peerCommitCount + c + 1);
+            commit["CommitIndex"] = SToStr(fromIndex + c);
             commit["Hash"] = result[c][0];
             commit.content = result[c][1];
             response.content += commit.serialize();
+            numCommits++;
         }
+        PINFO("Synchronizing commits from " << fromIndex << "-" << fromIndex + numCommits - 1);
+        response["NumCommits"] = SToStr(numCommits);
         SASSERTWARN(response.content.size() < 10 * 1024 * 1024); // Let's watch if it gets over 10MB
     }
 }
@@ -2268,6 +2886,13 @@ void SQLiteNode::_recvSynchronize(Peer* peer, const SData& message) {
             }
         }
 
+        // `prepare` hashed this commit onto our last one. If that's not the peer's hash, the peer's commits don't
+        // follow on from ours, and we can't commit this.
+        if (_db.getUncommittedHash() != commit["Hash"]) {
+            _db.rollback();
+            STHROW("commit chain mismatch");
+        }
+
         // Transaction succeeded, commit and go to the next
         SDEBUG("Committing current transaction because _recvSynchronize: " << _db.getUncommittedQuery());
         _db.commit(stateName(_state));
@@ -2275,9 +2900,6 @@ void SQLiteNode::_recvSynchronize(Peer* peer, const SData& message) {
         // Should work here.
         SINFO("[NOTIFY] setting commit count to: " << _db.getCommitCount());
         _localCommitNotifier.notifyThrough(_db.getCommitCount());
-
-        if (_db.getCommittedHash() != commit["Hash"])
-            STHROW("potential hash mismatch");
         --commitsRemaining;
     }
 
@@ -2286,6 +2908,462 @@ void SQLiteNode::_recvSynchronize(Peer* peer, const SData& message) {
         STHROW("commits remaining at end");
 }
 
+bool SQLiteNode::_startSnapshot(uint64_t freshestPeerCommitCount) {
+    uint64_t commitCount = _db.getCommitCount();
+    uint64_t threshold = snapshotThreshold;
+    if (!threshold || freshestPeerCommitCount < commitCount + threshold) {
+        return false;
+    }
+
+    // Snapshots are only served by FOLLOWING peers, so that building and streaming them never slows down leader.
+    Peer* snapshotPeer = nullptr;
+    for (auto peer : peerList) {
+        if (peer->loggedIn && peer->state == FOLLOWING && peer->commitCount >= commitCount + threshold &&
+            (!snapshotPeer || peer->commitCount > snapshotPeer->commitCount)) {
+            snapshotPeer = peer;
+        }
+    }
+    if (!snapshotPeer) {
+        SINFO("We're " << freshestPeerCommitCount - commitCount << " commits behind, but no FOLLOWING peer can serve "
+              "a snapshot, synchronizing instead.");
+        return false;
+    }
+
+    SINFO("We're " << freshestPeerCommitCount - commitCount << " commits behind, downloading snapshot from peer '"
+          << snapshotPeer->name << "'.");
+    _syncPeer = snapshotPeer;
+    _snapshotInProgress = true;
+    _snapshotCommitCount = 0;
+    _snapshotHash = "";
+    _snapshotBytesReceived = 0;
+    _snapshotTotalBytes = 0;
+    _syncStartCommit = commitCount;
+    _syncStartTime = STimeNow();
+    _syncTargetCommit = snapshotPeer->commitCount.load();
+    SData request("SNAPSHOT");
+    request["Offset"] = "0";
+    _sendToPeer(_syncPeer, request);
+    return true;
+}
+
+void SQLiteNode::_recvSnapshot(Peer* peer, const SData& message) {
+    uint64_t offset = message.calcU64("Offset");
+    uint64_t totalSize = message.calcU64("TotalSize");
+    uint64_t snapshotCommitCount = message.calcU64("SnapshotCommitCount");
+    if (!snapshotCommitCount || message["SnapshotHash"].empty()) {
+        STHROW("invalid snapshot");
+    }
+    if (offset == 0) {
+        // This is the start of a snapshot. This can also happen mid-download if the peer replaced its snapshot, in
+        // which case we just start over with the new one.
+        if (_snapshotCommitCount) {
+            PINFO("Peer replaced snapshot at commit " << _snapshotCommitCount << " with " << snapshotCommitCount
+                  << ", starting over.");
+        }
+
+        // A peer can hand us a snapshot it made a while ago, if that's not ahead of us, there's no point in using it.
+        if (snapshotCommitCount <= _db.getCommitCount()) {
+            PINFO("Snapshot at commit " << snapshotCommitCount << " is no newer than our DB, synchronizing instead.");
+            _snapshotInProgress = false;
+            return;
+        }
+        _snapshotCommitCount = snapshotCommitCount;
+        _snapshotHash = message["SnapshotHash"];
+        _snapshotBytesReceived = 0;
+        _snapshotTotalBytes = totalSize;
+        unlink(_snapshotFile.c_str());
+    } else if (offset != _snapshotBytesReceived || snapshotCommitCount != _snapshotCommitCount) {
+        STHROW("snapshot offset mismatch");
+    }
+
+    // Append this chunk to what we have so far.
+    {
+        ofstream file(_snapshotFile, ios::binary | ios::app);
+        file.write(message.content.data(), message.content.size());
+        if (!file) {
+            STHROW("error writing snapshot");
+        }
+    }
+    _snapshotBytesReceived += message.content.size();
+
+    // If there's more, ask for it.
+    if (_snapshotBytesReceived < totalSize) {
+        if (message.content.empty()) {
+            STHROW("empty snapshot chunk");
+        }
+        SData request("SNAPSHOT");
+        request["Offset"] = to_string(_snapshotBytesReceived);
+        request["SnapshotCommitCount"] = to_string(_snapshotCommitCount);
+        _sendToPeer(peer, request);
+        return;
+    }
+    if (_snapshotBytesReceived > totalSize) {
+        STHROW("snapshot too large");
+    }
+
+    // We have the whole thing, replace our DB with it.
+    PINFO("Received complete snapshot at commit " << _snapshotCommitCount << " (" << totalSize << " bytes), restoring.");
+    bool restored = _db.restoreSnapshot(_snapshotFile, _snapshotCommitCount, _snapshotHash);
+    unlink(_snapshotFile.c_str());
+    _snapshotInProgress = false;
+    if (!restored) {
+        STHROW("failed to restore snapshot");
+    }
+    SINFO("[NOTIFY] setting commit count to: " << _db.getCommitCount());
+    _localCommitNotifier.notifyThrough(_db.getCommitCount());
+}
+
+void SQLiteNode::_queueSnapshotRequest(Peer* peer, const SData& request) {
+    {
+        lock_guard<mutex> lock(_snapshotRequestMutex);
+        if (!_snapshotThread.joinable()) {
+            _snapshotThread = thread(&SQLiteNode::_serveSnapshots, this);
+        }
+        _snapshotRequests[peer->id] = request;
+    }
+    _snapshotRequestCV.notify_one();
+}
+
+void SQLiteNode::_serveSnapshots() {
+    SInitialize("snapshot");
+    unique_lock<mutex> lock(_snapshotRequestMutex);
+    while (true) {
+        _snapshotRequestCV.wait(lock, [this]() { return _snapshotThreadShouldExit || !_snapshotRequests.empty(); });
+        if (_snapshotThreadShouldExit) {
+            return;
+        }
+        uint64_t peerID = _snapshotRequests.begin()->first;
+        SData request = move(_snapshotRequests.begin()->second);
+        _snapshotRequests.erase(_snapshotRequests.begin());
+        lock.unlock();
+
+        // Peers are only deleted when we are, which joins this thread first, so this is safe to use until we're done.
+        Peer* peer = getPeerByID(peerID);
+        if (!peer) {
+            lock.lock();
+            continue;
+        }
+        SData response;
+        uint64_t delay = 0;
+        try {
+            SQLiteScopedHandle dbScope(_dbPool, _dbPool.getIndex());
+            SQLite& db = dbScope.db();
+            delay = _queueSnapshot(peer, db, request, response);
+
+            // The following two lines are copied from `_sendToPeer`.
+            response["CommitCount"] = to_string(db.getCommitCount());
+            response["Hash"] = db.getCommittedHash();
+        } catch (const SException& e) {
+            // Any failure causes the peer to reconnect, and try again, or synchronize instead.
+            response = SData("RECONNECT");
+            response["Reason"] = e.what();
+        }
+
+        // Wait out our rate limit, unless we're shutting down, in which case the peer will go looking elsewhere.
+        lock.lock();
+        auto shouldExit = [this]() { return _snapshotThreadShouldExit; };
+        if (delay && _snapshotRequestCV.wait_for(lock, chrono::microseconds(delay), shouldExit)) {
+            return;
+        }
+        lock.unlock();
+        peer->sendMessage(response);
+        lock.lock();
+    }
+}
+
+uint64_t SQLiteNode::_queueSnapshot(Peer* peer, SQLite& db, const SData& request, SData& response) {
+    // There's one snapshot file per node, shared by every peer that downloads it. It's replaced when a peer starts a
+    // new download and the existing one is older than SQL_NODE_SNAPSHOT_MAX_AGE. Peers in the middle of downloading
+    // a replaced snapshot are sent the start of the new one, and start over.
+    const string filename = db.getFilename() + ".snapshot";
+    uint64_t offset = request.calcU64("Offset");
+    if (!_servedSnapshotCommitCount || !SFileExists(filename) ||
+        (!offset && STimeNow() > _servedSnapshotCreated + SQL_NODE_SNAPSHOT_MAX_AGE)) {
+        PINFO("Creating snapshot.");
+        if (!db.createSnapshot(filename, _servedSnapshotCommitCount, _servedSnapshotHash)) {
+            _servedSnapshotCommitCount = 0;
+            STHROW("error creating snapshot");
+        }
+        _servedSnapshotCreated = STimeNow();
+    }
+    if (offset && request.calcU64("SnapshotCommitCount") != _servedSnapshotCommitCount) {
+        offset = 0;
+    }
+
+    // Read the requested chunk.
+    uint64_t totalSize = SFileSize(filename);
+    if (offset > totalSize) {
+        STHROW("invalid snapshot offset");
+    }
+    string chunk;
+    chunk.resize(min((uint64_t)SQL_NODE_SNAPSHOT_CHUNK_BYTES, totalSize - offset));
+    ifstream file(filename, ios::binary);
+    file.seekg(offset);
+    file.read(&chunk[0], chunk.size());
+    if (!file) {
+        STHROW("error reading snapshot");
+    }
+
+    // Work out how long to wait before sending this chunk to stay within our rate limit.
+    uint64_t delay = 0;
+    uint64_t maxBytesPerSecond = snapshotMaxBytesPerSecond;
+    if (maxBytesPerSecond) {
+        uint64_t now = STimeNow();
+        _nextSnapshotSendTime = max(_nextSnapshotSendTime, now);
+        delay = _nextSnapshotSendTime - now;
+        _nextSnapshotSendTime += chunk.size() * STIME_US_PER_S / maxBytesPerSecond;
+    }
+
+    PINFO("Sending snapshot bytes " << offset << "-" << offset + chunk.size() << " of " << totalSize << ".");
+    response.methodLine = "SNAPSHOT_RESPONSE";
+    response["Offset"] = to_string(offset);
+    response["TotalSize"] = to_string(totalSize);
+    response["SnapshotCommitCount"] = to_string(_servedSnapshotCommitCount);
+    response["SnapshotHash"] = _servedSnapshotHash;
+    response.content = move(chunk);
+    return delay;
+}
+
+void SQLiteNode::_commitPipelined() {
+    uint64_t commitID = _lastSentTransactionID + 1;
+    uint64_t beforeCommit = STimeNow();
+    int result = _db.commit(stateName(_state));
+    SINFO("SQLite::commit in SQLiteNode took " << ((STimeNow() - beforeCommit)/1000) << "ms.");
+    if (result == SQLITE_BUSY_SNAPSHOT) {
+        // We already asked everyone to begin this, so we have to tell them to roll back.
+        SINFO("[performance] Conflict committing pipelined QUORUM commit, rolling back.");
+        SData rollback("ROLLBACK_TRANSACTION");
+        rollback.set("ID", commitID);
+        _sendToAllPeers(rollback, true); // true: Only to subscribed peers.
+        _db.rollback();
+        _commitState = CommitState::FAILED;
+        return;
+    }
+
+    // Send the COMMIT right away, followers can't begin the next transaction until they've committed this one.
+    _sendOutstandingTransactions({commitID});
+    _quorumPendingCommits[commitID] = _db.getCommittedHash();
+    _lastPipelinedCommitID = commitID;
+    _commitState = CommitState::SUCCESS;
+    _updateQuorumApprovedCommit();
+    SINFO("[performance] Committed pipelined QUORUM transaction #" << commitID << " (" << _db.getCommittedHash()
+          << "), " << _quorumPendingCommits.size() << " awaiting approval.");
+}
+
+void SQLiteNode::_updateQuorumApprovedCommit() {
+    // Find the highest commit approved by a majority of full peers, using the same definition of "majority" as
+    // non-pipelined commits. A peer that denied a commit and then resynchronized never approves it, but if it's
+    // logged in and reports one of our pending commits with the same hash, its chain of commits is the same as ours up
+    // to there, so it has that commit and everything before it, which counts the same.
+    vector<uint64_t> approvals;
+    for (auto peer : peerList) {
+        if (!peer->permaFollower) {
+            auto it = _quorumApprovals.find(peer);
+            uint64_t approved = it == _quorumApprovals.end() ? 0 : it->second;
+            if (peer->loggedIn) {
+                uint64_t peerCommitCount;
+                string peerHash;
+                peer->getCommit(peerCommitCount, peerHash);
+                auto pendingIt = _quorumPendingCommits.find(peerCommitCount);
+                if (pendingIt != _quorumPendingCommits.end() && pendingIt->second == peerHash) {
+                    approved = max(approved, peerCommitCount);
+                }
+            }
+            approvals.push_back(approved);
+        }
+    }
+    // Everything before the first commit still pending was approved already, however few peers have told us so.
+    size_t required = (approvals.size() + 1) / 2;
+    if (!required || _quorumPendingCommits.empty()) {
+        _quorumApprovedCommit = _lastSentTransactionID;
+    } else {
+        nth_element(approvals.begin(), approvals.begin() + required - 1, approvals.end(), greater<uint64_t>());
+        _quorumApprovedCommit = max(_quorumPendingCommits.begin()->first - 1, approvals[required - 1]);
+    }
+    _quorumPendingCommits.erase(_quorumPendingCommits.begin(), _quorumPendingCommits.upper_bound(_quorumApprovedCommit));
+}
+
+void SQLiteNode::_startSynchronization() {
+    SASSERT(_syncPeer);
+    _syncRequestsInFlight.clear();
+    _syncResponsesPending.clear();
+    _syncRangesToRetry.clear();
+    _syncNextRequestCommit = _db.getCommitCount() + 1;
+    _syncPipelinedPeers.clear();
+    _syncLegacyPeers.clear();
+    _syncStartCommit = _db.getCommitCount();
+    _syncStartTime = STimeNow();
+    _sendSynchronizeRequests();
+}
+
+void SQLiteNode::_sendSynchronizeRequests() {
+    SASSERT(_syncPeer);
+    uint64_t commitCount = _db.getCommitCount();
+    uint64_t peerCommitCount = _syncPeer->commitCount;
+    _syncTargetCommit = peerCommitCount;
+
+    // If nothing is outstanding, start from wherever we are now. This also covers switching to a new sync peer.
+    if (_syncRequestsInFlight.empty() && _syncResponsesPending.empty()) {
+        _syncNextRequestCommit = commitCount + 1;
+        _syncRangesToRetry.clear();
+    }
+
+    // Until our sync peer confirms it understands pipelined requests, we only ask it for one chunk at a time, and
+    // don't involve anyone else. After that, we spread ranges across other peers that are ahead of us, skipping leader
+    // so that catching up doesn't add to its load.
+    list<Peer*> syncPeers = {_syncPeer};
+    if (_syncPipelinedPeers.count(_syncPeer)) {
+        for (auto peer : peerList) {
+            if (syncPeers.size() >= SQL_NODE_SYNC_MAX_PEERS) {
+                break;
+            }
+            if (peer == _syncPeer || !peer->connected() || !peer->loggedIn || peer->state == LEADING ||
+                peer->commitCount <= commitCount || _syncLegacyPeers.count(peer)) {
+                continue;
+            }
+            syncPeers.push_back(peer);
+        }
+    }
+    map<Peer*, size_t> peerRequests;
+    for (const auto& request : _syncRequestsInFlight) {
+        peerRequests[request.second.second]++;
+    }
+
+    // Responses that are waiting on an earlier range count against the limit, so a single slow peer can't make us
+    // buffer an unbounded amount of data from the others.
+    while (_syncRequestsInFlight.size() + _syncResponsesPending.size() < SQL_NODE_SYNC_MAX_IN_FLIGHT * syncPeers.size()) {
+        // Ranges to retry come first, as they're what's holding us up.
+        uint64_t fromCommit = 0;
+        uint64_t toCommit = 0;
+        auto retryIt = _syncRangesToRetry.begin();
+        if (retryIt != _syncRangesToRetry.end()) {
+            if (retryIt->second <= commitCount) {
+                _syncRangesToRetry.erase(retryIt);
+                continue;
+            }
+            fromCommit = max(retryIt->first, commitCount + 1);
+            toCommit = retryIt->second;
+        } else if (_syncNextRequestCommit <= peerCommitCount) {
+            fromCommit = _syncNextRequestCommit;
+            toCommit = min(peerCommitCount, fromCommit + _syncChunkCommits - 1);
+        } else {
+            break;
+        }
+
+        // Send it to whichever peer that has these commits has the fewest requests outstanding.
+        Peer* requestPeer = nullptr;
+        for (auto peer : syncPeers) {
+            size_t maxInFlight = _syncPipelinedPeers.count(peer) ? SQL_NODE_SYNC_MAX_IN_FLIGHT : 1;
+            if (peerRequests[peer] < maxInFlight && peer->commitCount >= fromCommit &&
+                (!requestPeer || peerRequests[peer] < peerRequests[requestPeer])) {
+                requestPeer = peer;
+            }
+        }
+        if (!requestPeer) {
+            break;
+        }
+        uint64_t rangeEnd = toCommit;
+        toCommit = min(toCommit, (uint64_t)requestPeer->commitCount);
+        if (retryIt != _syncRangesToRetry.end()) {
+            _syncRangesToRetry.erase(retryIt);
+            if (toCommit < rangeEnd) {
+                _syncRangesToRetry[toCommit + 1] = rangeEnd;
+            }
+        } else {
+            _syncNextRequestCommit = toCommit + 1;
+        }
+
+        SData request("SYNCHRONIZE");
+        request["FromCommit"] = to_string(fromCommit);
+        request["ToCommit"] = to_string(toCommit);
+        _sendToPeer(requestPeer, request);
+        _syncRequestsInFlight[fromCommit] = make_pair(toCommit, requestPeer);
+        peerRequests[requestPeer]++;
+    }
+    _syncInFlightDepth = _syncRequestsInFlight.size();
+    _syncActivePeers = count_if(peerRequests.begin(), peerRequests.end(), [](const auto& p) { return p.second; });
+}
+
+void SQLiteNode::_recvSynchronizeChunk(Peer* peer, const SData& message) {
+    uint64_t fromCommit = message.calcU64("FromCommit");
+    auto requestIt = _syncRequestsInFlight.find(fromCommit);
+    if (requestIt == _syncRequestsInFlight.end() || requestIt->second.second != peer) {
+        // This is a response to a request from an earlier synchronization attempt, or a range we've since asked
+        // someone else for, we don't need it anymore.
+        PINFO("Ignoring SYNCHRONIZE_RESPONSE from commit " << fromCommit << " that we aren't waiting for.");
+        return;
+    }
+    _syncPipelinedPeers.insert(peer);
+    _syncResponsesPending.emplace(fromCommit, make_tuple(requestIt->second.first, peer, message));
+    _syncRequestsInFlight.erase(requestIt);
+
+    // Apply everything that's next in line.
+    while (!_syncResponsesPending.empty()) {
+        auto pendingIt = _syncResponsesPending.begin();
+        uint64_t commitCount = _db.getCommitCount();
+        if (pendingIt->first > commitCount + 1) {
+            // There's a gap before this one, wait for it to arrive.
+            break;
+        }
+        if (pendingIt->first <= commitCount) {
+            // We already have this data.
+            _syncResponsesPending.erase(pendingIt);
+            continue;
+        }
+
+        uint64_t toCommit = get<0>(pendingIt->second);
+        Peer* responsePeer = get<1>(pendingIt->second);
+        const SData& response = get<2>(pendingIt->second);
+
+        // Ranges from different peers have to stitch together exactly. `_recvSynchronize` checks each commit's hash
+        // follows on from the one before it before committing it, so if this range doesn't, it stops at the first
+        // commit that doesn't, and we ask someone else for the rest.
+        size_t numCommits = response.calc("NumCommits");
+        try {
+            _recvSynchronize(responsePeer, response);
+        } catch (const SException& e) {
+            if (responsePeer == _syncPeer || !SStartsWith(e.what(), "commit chain mismatch")) {
+                throw;
+            }
+            uint64_t newCommitCount = _db.getCommitCount();
+            SWARN("Commits from peer '" << responsePeer->name << "' starting at " << pendingIt->first
+                  << " don't follow from our commit " << newCommitCount << ", requesting them elsewhere.");
+            _syncRangesToRetry[newCommitCount + 1] = toCommit;
+            _syncResponsesPending.erase(pendingIt);
+            _retrySynchronizeRanges(responsePeer);
+            _reconnectPeer(responsePeer);
+            break;
+        }
+
+        // Tune the chunk size so that subsequent requests come back near our byte target.
+        if (numCommits) {
+            uint64_t bytesPerCommit = max(response.content.size() / numCommits, (size_t)1);
+            _syncChunkCommits = max((uint64_t)10, min((uint64_t)10'000, SQL_NODE_SYNC_CHUNK_TARGET_BYTES / bytesPerCommit));
+        }
+
+        // If the peer sent less than we asked for (it was behind, or it capped the size of the chunk), ask for the
+        // remainder of the range.
+        uint64_t newCommitCount = _db.getCommitCount();
+        _syncResponsesPending.erase(pendingIt);
+        if (newCommitCount < toCommit) {
+            _syncRangesToRetry[newCommitCount + 1] = toCommit;
+        }
+    }
+    _syncInFlightDepth = _syncRequestsInFlight.size();
+}
+
+void SQLiteNode::_retrySynchronizeRanges(Peer* peer) {
+    for (auto it = _syncRequestsInFlight.begin(); it != _syncRequestsInFlight.end();) {
+        if (it->second.second == peer) {
+            _syncRangesToRetry[it->first] = it->second.first;
+            it = _syncRequestsInFlight.erase(it);
+        } else {
+            it++;
+        }
+    }
+    _syncInFlightDepth = _syncRequestsInFlight.size();
+}
+
 void SQLiteNode::_updateSyncPeer()
 {
     Peer* newSyncPeer = nullptr;
@@ -2357,6 +3435,7 @@ void SQLiteNode::_updateSyncPeer()
 
 void SQLiteNode::_reconnectPeer(Peer* peer) {
     // If we're connected, just kill the connection
+    lock_guard<decltype(peer->_stateMutex)> lock(peer->_stateMutex);
     if (peer->socket) {
         // Reset
         SHMMM("Reconnecting to '" << peer->name << "'");
@@ -2404,11 +3483,12 @@ bool SQLiteNode::peekPeerCommand(shared_ptr<SQLiteNode> node, SQLite& db, SQLite
                 // There's nobody to send to, but this was a valid command that's been handled.
                 return true;
             }
-            command.response.methodLine = "SYNCHRONIZE_RESPONSE";
 
             // Because we hold a sharedPtr to the node, it can't delete any peers (because it only does at
             // destruction), and since our peers our thread-safe, we can run this just fine.
-            _queueSynchronize(node.get(), peer, db, command.response, false);
+            command.response.methodLine = "SYNCHRONIZE_RESPONSE";
+            _queueSynchronize(node.get(), peer, db, command.response, false, command.request.calcU64("FromCommit"),
+                              command.request.calcU64("ToCommit"));
 
             // The following two lines are copied from `_sendToPeer`.
             command.response["CommitCount"] = to_string(db.getCommitCount());
@@ -19,6 +19,61 @@ class SQLiteNode : public STCPNode {
     // Separate timeout for receiving and applying synchronization commits.
     static const uint64_t SQL_NODE_SYNCHRONIZING_RECV_TIMEOUT;
 
+    // Synchronization is pipelined: we keep up to this many SYNCHRONIZE requests outstanding to each peer we're
+    // synchronizing from, so the next chunk is on the wire while we apply the current one.
+    static const size_t SQL_NODE_SYNC_MAX_IN_FLIGHT;
+
+    // The maximum number of peers we synchronize from at once. Commit ranges are spread across them.
+    static const size_t SQL_NODE_SYNC_MAX_PEERS;
+
+    // The number of commits we request per chunk is adjusted to keep chunks near this size.
+    static const size_t SQL_NODE_SYNC_CHUNK_TARGET_BYTES;
+
+    // A peer serving a pipelined SYNCHRONIZE request stops adding commits to a chunk once it reaches this size.
+    static const size_t SQL_NODE_SYNC_CHUNK_MAX_BYTES;
+
+    // Size of each SNAPSHOT_RESPONSE chunk.
+    static const size_t SQL_NODE_SNAPSHOT_CHUNK_BYTES;
+
+    // A peer serving snapshots reuses its existing snapshot file for new requests until it's this old.
+    static const uint64_t SQL_NODE_SNAPSHOT_MAX_AGE;
+
+    // Leader sends followers that support it a HEARTBEAT at this interval, so followers can bound how stale their
+    // data is even when there's nothing being committed.
+    static const uint64_t SQL_NODE_HEARTBEAT_INTERVAL;
+
+    // When a transaction conflicts during parallel replication, transactions that ran concurrently with another on
+    // leader are replicated serially until this many commits have passed without another conflict.
+    static const uint64_t SQL_NODE_SERIAL_REPLICATION_COMMITS;
+
+    // Parallel replication statistics are kept for batches of this many consecutive commits, and for this many of the
+    // most recent batches.
+    static const uint64_t SQL_NODE_REPLICATION_BATCH_COMMITS;
+    static const size_t SQL_NODE_REPLICATION_BATCHES_KEPT;
+
+    // If non-zero, a node that is at least this many commits behind the freshest peer bootstraps from a snapshot of a
+    // following peer's database, and then synchronizes from there, rather than synchronizing every commit.
+    static atomic<uint64_t> snapshotThreshold;
+
+    // If non-zero, the maximum rate, in bytes per second, at which this node serves snapshots to all peers combined.
+    static atomic<uint64_t> snapshotMaxBytesPerSecond;
+
+    // The number of QUORUM commits from the sync thread that can be awaiting approval by followers at once. At the
+    // default of 1, leader waits for a majority of followers to approve each QUORUM transaction before committing it,
+    // and can't start another until it has. Above 1, QUORUM commits are pipelined: leader commits locally as soon as
+    // it's sent the transaction to followers, and the caller holds the command's response until
+    // `getQuorumApprovedCommit` reaches it. This gives up the guarantee that a QUORUM commit can't exist only on a
+    // leader that fails before followers approve it, in exchange for not waiting a round trip per commit. It also means
+    // a follower denying a commit can't roll it back. Instead, the follower resynchronizes, and counts towards the
+    // majority once it reports the same commit and hash. A command whose commit no majority has confirmed by the time
+    // leader stops leading fails with "555 Commit not confirmed by quorum".
+    static atomic<size_t> quorumPipelineDepth;
+
+    // If non-zero, the most bytes that can be waiting in a peer's send buffer. A peer that falls this far behind
+    // reading from us is disconnected, and its buffer discarded, rather than letting the buffer grow without bound.
+    // It will synchronize the commits it missed when it reconnects.
+    static atomic<uint64_t> peerSendBufferLimit;
+
     // Write consistencies available
     enum ConsistencyLevel {
         ASYNC,  // Fully asynchronous write, no follower approval required.
@@ -44,6 +99,11 @@ class SQLiteNode : public STCPNode {
 
     const vector<Peer*> initPeers(const string& peerList);
 
+    // Wraps STCPNode's pre/postPoll. Before polling, sends any escalations and escalation responses queued since the
+    // last poll, batched per peer.
+    void prePoll(fd_map& fdm);
+    void postPoll(fd_map& fdm, uint64_t& nextActivity);
+
     // Simple Getters. See property definitions for details.
     State         getState()         { return _state; }
     int           getPriority()      { return _priority; }
@@ -62,6 +122,14 @@ class SQLiteNode : public STCPNode {
     // false.
     bool commitSucceeded() { return _commitState == CommitState::SUCCESS; }
 
+    // If the last commit succeeded and was pipelined (see `quorumPipelineDepth`), returns its commit ID, which hasn't
+    // necessarily been approved by a majority of followers yet. Otherwise, returns 0.
+    uint64_t getPipelinedCommitID() { return _commitState == CommitState::SUCCESS ? _lastPipelinedCommitID : 0; }
+
+    // Returns the highest commit that's been approved by a majority of full peers. Pipelined commits up to this one
+    // are safe to respond to. Only meaningful while LEADING or STANDINGDOWN, and only call from the sync thread.
+    uint64_t getQuorumApprovedCommit() { return _quorumApprovedCommit; }
+
     // Returns true if we're LEADING with enough FOLLOWERs to commit a quorum transaction. Not thread-safe to call
     // outside the sync thread.
     bool hasQuorum();
@@ -101,6 +169,25 @@ class SQLiteNode : public STCPNode {
     // This exists so that the _server can inspect internal state for diagnostic purposes.
     list<string> getEscalatedCommandRequestMethodLines();
 
+    // Returns progress information about the current (or most recent) synchronization, for diagnostic purposes.
+    STable getSynchronizationInfo();
+
+    // Returns an upper bound, in ms, on how far this node's data lags leader's: if we're FOLLOWING, it's how long ago
+    // leader told us a commit count that we've since caught up with. 0 if we're leading, and UINT64_MAX if we're not
+    // following anyone. Thread-safe.
+    uint64_t getReadStalenessMS();
+
+    // The commit count leader last told us it had, or 0 if we're not FOLLOWING. Thread-safe.
+    uint64_t getLeaderCommitCount();
+
+    // Returns a histogram of how long escalated commands took to get a response from leader, keyed by the upper bound
+    // of each bucket in ms. Thread-safe.
+    STable getEscalationLatencyHistogram();
+
+    // Returns conflict statistics for the most recent batches of commits replicated in parallel, oldest first.
+    // Thread-safe.
+    list<STable> getReplicationBatchStats();
+
     // This will broadcast a message to all peers, or a specific peer.
     void broadcast(const SData& message, Peer* peer = nullptr);
 
@@ -124,6 +211,89 @@ class SQLiteNode : public STCPNode {
     void _updateSyncPeer();
     Peer* _syncPeer;
 
+    // Pipelined synchronization state. These are only accessed from the sync thread.
+    // `_syncPeer` is our primary sync peer, but once it's shown it supports pipelining, commit ranges are also
+    // requested from other up-to-date peers. `_syncRequestsInFlight` maps the first commit of each outstanding
+    // SYNCHRONIZE request to the last commit requested and the peer it was sent to. Responses can arrive out of order,
+    // so they're held in `_syncResponsesPending` (keyed the same way) until they're next in line to be applied.
+    // Ranges that need to be requested again (because a peer disconnected, sent less than we asked for, or sent
+    // commits that don't chain from ours) are kept in `_syncRangesToRetry`.
+    map<uint64_t, pair<uint64_t, Peer*>> _syncRequestsInFlight;
+    map<uint64_t, tuple<uint64_t, Peer*, SData>> _syncResponsesPending;
+    map<uint64_t, uint64_t> _syncRangesToRetry;
+
+    // The first commit we haven't yet requested from any peer.
+    uint64_t _syncNextRequestCommit;
+
+    // Peers that have answered with a `FromCommit` header, indicating they support pipelined requests. Until a peer
+    // has, we only keep one request outstanding to it. Peers in `_syncLegacyPeers` answered without it, and we don't
+    // send them any more ranges.
+    set<Peer*> _syncPipelinedPeers;
+    set<Peer*> _syncLegacyPeers;
+
+    // Reset all of the above and send the first SYNCHRONIZE requests to `_syncPeer`.
+    void _startSynchronization();
+
+    // Send as many SYNCHRONIZE requests to `_syncPeer` and our other sync peers as we're allowed to have outstanding.
+    void _sendSynchronizeRequests();
+
+    // Handle a pipelined SYNCHRONIZE_RESPONSE, applying it and any pending responses that follow it in order.
+    void _recvSynchronizeChunk(Peer* peer, const SData& message);
+
+    // Stop waiting on any ranges requested from `peer`, and request them from someone else instead.
+    void _retrySynchronizeRanges(Peer* peer);
+
+    // Snapshot bootstrap state, also only accessed from the sync thread. When `_snapshotInProgress` is set, we're
+    // SYNCHRONIZING by downloading a snapshot from `_syncPeer` into `_snapshotFile` rather than by applying commits.
+    bool _snapshotInProgress;
+    string _snapshotFile;
+    uint64_t _snapshotCommitCount;
+    string _snapshotHash;
+
+    // If we're far enough behind, find a following peer to download a snapshot from, and start the download. Returns
+    // false if we shouldn't or can't bootstrap from a snapshot.
+    bool _startSnapshot(uint64_t freshestPeerCommitCount);
+
+    // Handle a SNAPSHOT_RESPONSE, requesting the next chunk, or restoring the snapshot if it's complete.
+    void _recvSnapshot(Peer* peer, const SData& message);
+
+    // Serving snapshots to peers. Creating a snapshot and waiting out `snapshotMaxBytesPerSecond` can both take a long
+    // time, so rather than tie up the sync thread or a worker, SNAPSHOT requests are handed to `_snapshotThread`,
+    // which serves them one at a time with its own DB handle. It's started the first time a peer asks for a snapshot.
+    // Each peer has at most one request waiting (a peer only asks for its next chunk once it has the last one), so
+    // there are never more waiting than we have peers. Returns immediately; called from the sync thread.
+    void _queueSnapshotRequest(Peer* peer, const SData& request);
+
+    // The body of `_snapshotThread`, which runs until `_snapshotThreadShouldExit` is set.
+    void _serveSnapshots();
+
+    // Build a SNAPSHOT_RESPONSE for `peer`'s request, creating the snapshot if required. Returns how long to wait, in
+    // microseconds, before sending it, to stay under `snapshotMaxBytesPerSecond`. Only called from `_snapshotThread`.
+    uint64_t _queueSnapshot(Peer* peer, SQLite& db, const SData& request, SData& response);
+
+    // State for `_snapshotThread`. The requests waiting, by peer ID, are protected by `_snapshotRequestMutex`.
+    thread _snapshotThread;
+    mutex _snapshotRequestMutex;
+    condition_variable _snapshotRequestCV;
+    map<uint64_t, SData> _snapshotRequests;
+    bool _snapshotThreadShouldExit;
+
+    // The snapshot file we serve, shared by every peer that downloads it, and only accessed by `_snapshotThread`.
+    uint64_t _servedSnapshotCommitCount;
+    string _servedSnapshotHash;
+    uint64_t _servedSnapshotCreated;
+    uint64_t _nextSnapshotSendTime;
+
+    // Synchronization progress, readable from any thread via `getSynchronizationInfo`.
+    atomic<uint64_t> _syncChunkCommits;
+    atomic<uint64_t> _syncInFlightDepth;
+    atomic<uint64_t> _syncActivePeers;
+    atomic<uint64_t> _syncStartCommit;
+    atomic<uint64_t> _syncStartTime;
+    atomic<uint64_t> _syncTargetCommit;
+    atomic<uint64_t> _snapshotBytesReceived;
+    atomic<uint64_t> _snapshotTotalBytes;
+
     // Store the ID of the last transaction that we replicated to peers. Whenever we do an update, we will try and send
     // any new committed transactions to peers, and update this value.
     static uint64_t _lastSentTransactionID;
@@ -157,6 +327,21 @@ class SQLiteNode : public STCPNode {
     // The write consistency requested for the current in-progress commit.
     ConsistencyLevel _commitConsistency;
 
+    // Pipelined QUORUM commit state, only accessed from the sync thread. `_quorumApprovals` is the highest pipelined
+    // commit each peer has approved. Followers apply commits strictly in order, so approving a commit means they have
+    // everything before it as well. `_quorumPendingCommits` maps the ID of each pipelined commit that a majority of
+    // peers haven't approved yet to its hash.
+    map<Peer*, uint64_t> _quorumApprovals;
+    map<uint64_t, string> _quorumPendingCommits;
+    uint64_t _lastPipelinedCommitID;
+    uint64_t _quorumApprovedCommit;
+
+    // Commit the current transaction without waiting for peers to approve it, after BEGIN_TRANSACTION has been sent.
+    void _commitPipelined();
+
+    // Recompute `_quorumApprovedCommit` from `_quorumApprovals`, and forget pending commits that it covers.
+    void _updateQuorumApprovedCommit();
+
     // Stopwatch to track if we're going to give up on gracefully shutting down and force it.
     SStopwatch _gracefulShutdownTimeout;
 
@@ -184,7 +369,10 @@ class SQLiteNode : public STCPNode {
     // Queue a SYNCHRONIZE message based on the current state of the node, thread-safe, but you need to pass the
     // *correct* DB for the thread that's making the call (i.e., you can't use the node's internal DB from a worker
     // thread with a different DB object) - which is why this is static.
-    static void _queueSynchronize(SQLiteNode* node, Peer* peer, SQLite& db, SData& response, bool sendAll);
+    // If `fromCommit` is set, commits are sent starting there rather than from the peer's current commit count, and
+    // if `toCommit` is set, no commits past it are sent.
+    static void _queueSynchronize(SQLiteNode* node, Peer* peer, SQLite& db, SData& response, bool sendAll,
+                                  uint64_t fromCommit = 0, uint64_t toCommit = 0);
     void _recvSynchronize(Peer* peer, const SData& message);
     void _reconnectPeer(Peer* peer);
     void _reconnectAll();
@@ -196,6 +384,72 @@ class SQLiteNode : public STCPNode {
     // following map of commandID to Command until the follower responds.
     SynchronizedMap<string, unique_ptr<SQLiteCommand>> _escalatedCommandMap;
 
+    // Escalations aren't sent as soon as they're made. They're queued here (along with the leader they were meant for)
+    // and sent together the next time we poll, so that a follower escalating many commands at once sends a single
+    // ESCALATE_BATCH. Only accessed from the sync thread.
+    list<pair<Peer*, SData>> _pendingEscalations;
+
+    // The same, for responses to commands escalated to us. These are queued by whichever thread finished the command,
+    // so this is synchronized, and it wakes up the sync thread's poll loop so responses aren't held up waiting for it.
+    SSynchronizedQueue<pair<uint64_t, SData>> _pendingEscalateResponses;
+
+    // Peers that said in their LOGIN that they understand ESCALATE_BATCH and ESCALATE_RESPONSE_BATCH. Anyone else
+    // gets the messages one at a time.
+    set<Peer*> _escalateBatchPeers;
+
+    // Peers that said in their LOGIN that they accept HEARTBEAT messages, and when we last sent them.
+    set<Peer*> _heartbeatPeers;
+    uint64_t _lastHeartbeatTime;
+
+    // While LEADING, send a HEARTBEAT to subscribed followers if it's been SQL_NODE_HEARTBEAT_INTERVAL since the last.
+    void _sendHeartbeats();
+
+    // While FOLLOWING, every message from leader is recorded here as (leader's commit count, time received), until
+    // we've committed up to that count, at which point we know our data was current as of that time, which is saved
+    // in `_caughtUpTime`. Protected by `_stalenessMutex` as `getReadStalenessMS` is called from worker threads.
+    list<pair<uint64_t, uint64_t>> _leaderContacts;
+    uint64_t _caughtUpTime;
+    mutex _stalenessMutex;
+
+    // Record a message from leader, and update `_caughtUpTime` against our current commit count. Call with
+    // `_stalenessMutex` locked.
+    void _recordLeaderContact(uint64_t leaderCommitCount);
+    void _updateCaughtUpTime();
+
+    // The time we sent each recent BEGIN_TRANSACTION, by commit count, so we can measure how long each peer takes to
+    // approve it. Only accessed from the sync thread.
+    map<uint64_t, uint64_t> _transactionSendTimes;
+
+    // When we last sampled our peers' telemetry.
+    uint64_t _lastTelemetryTime;
+
+    // Take a telemetry sample of every peer if it's been Peer::TELEMETRY_INTERVAL since the last one.
+    void _recordPeerTelemetry();
+
+    // Called after sending to a peer. Updates its send buffer high-water mark, and if the buffer is over
+    // `peerSendBufferLimit`, stops sending to the peer and drops the connection so it has to resynchronize.
+    void _checkSendBuffer(Peer* peer);
+
+    // Send everything in `_pendingEscalations` and `_pendingEscalateResponses`.
+    void _sendPendingEscalations();
+
+    // Send everything in `_pendingEscalateResponses`, batched by peer.
+    void _sendPendingEscalateResponses();
+
+    // Give every command in `_escalatedCommandMap` back to the server to be escalated to the next leader, except those
+    // that are already past their deadline, which are failed with a timeout instead. Clears the map.
+    void _requeueEscalatedCommands();
+
+    // Fail any escalated commands that are past their deadline, and ask leader to cancel them.
+    void _expireEscalatedCommands();
+
+    // Upper bounds (in ms) of the buckets in `_escalationLatencyHistogram`. The last bucket counts everything slower.
+    static constexpr array<uint64_t, 12> ESCALATION_LATENCY_BUCKETS_MS = {1, 2, 5, 10, 20, 50, 100, 200, 500, 1000, 2000, 5000};
+    array<atomic<uint64_t>, ESCALATION_LATENCY_BUCKETS_MS.size() + 1> _escalationLatencyHistogram;
+
+    // Send `messages` to `peer`, as a single `batchMethod` message if there's more than one and the peer supports it.
+    void _sendBatchToPeer(Peer* peer, const string& batchMethod, const list<SData>& messages);
+
     // Replicates any transactions that have been made on our database by other threads to peers.
     void _sendOutstandingTransactions(const set<uint64_t>& commitOnlyIDs = {});
 
@@ -249,6 +503,31 @@ class SQLiteNode : public STCPNode {
     // which happens when a node stops FOLLOWING.
     static void replicate(SQLiteNode& node, Peer* peer, SData command, size_t sqlitePoolIndex);
 
+    // Transactions that conflict with each other on followers are those that ran concurrently on leader, which we can
+    // tell from `dbCountAtStart` being earlier than the previous commit. When one of these conflicts, the rows it
+    // touches are likely to be hot, and the transactions following it are likely to conflict as well, so we run
+    // concurrent transactions serially, starting each once the previous one has committed, through this commit count.
+    atomic<uint64_t> _serialReplicationUntil;
+
+    // Record a conflict replicating commit `commitCount`, extending `_serialReplicationUntil`.
+    void _recordReplicationConflict(uint64_t commitCount);
+
+    // Statistics for a batch of SQL_NODE_REPLICATION_BATCH_COMMITS commits, starting from `firstCommit`, which they're
+    // keyed by.
+    // `conflicts` counts the transactions that conflicted at least once, and `retries` every time one was re-run.
+    struct ReplicationBatchStats {
+        uint64_t firstCommit;
+        uint64_t transactions;
+        uint64_t conflicts;
+        uint64_t retries;
+        uint64_t serial;
+    };
+    map<uint64_t, ReplicationBatchStats> _replicationBatchStats;
+    mutex _replicationBatchStatsMutex;
+
+    // Record a replicated commit, and how many times it was retried, in `_replicationBatchStats`.
+    void _recordReplicationStats(uint64_t commitCount, uint64_t retries, bool serial);
+
     // Counter of the total number of currently active replication threads. This is used to let us know when all
     // threads have finished.
     atomic<int64_t> _replicationThreadCount;
@@ -70,6 +70,15 @@ int main(int argc, char* argv[]) {
         threads = SToInt(args["-threads"]);
     }
 
+    // Perf fixtures are excluded unless specified explicitly.
+    if (args.isSet("-perf")) {
+        include.insert("Perf.*");
+        exclude.erase("Perf.*");
+    } else {
+        include.erase("Perf.*");
+        exclude.insert("Perf.*");
+    }
+
 
 
     int retval = 0;
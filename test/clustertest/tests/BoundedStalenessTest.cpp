@@ -0,0 +1,49 @@
+#include "../BedrockClusterTester.h"
+
+struct BoundedStalenessTest : tpunit::TestFixture {
+    BoundedStalenessTest()
+        : tpunit::TestFixture("BoundedStaleness",
+                              BEFORE_CLASS(BoundedStalenessTest::setup),
+                              AFTER_CLASS(BoundedStalenessTest::teardown),
+                              TEST(BoundedStalenessTest::freshRead),
+                              TEST(BoundedStalenessTest::staleReadAllowed)) { }
+
+    BedrockClusterTester* tester;
+
+    void setup() {
+        tester = new BedrockClusterTester();
+    }
+
+    void teardown() {
+        delete tester;
+    }
+
+    // Reads with `maxStalenessMS: 0` on a follower must see everything leader had committed when they were sent,
+    // whether the follower has caught up or has to escalate.
+    void freshRead() {
+        BedrockTester& leader = tester->getTester(0);
+        BedrockTester& follower = tester->getTester(1);
+        for (int i = 0; i < 20; i++) {
+            int id = 60000 + i;
+            SData insert("Query");
+            insert["writeConsistency"] = "ASYNC";
+            insert["Query"] = "INSERT INTO test VALUES(" + SQ(id) + ", " + SQ("bounded_staleness") + ");";
+            leader.executeWaitVerifyContent(insert);
+
+            SData select("Query");
+            select["maxStalenessMS"] = "0";
+            select["Query"] = "SELECT id FROM test WHERE id = " + SQ(id) + ";";
+            string result = follower.executeWaitVerifyContent(select);
+            ASSERT_TRUE(SContains(result, to_string(id)));
+        }
+    }
+
+    // A generous bound should still be answered normally.
+    void staleReadAllowed() {
+        BedrockTester& follower = tester->getTester(1);
+        SData select("Query");
+        select["maxStalenessMS"] = "60000";
+        select["Query"] = "SELECT COUNT(*) FROM test;";
+        follower.executeWaitVerifyContent(select);
+    }
+} __BoundedStalenessTest;
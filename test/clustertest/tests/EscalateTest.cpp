@@ -1,7 +1,7 @@
 #include "../BedrockClusterTester.h"
 
 struct EscalateTest : tpunit::TestFixture {
-    EscalateTest() : tpunit::TestFixture("EscalateTest", TEST(EscalateTest::test)) { }
+    EscalateTest() : tpunit::TestFixture("EscalateTest", TEST(EscalateTest::test), TEST(EscalateTest::cancel)) { }
 
     // NOTE: This test relies on two processes (the leader and follower Bedrock nodes) both writing to the same temp
     // file at potentially the same time. It's not impossible that these two writes step on each other and this test
@@ -30,4 +30,44 @@ struct EscalateTest : tpunit::TestFixture {
         ASSERT_EQUAL(results[0].methodLine, "200 OK");
         SFileDelete(cmd["tempFile"]);
     }
+
+    // Returns the method lines of the commands queued on `brtester`.
+    static list<string> queued(BedrockTester& brtester) {
+        STable status = SParseJSONObject(brtester.executeWaitVerifyContent(SData("Status"), "200", true));
+        return SParseJSONArray(status["queuedCommandList"]);
+    }
+
+    void cancel() {
+        BedrockClusterTester tester(ClusterSize::THREE_NODE_CLUSTER, {"CREATE TABLE test (id INTEGER NOT NULL PRIMARY KEY, value TEXT NOT NULL)"},
+                                    {{"-workerThreads", "1"}});
+        BedrockTester& leader = tester.getTester(0);
+        BedrockTester& follower = tester.getTester(1);
+
+        // Keep leader's only worker busy, so that a command escalated to it waits in its queue.
+        thread slow = leader.startSlowQuery();
+        thread escalated([&]() {
+            SData query("Query");
+            query["query"] = "INSERT INTO test VALUES(1, 'cancelled');";
+            query["timeout"] = "1000";
+            follower.executeWaitVerifyContent(query, "555");
+        });
+        uint64_t start = STimeNow();
+        while (queued(leader).empty() && STimeNow() < start + 5'000'000) {
+            usleep(10'000);
+        }
+        ASSERT_EQUAL(queued(leader), list<string>({"Query"}));
+
+        // Once the follower gives up on it, it tells leader, which drops it, even though its worker is still busy.
+        escalated.join();
+        start = STimeNow();
+        while (!queued(leader).empty() && STimeNow() < start + 1'000'000) {
+            usleep(10'000);
+        }
+        ASSERT_TRUE(queued(leader).empty());
+        slow.join();
+
+        SData query("Query");
+        query["query"] = "SELECT COUNT(*) FROM test;";
+        ASSERT_EQUAL(SParseList(leader.executeWaitVerifyContent(query), '\n').back(), "0");
+    }
 } __EscalateTest;
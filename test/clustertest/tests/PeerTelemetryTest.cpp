@@ -0,0 +1,72 @@
+#include "../BedrockClusterTester.h"
+
+struct PeerTelemetryTest : tpunit::TestFixture {
+    PeerTelemetryTest()
+        : tpunit::TestFixture("PeerTelemetry",
+                              BEFORE_CLASS(PeerTelemetryTest::setup),
+                              AFTER_CLASS(PeerTelemetryTest::teardown),
+                              TEST(PeerTelemetryTest::test),
+                              TEST(PeerTelemetryTest::unknownPeer)) { }
+
+    BedrockClusterTester* tester;
+
+    void setup() {
+        tester = new BedrockClusterTester();
+    }
+
+    void teardown() {
+        delete tester;
+    }
+
+    void test() {
+        BedrockTester& leader = tester->getTester(0);
+
+        // Generate some replication traffic.
+        for (int i = 0; i < 50; i++) {
+            SData query("Query");
+            query["writeConsistency"] = "QUORUM";
+            query["Query"] = "INSERT INTO test VALUES(" + SQ(70000 + i) + ", " + SQ("telemetry") + ");";
+            leader.executeWaitVerifyContent(query);
+        }
+
+        // Make sure a couple of samples have been taken since then.
+        sleep(3);
+
+        SData command("GetPeerTelemetry");
+        vector<SData> results = leader.executeWaitMultipleData({command}, 1, true);
+        ASSERT_EQUAL(results.size(), 1);
+        ASSERT_EQUAL(results[0].methodLine, "200 OK");
+        STable peers = SParseJSONObject(results[0].content);
+        ASSERT_EQUAL(peers.size(), 2);
+        for (auto& peer : peers) {
+            list<string> samples = SParseJSONArray(peer.second);
+            ASSERT_GREATER_THAN(samples.size(), 1);
+            STable latest = SParseJSONObject(samples.back());
+            for (const char* field : {"timestamp", "commitLag", "applyLagMS", "bytesSentPerSecond",
+                                      "bytesReceivedPerSecond", "messagesPerSecond", "sendBufferBytes",
+                                      "approvalRTT"}) {
+                ASSERT_TRUE(latest.find(field) != latest.end());
+            }
+
+            // Both followers approved QUORUM commits, so we should have measured how long that took.
+            ASSERT_GREATER_THAN(SToUInt64(latest["approvalRTT"]), 0);
+        }
+
+        // The latest sample for each peer is in Status, too.
+        STable status = SParseJSONObject(leader.executeWaitVerifyContent(SData("Status")));
+        for (auto& peer : SParseJSONArray(status["peerList"])) {
+            STable peerData = SParseJSONObject(peer);
+            ASSERT_TRUE(peerData.find("commitLag") != peerData.end());
+            ASSERT_TRUE(peerData.find("approvalRTT") != peerData.end());
+        }
+    }
+
+    void unknownPeer() {
+        SData command("GetPeerTelemetry");
+        command["peer"] = "nobody";
+        vector<SData> results = tester->getTester(0).executeWaitMultipleData({command}, 1, true);
+        ASSERT_EQUAL(results.size(), 1);
+        ASSERT_EQUAL(SToInt(results[0].methodLine), 404);
+    }
+
+} __PeerTelemetryTest;
@@ -0,0 +1,79 @@
+#include "../BedrockClusterTester.h"
+
+// Sends `count` QUORUM writes to leader at once, and returns their responses, and how long they took, in `elapsed`.
+static vector<SData> quorumWrites(BedrockClusterTester& tester, int count, uint64_t& elapsed) {
+    vector<SData> requests;
+    for (int i = 0; i < count; i++) {
+        SData query("Query");
+        query["writeConsistency"] = "QUORUM";
+        query["query"] = "INSERT INTO quorumtest VALUES(" + to_string(i) + ", " + SQ("value" + to_string(i)) + ");";
+        requests.push_back(query);
+    }
+    uint64_t start = STimeNow();
+    vector<SData> results = tester.getTester(0).executeWaitMultipleData(requests, 20);
+    elapsed = STimeNow() - start;
+    return results;
+}
+
+struct QuorumPipelineTest : tpunit::TestFixture {
+    QuorumPipelineTest()
+        : tpunit::TestFixture("QuorumPipeline",
+                              TEST(QuorumPipelineTest::everyNodeHasEveryRow)) { }
+
+    void everyNodeHasEveryRow() {
+        const int count = 100;
+        BedrockClusterTester tester(ClusterSize::THREE_NODE_CLUSTER, {"CREATE TABLE quorumtest (id INTEGER PRIMARY KEY, value TEXT NOT NULL)"},
+                                    {{"-quorumPipelineDepth", "16"}});
+        uint64_t elapsed;
+        vector<SData> results = quorumWrites(tester, count, elapsed);
+        ASSERT_EQUAL(results.size(), count);
+        for (auto& result : results) {
+            ASSERT_EQUAL(SToInt(result.methodLine), 200);
+        }
+
+        // Pipelined commits are sent to followers like any others, so every node should end up with every row.
+        for (int i : {0, 1, 2}) {
+            BedrockTester& brtester = tester.getTester(i);
+            int tries = 0;
+            string rows;
+            while (tries++ < 10) {
+                SData query("Query");
+                query["query"] = "SELECT COUNT(*) FROM quorumtest;";
+                query["Format"] = "json";
+                STable json = SParseJSONObject(brtester.executeWaitVerifyContent(query));
+                rows = SParseJSONArray(SParseJSONArray(json["rows"]).front()).front();
+                if (rows == to_string(count)) {
+                    break;
+                }
+                sleep(1);
+            }
+            ASSERT_EQUAL(rows, to_string(count));
+        }
+    }
+
+} __QuorumPipelineTest;
+
+// Only run with `-perf`.
+struct PerfQuorumPipelineTest : tpunit::TestFixture {
+    PerfQuorumPipelineTest()
+        : tpunit::TestFixture("PerfQuorumPipeline",
+                              TEST(PerfQuorumPipelineTest::benchmark)) { }
+
+    void benchmark() {
+        // Compare QUORUM commit throughput with and without pipelining.
+        const int count = 500;
+        for (const char* pipelineDepth : {"1", "16"}) {
+            BedrockClusterTester tester(ClusterSize::THREE_NODE_CLUSTER, {"CREATE TABLE quorumtest (id INTEGER PRIMARY KEY, value TEXT NOT NULL)"},
+                                        {{"-quorumPipelineDepth", pipelineDepth}});
+            uint64_t elapsed;
+            vector<SData> results = quorumWrites(tester, count, elapsed);
+            ASSERT_EQUAL(results.size(), count);
+            for (auto& result : results) {
+                ASSERT_EQUAL(SToInt(result.methodLine), 200);
+            }
+            cout << "[QuorumPipelineTest] quorumPipelineDepth=" << pipelineDepth << ": " << count << " QUORUM commits in "
+                 << elapsed / 1000 << "ms (" << (count * STIME_US_PER_S / max(elapsed, (uint64_t)1)) << "/s)." << endl;
+        }
+    }
+
+} __PerfQuorumPipelineTest;
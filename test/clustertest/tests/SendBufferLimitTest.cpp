@@ -0,0 +1,59 @@
+#include "../BedrockClusterTester.h"
+
+struct SendBufferLimitTest : tpunit::TestFixture {
+    SendBufferLimitTest()
+        : tpunit::TestFixture("SendBufferLimit",
+                              BEFORE_CLASS(SendBufferLimitTest::setup),
+                              AFTER_CLASS(SendBufferLimitTest::teardown),
+                              TEST(SendBufferLimitTest::dropSlowPeer)) { }
+
+    BedrockClusterTester* tester;
+
+    void setup() {
+        tester = new BedrockClusterTester(ClusterSize::THREE_NODE_CLUSTER, {}, {{"-peerSendBufferLimitMB", "1"}});
+    }
+
+    void teardown() {
+        delete tester;
+    }
+
+    // Returns leader's status for the peer called `name`.
+    STable peerStatus(const string& name) {
+        STable status = SParseJSONObject(tester->getTester(0).executeWaitVerifyContent(SData("Status")));
+        for (auto& peer : SParseJSONArray(status["peerList"])) {
+            STable peerData = SParseJSONObject(peer);
+            if (peerData["name"] == name) {
+                return peerData;
+            }
+        }
+        return STable();
+    }
+
+    void dropSlowPeer() {
+        BedrockTester& leader = tester->getTester(0);
+        BedrockTester& follower = tester->getTester(2);
+        ASSERT_TRUE(follower.waitForState("FOLLOWING"));
+
+        // Node 2 stops reading anything leader sends it, while leader commits 10MB, in transactions of 50KB each.
+        follower.signalServer(SIGSTOP);
+        for (int i = 0; i < 200; i++) {
+            SData query("Query");
+            query["query"] = "INSERT INTO test VALUES(" + SQ(100000 + i) + ", " + SQ(string(50'000, 'x')) + ");";
+            leader.executeWaitVerifyContent(query);
+        }
+
+        // Leader gave up on it once more than the 1MB it was given was waiting to be sent to it, but kept sending to
+        // node 1, which kept up.
+        STable slowPeer = peerStatus("cluster_node_2");
+        ASSERT_GREATER_THAN(SToUInt64(slowPeer["sendBufferOverflows"]), 0);
+        ASSERT_GREATER_THAN(SToUInt64(slowPeer["sendBufferHighWater"]), 1024 * 1024);
+        ASSERT_EQUAL(peerStatus("cluster_node_1")["sendBufferOverflows"], "0");
+
+        // Once it's running again, it reconnects and synchronizes everything it missed.
+        follower.signalServer(SIGCONT);
+        STable leaderStatus = SParseJSONObject(leader.executeWaitVerifyContent(SData("Status")));
+        ASSERT_TRUE(follower.waitForState("FOLLOWING"));
+        ASSERT_TRUE(follower.waitForStatusTerm("CommitCount", leaderStatus["CommitCount"]));
+    }
+
+} __SendBufferLimitTest;
@@ -53,6 +53,10 @@ struct StatusTest : tpunit::TestFixture {
                 ASSERT_EQUAL(json["isLeader"], "false");
             }
             ASSERT_EQUAL(peers.size(), 2);
+
+            // Every node reports synchronization progress, even if it has nothing to catch up on.
+            STable synchronization = SParseJSONObject(json["synchronization"]);
+            ASSERT_EQUAL(synchronization["commitsRemaining"], "0");
         }
     }
 } __StatusTest;
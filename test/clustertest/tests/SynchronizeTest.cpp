@@ -0,0 +1,93 @@
+#include "../BedrockClusterTester.h"
+
+struct SynchronizeTest : tpunit::TestFixture {
+    SynchronizeTest()
+        : tpunit::TestFixture("Synchronize",
+                              BEFORE_CLASS(SynchronizeTest::setup),
+                              AFTER_CLASS(SynchronizeTest::teardown),
+                              TEST(SynchronizeTest::pipelined),
+                              TEST(SynchronizeTest::snapshot)) { }
+
+    BedrockClusterTester* tester;
+
+    void setup() {
+        tester = new BedrockClusterTester();
+    }
+
+    void teardown() {
+        delete tester;
+    }
+
+    string count(BedrockTester& node, int firstID) {
+        SData query("Query");
+        query["query"] = "SELECT COUNT(*) FROM test WHERE id >= " + SQ(firstID) + " AND id < " + SQ(firstID + 1000)
+                         + ";";
+        query["Format"] = "json";
+        STable json = SParseJSONObject(node.executeWaitVerifyContent(query));
+        return SParseJSONArray(SParseJSONArray(json["rows"]).front()).front();
+    }
+
+    // Stops node 2, writes 100 rows of 50KB each from `firstID` on leader, and then starts node 2 again and returns
+    // once it has all of them.
+    void fallBehindAndCatchUp(int firstID) {
+        BedrockTester& leader = tester->getTester(0);
+        BedrockTester& follower = tester->getTester(2);
+        ASSERT_TRUE(follower.waitForState("FOLLOWING"));
+        tester->stopNode(2);
+        for (int i = 0; i < 100; i++) {
+            SData query("Query");
+            // A literal, rather than something like `zeroblob`, so the commit's query is 50KB, too.
+            query["query"] = "INSERT INTO test VALUES(" + SQ(firstID + i) + ", " + SQ(string(50'000, 'x')) + ");";
+            leader.executeWaitVerifyContent(query);
+        }
+        tester->startNode(2);
+        ASSERT_TRUE(follower.waitForState("FOLLOWING"));
+        string rows;
+        for (int tries = 0; tries < 30; tries++) {
+            rows = count(follower, firstID);
+            if (rows == "100") {
+                break;
+            }
+            sleep(1);
+        }
+        ASSERT_EQUAL(rows, "100");
+    }
+
+    void pipelined() {
+        // Fall about 5MB behind, in commits of 50KB each, which is far more than fits in one 1MB chunk.
+        BedrockTester& follower = tester->getTester(2);
+        fallBehindAndCatchUp(80000);
+
+        // The chunks shrank from the default 100 commits to stay near 1MB, and we measured how fast we caught up.
+        STable status = SParseJSONObject(follower.executeWaitVerifyContent(SData("Status")));
+        STable synchronization = SParseJSONObject(status["synchronization"]);
+        ASSERT_LESS_THAN(SToUInt64(synchronization["chunkCommits"]), 100);
+        ASSERT_GREATER_THAN(SToUInt64(synchronization["commitsPerSecond"]), 0);
+        ASSERT_EQUAL(synchronization["commitsRemaining"], "0");
+        ASSERT_EQUAL(synchronization["inFlightRequests"], "0");
+    }
+
+    void snapshot() {
+        // This time, being 100 commits behind is enough to download a snapshot from node 1 (the other follower)
+        // instead, in more than one chunk, and slowly enough for node 1 to be serving it while it keeps following.
+        BedrockTester& follower = tester->getTester(2);
+        follower.updateArgs({{"-snapshotThreshold", "50"}});
+        tester->getTester(1).updateArgs({{"-snapshotMaxBytesPerSecond", "4000000"}});
+        tester->stopNode(1);
+        tester->startNode(1);
+        ASSERT_TRUE(tester->getTester(1).waitForState("FOLLOWING"));
+        fallBehindAndCatchUp(90000);
+
+        // The snapshot replaced node 2's whole DB, which still has the rows from the last test as well as the new ones.
+        ASSERT_EQUAL(count(follower, 80000), "100");
+        STable status = SParseJSONObject(follower.executeWaitVerifyContent(SData("Status")));
+        STable synchronization = SParseJSONObject(status["synchronization"]);
+        ASSERT_GREATER_THAN(SToUInt64(synchronization["snapshotTotalBytes"]), 5'000'000);
+        ASSERT_EQUAL(synchronization["snapshotBytesReceived"], synchronization["snapshotTotalBytes"]);
+
+        // And it carries on from the snapshot's commit, just like everyone else.
+        STable leaderStatus = SParseJSONObject(tester->getTester(0).executeWaitVerifyContent(SData("Status")));
+        ASSERT_TRUE(follower.waitForStatusTerm("CommitCount", leaderStatus["CommitCount"]));
+    }
+
+} __SynchronizeTest;
@@ -220,6 +220,12 @@ void BedrockTester::stopServer(int signal) {
     }
 }
 
+void BedrockTester::signalServer(int signal) {
+    if (_serverPID) {
+        kill(_serverPID, signal);
+    }
+}
+
 string BedrockTester::executeWaitVerifyContent(SData request, const string& expectedResult, bool control) {
     auto results = executeWaitMultipleData({request}, 1, control);
     if (results.size() == 0) {
@@ -238,6 +244,62 @@ STable BedrockTester::executeWaitVerifyContentTable(SData request, const string&
     return SParseJSONObject(result);
 }
 
+vector<vector<SData>> BedrockTester::executePipelined(const vector<SData>& requests, int connections) {
+    vector<vector<SData>> results(connections);
+    list<thread> threads;
+    for (int i = 0; i < connections; i++) {
+        threads.emplace_back([&, i]() {
+            int socket = S_socket(_args["-serverHost"], true, false, true);
+            if (socket == -1) {
+                cout << "executePipelined(): couldn't connect" << endl;
+                return;
+            }
+
+            // Send everything at once.
+            SFastBuffer sendBuffer;
+            size_t expected = 0;
+            for (size_t j = i; j < requests.size(); j += connections) {
+                sendBuffer += requests[j].serialize();
+                expected++;
+            }
+            while (sendBuffer.size()) {
+                if (!S_sendconsume(socket, sendBuffer)) {
+                    cout << "executePipelined(): failed to send" << endl;
+                    break;
+                }
+            }
+
+            // Then read responses until we have them all, or it's been 60s.
+            SFastBuffer recvBuffer;
+            uint64_t recvStart = STimeNow();
+            while (results[i].size() < expected && recvStart + 60'000'000 > STimeNow()) {
+                SData response;
+                int size = response.deserialize(recvBuffer);
+                if (size) {
+                    recvBuffer.consumeFront(size);
+                    results[i].push_back(move(response));
+                    continue;
+                }
+                pollfd readSock;
+                readSock.fd = socket;
+                readSock.events = POLLIN | POLLHUP;
+                readSock.revents = 0;
+                poll(&readSock, 1, 1000);
+                if ((readSock.revents & (POLLIN | POLLHUP)) && !S_recvappend(socket, recvBuffer)) {
+                    cout << "executePipelined(): disconnected" << endl;
+                    break;
+                }
+            }
+            ::shutdown(socket, SHUT_RDWR);
+            ::close(socket);
+        });
+    }
+    for (thread& t : threads) {
+        t.join();
+    }
+    return results;
+}
+
 vector<SData> BedrockTester::executeWaitMultipleData(vector<SData> requests, int connections, bool control, bool returnOnDisconnect, int* errorCode) {
     // Synchronize dequeuing requests, and saving results.
     recursive_mutex listLock;
@@ -491,3 +553,33 @@ bool BedrockTester::waitForState(const string& state, uint64_t timeoutUS)
     return waitForStatusTerm("state", state, timeoutUS);
 }
 
+SData BedrockTester::slowQuery() {
+    SData query("Query");
+    query["query"] = "SELECT COUNT(*) FROM (WITH RECURSIVE c(x) AS "
+                     "(SELECT 1 UNION ALL SELECT x + 1 FROM c WHERE x < 20000000) SELECT x FROM c);";
+    return query;
+}
+
+thread BedrockTester::startSlowQuery() {
+    // Every command taken from the queue is counted in one of the wait histograms in `Status`.
+    auto dequeued = [this]() {
+        STable status = SParseJSONObject(executeWaitVerifyContent(SData("Status"), "200", true));
+        uint64_t total = 0;
+        for (const auto& priority : SParseJSONObject(status["queueWaitMS"])) {
+            for (const auto& bucket : SParseJSONObject(priority.second)) {
+                total += SToUInt64(bucket.second);
+            }
+        }
+        return total;
+    };
+    uint64_t before = dequeued();
+    thread slow([this]() {
+        executeWaitVerifyContent(slowQuery());
+    });
+    uint64_t start = STimeNow();
+    while (dequeued() == before && STimeNow() < start + 10'000'000) {
+        usleep(10'000);
+    }
+    return slow;
+}
+
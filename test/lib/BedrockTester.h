@@ -40,6 +40,9 @@ class BedrockTester {
     // Stop a server by sending it a signal.
     void stopServer(int signal = SIGTERM);
 
+    // Send a signal to the server without waiting for it to exit, for instance `SIGSTOP` to make it stop responding.
+    void signalServer(int signal);
+
     // Shuts down all bedrock servers associated with any existing testers.
     static void stopAll();
 
@@ -56,6 +59,11 @@ class BedrockTester {
     // If `control` is set, sends the message to the control port.
     vector<SData> executeWaitMultipleData(vector<SData> requests, int connections = 10, bool control = false, bool returnOnDisconnect = false, int* errorCode = nullptr);
 
+    // Sends `requests` pipelined over `connections` parallel connections to the server: requests are assigned to
+    // connections round-robin, and each connection sends all of its requests before reading any responses. Returns
+    // the responses received on each connection, in the order they arrived.
+    vector<vector<SData>> executePipelined(const vector<SData>& requests, int connections = 1);
+
     // Sends a single request, returning the response content.
     // If the response method line doesn't begin with the expected result, throws.
     // Convenience wrapper around executeWaitMultipleData.
@@ -78,6 +86,13 @@ class BedrockTester {
     // This is just a convenience wrapper around `waitForStatusTerm` looking for the state of the node.
     bool waitForState(const string& state, uint64_t timeoutUS = 60'000'000);
 
+    // Returns a read-only query that takes a worker several seconds to run.
+    static SData slowQuery();
+
+    // Sends `slowQuery` from a new thread, and returns once a worker has taken it from the queue, so anything sent
+    // afterwards waits behind it unless there's another worker free. Join the returned thread to wait for it to finish.
+    thread startSlowQuery();
+
   protected:
     // Returns an SQLite object attached to the same DB file as the bedrock server. Writing to this is dangerous and
     // should not be done!
@@ -62,13 +62,13 @@ int main(int argc, char* argv[]) {
         threads = SToInt(args["-threads"]);
     }
 
-    // Perf is excluded unless specified explicitly.
+    // Perf fixtures are excluded unless specified explicitly.
     if (args.isSet("-perf")) {
-        include.insert("Perf");
-        exclude.erase("Perf");
+        include.insert("Perf.*");
+        exclude.erase("Perf.*");
     } else {
-        include.erase("Perf");
-        exclude.insert("Perf");
+        include.erase("Perf.*");
+        exclude.insert("Perf.*");
     }
 
     // Set the defaults for the servers that each BedrockTester will start.
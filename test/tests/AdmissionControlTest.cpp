@@ -0,0 +1,61 @@
+#include <test/lib/BedrockTester.h>
+
+struct AdmissionControlTest : tpunit::TestFixture {
+    AdmissionControlTest()
+        : tpunit::TestFixture("AdmissionControl",
+                              BEFORE_CLASS(AdmissionControlTest::setup),
+                              TEST(AdmissionControlTest::shedLowPriority),
+                              AFTER_CLASS(AdmissionControlTest::tearDown)) { }
+
+    BedrockTester* tester;
+
+    void setup() {
+        // Thread 0 only runs blocking commands, so this leaves a single worker to run queries, and we can keep it busy.
+        tester = new BedrockTester({
+            {"-workerThreads", "2"},
+            {"-clientPipelineDepth", "64"},
+            {"-admissionMaxQueued", "5"},
+        }, {});
+    }
+
+    void tearDown() {
+        delete tester;
+    }
+
+    void shedLowPriority() {
+        thread slow = tester->startSlowQuery();
+
+        // While the worker's busy, only the first few low priority commands fit in the queue.
+        vector<SData> requests;
+        for (int i = 0; i < 50; i++) {
+            SData query("Query");
+            query["query"] = "SELECT " + SQ(i) + ";";
+            query["requestID"] = to_string(i);
+            query["priority"] = "250";
+            requests.push_back(query);
+        }
+        vector<SData> responses = tester->executePipelined(requests)[0];
+        ASSERT_EQUAL(responses.size(), 50);
+        int accepted = 0;
+        for (auto& response : responses) {
+            if (SStartsWith(response.methodLine, "503")) {
+                ASSERT_TRUE(response.calc("Retry-After") >= 1);
+            } else {
+                ASSERT_EQUAL(response.methodLine, "200 OK");
+                accepted++;
+            }
+        }
+        ASSERT_EQUAL(accepted, 5);
+
+        // Normal priority commands are never turned away.
+        SData query("Query");
+        query["query"] = "SELECT 1;";
+        tester->executeWaitVerifyContent(query);
+        slow.join();
+
+        STable status = SParseJSONObject(tester->executeWaitVerifyContent(SData("Status")));
+        STable low = SParseJSONObject(SParseJSONObject(status["admissionControl"])["250"]);
+        ASSERT_EQUAL(low["rejected"], "45");
+    }
+
+} __AdmissionControlTest;
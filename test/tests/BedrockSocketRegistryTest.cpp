@@ -0,0 +1,188 @@
+#include <libstuff/libstuff.h>
+#include <BedrockSocketRegistry.h>
+#include <test/lib/BedrockTester.h>
+
+struct BedrockSocketRegistryTest : tpunit::TestFixture {
+    BedrockSocketRegistryTest()
+        : tpunit::TestFixture("BedrockSocketRegistry",
+                              BEFORE(BedrockSocketRegistryTest::setup),
+                              AFTER(BedrockSocketRegistryTest::tearDown),
+                              TEST(BedrockSocketRegistryTest::oneAtATime),
+                              TEST(BedrockSocketRegistryTest::pipelined),
+                              TEST(BedrockSocketRegistryTest::ordered),
+                              TEST(BedrockSocketRegistryTest::close),
+                              TEST(BedrockSocketRegistryTest::removed)) { }
+
+    // A connected socket, and the client's end of it.
+    STCPManager::Socket* socket;
+    int client;
+
+    void setup() {
+        int fds[2];
+        ASSERT_EQUAL(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+        socket = new STCPManager::Socket(fds[0], STCPManager::Socket::CONNECTED);
+        client = fds[1];
+        fcntl(client, F_SETFL, fcntl(client, F_GETFL, 0) | O_NONBLOCK);
+    }
+
+    void tearDown() {
+        delete socket;
+        ::close(client);
+    }
+
+    SData response(const string& content) {
+        SData response("200 OK");
+        response.content = content;
+        return response;
+    }
+
+    // Returns the content of every response the client has been sent since last time, in the order it got them.
+    list<string> received() {
+        string buffer;
+        char chunk[4096];
+        ssize_t bytes;
+        while ((bytes = read(client, chunk, sizeof(chunk))) > 0) {
+            buffer.append(chunk, bytes);
+        }
+        list<string> contents;
+        SData message;
+        int consumed;
+        while ((consumed = message.deserialize(buffer))) {
+            contents.push_back(message.content);
+            buffer.erase(0, consumed);
+        }
+        return contents;
+    }
+
+    void oneAtATime() {
+        BedrockSocketRegistry registry;
+        BedrockSocketRegistry::Owner owner;
+        STCPManager manager;
+        bool pipelining;
+        ASSERT_TRUE(registry.canAdd(socket->id, 10, pipelining));
+        ASSERT_FALSE(pipelining);
+
+        // Nothing more is read while a request that isn't pipelined is in flight.
+        uint64_t sequence = registry.add(socket, owner, false, false);
+        ASSERT_TRUE(registry.contains(socket->id));
+        ASSERT_FALSE(registry.canAdd(socket->id, 10, pipelining));
+        ASSERT_TRUE(pipelining);
+
+        // Nothing is sent until the owner sends it, and then the socket is forgotten, as it has nothing in flight.
+        SData first = response("first");
+        ASSERT_TRUE(registry.reply(socket->id, sequence, first, "", false, false));
+        ASSERT_EQUAL(received(), list<string>());
+        registry.send(owner, manager);
+        ASSERT_EQUAL(received(), list<string>({"first"}));
+        ASSERT_FALSE(registry.contains(socket->id));
+        ASSERT_EQUAL(registry.size(), 0);
+        ASSERT_TRUE(registry.canAdd(socket->id, 10, pipelining));
+        ASSERT_FALSE(pipelining);
+
+        // It doesn't get a second response.
+        ASSERT_FALSE(registry.reply(socket->id, sequence, first, "", false, false));
+    }
+
+    void pipelined() {
+        BedrockSocketRegistry registry;
+        BedrockSocketRegistry::Owner owner;
+        STCPManager manager;
+        bool pipelining;
+
+        // Pipelined requests can be read up to the depth.
+        uint64_t first = registry.add(socket, owner, true, false);
+        uint64_t second = registry.add(socket, owner, true, false);
+        ASSERT_TRUE(registry.canAdd(socket->id, 3, pipelining));
+        ASSERT_TRUE(pipelining);
+        uint64_t third = registry.add(socket, owner, true, false);
+        ASSERT_FALSE(registry.canAdd(socket->id, 3, pipelining));
+
+        // Responses are sent as they come, each with the requestID it answers.
+        SData response3 = response("3");
+        SData response1 = response("1");
+        ASSERT_TRUE(registry.reply(socket->id, third, response3, "c", false, false));
+        ASSERT_TRUE(registry.reply(socket->id, first, response1, "a", false, false));
+        ASSERT_EQUAL(response3["requestID"], "c");
+        ASSERT_EQUAL(response1["requestID"], "a");
+        registry.send(owner, manager);
+        ASSERT_EQUAL(received(), list<string>({"3", "1"}));
+        ASSERT_TRUE(registry.contains(socket->id));
+        ASSERT_TRUE(registry.canAdd(socket->id, 3, pipelining));
+
+        SData response2 = response("2");
+        ASSERT_TRUE(registry.reply(socket->id, second, response2, "b", false, false));
+        registry.send(owner, manager);
+        ASSERT_EQUAL(received(), list<string>({"2"}));
+        ASSERT_FALSE(registry.contains(socket->id));
+    }
+
+    void ordered() {
+        BedrockSocketRegistry registry;
+        BedrockSocketRegistry::Owner owner;
+        STCPManager manager;
+        uint64_t first = registry.add(socket, owner, true, false);
+        uint64_t second = registry.add(socket, owner, true, false);
+        uint64_t third = registry.add(socket, owner, true, false);
+        uint64_t fourth = registry.add(socket, owner, true, false);
+
+        // Ordered responses wait for every earlier request, but unordered ones don't.
+        SData response4 = response("4");
+        SData response2 = response("2");
+        ASSERT_TRUE(registry.reply(socket->id, fourth, response4, "d", true, false));
+        ASSERT_TRUE(registry.reply(socket->id, second, response2, "b", true, false));
+        registry.send(owner, manager);
+        ASSERT_EQUAL(received(), list<string>());
+        SData response3 = response("3");
+        ASSERT_TRUE(registry.reply(socket->id, third, response3, "c", false, false));
+        registry.send(owner, manager);
+        ASSERT_EQUAL(received(), list<string>({"3"}));
+
+        // Answering the first releases everything that was only waiting on it, in order.
+        SData response1 = response("1");
+        ASSERT_TRUE(registry.reply(socket->id, first, response1, "a", true, false));
+        registry.send(owner, manager);
+        ASSERT_EQUAL(received(), list<string>({"1", "2", "4"}));
+        ASSERT_FALSE(registry.contains(socket->id));
+    }
+
+    void close() {
+        BedrockSocketRegistry registry;
+        BedrockSocketRegistry::Owner owner;
+        STCPManager manager;
+        bool pipelining;
+
+        // Once a request asks us to close, nothing more is read, and we shut down once it and everything before it is
+        // answered.
+        uint64_t first = registry.add(socket, owner, true, false);
+        uint64_t second = registry.add(socket, owner, true, true);
+        ASSERT_FALSE(registry.canAdd(socket->id, 10, pipelining));
+        SData response2 = response("2");
+        ASSERT_TRUE(registry.reply(socket->id, second, response2, "b", false, false));
+        registry.send(owner, manager);
+        ASSERT_EQUAL(received(), list<string>({"2"}));
+        ASSERT_EQUAL(socket->state.load(), STCPManager::Socket::CONNECTED);
+        SData response1 = response("1");
+        ASSERT_TRUE(registry.reply(socket->id, first, response1, "a", false, false));
+        registry.send(owner, manager);
+        ASSERT_EQUAL(received(), list<string>({"1"}));
+        ASSERT_EQUAL(socket->state.load(), STCPManager::Socket::SHUTTINGDOWN);
+        ASSERT_FALSE(registry.contains(socket->id));
+    }
+
+    void removed() {
+        BedrockSocketRegistry registry;
+        BedrockSocketRegistry::Owner owner;
+        STCPManager manager;
+
+        // A response to a socket that's been closed since its request was read goes nowhere.
+        uint64_t sequence = registry.add(socket, owner, false, false);
+        registry.remove(socket->id);
+        ASSERT_FALSE(registry.contains(socket->id));
+        SData first = response("first");
+        ASSERT_FALSE(registry.reply(socket->id, sequence, first, "", false, false));
+        ASSERT_FALSE(registry.replyWithSocket(socket->id, sequence, false, [](STCPManager::Socket* s) {}));
+        registry.send(owner, manager);
+        ASSERT_EQUAL(received(), list<string>());
+    }
+
+} __BedrockSocketRegistryTest;
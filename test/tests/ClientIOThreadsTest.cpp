@@ -0,0 +1,78 @@
+#include <test/lib/BedrockTester.h>
+
+struct ClientIOThreadsTest : tpunit::TestFixture {
+    ClientIOThreadsTest()
+        : tpunit::TestFixture("ClientIOThreads",
+                              BEFORE_CLASS(ClientIOThreadsTest::setup),
+                              TEST(ClientIOThreadsTest::manyConnections),
+                              TEST(ClientIOThreadsTest::suppressCommandPort),
+                              TEST(ClientIOThreadsTest::controlPort),
+                              AFTER_CLASS(ClientIOThreadsTest::tearDown)) { }
+
+    BedrockTester* tester;
+
+    void setup() {
+        tester = new BedrockTester({{"-ioThreads", "4"}}, {});
+    }
+
+    void tearDown() {
+        delete tester;
+    }
+
+    void manyConnections() {
+        // Enough connections that every I/O thread should get some of them, all at once, with status and control
+        // commands mixed in with the queries: the I/O threads answer the status commands themselves, and pass the
+        // control commands to the main thread, which answers them on the I/O threads' sockets.
+        vector<SData> requests;
+        for (int i = 0; i < 400; i++) {
+            if (i % 10 == 1) {
+                requests.push_back(SData("Ping"));
+            } else if (i % 10 == 2) {
+                requests.push_back(SData("EnableSQLTracing"));
+            } else {
+                SData query("Query");
+                query["query"] = "SELECT " + SQ(i) + ";";
+                requests.push_back(query);
+            }
+        }
+        vector<SData> results = tester->executeWaitMultipleData(requests, 40);
+        ASSERT_EQUAL(results.size(), requests.size());
+        for (size_t i = 0; i < results.size(); i++) {
+            ASSERT_EQUAL(results[i].methodLine, "200 OK");
+            if (i % 10 == 2) {
+                ASSERT_EQUAL(results[i]["oldValue"], "false");
+            } else if (i % 10 != 1) {
+                ASSERT_EQUAL(SToInt(results[i].content), (int)i);
+            }
+        }
+    }
+
+    void suppressCommandPort() {
+        // A control command on the command port closes it in every I/O thread, through the main thread.
+        tester->executeWaitVerifyContent(SData("SuppressCommandPort"));
+        bool refused = false;
+        for (int i = 0; i < 50 && !refused; i++) {
+            int error = 0;
+            tester->executeWaitMultipleData({SData("Ping")}, 1, false, true, &error);
+            refused = error == 1;
+            if (!refused) {
+                usleep(100'000);
+            }
+        }
+        ASSERT_TRUE(refused);
+
+        // And clearing it on the control port opens them again.
+        tester->executeWaitVerifyContent(SData("ClearCommandPort"), "200", true);
+        SData query("Query");
+        query["query"] = "SELECT 1;";
+        ASSERT_EQUAL(SToInt(tester->executeWaitVerifyContent(query)), 1);
+    }
+
+    void controlPort() {
+        // The control port is still handled by the main thread.
+        vector<SData> results = tester->executeWaitMultipleData({SData("Status")}, 1, true);
+        ASSERT_EQUAL(results.size(), 1);
+        ASSERT_EQUAL(results[0].methodLine, "200 OK");
+    }
+
+} __ClientIOThreadsTest;
@@ -0,0 +1,53 @@
+#include <test/lib/BedrockTester.h>
+
+struct CoalesceTest : tpunit::TestFixture {
+    CoalesceTest()
+        : tpunit::TestFixture("Coalesce",
+                              BEFORE_CLASS(CoalesceTest::setup),
+                              TEST(CoalesceTest::identicalReads),
+                              AFTER_CLASS(CoalesceTest::tearDown)) { }
+
+    BedrockTester* tester;
+
+    void setup() {
+        tester = new BedrockTester({
+            {"-workerThreads", "3"},
+            {"-clientPipelineDepth", "64"},
+            {"-coalesceCommands", "Query"},
+        }, {});
+    }
+
+    void tearDown() {
+        delete tester;
+    }
+
+    void identicalReads() {
+        // Twenty copies of a slow query (that starts with SELECT, so the DB plugin peeks it), and a few different
+        // ones, all in flight at once. Every copy is read and queued long before the first one finishes.
+        vector<SData> requests;
+        for (int i = 0; i < 25; i++) {
+            SData query = BedrockTester::slowQuery();
+            if (i >= 20) {
+                query["query"] = "SELECT " + SQ(i) + ";";
+            }
+            query["requestID"] = to_string(i);
+            requests.push_back(query);
+        }
+        vector<SData> responses = tester->executePipelined(requests)[0];
+        ASSERT_EQUAL(responses.size(), 25);
+        for (auto& response : responses) {
+            ASSERT_EQUAL(response.methodLine, "200 OK");
+            int i = SToInt(response["requestID"]);
+            list<string> rows = SParseList(response.content, '\n');
+            ASSERT_EQUAL(rows.back(), i < 20 ? "20000000" : to_string(i));
+        }
+
+        // Only the first copy of the slow query ran, and the rest shared its response.
+        STable status = SParseJSONObject(tester->executeWaitVerifyContent(SData("Status")));
+        STable coalesced = SParseJSONObject(status["coalescedCommands"]);
+        ASSERT_EQUAL(coalesced["shared"], "19");
+        ASSERT_EQUAL(coalesced["running"], "0");
+        ASSERT_EQUAL(coalesced["waiting"], "0");
+    }
+
+} __CoalesceTest;
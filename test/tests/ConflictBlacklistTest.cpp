@@ -0,0 +1,69 @@
+#include <libstuff/libstuff.h>
+#include <BedrockConflictBlacklist.h>
+#include <test/lib/BedrockTester.h>
+
+struct ConflictBlacklistTest : tpunit::TestFixture {
+    ConflictBlacklistTest()
+        : tpunit::TestFixture("ConflictBlacklist",
+                              TEST(ConflictBlacklistTest::blacklist),
+                              TEST(ConflictBlacklistTest::disabled)) { }
+
+    void record(BedrockConflictBlacklist& blacklist, const string& methodLine, int commits, int conflicts) {
+        for (int i = 0; i < commits; i++) {
+            blacklist.recordCommit(methodLine, i < conflicts);
+        }
+    }
+
+    void blacklist() {
+        SData args;
+        args["-autoBlacklistConflictPercent"] = "50";
+        args["-autoBlacklistMinCommits"] = "4";
+        args["-autoBlacklistSeconds"] = "1";
+        BedrockConflictBlacklist blacklist(args);
+
+        // Nothing happens until we've seen enough commits, and then only if enough of them conflicted.
+        record(blacklist, "a", 3, 3);
+        ASSERT_FALSE(blacklist.contains("a"));
+        record(blacklist, "a", 1, 0);
+        ASSERT_TRUE(blacklist.contains("a"));
+        record(blacklist, "b", 4, 1);
+        ASSERT_FALSE(blacklist.contains("b"));
+        ASSERT_EQUAL(blacklist.getBlacklist(), list<string>({"a"}));
+
+        // Commits that were already in progress are counted, but don't start a new measurement.
+        record(blacklist, "a", 2, 2);
+        STable state = blacklist.getState();
+        STable a = SParseJSONObject(state["a"]);
+        ASSERT_EQUAL(a["commits"], "6");
+        ASSERT_EQUAL(a["conflicts"], "5");
+        ASSERT_EQUAL(a["timesBlacklisted"], "1");
+        ASSERT_EQUAL(a["blacklistedSeconds"], "1");
+        ASSERT_EQUAL(SParseJSONObject(state["b"])["timesBlacklisted"], "0");
+
+        // It's let back on the workers once its time is up, and if it's still conflicting, it goes back on the list for
+        // twice as long.
+        usleep(1'100'000);
+        ASSERT_FALSE(blacklist.contains("a"));
+        record(blacklist, "a", 4, 4);
+        ASSERT_TRUE(blacklist.contains("a"));
+        usleep(1'100'000);
+        ASSERT_TRUE(blacklist.contains("a"));
+        usleep(1'000'000);
+        ASSERT_FALSE(blacklist.contains("a"));
+
+        // Once it stops conflicting, it stays off the list.
+        record(blacklist, "a", 4, 0);
+        ASSERT_FALSE(blacklist.contains("a"));
+        ASSERT_TRUE(blacklist.getBlacklist().empty());
+    }
+
+    void disabled() {
+        SData args;
+        args["-autoBlacklistConflictPercent"] = "0";
+        BedrockConflictBlacklist blacklist(args);
+        record(blacklist, "a", 100, 100);
+        ASSERT_FALSE(blacklist.contains("a"));
+        ASSERT_EQUAL(SParseJSONObject(blacklist.getState()["a"])["conflicts"], "100");
+    }
+
+} __ConflictBlacklistTest;
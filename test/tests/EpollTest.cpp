@@ -0,0 +1,138 @@
+#include <test/lib/BedrockTester.h>
+
+struct EpollTest : tpunit::TestFixture {
+    EpollTest()
+        : tpunit::TestFixture("Epoll",
+                              BEFORE_CLASS(EpollTest::setup),
+                              TEST(EpollTest::manyConnections),
+                              TEST(EpollTest::largeResponse),
+                              TEST(EpollTest::sendAndShutdown),
+                              TEST(EpollTest::activeSockets),
+                              AFTER_CLASS(EpollTest::tearDown)) { }
+
+    BedrockTester* tester;
+
+    void setup() {
+        tester = new BedrockTester({{"-pollBackend", "epoll"}}, {});
+    }
+
+    void tearDown() {
+        delete tester;
+    }
+
+    void manyConnections() {
+        vector<SData> requests;
+        for (int i = 0; i < 200; i++) {
+            SData query("Query");
+            query["query"] = "SELECT " + SQ(i) + ";";
+            requests.push_back(query);
+        }
+        vector<SData> results = tester->executeWaitMultipleData(requests, 20);
+        ASSERT_EQUAL(results.size(), requests.size());
+        for (size_t i = 0; i < results.size(); i++) {
+            ASSERT_EQUAL(results[i].methodLine, "200 OK");
+            ASSERT_EQUAL(SToInt(results[i].content), (int)i);
+        }
+    }
+
+    void largeResponse() {
+        // Too big to send at once, so the server has to wait for the socket to be writable again to finish it.
+        SData query("Query");
+        query["query"] = "SELECT hex(zeroblob(4000000));";
+        string response = tester->executeWaitVerifyContent(query);
+        ASSERT_GREATER_THAN(response.size(), 8000000);
+    }
+
+    // Polls both managers, like a server's main loop, until `done` returns true or we give up after 10 seconds.
+    bool pollUntil(STCPServer& server, STCPManager& client, function<bool()> done) {
+        uint64_t end = STimeNow() + 10'000'000;
+        while (!done() && STimeNow() < end) {
+            fd_map fdm;
+            server.prePoll(fdm);
+            client.prePoll(fdm);
+            S_poll(fdm, 10'000);
+            server.postPoll(fdm);
+            client.postPoll(fdm);
+        }
+        return done();
+    }
+
+    void sendAndShutdown() {
+        // Each socket is only registered with epoll once, when it's opened or accepted, for both reading and writing.
+        STCPManager::pollBackend = STCPManager::EPOLL;
+        STCPServer server("127.0.0.1:19995");
+        STCPManager client;
+        STCPManager::pollBackend = STCPManager::POLL;
+        STCPManager::Socket* clientSocket = client.openSocket("127.0.0.1:19995");
+        STCPManager::Socket* serverSocket = nullptr;
+        ASSERT_TRUE(pollUntil(server, client, [&]() {
+            if (!serverSocket) {
+                serverSocket = server.acceptSocket();
+            }
+            return serverSocket && clientSocket->state.load() == STCPManager::Socket::CONNECTED;
+        }));
+
+        // Far more than fits in the kernel's buffers, so the client only finishes sending because epoll tells it when
+        // the socket's writable again, without it ever asking for that specifically.
+        clientSocket->send(string(20'000'000, 'x'));
+        ASSERT_FALSE(clientSocket->sendBufferEmpty());
+        ASSERT_TRUE(pollUntil(server, client, [&]() {
+            return serverSocket->recvBuffer.size() == 20'000'000;
+        }));
+        ASSERT_TRUE(clientSocket->sendBufferEmpty());
+
+        // Shutting down is finished even though nothing's sent or received on the socket afterwards, and the other end
+        // sees it.
+        server.shutdownSocket(serverSocket);
+        ASSERT_TRUE(pollUntil(server, client, [&]() {
+            return serverSocket->state.load() == STCPManager::Socket::CLOSED &&
+                   clientSocket->state.load() == STCPManager::Socket::CLOSED;
+        }));
+        server.closeSocket(serverSocket);
+        client.closeSocket(clientSocket);
+    }
+
+    void activeSockets() {
+        STCPManager::pollBackend = STCPManager::EPOLL;
+        STCPServer server("127.0.0.1:19996");
+        STCPManager client;
+        STCPManager::pollBackend = STCPManager::POLL;
+        STCPManager::Socket* quiet = client.openSocket("127.0.0.1:19996");
+        STCPManager::Socket* busy = client.openSocket("127.0.0.1:19996");
+        list<STCPManager::Socket*> accepted;
+        ASSERT_TRUE(pollUntil(server, client, [&]() {
+            while (STCPManager::Socket* socket = server.acceptSocket()) {
+                accepted.push_back(socket);
+            }
+            return accepted.size() == 2 && quiet->state.load() == STCPManager::Socket::CONNECTED &&
+                   busy->state.load() == STCPManager::Socket::CONNECTED;
+        }));
+
+        // Only the socket that's received something is returned.
+        busy->send("hello");
+        list<STCPManager::Socket*> active;
+        ASSERT_TRUE(pollUntil(server, client, [&]() {
+            fd_map fdm;
+            server.prePoll(fdm);
+            S_poll(fdm, 10'000);
+            active = server.postPoll(fdm);
+            return !active.empty();
+        }));
+        ASSERT_EQUAL(active.size(), 1);
+        STCPManager::Socket* received = active.front();
+        ASSERT_EQUAL(received->recvBuffer.size(), 5);
+
+        // It keeps being returned, though nothing more arrives, until what it received is consumed.
+        fd_map fdm;
+        ASSERT_EQUAL(server.postPoll(fdm), list<STCPManager::Socket*>({received}));
+        received->recvBuffer.consumeFront(5);
+        ASSERT_TRUE(server.postPoll(fdm).empty());
+
+        for (auto socket : accepted) {
+            server.closeSocket(socket);
+        }
+        client.closeSocket(quiet);
+        client.closeSocket(busy);
+    }
+
+} __EpollTest;
@@ -0,0 +1,116 @@
+#include <BedrockCommandQueue.h>
+#include <test/lib/BedrockTester.h>
+
+struct FairQueueTest : tpunit::TestFixture {
+    FairQueueTest()
+        : tpunit::TestFixture("FairQueue",
+                              TEST(FairQueueTest::fairness),
+                              TEST(FairQueueTest::rateLimit),
+                              TEST(FairQueueTest::abandonRateLimited)) { }
+
+    // Builds `count` queries from `client` that each record which client ran them, in the order they ran.
+    vector<SData> inserts(const string& client, int count) {
+        vector<SData> requests;
+        for (int i = 0; i < count; i++) {
+            SData query("Query");
+            query["query"] = "INSERT INTO runs (client) VALUES (" + SQ(client) + ");";
+            query["client"] = client;
+            query["requestID"] = client + to_string(i);
+            requests.push_back(query);
+        }
+        return requests;
+    }
+
+    // Returns the parsed `queueClients` object from `Status`.
+    STable clientStats(BedrockTester& tester) {
+        STable status = SParseJSONObject(tester.executeWaitVerifyContent(SData("Status")));
+        return SParseJSONObject(status["queueClients"]);
+    }
+
+    void fairness() {
+        // A single worker to run queries, besides thread 0, which only runs blocking commands.
+        BedrockTester tester({
+            {"-workerThreads", "2"},
+            {"-clientPipelineDepth", "64"},
+            {"-queueOrder", "fair"},
+            {"-fairQueueKey", "client"},
+        }, {"CREATE TABLE runs (id INTEGER PRIMARY KEY AUTOINCREMENT, client TEXT);"});
+
+        // While the worker's busy, A floods the queue, and then B sends a few. B shouldn't have to wait for all of A's.
+        // They're on the same connection, so they're queued in that order.
+        thread slow = tester.startSlowQuery();
+        vector<SData> requests = inserts("A", 30);
+        for (auto& request : inserts("B", 3)) {
+            requests.push_back(request);
+        }
+        ASSERT_EQUAL(tester.executePipelined(requests)[0].size(), 33);
+        slow.join();
+
+        SQResult result;
+        ASSERT_TRUE(tester.readDB("SELECT client FROM runs ORDER BY id;", result));
+        ASSERT_EQUAL(result.size(), 33);
+        int lastB = 0;
+        for (size_t i = 0; i < result.size(); i++) {
+            if (result[i][0] == "B") {
+                lastB = i + 1;
+            }
+        }
+        ASSERT_LESS_THAN(lastB, 10);
+
+        STable stats = clientStats(tester);
+        ASSERT_EQUAL(SParseJSONObject(stats["A"])["dequeued"], "30");
+        ASSERT_EQUAL(SParseJSONObject(stats["B"])["dequeued"], "3");
+    }
+
+    void rateLimit() {
+        BedrockTester tester({{"-clientRateLimit", "20"}}, {});
+        uint64_t start = STimeNow();
+        for (int i = 0; i < 10; i++) {
+            SData query("Query");
+            query["query"] = "SELECT 1;";
+            tester.executeWaitVerifyContent(query);
+        }
+
+        // Ten commands at 20 per second take at least 450ms, as the first one doesn't wait.
+        ASSERT_GREATER_THAN(STimeNow() - start, 400'000);
+        STable local = SParseJSONObject(clientStats(tester)["local"]);
+        ASSERT_EQUAL(local["dequeued"], "10");
+        ASSERT_TRUE(SToInt(local["delayed"]) > 0);
+    }
+
+    // Returns a new command from a client that's waiting for its response.
+    unique_ptr<BedrockCommand> command(uint64_t executeTime = 0) {
+        SData request("Query");
+        if (executeTime) {
+            request["commandExecuteTime"] = to_string(executeTime);
+        }
+        auto command = make_unique<BedrockCommand>(SQLiteCommand(move(request)), nullptr);
+        command->clientSequence = 1;
+        return command;
+    }
+
+    void abandonRateLimited() {
+        SData args;
+        args["-clientRateLimit"] = "1";
+        BedrockCommandQueue queue(args);
+        BedrockCommandQueue blockingQueue(args, false);
+        for (int i = 0; i < 10; i++) {
+            queue.push(command());
+            blockingQueue.push(command());
+        }
+        queue.push(command(STimeNow() + 60 * STIME_US_PER_S));
+
+        // At one a second, the last four are more than five seconds away. When we abandon them, their clients are still
+        // owed responses, but not the client that asked for its command to run later.
+        ASSERT_EQUAL(queue.abandonFutureCommands(5000).size(), 4);
+        ASSERT_EQUAL(queue.size(), 6);
+
+        // The rate limit doesn't apply to a queue without per-client limits, so everything there is ready now.
+        for (int i = 0; i < 10; i++) {
+            blockingQueue.get(1);
+        }
+        ASSERT_TRUE(blockingQueue.empty());
+        ASSERT_TRUE(blockingQueue.getClientStats().empty());
+    }
+
+} __FairQueueTest;
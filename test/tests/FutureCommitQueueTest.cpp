@@ -0,0 +1,91 @@
+#include <libstuff/libstuff.h>
+#include <BedrockFutureCommitQueue.h>
+#include <test/lib/BedrockTester.h>
+
+struct FutureCommitQueueTest : tpunit::TestFixture {
+    FutureCommitQueueTest()
+        : tpunit::TestFixture("FutureCommitQueue",
+                              TEST(FutureCommitQueueTest::releaseByCommitCount),
+                              TEST(FutureCommitQueueTest::expire)) { }
+
+    unique_ptr<BedrockCommand> command(const string& name, uint64_t timeoutMS = 60'000) {
+        SData request("Query");
+        request["name"] = name;
+        request["timeout"] = to_string(timeoutMS);
+        return make_unique<BedrockCommand>(SQLiteCommand(move(request)), nullptr);
+    }
+
+    // Returns the names of everything in `queue`, in the order they come out.
+    list<string> drain(BedrockCommandQueue& queue) {
+        list<string> names;
+        while (!queue.empty()) {
+            names.push_back(queue.get()->request["name"]);
+        }
+        return names;
+    }
+
+    void releaseByCommitCount() {
+        BedrockCommandQueue queue;
+        BedrockFutureCommitQueue futureCommits(queue);
+
+        // Pushed out of order, and two waiting on the same commit.
+        futureCommits.push(command("seven"), 7);
+        futureCommits.push(command("three"), 3);
+        futureCommits.push(command("five"), 5);
+        futureCommits.push(command("five again"), 5);
+        ASSERT_EQUAL(futureCommits.size(), 4);
+        ASSERT_TRUE(queue.empty());
+
+        // Only what's waiting on commits up to 4 is released.
+        futureCommits.committed(4);
+        ASSERT_EQUAL(futureCommits.size(), 3);
+        ASSERT_EQUAL(drain(queue), list<string>({"three"}));
+
+        // A command waiting on a commit we already have goes straight back.
+        futureCommits.push(command("two"), 2);
+        futureCommits.push(command("four"), 4);
+        ASSERT_EQUAL(futureCommits.size(), 3);
+        ASSERT_EQUAL(drain(queue), list<string>({"two", "four"}));
+
+        // Being told about an older commit than we've seen doesn't go backwards, or release anything.
+        futureCommits.committed(2);
+        futureCommits.push(command("four again"), 4);
+        ASSERT_EQUAL(futureCommits.size(), 3);
+        ASSERT_EQUAL(drain(queue), list<string>({"four again"}));
+
+        // Skipping ahead releases everything up to the new commit, in commit order.
+        futureCommits.committed(6);
+        ASSERT_EQUAL(futureCommits.size(), 1);
+        ASSERT_EQUAL(drain(queue), list<string>({"five", "five again"}));
+        futureCommits.committed(7);
+        ASSERT_EQUAL(futureCommits.size(), 0);
+        ASSERT_EQUAL(drain(queue), list<string>({"seven"}));
+    }
+
+    void expire() {
+        BedrockCommandQueue queue;
+        BedrockFutureCommitQueue futureCommits(queue);
+        futureCommits.push(command("soon", 100), 10);
+        futureCommits.push(command("later"), 10);
+        futureCommits.push(command("other commit"), 11);
+
+        // Nothing has timed out yet.
+        futureCommits.expire();
+        ASSERT_EQUAL(futureCommits.size(), 3);
+
+        // Once it has, only that command is returned, and its commit arriving later doesn't return it again.
+        usleep(300'000);
+        futureCommits.expire();
+        ASSERT_EQUAL(futureCommits.size(), 2);
+        ASSERT_EQUAL(drain(queue), list<string>({"soon"}));
+        futureCommits.committed(10);
+        ASSERT_EQUAL(futureCommits.size(), 1);
+        ASSERT_EQUAL(drain(queue), list<string>({"later"}));
+
+        // And `returnAll` returns the rest whatever they're waiting for.
+        futureCommits.returnAll();
+        ASSERT_EQUAL(futureCommits.size(), 0);
+        ASSERT_EQUAL(drain(queue), list<string>({"other commit"}));
+    }
+
+} __FutureCommitQueueTest;
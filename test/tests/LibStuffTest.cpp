@@ -6,6 +6,7 @@ struct LibStuff : tpunit::TestFixture {
                                     TEST(LibStuff::testEncryptDecrpyt),
                                     TEST(LibStuff::testSHMACSHA1),
                                     TEST(LibStuff::testSHMACSHA256),
+                                    TEST(LibStuff::testSHA),
                                     TEST(LibStuff::testJSONDecode),
                                     TEST(LibStuff::testJSON),
                                     TEST(LibStuff::testEscapeUnescape),
@@ -49,6 +50,33 @@ struct LibStuff : tpunit::TestFixture {
         ASSERT_EQUAL(SToHex(SHMACSHA256("key", "Only a Sith deals in absolutes")), "524C9B1C0B6E9F47F10041A429FCB2C880129F940DC9E41F31267E0909D46845");
     }
 
+    void testSHA() {
+        ASSERT_EQUAL(SToHex(SHashSHA1("")), "DA39A3EE5E6B4B0D3255BFEF95601890AFD80709");
+        ASSERT_EQUAL(SToHex(SHashSHA1("The quick brown fox jumps over the lazy dog")),
+                     "2FD4E1C67A2D28FCED849EE1BB76E7391B93EB12");
+        ASSERT_EQUAL(SToHex(SHashSHA256("")), "E3B0C44298FC1C149AFBF4C8996FB92427AE41E4649B934CA495991B7852B855");
+        ASSERT_EQUAL(SToHex(SHashSHA256("The quick brown fox jumps over the lazy dog")),
+                     "D7A8FBB307D7809469CA9ABCB0082E4F8D5651E46D3CDB762D02D0BF37C9E592");
+
+        // The hardware implementation should agree with mbedtls for every length of padding, and across multiple
+        // blocks.
+        if (!SHash::hardwareSupported()) {
+            cout << "[LibStuff] SHA extensions not supported on this CPU, only testing mbedtls." << endl;
+            return;
+        }
+        string buffer;
+        for (int i = 0; i < 300; i++) {
+            SHash::hardwareEnabled = true;
+            string hardwareSHA1 = SHashSHA1(buffer);
+            string hardwareSHA256 = SHashSHA256(buffer);
+            SHash::hardwareEnabled = false;
+            ASSERT_EQUAL(hardwareSHA1, SHashSHA1(buffer));
+            ASSERT_EQUAL(hardwareSHA256, SHashSHA256(buffer));
+            buffer += (char)SRandom::rand64();
+        }
+        SHash::hardwareEnabled = true;
+    }
+
     void testJSONDecode() {
         const string& sampleJson = SFileLoad("sample_data/lottoNumbers.json");
         ASSERT_FALSE(sampleJson.empty());
@@ -630,3 +658,34 @@ struct LibStuff : tpunit::TestFixture {
         ASSERT_EQUAL(SFirstOfMonth(timeStamp4, -25), "2018-06-01");
     }
 } __LibStuff;
+
+// Only run with `-perf`.
+struct PerfSHATest : tpunit::TestFixture {
+    PerfSHATest() : tpunit::TestFixture("PerfSHA", TEST(PerfSHATest::benchmark)) { }
+
+    void benchmark() {
+        // Compare throughput of each implementation on something the size of a large commit. This switches
+        // implementations for the whole process, so don't run it alongside anything else that hashes.
+        string buffer;
+        for (int i = 0; i < 4 * 1024 * 1024; i++) {
+            buffer += (char)i;
+        }
+        const int iterations = 20;
+        for (bool hardware : {false, true}) {
+            if (hardware && !SHash::hardwareSupported()) {
+                continue;
+            }
+            SHash::hardwareEnabled = hardware;
+            for (auto& hash : {make_pair("SHA1", &SHashSHA1), make_pair("SHA256", &SHashSHA256)}) {
+                uint64_t start = STimeNow();
+                for (int i = 0; i < iterations; i++) {
+                    hash.second(buffer);
+                }
+                uint64_t elapsed = max(STimeNow() - start, (uint64_t)1);
+                cout << "[PerfSHA] " << hash.first << " (" << (hardware ? "SHA extensions" : "mbedtls") << "): "
+                     << (buffer.size() * iterations / elapsed) << "MB/s." << endl;
+            }
+        }
+        SHash::hardwareEnabled = true;
+    }
+} __PerfSHATest;
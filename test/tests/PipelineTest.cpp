@@ -0,0 +1,122 @@
+#include <test/lib/BedrockTester.h>
+
+// Builds `count` queries that each return their own index, optionally tagged with a requestID.
+static vector<SData> queries(int count, bool requestID, bool ordered = false) {
+    vector<SData> requests;
+    for (int i = 0; i < count; i++) {
+        SData query("Query");
+        query["query"] = "SELECT " + SQ(i) + ";";
+        if (requestID) {
+            query["requestID"] = "pipeline" + to_string(i);
+        }
+        if (ordered) {
+            query["orderedResponse"] = "true";
+        }
+        requests.push_back(query);
+    }
+    return requests;
+}
+
+struct PipelineTest : tpunit::TestFixture {
+    PipelineTest()
+        : tpunit::TestFixture("Pipeline",
+                              BEFORE_CLASS(PipelineTest::setup),
+                              TEST(PipelineTest::unordered),
+                              TEST(PipelineTest::ordered),
+                              TEST(PipelineTest::withoutRequestID),
+                              TEST(PipelineTest::closeStopsReading),
+                              AFTER_CLASS(PipelineTest::tearDown)) { }
+
+    BedrockTester* tester;
+
+    void setup() {
+        tester = new BedrockTester({{"-clientPipelineDepth", "32"}}, {});
+    }
+
+    void tearDown() {
+        delete tester;
+    }
+
+    void unordered() {
+        // Every request gets exactly one response, which we can match up with the requestID.
+        vector<SData> responses = tester->executePipelined(queries(200, true))[0];
+        ASSERT_EQUAL(responses.size(), 200);
+        set<int> answered;
+        for (auto& response : responses) {
+            ASSERT_EQUAL(response.methodLine, "200 OK");
+            ASSERT_EQUAL(response["requestID"], "pipeline" + SToStr(SToInt(response.content)));
+            answered.insert(SToInt(response.content));
+        }
+        ASSERT_EQUAL(answered.size(), 200);
+    }
+
+    void ordered() {
+        vector<SData> responses = tester->executePipelined(queries(200, true, true))[0];
+        ASSERT_EQUAL(responses.size(), 200);
+        for (size_t i = 0; i < responses.size(); i++) {
+            ASSERT_EQUAL(responses[i]["requestID"], "pipeline" + to_string(i));
+            ASSERT_EQUAL(SToInt(responses[i].content), (int)i);
+        }
+    }
+
+    void withoutRequestID() {
+        // Without requestIDs, requests are handled one at a time, so the responses come back in order.
+        vector<SData> responses = tester->executePipelined(queries(50, false))[0];
+        ASSERT_EQUAL(responses.size(), 50);
+        for (size_t i = 0; i < responses.size(); i++) {
+            ASSERT_EQUAL(SToInt(responses[i].content), (int)i);
+        }
+    }
+
+    void closeStopsReading() {
+        // Once a client asks us to close the connection, we answer what we've already read, and nothing after it.
+        vector<SData> requests = queries(5, true, true);
+        requests[2]["Connection"] = "close";
+        vector<SData> responses = tester->executePipelined(requests)[0];
+        ASSERT_EQUAL(responses.size(), 3);
+        for (size_t i = 0; i < responses.size(); i++) {
+            ASSERT_EQUAL(responses[i]["requestID"], "pipeline" + to_string(i));
+        }
+    }
+
+} __PipelineTest;
+
+// Only run with `-perf`.
+struct PerfPipelineTest : tpunit::TestFixture {
+    PerfPipelineTest()
+        : tpunit::TestFixture("PerfPipeline",
+                              BEFORE_CLASS(PerfPipelineTest::setup),
+                              TEST(PerfPipelineTest::benchmark),
+                              AFTER_CLASS(PerfPipelineTest::tearDown)) { }
+
+    BedrockTester* tester;
+
+    void setup() {
+        tester = new BedrockTester({{"-clientPipelineDepth", "32"}}, {});
+    }
+
+    void tearDown() {
+        delete tester;
+    }
+
+    void benchmark() {
+        // Compare throughput with and without pipelining, at different numbers of connections.
+        const int count = 4000;
+        for (int connections : {1, 4, 16, 64}) {
+            uint64_t results[2];
+            for (int pipelined = 0; pipelined < 2; pipelined++) {
+                vector<SData> requests = queries(count, pipelined);
+                uint64_t start = STimeNow();
+                size_t responses = 0;
+                for (auto& connectionResponses : tester->executePipelined(requests, connections)) {
+                    responses += connectionResponses.size();
+                }
+                ASSERT_EQUAL(responses, count);
+                results[pipelined] = count * STIME_US_PER_S / max(STimeNow() - start, (uint64_t)1);
+            }
+            cout << "[PipelineTest] " << connections << " connections: " << results[0] << " commands/s one at a time, "
+                 << results[1] << " commands/s pipelined." << endl;
+        }
+    }
+
+} __PerfPipelineTest;
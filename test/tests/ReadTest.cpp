@@ -7,6 +7,8 @@ struct ReadTest : tpunit::TestFixture {
                               TEST(ReadTest::simpleRead),
                               TEST(ReadTest::simpleReadWithHttp),
                               TEST(ReadTest::readNoSemicolon),
+                              TEST(ReadTest::verbCase),
+                              TEST(ReadTest::queryInMethodLine),
                               AFTER_CLASS(ReadTest::tearDown)) { }
 
     BedrockTester* tester;
@@ -41,4 +43,17 @@ struct ReadTest : tpunit::TestFixture {
         tester->executeWaitVerifyContent(status, "502");
     }
 
+    void verbCase() {
+        // Verbs are matched case-insensitively.
+        SData query("qUeRy");
+        query["query"] = "SELECT 1;";
+        ASSERT_EQUAL(SToInt(tester->executeWaitVerifyContent(query)), 1);
+    }
+
+    void queryInMethodLine() {
+        // This isn't a registered verb, so it's found by the DB plugin's prefix match.
+        SData query("Query: SELECT 2;");
+        ASSERT_EQUAL(SToInt(tester->executeWaitVerifyContent(query)), 2);
+    }
+
 } __ReadTest;
@@ -13,22 +13,127 @@ class SQLiteNodeTester {
     static void updateSyncPeer(SQLiteNode& node) {
         node._updateSyncPeer();
     }
+
+    static void recvSynchronize(SQLiteNode& node, SQLiteNode::Peer* peer, const SData& response) {
+        node._recvSynchronize(peer, response);
+    }
+
+    static void lead(SQLiteNode& node, const map<uint64_t, string>& pipelinedCommits) {
+        node._state = SQLiteNode::LEADING;
+        node._quorumPendingCommits = pipelinedCommits;
+    }
+
+    static void onMessage(SQLiteNode& node, SQLiteNode::Peer* peer, const SData& message) {
+        node._onMESSAGE(peer, message);
+    }
+
+    static void updateQuorumApprovedCommit(SQLiteNode& node) {
+        node._updateQuorumApprovedCommit();
+    }
+
+    static size_t pendingEscalateResponses(SQLiteNode& node) {
+        return node._pendingEscalateResponses.size();
+    }
+
+    static void follow(SQLiteNode& node, SQLiteNode::Peer* leader) {
+        node._state = SQLiteNode::FOLLOWING;
+        node._leadPeer = leader;
+    }
+
+    static void addEscalatedCommand(SQLiteNode& node, unique_ptr<SQLiteCommand>&& command) {
+        string id = command->id;
+        node._escalatedCommandMap.emplace(id, move(command));
+    }
+
+    static void setSocket(SQLiteNode::Peer* peer, STCPManager::Socket* socket) {
+        lock_guard<decltype(peer->_stateMutex)> lock(peer->_stateMutex);
+        peer->socket = socket;
+    }
+
+    static void sendToPeer(SQLiteNode& node, SQLiteNode::Peer* peer, const SData& message) {
+        node._sendToPeer(peer, message);
+    }
+
+    static void recordReplicationStats(SQLiteNode& node, uint64_t commitCount, uint64_t retries, bool serial) {
+        node._recordReplicationStats(commitCount, retries, serial);
+    }
+
+    static list<string> escalatedCommandIDs(SQLiteNode& node) {
+        list<string> ids;
+        auto lock = node._escalatedCommandMap.scopedLock();
+        for (auto& command : node._escalatedCommandMap) {
+            ids.push_back(command.first);
+        }
+        return ids;
+    }
 };
 
 class TestServer : public SQLiteServer {
   public:
     TestServer(const string& host) : SQLiteServer(host) { }
 
-    virtual void acceptCommand(unique_ptr<SQLiteCommand>&& command, bool isNew) { }
-    virtual void cancelCommand(const string& commandID) { }
+    virtual void acceptCommand(unique_ptr<SQLiteCommand>&& command, bool isNew) {
+        acceptedCommands.push_back(move(command));
+    }
+    virtual void cancelCommand(const string& commandID) {
+        cancelledCommands.push_back(commandID);
+    }
     virtual bool canStandDown() { return true; }
     virtual void onNodeLogin(SQLiteNode::Peer* peer) { }
+
+    // Everything the node has handed us.
+    list<unique_ptr<SQLiteCommand>> acceptedCommands;
+    list<string> cancelledCommands;
+};
+
+// A command with a deadline, like a BedrockCommand's.
+class TimedCommand : public SQLiteCommand {
+  public:
+    TimedCommand(SData&& request, uint64_t timeout) : SQLiteCommand(move(request)), _timeout(timeout) { }
+    virtual uint64_t timeout() const { return _timeout; }
+
+  private:
+    uint64_t _timeout;
+};
+
+// A temp file for a test DB, deleted along with its journal files when it goes out of scope.
+struct TempDBFile {
+    TempDBFile() {
+        char filename[17] = "br_sync_dbXXXXXX";
+        close(mkstemp(filename));
+        name = filename;
+    }
+    ~TempDBFile() {
+        for (const char* suffix : {"", "-wal", "-shm"}) {
+            unlink((name + suffix).c_str());
+        }
+    }
+    string name;
+};
+
+// A node on its own temp DB, with a TestServer, for a single test.
+struct TestNode {
+    TestNode(const string& peerList = "host1.fake:15555?nodeName=peer1")
+      : dbPool(10, file.name, 1000000, 5000, 0), server(""),
+        node(server, dbPool, "test", "localhost:19998", peerList, 1, 1000000000, "1.0") { }
+    TempDBFile file;
+    SQLitePool dbPool;
+    TestServer server;
+    SQLiteNode node;
 };
 
 struct SQLiteNodeTest : tpunit::TestFixture {
     SQLiteNodeTest() : tpunit::TestFixture("SQLiteNode",
                                            AFTER_CLASS(SQLiteNodeTest::teardown),
-                                           TEST(SQLiteNodeTest::testFindSyncPeer)) { }
+                                           TEST(SQLiteNodeTest::testFindSyncPeer),
+                                           TEST(SQLiteNodeTest::testCommitChain),
+                                           TEST(SQLiteNodeTest::testSnapshot),
+                                           TEST(SQLiteNodeTest::testPipelinedQuorumDeny),
+                                           TEST(SQLiteNodeTest::testEscalateResponse),
+                                           TEST(SQLiteNodeTest::testEscalationDeadline),
+                                           TEST(SQLiteNodeTest::testEscalationExpiry),
+                                           TEST(SQLiteNodeTest::testSendBufferLimit),
+                                           TEST(SQLiteNodeTest::testReplicationStats)) { }
 
     // Filename for temp DB.
     char filenameTemplate[17] = "br_sync_dbXXXXXX";
@@ -38,6 +143,13 @@ struct SQLiteNodeTest : tpunit::TestFixture {
         unlink(filename);
     }
 
+    void commit(SQLite& db, const string& query) {
+        ASSERT_TRUE(db.beginTransaction());
+        ASSERT_TRUE(db.write(query));
+        ASSERT_TRUE(db.prepare());
+        ASSERT_EQUAL(db.commit(), SQLITE_OK);
+    }
+
     void testFindSyncPeer() {
 
         // This exposes just enough to test the peer selection logic.
@@ -117,4 +229,309 @@ struct SQLiteNodeTest : tpunit::TestFixture {
         ASSERT_EQUAL(SQLiteNodeTester::getSyncPeer(testNode), fastest);
     }
 
+    // Returns a SYNCHRONIZE_RESPONSE with a commit for each of `queries`, following on from commit `commitCount`,
+    // `hash`.
+    SData synchronizeResponse(uint64_t commitCount, string hash, const list<string>& queries) {
+        SData response("SYNCHRONIZE_RESPONSE");
+        for (const string& query : queries) {
+            SData commit("COMMIT");
+            commit.content = query;
+            hash = SToHex(SHashSHA1(hash + commit.content));
+            commit["CommitIndex"] = to_string(++commitCount);
+            commit["Hash"] = hash;
+            response.content += commit.serialize();
+        }
+        response["NumCommits"] = to_string(queries.size());
+        return response;
+    }
+
+    void testCommitChain() {
+        TestNode test;
+        SQLiteNode& testNode = test.node;
+        SQLiteNode::Peer* peer = testNode.peerList.front();
+        SQLite& db = test.dbPool.getBase();
+        uint64_t commitCount = db.getCommitCount();
+        const string hash = db.getCommittedHash();
+
+        // Commits that don't follow on from ours aren't applied, even if they follow on from each other.
+        SData forked = synchronizeResponse(commitCount, SToHex(SHashSHA1("other")),
+                                           {"CREATE TABLE test (id INTEGER);"});
+        ASSERT_THROW(SQLiteNodeTester::recvSynchronize(testNode, peer, forked), SException);
+        ASSERT_EQUAL(db.getCommitCount(), commitCount);
+
+        // And a commit that's been tampered with is where we stop.
+        SData tampered = synchronizeResponse(commitCount, hash, {"CREATE TABLE test (id INTEGER);",
+                                                                 "INSERT INTO test VALUES(1);",
+                                                                 "INSERT INTO test VALUES(2);"});
+        tampered.content = SReplace(tampered.content, "VALUES(2)", "VALUES(4)");
+        ASSERT_THROW(SQLiteNodeTester::recvSynchronize(testNode, peer, tampered), SException);
+        ASSERT_EQUAL(db.getCommitCount(), commitCount + 2);
+        ASSERT_EQUAL(db.read("SELECT COUNT(*) FROM test;"), "1");
+
+        // Commits that do follow on are all applied.
+        SData response = synchronizeResponse(commitCount + 2, db.getCommittedHash(), {"INSERT INTO test VALUES(2);"});
+        SQLiteNodeTester::recvSynchronize(testNode, peer, response);
+        ASSERT_EQUAL(db.getCommitCount(), commitCount + 3);
+        ASSERT_EQUAL(db.read("SELECT COUNT(*) FROM test;"), "2");
+    }
+
+    void testSnapshot() {
+        TempDBFile sourceFile;
+        TempDBFile destFile;
+        SQLitePool sourcePool(2, sourceFile.name, 1000000, 5000, 0);
+        SQLitePool destPool(2, destFile.name, 1000000, 5000, 0);
+        SQLite& source = sourcePool.getBase();
+        SQLite& dest = destPool.getBase();
+
+        // Give each DB its own history.
+        commit(source, "CREATE TABLE test (id INTEGER PRIMARY KEY, value TEXT);");
+        for (int i = 0; i < 10; i++) {
+            commit(source, "INSERT INTO test VALUES(" + SQ(i) + ", " + SQ("value" + to_string(i)) + ");");
+        }
+        commit(dest, "CREATE TABLE other (id INTEGER PRIMARY KEY);");
+
+        // The snapshot is at the source's latest commit.
+        const string snapshotFilename = sourceFile.name + ".snapshot";
+        uint64_t commitCount = 0;
+        string hash;
+        ASSERT_TRUE(source.createSnapshot(snapshotFilename, commitCount, hash));
+        ASSERT_EQUAL(commitCount, source.getCommitCount());
+        ASSERT_EQUAL(hash, source.getCommittedHash());
+
+        // It won't restore as a different commit, and that leaves the DB alone.
+        ASSERT_FALSE(dest.restoreSnapshot(snapshotFilename, commitCount, SToHex(SHashSHA1("other"))));
+        ASSERT_EQUAL(dest.getCommitCount(), 1);
+        ASSERT_EQUAL(dest.read("SELECT COUNT(*) FROM other;"), "0");
+
+        // Restored, the destination has the source's data and commit, and carries on from there.
+        ASSERT_TRUE(dest.restoreSnapshot(snapshotFilename, commitCount, hash));
+        ASSERT_EQUAL(dest.getCommitCount(), commitCount);
+        ASSERT_EQUAL(dest.getCommittedHash(), hash);
+        ASSERT_EQUAL(dest.read("SELECT COUNT(*) FROM test;"), "10");
+        ASSERT_EQUAL(dest.read("SELECT value FROM test WHERE id = 9;"), "value9");
+        ASSERT_EQUAL(dest.read("SELECT COUNT(*) FROM sqlite_master WHERE name = 'other';"), "0");
+        const string query = "INSERT INTO test VALUES(10, 'value10');";
+        commit(source, query);
+        commit(dest, query);
+        ASSERT_EQUAL(dest.getCommitCount(), source.getCommitCount());
+        ASSERT_EQUAL(dest.getCommittedHash(), source.getCommittedHash());
+        unlink(snapshotFilename.c_str());
+    }
+
+    // Returns `peer`'s response to pipelined transaction `id`.
+    SData transactionResponse(const string& methodLine, uint64_t peerCommitCount, uint64_t id, const string& hash) {
+        SData response(methodLine);
+        response["CommitCount"] = to_string(peerCommitCount);
+        response["Hash"] = "peerhash";
+        response["ID"] = to_string(id);
+        response["NewCount"] = to_string(id);
+        response["NewHash"] = hash;
+        return response;
+    }
+
+    void testPipelinedQuorumDeny() {
+        TestNode test("host1.fake:15555?nodeName=peer1,host2.fake:16666?nodeName=peer2,"
+                      "host3.fake:17777?nodeName=peer3,host4.fake:18888?nodeName=peer4");
+        SQLiteNode& testNode = test.node;
+        vector<SQLiteNode::Peer*> peers(testNode.peerList.begin(), testNode.peerList.end());
+        for (auto peer : peers) {
+            peer->loggedIn = true;
+            peer->setCommit(4, "peerhash");
+        }
+
+        // We've committed #5 and #6 without waiting for anyone to approve them, and with four peers, we need two to.
+        SQLiteNodeTester::lead(testNode, {{5, "hash5"}, {6, "hash6"}});
+        SQLiteNodeTester::onMessage(testNode, peers[0], transactionResponse("DENY_TRANSACTION", 4, 5, "hash5"));
+        SQLiteNodeTester::onMessage(testNode, peers[1], transactionResponse("APPROVE_TRANSACTION", 4, 5, "hash5"));
+        SQLiteNodeTester::onMessage(testNode, peers[1], transactionResponse("APPROVE_TRANSACTION", 5, 6, "hash6"));
+        ASSERT_EQUAL(testNode.getQuorumApprovedCommit(), 4);
+
+        // The peer that denied them doesn't count until it reports having our commits, with our hashes, so a forked
+        // peer with the same commit count doesn't count either.
+        peers[0]->setCommit(6, "forkedhash");
+        SQLiteNodeTester::updateQuorumApprovedCommit(testNode);
+        ASSERT_EQUAL(testNode.getQuorumApprovedCommit(), 4);
+        peers[0]->setCommit(6, "hash6");
+        SQLiteNodeTester::updateQuorumApprovedCommit(testNode);
+        ASSERT_EQUAL(testNode.getQuorumApprovedCommit(), 6);
+    }
+
+    void testEscalateResponse() {
+        TestNode test;
+        SQLiteNode& testNode = test.node;
+        SQLiteCommand command(SData("Query"));
+        command.initiatingPeerID = 1;
+        command.id = "escalated";
+        command.response.methodLine = "200 OK";
+
+        // A worker finishing a command escalated to us wakes up the sync thread's poll, and the response goes out as
+        // soon as it's handled what woke it up, without waiting for the next prePoll.
+        fd_map fdm;
+        testNode.prePoll(fdm);
+        uint64_t start = STimeNow();
+        thread worker([&]() {
+            usleep(100'000);
+            testNode.sendResponse(command);
+        });
+        S_poll(fdm, 10'000'000);
+        worker.join();
+        ASSERT_LESS_THAN(STimeNow() - start, 5'000'000);
+        ASSERT_EQUAL(SQLiteNodeTester::pendingEscalateResponses(testNode), 1);
+        uint64_t nextActivity = STimeNow() + STIME_US_PER_S;
+        testNode.postPoll(fdm, nextActivity);
+        ASSERT_EQUAL(SQLiteNodeTester::pendingEscalateResponses(testNode), 0);
+    }
+
+    // Returns an ESCALATE for a Query with ID `id`, sent `sentAgo` microseconds ago, that the follower will wait
+    // `timeRemaining` more milliseconds for.
+    SData escalate(const string& id, uint64_t sentAgo, int64_t timeRemaining) {
+        SData request("Query");
+        request["commandExecuteTime"] = to_string(STimeNow() - sentAgo);
+        SData escalate("ESCALATE");
+        escalate["CommitCount"] = "0";
+        escalate["Hash"] = "peerhash";
+        escalate["ID"] = id;
+        escalate["TimeRemaining"] = to_string(timeRemaining);
+        escalate.content = request.serialize();
+        return escalate;
+    }
+
+    void testEscalationDeadline() {
+        TestNode test;
+        SQLiteNode& testNode = test.node;
+        SQLiteNode::Peer* peer = testNode.peerList.front();
+        peer->loggedIn = true;
+        peer->subscribed = true;
+        SQLiteNodeTester::lead(testNode, {});
+
+        // Leader gives an escalated command the rest of the time the follower's waiting, counted from when the
+        // follower received it.
+        SQLiteNodeTester::onMessage(testNode, peer, escalate("a", 1'000'000, 2000));
+        ASSERT_EQUAL(test.server.acceptedCommands.size(), 1);
+        SQLiteCommand& command = *test.server.acceptedCommands.front();
+        ASSERT_EQUAL(command.id, "a");
+        ASSERT_EQUAL(command.initiatingPeerID, (int64_t)peer->id);
+        ASSERT_GREATER_THAN_EQUAL(command.request.calc64("timeout"), 2999);
+        ASSERT_LESS_THAN(command.request.calc64("timeout"), 3100);
+
+        // If there's no time left, it doesn't even try.
+        SQLiteNodeTester::onMessage(testNode, peer, escalate("b", 1'000'000, 0));
+        ASSERT_EQUAL(test.server.acceptedCommands.size(), 1);
+
+        // And the follower can cancel it.
+        SData cancel("ESCALATE_CANCEL");
+        cancel["CommitCount"] = "0";
+        cancel["Hash"] = "peerhash";
+        cancel["ID"] = "A";
+        cancel.content = command.request.serialize();
+        SQLiteNodeTester::onMessage(testNode, peer, cancel);
+        ASSERT_EQUAL(test.server.cancelledCommands, list<string>({"a"}));
+    }
+
+    void testEscalationExpiry() {
+        TestNode test;
+        SQLiteNode& testNode = test.node;
+        SQLiteNode::Peer* leader = testNode.peerList.front();
+        leader->state = SQLiteNode::LEADING;
+        SQLiteNodeTester::follow(testNode, leader);
+
+        // Two commands escalated to leader, one of which is out of time.
+        map<string, uint64_t> deadlines = {{"expired", STimeNow() - 1}, {"waiting", STimeNow() + STIME_US_PER_M}};
+        for (auto& deadline : deadlines) {
+            auto command = make_unique<TimedCommand>(SData("Query"), deadline.second);
+            command->id = deadline.first;
+            command->escalated = true;
+            SQLiteNodeTester::addEscalatedCommand(testNode, move(command));
+        }
+
+        // Before polling, follower gives up on the one that's out of time, and hands it back to the server to respond
+        // to, leaving the other one alone.
+        fd_map fdm;
+        testNode.prePoll(fdm);
+        ASSERT_EQUAL(test.server.acceptedCommands.size(), 1);
+        SQLiteCommand& command = *test.server.acceptedCommands.front();
+        ASSERT_EQUAL(command.id, "expired");
+        ASSERT_TRUE(command.complete);
+        ASSERT_EQUAL(command.response.methodLine, "555 Timeout");
+        ASSERT_EQUAL(SQLiteNodeTester::escalatedCommandIDs(testNode), list<string>({"waiting"}));
+    }
+
+    void testSendBufferLimit() {
+        TestNode test;
+        SQLiteNode& testNode = test.node;
+        SQLiteNode::Peer* peer = testNode.peerList.front();
+        peer->loggedIn = true;
+        peer->subscribed = true;
+
+        // A peer that never reads anything we send it.
+        int fds[2];
+        ASSERT_EQUAL(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+        fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL) | O_NONBLOCK);
+        STCPManager::Socket* socket = new STCPManager::Socket(fds[0], STCPManager::Socket::CONNECTED);
+        SQLiteNodeTester::setSocket(peer, socket);
+        SData message("BEGIN_TRANSACTION");
+        message.content = string(100'000, 'x');
+
+        // With no limit, its send buffer can grow as much as it likes, and we keep track of how big it's been.
+        uint64_t previousLimit = SQLiteNode::peerSendBufferLimit.exchange(0);
+        for (int i = 0; i < 50; i++) {
+            SQLiteNodeTester::sendToPeer(testNode, peer, message);
+        }
+        size_t buffered = socket->sendBufferSize();
+        ASSERT_GREATER_THAN(buffered, 2'000'000);
+        ASSERT_EQUAL(peer->sendBufferHighWater, buffered);
+        ASSERT_EQUAL(peer->sendBufferOverflows, 0);
+        ASSERT_TRUE(peer->subscribed);
+
+        // Once it's over the limit, we give up on it: the buffer's discarded, and we disconnect, so it'll have to log
+        // in and synchronize again.
+        SQLiteNode::peerSendBufferLimit = 1'000'000;
+        SQLiteNodeTester::sendToPeer(testNode, peer, message);
+        ASSERT_EQUAL(peer->sendBufferOverflows, 1);
+        ASSERT_EQUAL(socket->sendBufferSize(), 0);
+        ASSERT_EQUAL(socket->state.load(), STCPManager::Socket::SHUTTINGDOWN);
+        ASSERT_FALSE(peer->subscribed);
+        ASSERT_FALSE(peer->loggedIn);
+        ASSERT_GREATER_THAN(peer->sendBufferHighWater, buffered);
+
+        // And nothing more is queued for it while it disconnects.
+        SQLiteNodeTester::sendToPeer(testNode, peer, message);
+        ASSERT_EQUAL(socket->sendBufferSize(), 0);
+        ASSERT_EQUAL(peer->sendBufferOverflows, 1);
+
+        SQLiteNode::peerSendBufferLimit = previousLimit;
+        close(fds[1]);
+    }
+
+    void testReplicationStats() {
+        TestNode test;
+        SQLiteNode& testNode = test.node;
+
+        // Replication threads finish in any order, so commits from a batch can arrive after ones from the next.
+        SQLiteNodeTester::recordReplicationStats(testNode, 999, 0, false);
+        SQLiteNodeTester::recordReplicationStats(testNode, 1000, 2, true);
+        SQLiteNodeTester::recordReplicationStats(testNode, 998, 1, false);
+        SQLiteNodeTester::recordReplicationStats(testNode, 1001, 0, false);
+        list<STable> batches = testNode.getReplicationBatchStats();
+        ASSERT_EQUAL(batches.size(), 2);
+        ASSERT_EQUAL(batches.front()["firstCommit"], "0");
+        ASSERT_EQUAL(batches.front()["transactions"], "2");
+        ASSERT_EQUAL(batches.front()["conflicts"], "1");
+        ASSERT_EQUAL(batches.front()["retries"], "1");
+        ASSERT_EQUAL(batches.back()["firstCommit"], "1000");
+        ASSERT_EQUAL(batches.back()["transactions"], "2");
+        ASSERT_EQUAL(batches.back()["retries"], "2");
+        ASSERT_EQUAL(batches.back()["serial"], "1");
+
+        // Only the most recent batches are kept, and a straggler from one that's been discarded doesn't bring it back.
+        for (uint64_t commit = 2000; commit <= SQLiteNode::SQL_NODE_REPLICATION_BATCHES_KEPT * 1000; commit += 1000) {
+            SQLiteNodeTester::recordReplicationStats(testNode, commit, 0, false);
+        }
+        SQLiteNodeTester::recordReplicationStats(testNode, 997, 0, false);
+        batches = testNode.getReplicationBatchStats();
+        ASSERT_EQUAL(batches.size(), SQLiteNode::SQL_NODE_REPLICATION_BATCHES_KEPT);
+        ASSERT_EQUAL(batches.front()["firstCommit"], "1000");
+        ASSERT_EQUAL(batches.back()["firstCommit"], to_string(SQLiteNode::SQL_NODE_REPLICATION_BATCHES_KEPT * 1000));
+    }
+
 } __SQLiteNodeTest;
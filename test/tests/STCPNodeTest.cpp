@@ -0,0 +1,127 @@
+#include <libstuff/libstuff.h>
+#include <test/lib/BedrockTester.h>
+
+class STCPNodeTester {
+  public:
+    // Does what `SQLiteNode::_reconnectPeer` does.
+    static void reconnect(STCPNode& node, STCPNode::Peer* peer) {
+        lock_guard<decltype(peer->_stateMutex)> lock(peer->_stateMutex);
+        if (peer->socket) {
+            node.shutdownSocket(peer->socket);
+        }
+    }
+
+    static void setSocket(STCPNode::Peer& peer, STCPManager::Socket* socket) {
+        lock_guard<decltype(peer._stateMutex)> lock(peer._stateMutex);
+        peer.socket = socket;
+    }
+};
+
+// A node with a single peer that just counts what happens to it.
+class CountingNode : public STCPNode {
+  public:
+    CountingNode(const string& name, const string& host, const string& peerName, const string& peerHost)
+      : STCPNode(name, host, {new Peer(peerName, peerHost, STable(), 1)}), connects(0), disconnects(0), messages(0) { }
+
+    virtual void _onConnect(Peer* peer) { connects++; }
+    virtual void _onDisconnect(Peer* peer) { disconnects++; }
+    virtual void _onMESSAGE(Peer* peer, const SData& message) { messages++; }
+
+    atomic<int> connects;
+    atomic<int> disconnects;
+    atomic<int> messages;
+};
+
+struct STCPNodeTest : tpunit::TestFixture {
+    STCPNodeTest()
+        : tpunit::TestFixture("STCPNode",
+                              TEST(STCPNodeTest::reconnectWhileSending),
+                              TEST(STCPNodeTest::telemetryCounterReset)) { }
+
+    // Runs the loop the sync thread would for both nodes, for `duration` microseconds.
+    void poll(CountingNode& a, CountingNode& b, uint64_t duration) {
+        uint64_t end = STimeNow() + duration;
+        while (STimeNow() < end) {
+            fd_map fdm;
+            a.prePoll(fdm);
+            b.prePoll(fdm);
+            S_poll(fdm, 10'000);
+            uint64_t nextActivity = 0;
+            a.postPoll(fdm, nextActivity);
+            b.postPoll(fdm, nextActivity);
+        }
+    }
+
+    void reconnectWhileSending() {
+        CountingNode a("a", "127.0.0.1:19990", "b", "127.0.0.1:19991");
+        CountingNode b("b", "127.0.0.1:19991", "a", "127.0.0.1:19990");
+        a.startNetworkThread();
+        b.startNetworkThread();
+
+        // Another thread keeps sending, like a worker would, while the network thread replaces the socket it's
+        // sending on each time we reconnect.
+        atomic<bool> done(false);
+        thread sender([&]() {
+            SData message("TEST");
+            while (!done) {
+                a.peerList.front()->sendMessage(message);
+                usleep(100);
+            }
+        });
+        for (int i = 0; i < 10; i++) {
+            poll(a, b, 500'000);
+            STCPNodeTester::reconnect(a, a.peerList.front());
+        }
+        poll(a, b, 7'000'000);
+        done = true;
+        sender.join();
+
+        // Every reconnection was handled, and we're connected again, and still delivering messages.
+        poll(a, b, 500'000);
+        ASSERT_GREATER_THAN(a.disconnects, 0);
+        ASSERT_TRUE(a.peerList.front()->connected());
+        ASSERT_GREATER_THAN(b.messages, 0);
+        int messages = b.messages;
+        a.peerList.front()->sendMessage(SData("TEST"));
+        poll(a, b, 500'000);
+        ASSERT_GREATER_THAN(b.messages, messages);
+
+        a.stopNetworkThread();
+        b.stopNetworkThread();
+    }
+
+    void telemetryCounterReset() {
+        int fds[2];
+        ASSERT_EQUAL(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+        STCPManager::Socket* socket = new STCPManager::Socket(fds[0], STCPManager::Socket::CONNECTED);
+        STCPNode::Peer peer("b", "127.0.0.1:19991", STable(), 1);
+        STCPNodeTester::setSocket(peer, socket);
+
+        // 1000 bytes sent before the first sample, and 10 more before the second, 100ms later.
+        socket->send(string(1000, 'x'));
+        peer.recordTelemetry(0);
+        usleep(100'000);
+        socket->send(string(10, 'x'));
+        peer.recordTelemetry(0);
+
+        // Then the node resets the socket's counters, as `SQLiteNode` does every 10 seconds, and we send 10 more.
+        socket->resetCounters();
+        usleep(100'000);
+        socket->send(string(10, 'x'));
+        peer.recordTelemetry(0);
+
+        // Each of the last two samples only counts what was sent since the one before, so it's no more than 10 bytes
+        // in 100ms, rather than wrapping around when the counter went down.
+        vector<STCPNode::Peer::TelemetrySample> samples = peer.getTelemetry();
+        ASSERT_EQUAL(samples.size(), 3);
+        for (size_t i = 1; i < samples.size(); i++) {
+            ASSERT_GREATER_THAN(samples[i].bytesSentPerSecond, 0);
+            ASSERT_LESS_THAN(samples[i].bytesSentPerSecond, 101);
+        }
+
+        STCPNodeTester::setSocket(peer, nullptr);
+        delete socket;
+        close(fds[1]);
+    }
+
+} __STCPNodeTest;
@@ -0,0 +1,251 @@
+#include <libstuff/libstuff.h>
+#include <libstuff/SShardedScheduledPriorityQueue.h>
+#include <test/lib/BedrockTester.h>
+
+struct ScheduledPriorityQueueTest : tpunit::TestFixture {
+    ScheduledPriorityQueueTest()
+        : tpunit::TestFixture("ScheduledPriorityQueue",
+                              TEST(ScheduledPriorityQueueTest::priorityOrder),
+                              TEST(ScheduledPriorityQueueTest::scheduledInFuture),
+                              TEST(ScheduledPriorityQueueTest::timeoutFirst),
+                              TEST(ScheduledPriorityQueueTest::stealing),
+                              TEST(ScheduledPriorityQueueTest::futureDoesNotHideReady),
+                              TEST(ScheduledPriorityQueueTest::deadlineOrder),
+                              TEST(ScheduledPriorityQueueTest::wakeWhenScheduled),
+                              TEST(ScheduledPriorityQueueTest::wakeOnTimeout)) { }
+
+    static constexpr uint64_t NO_TIMEOUT = numeric_limits<uint64_t>::max();
+
+    void priorityOrder() {
+        // Items pushed from different threads land in different shards, but still come out in priority order, and in
+        // scheduled order within a priority.
+        SShardedScheduledPriorityQueue<int> queue(4);
+        uint64_t now = STimeNow();
+        thread([&]() {
+            queue.push(1, 500, now - 10, NO_TIMEOUT);
+            queue.push(2, 1000, now - 5, NO_TIMEOUT);
+            queue.push(3, 1000, now - 20, NO_TIMEOUT);
+            queue.push(4, 0, now - 30, NO_TIMEOUT);
+        }).join();
+        ASSERT_EQUAL(queue.size(), 4);
+        ASSERT_EQUAL(queue.sizeByPriority()[1000], 2);
+        ASSERT_EQUAL(queue.sizeByPriority()[0], 1);
+        ASSERT_EQUAL(queue.get(1), 3);
+        ASSERT_EQUAL(queue.get(1), 2);
+        ASSERT_EQUAL(queue.get(1), 1);
+        ASSERT_EQUAL(queue.get(1), 4);
+        ASSERT_TRUE(queue.empty());
+    }
+
+    void scheduledInFuture() {
+        SShardedScheduledPriorityQueue<int> queue(4);
+        queue.push(1, 1000, STimeNow() + 10 * STIME_US_PER_S, NO_TIMEOUT);
+        bool timedOut = false;
+        try {
+            queue.get(1000);
+        } catch (const SShardedScheduledPriorityQueue<int>::timeout_error& e) {
+            timedOut = true;
+        }
+        ASSERT_TRUE(timedOut);
+        ASSERT_EQUAL(queue.size(), 1);
+    }
+
+    void timeoutFirst() {
+        // A timed out item comes out before anything else, even if it's low priority and scheduled in the future.
+        SShardedScheduledPriorityQueue<int> queue(4);
+        uint64_t now = STimeNow();
+        thread([&]() {
+            queue.push(1, 1000, now, NO_TIMEOUT);
+            queue.push(2, 0, now + 10 * STIME_US_PER_S, now - 1);
+        }).join();
+        ASSERT_EQUAL(queue.get(1), 2);
+        ASSERT_EQUAL(queue.get(1), 1);
+    }
+
+    void stealing() {
+        // One thread pushes everything to its home shard, and several others take it all.
+        SShardedScheduledPriorityQueue<int> queue(8);
+        const int count = 10000;
+        thread([&]() {
+            try {
+                queue.get(1);
+            } catch (...) {}
+            for (int i = 0; i < count; i++) {
+                queue.push(move(i), 0, 0, NO_TIMEOUT);
+            }
+        }).join();
+        atomic<int> received(0);
+        list<thread> threads;
+        for (int i = 0; i < 4; i++) {
+            threads.emplace_back([&]() {
+                try {
+                    while (true) {
+                        queue.get(10000);
+                        received++;
+                    }
+                } catch (const SShardedScheduledPriorityQueue<int>::timeout_error& e) {}
+            });
+        }
+        for (auto& t : threads) {
+            t.join();
+        }
+        ASSERT_EQUAL(received, count);
+    }
+
+    void futureDoesNotHideReady() {
+        for (auto order : {SShardedScheduledPriorityQueue<int>::Order::SCHEDULED,
+                           SShardedScheduledPriorityQueue<int>::Order::RANKED}) {
+            // Pushed from a thread without a home shard, these alternate between the two shards, so the first shard's
+            // highest priority item is scheduled in the future, and the best ready item is in the other.
+            SShardedScheduledPriorityQueue<int> queue(2, [](int&){}, [](int&){}, order);
+            uint64_t now = STimeNow();
+            thread([&]() {
+                queue.push(1, 1000, now + 10 * STIME_US_PER_S, NO_TIMEOUT);
+                queue.push(2, 500, now, NO_TIMEOUT);
+                queue.push(3, 0, now, NO_TIMEOUT);
+                queue.push(4, 0, now, NO_TIMEOUT);
+                queue.push(5, 1000, now + 100'000, NO_TIMEOUT);
+            }).join();
+
+            // The future items don't stop the best ready one coming out first.
+            ASSERT_EQUAL(queue.get(1), 2);
+
+            // And once one of them is due, it comes out ahead of the lower priority items that were already ready.
+            usleep(150'000);
+            ASSERT_EQUAL(queue.get(1), 5);
+            int third = queue.get(1);
+            int fourth = queue.get(1);
+            ASSERT_EQUAL(third + fourth, 7);
+            ASSERT_EQUAL(queue.size(), 1);
+        }
+    }
+
+    template<typename Q>
+    void checkDeadlineOrder(Q& queue) {
+        uint64_t now = STimeNow();
+        queue.push(1, 500, now - 30, now + 30 * STIME_US_PER_S);
+        queue.push(2, 500, now - 20, now + 10 * STIME_US_PER_S);
+        queue.push(3, 500, now - 10, now + 20 * STIME_US_PER_S);
+        queue.push(4, 1000, now - 5, now + 60 * STIME_US_PER_S);
+        queue.push(5, 500, now - 40, now - 1);
+        queue.push(6, 500, now + 10 * STIME_US_PER_S, now + 1 * STIME_US_PER_S);
+        queue.push(7, 500, now + 10 * STIME_US_PER_S, now + 5 * STIME_US_PER_S);
+
+        // Anything timed out still comes first, then the higher priority, then earliest deadline first, except that
+        // items scheduled in the future wait, even with earlier deadlines.
+        ASSERT_EQUAL(queue.get(1), 5);
+        ASSERT_EQUAL(queue.get(1), 4);
+        ASSERT_EQUAL(queue.get(1), 2);
+        ASSERT_EQUAL(queue.get(1), 3);
+        ASSERT_EQUAL(queue.get(1), 1);
+        ASSERT_EQUAL(queue.size(), 2);
+
+        // Items can be erased whether or not they're due.
+        queue.push(8, 500, now - 1, now + 10 * STIME_US_PER_S);
+        ASSERT_EQUAL(queue.eraseScheduledAfter(now), 2);
+        ASSERT_EQUAL(queue.eraseScheduledAfter(0), 1);
+        ASSERT_TRUE(queue.empty());
+
+        // Or picked out individually.
+        queue.push(11, 500, now - 1, now + 10 * STIME_US_PER_S);
+        queue.push(12, 500, now + 10 * STIME_US_PER_S, now + 10 * STIME_US_PER_S);
+        ASSERT_EQUAL(queue.eraseIf([](int& item) { return item == 12; }), 1);
+        ASSERT_EQUAL(queue.eraseIf([](int& item) { return item == 12; }), 0);
+        ASSERT_EQUAL(queue.eraseIf([](int& item) { return item == 11; }), 1);
+        ASSERT_TRUE(queue.empty());
+
+        // The rank can be given explicitly instead of using the timeout.
+        queue.push(9, 500, now - 2, NO_TIMEOUT, 20);
+        queue.push(10, 500, now - 1, NO_TIMEOUT, 10);
+        ASSERT_EQUAL(queue.get(1), 10);
+        ASSERT_EQUAL(queue.get(1), 9);
+    }
+
+    void deadlineOrder() {
+        SScheduledPriorityQueue<int> single([](int&){}, [](int&){}, SScheduledPriorityQueue<int>::Order::RANKED);
+        SShardedScheduledPriorityQueue<int> sharded(1, [](int&){}, [](int&){},
+                                                    SShardedScheduledPriorityQueue<int>::Order::RANKED);
+        checkDeadlineOrder(single);
+        checkDeadlineOrder(sharded);
+    }
+
+    // Starts a thread waiting on `queue`, then pushes an item that's available 100ms from now, either because that's
+    // when it's scheduled, or because that's when it times out. Returns how long after that the waiting thread got it.
+    template<typename Q>
+    uint64_t lateness(Q& queue, bool byTimeout) {
+        atomic<uint64_t> received(0);
+        thread waiter([&]() {
+            queue.get(5 * STIME_US_PER_S);
+            received = STimeNow();
+        });
+        usleep(10'000);
+        uint64_t eligible = STimeNow() + 100'000;
+        if (byTimeout) {
+            queue.push(1, 0, eligible + 10 * STIME_US_PER_S, eligible);
+        } else {
+            queue.push(1, 0, eligible, NO_TIMEOUT);
+        }
+        waiter.join();
+        return received - min(received.load(), eligible);
+    }
+
+    void wakeWhenScheduled() {
+        // The waiting thread should wake up when the item is due, not when its own wait runs out.
+        SScheduledPriorityQueue<int> single;
+        SShardedScheduledPriorityQueue<int> sharded(4);
+        ASSERT_LESS_THAN(lateness(single, false), 50'000);
+        ASSERT_LESS_THAN(lateness(sharded, false), 50'000);
+    }
+
+    void wakeOnTimeout() {
+        SScheduledPriorityQueue<int> single;
+        SShardedScheduledPriorityQueue<int> sharded(4);
+        ASSERT_LESS_THAN(lateness(single, true), 50'000);
+        ASSERT_LESS_THAN(lateness(sharded, true), 50'000);
+    }
+
+} __ScheduledPriorityQueueTest;
+
+// Only run with `-perf`.
+struct PerfScheduledPriorityQueueTest : tpunit::TestFixture {
+    PerfScheduledPriorityQueueTest()
+        : tpunit::TestFixture("PerfScheduledPriorityQueue",
+                              TEST(PerfScheduledPriorityQueueTest::benchmark)) { }
+
+    static constexpr uint64_t NO_TIMEOUT = numeric_limits<uint64_t>::max();
+
+    // Pushes and gets `perThread` items from each of `threads` threads at once, and returns the operations per second.
+    template<typename Q>
+    uint64_t contention(Q& queue, int threads, int perThread) {
+        list<thread> threadList;
+        uint64_t start = STimeNow();
+        for (int t = 0; t < threads; t++) {
+            threadList.emplace_back([&queue, perThread, t]() {
+                for (int i = 0; i < perThread; i++) {
+                    queue.push(move(i), (i + t) % 3, 0, NO_TIMEOUT);
+                    queue.get(STIME_US_PER_S);
+                }
+            });
+        }
+        for (auto& t : threadList) {
+            t.join();
+        }
+        return 2 * threads * perThread * STIME_US_PER_S / max(STimeNow() - start, (uint64_t)1);
+    }
+
+    void benchmark() {
+        // Compare push/get throughput of a single locked queue with the sharded one as contention increases.
+        const int perThread = 20000;
+        for (int threads : {1, 4, 16, 64}) {
+            SScheduledPriorityQueue<int> single;
+            SShardedScheduledPriorityQueue<int> sharded;
+            uint64_t singleOps = contention(single, threads, perThread);
+            uint64_t shardedOps = contention(sharded, threads, perThread);
+            ASSERT_TRUE(single.empty());
+            ASSERT_TRUE(sharded.empty());
+            cout << "[ScheduledPriorityQueueTest] " << threads << " threads: " << singleOps << " ops/s single lock, "
+                 << shardedOps << " ops/s sharded." << endl;
+        }
+    }
+
+} __PerfScheduledPriorityQueueTest;